@@ -0,0 +1,198 @@
+//
+//  BatchTransform.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <math.h>
+#include <algorithm>
+#include "BatchTransform.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Check grid for the fit.  The fit itself uses the -1, 0, 1 samples.
+static const int NumCheckXY = 5;
+static const int NumCheckZ = 3;
+static const int NumCheckPoints = NumCheckXY*NumCheckXY*NumCheckZ;
+
+// Smallest half extent we'll fit over, so flat or tiny tiles still work
+static const double MinHalfExtent = 1e-3;
+
+BatchTransform::BatchTransform(const ExactFunc &exact,double maxError)
+    : exact(exact), maxError(maxError), lastError(0.0), numApprox(0), numExact(0)
+{
+}
+
+bool BatchTransform::transform(size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ)
+{
+    // Not worth it for a handful of points
+    if (count < 2*NumCheckPoints)
+    {
+        if (count > 0)
+            exact(count,x,y,z,outX,outY,outZ);
+        numExact++;
+        return false;
+    }
+
+    double minPt[3] = {x[0],y[0],z[0]},maxPt[3] = {x[0],y[0],z[0]};
+    for (size_t ii=1;ii<count;ii++)
+    {
+        minPt[0] = std::min(minPt[0],x[ii]);  maxPt[0] = std::max(maxPt[0],x[ii]);
+        minPt[1] = std::min(minPt[1],y[ii]);  maxPt[1] = std::max(maxPt[1],y[ii]);
+        minPt[2] = std::min(minPt[2],z[ii]);  maxPt[2] = std::max(maxPt[2],z[ii]);
+    }
+
+    Affine affine;
+    double err;
+    if (fitAffine(minPt,maxPt,affine,err))
+    {
+        applyAffine(affine,count,x,y,z,outX,outY,outZ);
+        numApprox++;
+        return true;
+    }
+
+    exact(count,x,y,z,outX,outY,outZ);
+    numExact++;
+    return false;
+}
+
+bool BatchTransform::fitAffine(const double minPt[3],const double maxPt[3],Affine &affine,double &maxErr)
+{
+    double halfExt[3];
+    for (int ii=0;ii<3;ii++)
+    {
+        affine.center[ii] = (minPt[ii]+maxPt[ii])/2.0;
+        halfExt[ii] = std::max((maxPt[ii]-minPt[ii])/2.0,MinHalfExtent);
+    }
+
+    // Run the check grid through the exact transform
+    double u[3][NumCheckPoints];
+    double in[3][NumCheckPoints],out[3][NumCheckPoints];
+    int which = 0;
+    for (int iz=0;iz<NumCheckZ;iz++)
+        for (int iy=0;iy<NumCheckXY;iy++)
+            for (int ix=0;ix<NumCheckXY;ix++,which++)
+            {
+                u[0][which] = 2.0*ix/(NumCheckXY-1) - 1.0;
+                u[1][which] = 2.0*iy/(NumCheckXY-1) - 1.0;
+                u[2][which] = 2.0*iz/(NumCheckZ-1) - 1.0;
+                for (int ii=0;ii<3;ii++)
+                    in[ii][which] = affine.center[ii] + u[ii][which]*halfExt[ii];
+            }
+    exact(NumCheckPoints,in[0],in[1],in[2],out[0],out[1],out[2]);
+
+    // Least squares fit over the points on the 3x3x3 grid.
+    // That grid is symmetric about the center, so the normal equations are diagonal.
+    double sum[3] = {0.0,0.0,0.0};
+    double sumU[3][3] = {{0.0}};
+    double sumUU = 0.0;
+    int numFit = 0;
+    for (which=0;which<NumCheckPoints;which++)
+    {
+        bool onGrid = true;
+        for (int ii=0;ii<3;ii++)
+            if (u[ii][which] != -1.0 && u[ii][which] != 0.0 && u[ii][which] != 1.0)
+                onGrid = false;
+        if (!onGrid)
+            continue;
+
+        numFit++;
+        sumUU += u[0][which]*u[0][which];
+        for (int oi=0;oi<3;oi++)
+        {
+            sum[oi] += out[oi][which];
+            for (int ii=0;ii<3;ii++)
+                sumU[oi][ii] += out[oi][which]*u[ii][which];
+        }
+    }
+    for (int oi=0;oi<3;oi++)
+    {
+        affine.trans[oi] = sum[oi] / numFit;
+        for (int ii=0;ii<3;ii++)
+            affine.mat[oi][ii] = sumU[oi][ii] / sumUU / halfExt[ii];
+    }
+
+    // Now see how well we did over the whole grid
+    maxErr = 0.0;
+    for (which=0;which<NumCheckPoints;which++)
+    {
+        double dist2 = 0.0;
+        for (int oi=0;oi<3;oi++)
+        {
+            double val = affine.trans[oi];
+            for (int ii=0;ii<3;ii++)
+                val += affine.mat[oi][ii] * (in[ii][which] - affine.center[ii]);
+            double diff = val - out[oi][which];
+            dist2 += diff*diff;
+        }
+        // The exact transform can fail outside its valid area
+        if (isnan(dist2))
+        {
+            lastError = maxErr = dist2;
+            return false;
+        }
+        maxErr = std::max(maxErr,dist2);
+    }
+    maxErr = sqrt(maxErr);
+    lastError = maxErr;
+
+    return maxErr <= maxError;
+}
+
+void BatchTransform::applyAffine(const Affine &affine,size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ)
+{
+    double *outs[3] = {outX,outY,outZ};
+    size_t ii = 0;
+#if defined(__SSE2__)
+    const __m128d cx = _mm_set1_pd(affine.center[0]);
+    const __m128d cy = _mm_set1_pd(affine.center[1]);
+    const __m128d cz = _mm_set1_pd(affine.center[2]);
+    for (;ii+2<=count;ii+=2)
+    {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(x+ii),cx);
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(y+ii),cy);
+        __m128d dz = _mm_sub_pd(_mm_loadu_pd(z+ii),cz);
+        for (int oi=0;oi<3;oi++)
+        {
+            __m128d val = _mm_set1_pd(affine.trans[oi]);
+            val = _mm_add_pd(val,_mm_mul_pd(dx,_mm_set1_pd(affine.mat[oi][0])));
+            val = _mm_add_pd(val,_mm_mul_pd(dy,_mm_set1_pd(affine.mat[oi][1])));
+            val = _mm_add_pd(val,_mm_mul_pd(dz,_mm_set1_pd(affine.mat[oi][2])));
+            _mm_storeu_pd(outs[oi]+ii,val);
+        }
+    }
+#elif defined(__aarch64__)
+    const float64x2_t cx = vdupq_n_f64(affine.center[0]);
+    const float64x2_t cy = vdupq_n_f64(affine.center[1]);
+    const float64x2_t cz = vdupq_n_f64(affine.center[2]);
+    for (;ii+2<=count;ii+=2)
+    {
+        float64x2_t dx = vsubq_f64(vld1q_f64(x+ii),cx);
+        float64x2_t dy = vsubq_f64(vld1q_f64(y+ii),cy);
+        float64x2_t dz = vsubq_f64(vld1q_f64(z+ii),cz);
+        for (int oi=0;oi<3;oi++)
+        {
+            float64x2_t val = vdupq_n_f64(affine.trans[oi]);
+            val = vfmaq_n_f64(val,dx,affine.mat[oi][0]);
+            val = vfmaq_n_f64(val,dy,affine.mat[oi][1]);
+            val = vfmaq_n_f64(val,dz,affine.mat[oi][2]);
+            vst1q_f64(outs[oi]+ii,val);
+        }
+    }
+#endif
+    // Leftovers, or everything if we've got no vector unit
+    for (;ii<count;ii++)
+    {
+        double dx = x[ii] - affine.center[0];
+        double dy = y[ii] - affine.center[1];
+        double dz = z[ii] - affine.center[2];
+        for (int oi=0;oi<3;oi++)
+            outs[oi][ii] = affine.trans[oi] + affine.mat[oi][0]*dx + affine.mat[oi][1]*dy + affine.mat[oi][2]*dz;
+    }
+}
@@ -0,0 +1,59 @@
+//
+//  BatchTransform.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef BatchTransform_h
+#define BatchTransform_h
+
+#include <stddef.h>
+#include <functional>
+
+/* Transforms a whole tile's worth of points from one coordinate system to another.
+    The exact transform (e.g. proj4 into display coordinates) is expensive, so
+    we fit an affine transform around the tile, check it against the exact one
+    and use it if it's close enough.  Big tiles, where it isn't, get the exact one.
+  */
+class BatchTransform
+{
+public:
+    // The exact transform for a run of points.  The outputs don't overlap the inputs.
+    typedef std::function<void(size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ)> ExactFunc;
+
+    // Pass in the exact transform and the largest error (distance in output units) we'll accept
+    BatchTransform(const ExactFunc &exact,double maxError);
+
+    // Transform a set of points, one array per coordinate.
+    // Returns true if we used the approximation, false if we went exact.
+    bool transform(size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ);
+
+    // Largest error we measured for the last approximation we tried
+    double getLastError() { return lastError; }
+
+    // Number of tiles we approximated and number we did exactly
+    int getNumApproximated() { return numApprox; }
+    int getNumExact() { return numExact; }
+
+protected:
+    // Output = trans + mat * (input - center)
+    class Affine
+    {
+    public:
+        double center[3];
+        double trans[3];
+        double mat[3][3];
+    };
+
+    bool fitAffine(const double minPt[3],const double maxPt[3],Affine &affine,double &maxErr);
+    void applyAffine(const Affine &affine,size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ);
+
+    ExactFunc exact;
+    double maxError;
+    double lastError;
+    int numApprox,numExact;
+};
+
+#endif /* BatchTransform_h */
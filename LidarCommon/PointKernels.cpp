@@ -0,0 +1,117 @@
+//
+//  PointKernels.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "PointKernels.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+void ScaleOffsetInts(const int32_t *in,size_t count,double scale,double offset,double *out)
+{
+    size_t ii = 0;
+#if defined(__SSE2__)
+    const __m128d scaleV = _mm_set1_pd(scale);
+    const __m128d offsetV = _mm_set1_pd(offset);
+    for (;ii+4<=count;ii+=4)
+    {
+        __m128i ints = _mm_loadu_si128((const __m128i *)(in+ii));
+        __m128d lo = _mm_cvtepi32_pd(ints);
+        __m128d hi = _mm_cvtepi32_pd(_mm_shuffle_epi32(ints,_MM_SHUFFLE(1,0,3,2)));
+        _mm_storeu_pd(out+ii,_mm_add_pd(_mm_mul_pd(lo,scaleV),offsetV));
+        _mm_storeu_pd(out+ii+2,_mm_add_pd(_mm_mul_pd(hi,scaleV),offsetV));
+    }
+#elif defined(__aarch64__)
+    const float64x2_t scaleV = vdupq_n_f64(scale);
+    const float64x2_t offsetV = vdupq_n_f64(offset);
+    for (;ii+4<=count;ii+=4)
+    {
+        int32x4_t ints = vld1q_s32(in+ii);
+        float64x2_t lo = vcvtq_f64_s64(vmovl_s32(vget_low_s32(ints)));
+        float64x2_t hi = vcvtq_f64_s64(vmovl_s32(vget_high_s32(ints)));
+        // Separate multiply and add, so we match the scalar version exactly
+        vst1q_f64(out+ii,vaddq_f64(vmulq_f64(lo,scaleV),offsetV));
+        vst1q_f64(out+ii+2,vaddq_f64(vmulq_f64(hi,scaleV),offsetV));
+    }
+#endif
+    // Leftovers, or everything if we've got no vector unit
+    for (;ii<count;ii++)
+        out[ii] = in[ii] * scale + offset;
+}
+
+void ClassifyQuadrants(const int32_t *x,const int32_t *y,size_t count,int32_t splitX,int32_t splitY,uint8_t *out)
+{
+    size_t ii = 0;
+#if defined(__SSE2__)
+    const __m128i splitXV = _mm_set1_epi32(splitX);
+    const __m128i splitYV = _mm_set1_epi32(splitY);
+    const __m128i oneV = _mm_set1_epi32(1);
+    const __m128i twoV = _mm_set1_epi32(2);
+    for (;ii+8<=count;ii+=8)
+    {
+        // Below the split sets the mask, so the bit we want is the inverse
+        __m128i x0 = _mm_loadu_si128((const __m128i *)(x+ii));
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(x+ii+4));
+        __m128i y0 = _mm_loadu_si128((const __m128i *)(y+ii));
+        __m128i y1 = _mm_loadu_si128((const __m128i *)(y+ii+4));
+        __m128i q0 = _mm_or_si128(_mm_andnot_si128(_mm_cmplt_epi32(x0,splitXV),oneV),_mm_andnot_si128(_mm_cmplt_epi32(y0,splitYV),twoV));
+        __m128i q1 = _mm_or_si128(_mm_andnot_si128(_mm_cmplt_epi32(x1,splitXV),oneV),_mm_andnot_si128(_mm_cmplt_epi32(y1,splitYV),twoV));
+        // 8 x 32 bits down to 8 bytes
+        __m128i q16 = _mm_packs_epi32(q0,q1);
+        _mm_storel_epi64((__m128i *)(out+ii),_mm_packus_epi16(q16,q16));
+    }
+#elif defined(__aarch64__)
+    const int32x4_t splitXV = vdupq_n_s32(splitX);
+    const int32x4_t splitYV = vdupq_n_s32(splitY);
+    const uint32x4_t oneV = vdupq_n_u32(1);
+    const uint32x4_t twoV = vdupq_n_u32(2);
+    for (;ii+8<=count;ii+=8)
+    {
+        uint32x4_t q0 = vorrq_u32(vandq_u32(vcgeq_s32(vld1q_s32(x+ii),splitXV),oneV),vandq_u32(vcgeq_s32(vld1q_s32(y+ii),splitYV),twoV));
+        uint32x4_t q1 = vorrq_u32(vandq_u32(vcgeq_s32(vld1q_s32(x+ii+4),splitXV),oneV),vandq_u32(vcgeq_s32(vld1q_s32(y+ii+4),splitYV),twoV));
+        vst1_u8(out+ii,vmovn_u16(vcombine_u16(vmovn_u32(q0),vmovn_u32(q1))));
+    }
+#endif
+    for (;ii<count;ii++)
+        out[ii] = (uint8_t)(((y[ii] >= splitY) << 1) | (x[ii] >= splitX));
+}
+
+void MergeBytePlanes4(const uint8_t *planes,size_t count,uint32_t *out)
+{
+    const uint8_t *p0 = planes, *p1 = planes + count, *p2 = planes + 2*count, *p3 = planes + 3*count;
+    size_t ii = 0;
+#if defined(__SSE2__)
+    for (;ii+16<=count;ii+=16)
+    {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(p0+ii));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(p1+ii));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p2+ii));
+        __m128i b3 = _mm_loadu_si128((const __m128i *)(p3+ii));
+        // Pair up the low and high halves, then the pairs
+        __m128i lo01 = _mm_unpacklo_epi8(b0,b1), hi01 = _mm_unpackhi_epi8(b0,b1);
+        __m128i lo23 = _mm_unpacklo_epi8(b2,b3), hi23 = _mm_unpackhi_epi8(b2,b3);
+        _mm_storeu_si128((__m128i *)(out+ii),_mm_unpacklo_epi16(lo01,lo23));
+        _mm_storeu_si128((__m128i *)(out+ii+4),_mm_unpackhi_epi16(lo01,lo23));
+        _mm_storeu_si128((__m128i *)(out+ii+8),_mm_unpacklo_epi16(hi01,hi23));
+        _mm_storeu_si128((__m128i *)(out+ii+12),_mm_unpackhi_epi16(hi01,hi23));
+    }
+#elif defined(__aarch64__)
+    for (;ii+16<=count;ii+=16)
+    {
+        // The interleaving store does exactly this
+        uint8x16x4_t b;
+        b.val[0] = vld1q_u8(p0+ii);  b.val[1] = vld1q_u8(p1+ii);
+        b.val[2] = vld1q_u8(p2+ii);  b.val[3] = vld1q_u8(p3+ii);
+        vst4q_u8((uint8_t *)(out+ii),b);
+    }
+#endif
+    for (;ii<count;ii++)
+        out[ii] = (uint32_t)p0[ii] | ((uint32_t)p1[ii] << 8) | ((uint32_t)p2[ii] << 16) | ((uint32_t)p3[ii] << 24);
+}
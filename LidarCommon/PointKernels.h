@@ -0,0 +1,31 @@
+//
+//  PointKernels.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef PointKernels_h
+#define PointKernels_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Loops over whole columns of points that both the sorter and the viewer use.
+    These are vectorized with SSE2 or NEON where we have them and fall back
+    to plain loops otherwise.  The results match the plain loops exactly.
+  */
+
+// out[i] = in[i] * scale + offset.  Vectorized where we can.
+void ScaleOffsetInts(const int32_t *in,size_t count,double scale,double offset,double *out);
+
+// Which quadrant each point is in, as (y >= splitY)*2 + (x >= splitX).
+// Works on the quantized coordinates, so the splits are in those too.
+void ClassifyQuadrants(const int32_t *x,const int32_t *y,size_t count,int32_t splitX,int32_t splitY,uint8_t *out);
+
+// Put four byte planes (count bytes each, one after the other) back together into 32 bit values.
+// The first plane is the low byte.
+void MergeBytePlanes4(const uint8_t *planes,size_t count,uint32_t *out);
+
+#endif /* PointKernels_h */
@@ -0,0 +1,135 @@
+//
+//  BatchTransformTest.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "BatchTransform.h"
+#include "TestUtil.h"
+
+// Points scattered through a tile sized box, one array per coordinate
+class TestTile
+{
+public:
+    TestTile(size_t count,unsigned int seed)
+        : x(count), y(count), z(count), outX(count,-1.0), outY(count,-1.0), outZ(count,-1.0)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> xy(0.0,500.0),height(-20.0,80.0);
+        for (size_t ii=0;ii<count;ii++)
+        {
+            x[ii] = 350000.0 + xy(rng);
+            y[ii] = 4100000.0 + xy(rng);
+            z[ii] = height(rng);
+        }
+    }
+
+    bool transform(BatchTransform &trans)
+    {
+        return trans.transform(x.size(),&x[0],&y[0],&z[0],&outX[0],&outY[0],&outZ[0]);
+    }
+
+    // Largest distance from what the exact transform gives for each point on its own
+    double maxErrorAgainst(const BatchTransform::ExactFunc &exact)
+    {
+        double maxErr = 0.0;
+        for (size_t ii=0;ii<x.size();ii++)
+        {
+            double ex,ey,ez;
+            exact(1,&x[ii],&y[ii],&z[ii],&ex,&ey,&ez);
+            double dx = outX[ii]-ex, dy = outY[ii]-ey, dz = outZ[ii]-ez;
+            maxErr = std::max(maxErr,sqrt(dx*dx+dy*dy+dz*dz));
+        }
+        return maxErr;
+    }
+
+    std::vector<double> x,y,z;
+    std::vector<double> outX,outY,outZ;
+};
+
+// Rotate, scale and shift, which the affine fit should nail
+static void AffineExact(size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ)
+{
+    const double ang = 0.3, scale = 1.5;
+    for (size_t ii=0;ii<count;ii++)
+    {
+        outX[ii] = scale * (cos(ang)*x[ii] - sin(ang)*y[ii]) + 12.0;
+        outY[ii] = scale * (sin(ang)*x[ii] + cos(ang)*y[ii]) - 7.0;
+        outZ[ii] = 2.0 * z[ii] + 0.25 * x[ii];
+    }
+}
+
+// A gentle bend, like a projection over a tile
+static void BentExact(size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ)
+{
+    for (size_t ii=0;ii<count;ii++)
+    {
+        double dy = y[ii] - 4100000.0;
+        outX[ii] = x[ii] * (1.0 + 1e-13 * dy * dy);
+        outY[ii] = y[ii];
+        outZ[ii] = z[ii];
+    }
+}
+
+// Far too curved over a tile for any affine fit
+static void WildExact(size_t count,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ)
+{
+    for (size_t ii=0;ii<count;ii++)
+    {
+        outX[ii] = x[ii] + 10.0 * sin(y[ii] / 20.0);
+        outY[ii] = y[ii] * y[ii] / 1e6;
+        outZ[ii] = z[ii];
+    }
+}
+
+TEST(BatchTransformAffineMatchesExact)
+{
+    BatchTransform trans(AffineExact,0.001);
+    // Odd count, so the vector loop leaves a tail
+    TestTile tile(1001,5);
+    CHECK(tile.transform(trans));
+    CHECK(trans.getNumApproximated() == 1 && trans.getNumExact() == 0);
+    CHECK(trans.getLastError() <= 0.001);
+    CHECK(tile.maxErrorAgainst(AffineExact) <= 1e-6);
+}
+
+TEST(BatchTransformStaysWithinError)
+{
+    const double maxError = 0.01;
+    BatchTransform trans(BentExact,maxError);
+    TestTile tile(2000,7);
+    CHECK(tile.transform(trans));
+    // The bend is big enough to measure, but well inside the limit
+    CHECK(trans.getLastError() > 0.0 && trans.getLastError() <= maxError);
+    CHECK(tile.maxErrorAgainst(BentExact) <= maxError);
+}
+
+TEST(BatchTransformFallsBackToExact)
+{
+    BatchTransform trans(WildExact,0.01);
+    TestTile tile(1001,9);
+    CHECK(!tile.transform(trans));
+    CHECK(trans.getNumApproximated() == 0 && trans.getNumExact() == 1);
+    CHECK(trans.getLastError() > 0.01);
+    // The fallback runs the exact transform, so the results should be identical
+    CHECK(tile.maxErrorAgainst(WildExact) == 0.0);
+}
+
+TEST(BatchTransformSmallTilesGoExact)
+{
+    // Even an affine transform isn't worth fitting for a handful of points
+    BatchTransform trans(AffineExact,0.001);
+    TestTile tile(10,11);
+    CHECK(!tile.transform(trans));
+    CHECK(trans.getNumExact() == 1);
+    CHECK(tile.maxErrorAgainst(AffineExact) == 0.0);
+
+    CHECK(!trans.transform(0,NULL,NULL,NULL,NULL,NULL,NULL));
+    CHECK(trans.getNumExact() == 2);
+}
@@ -0,0 +1,103 @@
+//
+//  PointKernelsTest.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <stdint.h>
+#include <limits>
+#include <random>
+#include <vector>
+#include "PointKernels.h"
+#include "TestUtil.h"
+
+// The vector loops go 4, 8 or 16 at a time, so this covers every tail length
+static const size_t MaxCount = 67;
+
+// Start this far into the arrays so the vector loads aren't aligned
+static const size_t Skew = 1;
+
+TEST(ScaleOffsetIntsMatchesScalar)
+{
+    std::mt19937 rng(17);
+    std::uniform_int_distribution<int32_t> dist(std::numeric_limits<int32_t>::min(),std::numeric_limits<int32_t>::max());
+    const double scale = 0.001, offset = -12345.678;
+
+    for (size_t count=0;count<=MaxCount;count++)
+    {
+        std::vector<int32_t> in(count+Skew);
+        for (auto &val : in)
+            val = dist(rng);
+        if (count > 1)
+        {
+            in[Skew] = std::numeric_limits<int32_t>::min();
+            in[Skew+count-1] = std::numeric_limits<int32_t>::max();
+        }
+
+        // Guard value past the end to catch overruns
+        std::vector<double> out(count+Skew+1,-1.0);
+        ScaleOffsetInts(&in[Skew],count,scale,offset,&out[Skew]);
+        for (size_t which=0;which<count;which++)
+            CHECK(out[Skew+which] == in[Skew+which] * scale + offset);
+        CHECK(out[Skew+count] == -1.0);
+    }
+}
+
+TEST(ClassifyQuadrantsMatchesScalar)
+{
+    std::mt19937 rng(29);
+    std::uniform_int_distribution<int32_t> dist(-1000,1000);
+    const int32_t splitX = 10, splitY = -5;
+
+    for (size_t count=0;count<=MaxCount;count++)
+    {
+        std::vector<int32_t> x(count+Skew),y(count+Skew);
+        for (size_t which=0;which<count+Skew;which++)
+        {
+            x[which] = dist(rng);
+            y[which] = dist(rng);
+        }
+        // Right on the split and out at the extremes, where signed compares go wrong
+        if (count > 3)
+        {
+            x[Skew] = splitX;  y[Skew] = splitY;
+            x[Skew+1] = splitX-1;  y[Skew+1] = splitY-1;
+            x[Skew+2] = std::numeric_limits<int32_t>::min();  y[Skew+2] = std::numeric_limits<int32_t>::max();
+            x[Skew+3] = std::numeric_limits<int32_t>::max();  y[Skew+3] = std::numeric_limits<int32_t>::min();
+        }
+
+        std::vector<uint8_t> out(count+Skew+1,0xff);
+        ClassifyQuadrants(&x[Skew],&y[Skew],count,splitX,splitY,&out[Skew]);
+        for (size_t which=0;which<count;which++)
+        {
+            uint8_t expect = ((y[Skew+which] >= splitY) << 1) | (x[Skew+which] >= splitX);
+            CHECK(out[Skew+which] == expect);
+        }
+        CHECK(out[Skew+count] == 0xff);
+    }
+}
+
+TEST(MergeBytePlanes4MatchesScalar)
+{
+    std::mt19937 rng(31);
+
+    for (size_t count=0;count<=MaxCount;count++)
+    {
+        std::vector<uint8_t> planes(4*count+Skew);
+        for (auto &val : planes)
+            val = (uint8_t)rng();
+
+        std::vector<uint32_t> out(count+Skew+1,0xdeadbeef);
+        const uint8_t *p = &planes[Skew];
+        MergeBytePlanes4(p,count,&out[Skew]);
+        for (size_t which=0;which<count;which++)
+        {
+            uint32_t expect = (uint32_t)p[which] | ((uint32_t)p[count+which] << 8) |
+                              ((uint32_t)p[2*count+which] << 16) | ((uint32_t)p[3*count+which] << 24);
+            CHECK(out[Skew+which] == expect);
+        }
+        CHECK(out[Skew+count] == 0xdeadbeef);
+    }
+}
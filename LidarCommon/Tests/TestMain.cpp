@@ -0,0 +1,43 @@
+//
+//  TestMain.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <vector>
+#include <utility>
+#include "TestUtil.h"
+
+int TestFailures = 0;
+
+// Built up by the static TestRegistrars, so it has to exist before any of them run
+static std::vector<std::pair<const char *,TestFunc> > &AllTests()
+{
+    static std::vector<std::pair<const char *,TestFunc> > tests;
+    return tests;
+}
+
+TestRegistrar::TestRegistrar(const char *name,TestFunc func)
+{
+    AllTests().push_back(std::make_pair(name,func));
+}
+
+int main()
+{
+    int numFailed = 0;
+    for (auto &test : AllTests())
+    {
+        int startFailures = TestFailures;
+        test.second();
+        bool passed = TestFailures == startFailures;
+        if (!passed)
+            numFailed++;
+        fprintf(stdout,"%s %s\n",passed ? "PASS" : "FAIL",test.first);
+    }
+
+    fprintf(stdout,"%d of %d tests passed\n",(int)AllTests().size()-numFailed,(int)AllTests().size());
+
+    return numFailed ? 1 : 0;
+}
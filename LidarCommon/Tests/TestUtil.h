@@ -0,0 +1,44 @@
+//
+//  TestUtil.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TestUtil_h
+#define TestUtil_h
+
+#include <stdio.h>
+
+/* Just enough of a test harness for the LidarCommon tests.
+    Each TEST registers itself and TestMain runs them all.
+    A failed CHECK is reported and counted, but the test keeps going.
+  */
+
+typedef void (*TestFunc)();
+
+class TestRegistrar
+{
+public:
+    TestRegistrar(const char *name,TestFunc func);
+};
+
+// Number of failed checks so far
+extern int TestFailures;
+
+#define TEST(name) \
+    static void name(); \
+    static TestRegistrar name##Registrar(#name,name); \
+    static void name()
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr,"%s:%d: CHECK failed: %s\n",__FILE__,__LINE__,#cond); \
+            TestFailures++; \
+        } \
+    } while (0)
+
+#endif /* TestUtil_h */
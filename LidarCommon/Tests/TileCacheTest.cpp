@@ -0,0 +1,123 @@
+//
+//  TileCacheTest.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <memory>
+#include "TileCache.h"
+#include "TestUtil.h"
+
+typedef TileCache<long long,int> IntCache;
+
+static IntCache::ValueRef MakeValue(int val)
+{
+    return std::make_shared<int>(val);
+}
+
+TEST(TileCacheFindAndStats)
+{
+    IntCache cache(100);
+    CHECK(!cache.find(1));
+
+    cache.insert(1,MakeValue(10),30);
+    cache.insert(2,MakeValue(20),30);
+    IntCache::ValueRef val = cache.find(1);
+    CHECK(val && *val == 10);
+
+    // Replacing a tile swaps the value and the size
+    cache.insert(2,MakeValue(21),40);
+    val = cache.find(2);
+    CHECK(val && *val == 21);
+
+    cache.remove(1);
+    CHECK(!cache.find(1));
+
+    IntCache::Stats stats = cache.getStats();
+    CHECK(stats.hits == 2);
+    CHECK(stats.misses == 2);
+    CHECK(stats.evictions == 0);
+    CHECK(stats.numEntries == 1);
+    CHECK(stats.bytes == 40);
+
+    cache.clear();
+    stats = cache.getStats();
+    CHECK(stats.numEntries == 0 && stats.bytes == 0);
+}
+
+TEST(TileCacheStaysInBudget)
+{
+    IntCache cache(100);
+    for (int which=0;which<50;which++)
+    {
+        cache.insert(which,MakeValue(which),15);
+        CHECK(cache.getStats().bytes <= 100);
+    }
+    // Too big to ever fit
+    cache.insert(100,MakeValue(100),101);
+    CHECK(!cache.find(100));
+
+    IntCache::Stats stats = cache.getStats();
+    CHECK(stats.numEntries == 6);
+    CHECK(stats.evictions == 44);
+    // The newest ones are left
+    CHECK(cache.find(49) && cache.find(44));
+    CHECK(!cache.find(43));
+}
+
+TEST(TileCacheKeepsProtectedTiles)
+{
+    IntCache cache(100);
+    cache.insert(1,MakeValue(1),20);
+    cache.insert(2,MakeValue(2),20);
+    // Seen twice, so they're protected
+    CHECK(cache.find(1));
+    CHECK(cache.find(2));
+
+    // A pass over lots of tiles we only see once shouldn't push those out
+    for (int which=10;which<30;which++)
+        cache.insert(which,MakeValue(which),20);
+    CHECK(cache.find(1));
+    CHECK(cache.find(2));
+    CHECK(!cache.find(10));
+    CHECK(cache.find(29));
+}
+
+TEST(TileCacheDemotesOldProtectedTiles)
+{
+    // Room for 50 bytes of protected tiles
+    IntCache cache(100,0.5);
+    for (int which=0;which<4;which++)
+    {
+        cache.insert(which,MakeValue(which),20);
+        CHECK(cache.find(which));
+    }
+
+    // The two oldest went back to probation, so they're the first to go
+    cache.insert(10,MakeValue(10),20);
+    cache.insert(11,MakeValue(11),20);
+    CHECK(!cache.find(0));
+    CHECK(cache.find(2));
+    CHECK(cache.find(3));
+    CHECK(cache.find(11));
+}
+
+TEST(TileCacheKeepsNewTileOverProtected)
+{
+    IntCache cache(100);
+    cache.insert(1,MakeValue(1),40);
+    cache.insert(2,MakeValue(2),40);
+    CHECK(cache.find(1));
+    CHECK(cache.find(2));
+
+    // Probation is just the new tile, so the oldest protected one has to go instead
+    cache.insert(3,MakeValue(3),40);
+    IntCache::ValueRef val = cache.find(3);
+    CHECK(val && *val == 3);
+    CHECK(!cache.find(1));
+    CHECK(cache.find(2));
+    CHECK(cache.getStats().evictions == 1);
+    CHECK(cache.getStats().bytes <= 100);
+}
@@ -0,0 +1,188 @@
+//
+//  TileCodecTest.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "TileCodec.h"
+#include "TileDecoder.h"
+#include "TestUtil.h"
+
+static const TileQuantization TestQuant(0.01,0.01,0.001,1000.0,-2000.0,50.0);
+
+// Points come back in Morton order, so we compare them as sorted lists of these
+typedef std::tuple<int,int,int,int,int,int,int,int> CompactValues;
+typedef std::tuple<int,int,int,int,int,int,int,int,int,double,int,int> ColumnarValues;
+
+static int Quantize(double val,int which)
+{
+    return (int)lround((val - TestQuant.offset[which]) / TestQuant.scale[which]);
+}
+
+// Random points clumped together the way they are in a tile
+static std::vector<laszip_point_struct> MakeTestPoints(int numPoints,unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> coord(-5000,5000);
+    std::vector<laszip_point_struct> pts(numPoints);
+    for (auto &p : pts)
+    {
+        memset(&p,0,sizeof(p));
+        p.X = coord(rng) + 100000;  p.Y = coord(rng) - 3000;  p.Z = coord(rng);
+        p.intensity = (laszip_U16)rng();
+        p.classification = rng() % 32;
+        p.synthetic_flag = rng() & 1;
+        p.withheld_flag = rng() & 1;
+        p.return_number = 1 + rng() % 5;
+        p.number_of_returns = 5;
+        p.scan_direction_flag = rng() & 1;
+        p.scan_angle_rank = (laszip_I8)(rng() % 180 - 90);
+        p.user_data = (laszip_U8)rng();
+        p.point_source_ID = (laszip_U16)rng();
+        p.gps_time = rng() / 1000.0;
+        p.rgb[0] = (laszip_U16)rng();  p.rgb[1] = (laszip_U16)rng();  p.rgb[2] = (laszip_U16)rng();
+    }
+    // A couple of duplicates, which land on the same spot on the curve
+    if (numPoints > 2)
+        pts[numPoints-1] = pts[0];
+
+    return pts;
+}
+
+static void CheckCompactRoundTrip(size_t numPoints)
+{
+    std::vector<laszip_point_struct> pts = MakeTestPoints((int)numPoints,(unsigned int)numPoints);
+    CompactTileEncoder encoder;
+    encoder.reset(3);
+    for (auto &p : pts)
+        encoder.addPoint(&p);
+    CHECK(encoder.getNumPoints() == numPoints);
+    std::string tile;
+    CHECK(encoder.encode(tile));
+    CHECK(IsCompactTile(tile.data(),tile.size()));
+    CHECK(!IsTileColumn(tile.data(),tile.size()));
+
+    // The general decoder should work out that it's compact
+    TileDecoder decoder;
+    decoder.setQuantization(TestQuant);
+    TilePoints points;
+    CHECK(decoder.decode(tile.data(),tile.size(),points));
+    CHECK(points.numPoints == numPoints);
+    CHECK(points.pointDataFormat == 3);
+    if (points.numPoints != numPoints || points.red.size() != numPoints)
+        return;
+
+    std::vector<CompactValues> expect,got;
+    for (auto &p : pts)
+        expect.push_back(CompactValues(p.X,p.Y,p.Z,p.intensity,(int)p.classification,p.rgb[0],p.rgb[1],p.rgb[2]));
+    for (size_t which=0;which<numPoints;which++)
+    {
+        got.push_back(CompactValues(Quantize(points.x[which],0),Quantize(points.y[which],1),Quantize(points.z[which],2),
+                                    points.intensity[which],points.classification[which],
+                                    points.red[which],points.green[which],points.blue[which]));
+        CHECK(points.x[which] >= points.minX && points.x[which] <= points.maxX);
+        CHECK(points.z[which] >= points.minZ && points.z[which] <= points.maxZ);
+    }
+    std::sort(expect.begin(),expect.end());
+    std::sort(got.begin(),got.end());
+    CHECK(expect == got);
+}
+
+TEST(CompactTileRoundTrip)
+{
+    CheckCompactRoundTrip(1);
+    CheckCompactRoundTrip(17);
+    CheckCompactRoundTrip(4000);
+}
+
+TEST(ColumnarTileRoundTrip)
+{
+    const int numPoints = 1000, numExtraBytes = 2;
+    std::vector<laszip_point_struct> pts = MakeTestPoints(numPoints,3);
+    std::vector<laszip_U8> extra(numPoints*numExtraBytes);
+    CompactTileEncoder encoder;
+    encoder.reset(3,numExtraBytes);
+    for (int which=0;which<numPoints;which++)
+    {
+        // Extra bytes tag each point with where it started out
+        extra[which*numExtraBytes] = which & 0xff;
+        extra[which*numExtraBytes+1] = which >> 8;
+        pts[which].extra_bytes = &extra[which*numExtraBytes];
+        pts[which].num_extra_bytes = numExtraBytes;
+        encoder.addPoint(&pts[which]);
+    }
+    std::vector<std::string> columns;
+    CHECK(encoder.encodeColumns(columns));
+    CHECK(columns.size() == TileColumnCount);
+    if (columns.size() != TileColumnCount)
+        return;
+
+    // Attributes need the positions loaded first
+    TileDecoder decoder;
+    decoder.setQuantization(TestQuant);
+    TilePoints points;
+    CHECK(!decoder.decodeColumn(columns[TileColumnColor].data(),columns[TileColumnColor].size(),points));
+
+    for (int column=0;column<TileColumnCount;column++)
+    {
+        CHECK(!columns[column].empty());
+        CHECK(IsTileColumn(columns[column].data(),columns[column].size()));
+        CHECK(decoder.decodeColumn(columns[column].data(),columns[column].size(),points));
+    }
+    CHECK(points.numPoints == numPoints);
+    CHECK(points.numExtraBytes == numExtraBytes);
+    if (points.numPoints != numPoints || points.gpsTime.size() != numPoints || points.extraBytes.size() != numPoints*numExtraBytes)
+        return;
+
+    // The extra bytes say which point this was, so we can check each one directly
+    for (int which=0;which<numPoints;which++)
+    {
+        int orig = points.extraBytes[which*numExtraBytes] | (points.extraBytes[which*numExtraBytes+1] << 8);
+        CHECK(orig >= 0 && orig < numPoints);
+        if (orig < 0 || orig >= numPoints)
+            continue;
+        const laszip_point_struct &p = pts[orig];
+        ColumnarValues expect(p.X,p.Y,p.Z,p.intensity,(int)p.classification,p.synthetic_flag | (p.withheld_flag << 2),
+                              (int)p.return_number,(int)p.number_of_returns,(int)p.scan_direction_flag,p.gps_time,p.scan_angle_rank,p.point_source_ID);
+        ColumnarValues got(Quantize(points.x[which],0),Quantize(points.y[which],1),Quantize(points.z[which],2),
+                           points.intensity[which],points.classification[which],points.classFlags[which],
+                           points.returnNumber[which],points.numberOfReturns[which],points.scanFlags[which],
+                           points.gpsTime[which],points.scanAngle[which],points.pointSourceID[which]);
+        CHECK(expect == got);
+        CHECK(points.userData[which] == p.user_data);
+        CHECK(points.red[which] == p.rgb[0] && points.green[which] == p.rgb[1] && points.blue[which] == p.rgb[2]);
+    }
+
+    // Compact and columnar tiles put the points in the same order
+    std::string tile;
+    CHECK(encoder.encode(tile));
+    TilePoints compactPoints;
+    CHECK(decoder.decode(tile.data(),tile.size(),compactPoints));
+    CHECK(compactPoints.x == points.x && compactPoints.y == points.y && compactPoints.z == points.z);
+    CHECK(compactPoints.intensity == points.intensity);
+}
+
+TEST(CompactTileRejectsTruncation)
+{
+    std::vector<laszip_point_struct> pts = MakeTestPoints(100,11);
+    CompactTileEncoder encoder;
+    encoder.reset(3);
+    for (auto &p : pts)
+        encoder.addPoint(&p);
+    std::string tile;
+    CHECK(encoder.encode(tile));
+
+    CompactTileDecoder decoder;
+    TilePoints points;
+    CHECK(!decoder.decode(tile.data(),tile.size()-1,TestQuant,points));
+    CHECK(!decoder.getError().empty());
+}
@@ -0,0 +1,165 @@
+//
+//  TileDecoderTest.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <string.h>
+#include <math.h>
+#include <sstream>
+#include <string>
+#include "TileDecoder.h"
+#include "TestUtil.h"
+
+TEST(MemoryStreamBufSeeking)
+{
+    const char *data = "0123456789";
+    MemoryStreamBuf buf(data,strlen(data));
+    std::istream stream(&buf);
+
+    stream.seekg(3);
+    CHECK(stream.get() == '3');
+    CHECK(stream.tellg() == std::streampos(4));
+
+    stream.seekg(-2,std::ios_base::cur);
+    CHECK(stream.get() == '2');
+
+    stream.seekg(-1,std::ios_base::end);
+    CHECK(stream.get() == '9');
+
+    // Right at the end is fine, there's just nothing to read
+    stream.seekg(0,std::ios_base::end);
+    CHECK(stream.tellg() == std::streampos(10));
+    CHECK(stream.get() == std::char_traits<char>::eof());
+    stream.clear();
+
+    // Off either end fails and leaves us where we were
+    stream.seekg(2);
+    stream.seekg(11);
+    CHECK(stream.fail());
+    stream.clear();
+    stream.seekg(-1,std::ios_base::beg);
+    CHECK(stream.fail());
+    stream.clear();
+    CHECK(stream.get() == '2');
+
+    // Read only
+    CHECK(buf.pubseekpos(0,std::ios_base::out) == std::streampos(std::streamoff(-1)));
+    CHECK(buf.pubseekoff(0,std::ios_base::beg,std::ios_base::in) == std::streampos(0));
+
+    // Empty buffer
+    MemoryStreamBuf emptyBuf(data,0);
+    CHECK(emptyBuf.pubseekoff(0,std::ios_base::end,std::ios_base::in) == std::streampos(0));
+    CHECK(emptyBuf.pubseekpos(1,std::ios_base::in) == std::streampos(std::streamoff(-1)));
+}
+
+static const int NumTestPoints = 500;
+
+// Quantized values for a test point
+static void MakeTestPoint(int which,laszip_point_struct *p)
+{
+    p->X = (which * 7919) % 10000 - 5000;
+    p->Y = (which * 104729) % 20000;
+    p->Z = which * 3 - 700;
+    p->intensity = (laszip_U16)(which * 131);
+    p->classification = which % 12;
+    p->rgb[0] = (laszip_U16)(which * 65);
+    p->rgb[1] = (laszip_U16)(65535 - which);
+    p->rgb[2] = (laszip_U16)(which * 1000);
+}
+
+// Write a LAZ tile into memory the way the sorter does
+static bool WriteTestTile(std::string &out)
+{
+    laszip_POINTER writer = NULL;
+    if (laszip_create(&writer))
+        return false;
+
+    laszip_header_struct *header;
+    laszip_get_header_pointer(writer,&header);
+    header->version_major = 1;
+    header->version_minor = 2;
+    header->header_size = 227;
+    header->offset_to_point_data = 227;
+    header->point_data_format = 3;
+    header->point_data_record_length = 34;
+    header->number_of_point_records = NumTestPoints;
+    header->x_scale_factor = 0.01;  header->y_scale_factor = 0.01;  header->z_scale_factor = 0.001;
+    header->x_offset = 1000.0;  header->y_offset = -2000.0;  header->z_offset = 50.0;
+    header->min_x = 1000.0 - 50.0;  header->max_x = 1000.0 + 49.99;
+    header->min_y = -2000.0;  header->max_y = -2000.0 + 199.99;
+    header->min_z = 50.0 - 0.7;  header->max_z = 50.0 + (NumTestPoints-1)*0.003 - 0.7;
+
+    std::ostringstream stream;
+    bool ok = !laszip_open_stream_writer(writer,&stream,true);
+    laszip_point_struct *p;
+    laszip_get_point_pointer(writer,&p);
+    for (int which=0;ok && which<NumTestPoints;which++)
+    {
+        MakeTestPoint(which,p);
+        ok = !laszip_write_point(writer) && !laszip_update_inventory(writer);
+    }
+    ok = !laszip_close_writer(writer) && ok;
+    laszip_destroy(writer);
+
+    out = stream.str();
+    return ok;
+}
+
+TEST(TileDecoderDecodesLAZ)
+{
+    std::string tile;
+    CHECK(WriteTestTile(tile));
+
+    TileDecoder decoder;
+    TilePoints points;
+    CHECK(decoder.decode(tile.data(),tile.size(),points));
+    CHECK(points.numPoints == NumTestPoints);
+    CHECK(points.pointDataFormat == 3);
+    CHECK(points.x.size() == NumTestPoints && points.red.size() == NumTestPoints);
+    CHECK(points.minX == 950.0 && points.minY == -2000.0);
+    if (points.numPoints != NumTestPoints || points.red.size() != NumTestPoints)
+        return;
+
+    // LAZ tiles keep the points in the order they were written
+    laszip_point_struct expect;
+    for (int which=0;which<NumTestPoints;which++)
+    {
+        memset(&expect,0,sizeof(expect));
+        MakeTestPoint(which,&expect);
+        CHECK(fabs(points.x[which] - (expect.X * 0.01 + 1000.0)) < 1e-9);
+        CHECK(fabs(points.y[which] - (expect.Y * 0.01 - 2000.0)) < 1e-9);
+        CHECK(fabs(points.z[which] - (expect.Z * 0.001 + 50.0)) < 1e-9);
+        CHECK(points.intensity[which] == expect.intensity);
+        CHECK(points.classification[which] == expect.classification);
+        CHECK(points.red[which] == expect.rgb[0] && points.green[which] == expect.rgb[1] && points.blue[which] == expect.rgb[2]);
+    }
+
+    // The decoder gets reused between tiles
+    CHECK(decoder.decode(tile.data(),tile.size(),points));
+    CHECK(points.numPoints == NumTestPoints);
+}
+
+TEST(TileDecoderRejectsBadTiles)
+{
+    TileDecoder decoder;
+    TilePoints points;
+    CHECK(!decoder.decode(NULL,0,points));
+    CHECK(!decoder.getError().empty());
+
+    const char junk[] = "this is not a LAS file at all";
+    CHECK(!decoder.decode(junk,sizeof(junk),points));
+    CHECK(points.numPoints == 0);
+}
+
+TEST(PointFormatColors)
+{
+    CHECK(!PointFormatHasColor(0));
+    CHECK(!PointFormatHasColor(1));
+    CHECK(PointFormatHasColor(2));
+    CHECK(PointFormatHasColor(3));
+    CHECK(!PointFormatHasColor(6));
+    CHECK(PointFormatHasColor(7));
+}
@@ -0,0 +1,92 @@
+//
+//  TileGridTest.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <math.h>
+#include <string>
+#include <vector>
+#include "TileGrid.h"
+#include "TestUtil.h"
+
+// Run the grid through a blob, which is how the viewer sees it
+static std::vector<float> GridCells(const TileGroundGrid &grid)
+{
+    std::string blob = grid.encode();
+    std::vector<float> cells;
+    CHECK(TileGroundGrid::decode(blob.data(),blob.size(),grid.getSizeX(),grid.getSizeY(),cells));
+    return cells;
+}
+
+TEST(GroundGridCellLookup)
+{
+    // 4 by 2 cells, each 25 units on a side
+    TileGroundGrid grid(4,2,100.0,200.0,200.0,250.0);
+    grid.addPoint(110.0,210.0,5.0);
+    grid.addPoint(112.0,212.0,3.0);
+    grid.addPoint(111.0,211.0,4.0);
+    // Right on the boundary between two cells goes in the upper one
+    grid.addPoint(125.0,225.0,7.0);
+
+    std::vector<float> cells = GridCells(grid);
+    CHECK(cells.size() == 8);
+    if (cells.size() != 8)
+        return;
+    CHECK(cells[0] == 3.0f);
+    CHECK(cells[1*4+1] == 7.0f);
+    // Nothing landed in the rest
+    CHECK(isnan(cells[1]) && isnan(cells[3]) && isnan(cells[1*4+0]) && isnan(cells[1*4+3]));
+}
+
+TEST(GroundGridSnapsToEdges)
+{
+    TileGroundGrid grid(4,2,100.0,200.0,200.0,250.0);
+    // Exactly on the max edges, which would be one cell past the end
+    grid.addPoint(200.0,250.0,1.0);
+    grid.addPoint(200.0,200.0,2.0);
+    // Outside the tile entirely, which happens with points right on a split
+    grid.addPoint(99.0,199.0,3.0);
+    grid.addPoint(-1e6,1e6,4.0);
+    grid.addPoint(1e6,225.0,5.0);
+
+    std::vector<float> cells = GridCells(grid);
+    CHECK(cells.size() == 8);
+    if (cells.size() != 8)
+        return;
+    CHECK(cells[1*4+3] == 1.0f);
+    CHECK(cells[3] == 2.0f);
+    CHECK(cells[0] == 3.0f);
+    CHECK(cells[1*4+0] == 4.0f);
+    CHECK(cells[1*4+3] == 1.0f);
+    CHECK(isnan(cells[1]) && isnan(cells[2]));
+}
+
+TEST(GroundGridRange)
+{
+    TileGroundGrid grid(3,3,0.0,0.0,30.0,30.0);
+    CHECK(grid.getNumPoints() == 0);
+    grid.addPoint(5.0,5.0,-2.5);
+    grid.addPoint(15.0,25.0,40.0);
+    grid.addPoint(29.0,1.0,12.0);
+    CHECK(grid.getNumPoints() == 3);
+    CHECK(grid.getMinZ() == -2.5);
+    CHECK(grid.getMaxZ() == 40.0);
+}
+
+TEST(GroundGridDecodeChecksSize)
+{
+    TileGroundGrid grid(3,2,0.0,0.0,30.0,20.0);
+    grid.addPoint(1.0,1.0,1.0);
+    std::string blob = grid.encode();
+    CHECK(blob.size() == 3*2*sizeof(float));
+
+    std::vector<float> cells;
+    CHECK(!TileGroundGrid::decode(blob.data(),blob.size()-1,3,2,cells));
+    CHECK(!TileGroundGrid::decode(blob.data(),blob.size(),2,3+1,cells));
+    CHECK(!TileGroundGrid::decode(blob.data(),blob.size(),0,2,cells));
+    CHECK(TileGroundGrid::decode(blob.data(),blob.size(),3,2,cells));
+    CHECK(cells.size() == 6 && cells[0] == 1.0f);
+}
@@ -0,0 +1,94 @@
+//
+//  TileKeyTest.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <random>
+#include "TileKey.h"
+#include "TestUtil.h"
+
+TEST(MortonEncodeInterleaves)
+{
+    CHECK(MortonEncode(0,0) == 0);
+    CHECK(MortonEncode(1,0) == 1);
+    CHECK(MortonEncode(0,1) == 2);
+    CHECK(MortonEncode(3,3) == 15);
+    CHECK(MortonEncode(0xffffffff,0) == 0x5555555555555555ULL);
+
+    uint32_t x,y;
+    MortonDecode(MortonEncode(0x12345678,0x9abcdef0),x,y);
+    CHECK(x == 0x12345678 && y == 0x9abcdef0);
+}
+
+// Every level, at the corners and some random spots in between
+TEST(TileKeyRoundTrip)
+{
+    std::mt19937 rng(5);
+    const TileKeyScheme schemes[2] = {TileKeyRowMajor,TileKeyMorton};
+
+    for (TileKeyScheme scheme : schemes)
+        for (int level=0;level<=TileKeyMaxLevel;level++)
+        {
+            int maxTile = (1<<level)-1;
+            std::uniform_int_distribution<int> dist(0,maxTile);
+            for (int which=0;which<20;which++)
+            {
+                int x = which == 0 ? 0 : (which == 1 ? maxTile : dist(rng));
+                int y = which == 0 ? 0 : (which == 1 ? maxTile : dist(rng));
+                int64_t key = TileKeyMake(x,y,level,scheme);
+                CHECK(TileKeyLevel(key) == level);
+
+                int outX,outY,outLevel;
+                TileKeyDecode(key,outX,outY,outLevel,scheme);
+                CHECK(outX == x && outY == y && outLevel == level);
+            }
+
+            // Levels sit one after the other
+            CHECK(TileKeyMake(0,0,level,scheme) == (int64_t)TileKeyLevelOffset(level));
+            if (level < TileKeyMaxLevel)
+                CHECK(TileKeyMake(maxTile,maxTile,level,scheme)+1 == TileKeyMake(0,0,level+1,scheme));
+        }
+}
+
+TEST(TileKeyMortonNeighbors)
+{
+    // The four children of a tile are next to each other under Morton, but not row by row
+    int64_t key = TileKeyMake(2,2,3,TileKeyMorton);
+    CHECK(TileKeyMake(3,2,3,TileKeyMorton) == key+1);
+    CHECK(TileKeyMake(2,3,3,TileKeyMorton) == key+2);
+    CHECK(TileKeyMake(3,3,3,TileKeyMorton) == key+3);
+    CHECK(TileKeyMake(2,3,3,TileKeyRowMajor) == TileKeyMake(2,2,3,TileKeyRowMajor)+8);
+}
+
+TEST(TileKeyOctreeRoundTrip)
+{
+    std::mt19937 rng(7);
+
+    CHECK(TileKeyMakeOctree(0,0,0,0) == 0);
+    for (int level=0;level<=TileKeyOctreeMaxLevel;level++)
+    {
+        int maxTile = (1<<level)-1;
+        std::uniform_int_distribution<int> dist(0,maxTile);
+        for (int which=0;which<20;which++)
+        {
+            int x = which == 0 ? 0 : (which == 1 ? maxTile : dist(rng));
+            int y = which == 0 ? 0 : (which == 1 ? maxTile : dist(rng));
+            int zCell = which == 0 ? 0 : (which == 1 ? maxTile : dist(rng));
+            int64_t key = TileKeyMakeOctree(x,y,zCell,level);
+
+            int outX,outY,outZCell,outLevel;
+            TileKeyDecodeOctree(key,outX,outY,outZCell,outLevel);
+            CHECK(outX == x && outY == y && outZCell == zCell && outLevel == level);
+        }
+
+        if (level < TileKeyOctreeMaxLevel)
+            CHECK(TileKeyMakeOctree(maxTile,maxTile,maxTile,level)+1 == TileKeyMakeOctree(0,0,0,level+1));
+    }
+
+    // Leaves room for the columns of a columnar tile
+    int64_t lastKey = TileKeyMakeOctree((1<<TileKeyOctreeMaxLevel)-1,(1<<TileKeyOctreeMaxLevel)-1,(1<<TileKeyOctreeMaxLevel)-1,TileKeyOctreeMaxLevel);
+    CHECK(lastKey > 0 && lastKey < INT64_MAX/16);
+}
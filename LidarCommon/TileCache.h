@@ -0,0 +1,180 @@
+//
+//  TileCache.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TileCache_h
+#define TileCache_h
+
+#include <stddef.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/* Byte budgeted cache of decoded tiles, safe to call from multiple threads.
+
+    This is a segmented LRU.  New tiles go into a probation segment and only
+    move to the protected segment if they're asked for again.  Tiles we only
+    saw once (say, on a zoom in that we didn't come back from) get evicted first,
+    so a pan back and forth over the same area doesn't flush the tiles we keep using.
+  */
+template<typename Key,typename Value>
+class TileCache
+{
+public:
+    typedef std::shared_ptr<Value> ValueRef;
+
+    // Hit, miss and eviction counts, plus what's in there now
+    class Stats
+    {
+    public:
+        Stats() : hits(0), misses(0), evictions(0), numEntries(0), bytes(0) { }
+        long long hits,misses,evictions;
+        long long numEntries;
+        size_t bytes;
+    };
+
+    // Budget in bytes.  protectedFraction is the part of that reserved for tiles we've seen twice.
+    TileCache(size_t maxBytes,double protectedFraction = 0.8)
+        : maxBytes(maxBytes), maxProtectedBytes((size_t)(maxBytes * protectedFraction)), probationBytes(0), protectedBytes(0)
+    {
+    }
+
+    // Look for a tile.  Returns an empty ref if it's not there.
+    ValueRef find(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        typename EntryMap::iterator it = entries.find(key);
+        if (it == entries.end())
+        {
+            stats.misses++;
+            return ValueRef();
+        }
+        stats.hits++;
+
+        // Second time we've seen this one, so it gets promoted
+        Entry &entry = it->second;
+        if (entry.isProtected)
+            protectedList.splice(protectedList.begin(),protectedList,entry.pos);
+        else {
+            protectedList.splice(protectedList.begin(),probationList,entry.pos);
+            entry.pos = protectedList.begin();
+            entry.isProtected = true;
+            probationBytes -= entry.size;
+            protectedBytes += entry.size;
+
+            // Too many protected tiles pushes the oldest back into probation
+            while (protectedBytes > maxProtectedBytes && protectedList.size() > 1)
+            {
+                Entry &oldest = entries[protectedList.back()];
+                probationList.splice(probationList.begin(),protectedList,oldest.pos);
+                oldest.pos = probationList.begin();
+                oldest.isProtected = false;
+                protectedBytes -= oldest.size;
+                probationBytes += oldest.size;
+            }
+        }
+
+        return entry.value;
+    }
+
+    // Add a tile (or replace it) along with how much memory it's using
+    void insert(const Key &key,const ValueRef &value,size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Bigger than the whole cache, so don't bother
+        if (size > maxBytes)
+            return;
+
+        removeLocked(key);
+
+        probationList.push_front(key);
+        Entry &entry = entries[key];
+        entry.value = value;
+        entry.size = size;
+        entry.isProtected = false;
+        entry.pos = probationList.begin();
+        probationBytes += size;
+
+        // Evict from probation first, then protected, but never the tile we just added.
+        // It's at the front of probation, so it's the last one there.
+        while (probationBytes + protectedBytes > maxBytes && (probationList.size() > 1 || !protectedList.empty()))
+        {
+            Key victim = probationList.size() > 1 ? probationList.back() : protectedList.back();
+            removeLocked(victim);
+            stats.evictions++;
+        }
+    }
+
+    // Drop a tile if it's in there
+    void remove(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        removeLocked(key);
+    }
+
+    // Dump everything
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        probationList.clear();
+        protectedList.clear();
+        probationBytes = protectedBytes = 0;
+    }
+
+    Stats getStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats ret = stats;
+        ret.numEntries = entries.size();
+        ret.bytes = probationBytes + protectedBytes;
+        return ret;
+    }
+
+protected:
+    class Entry
+    {
+    public:
+        Entry() : size(0), isProtected(false) { }
+        ValueRef value;
+        size_t size;
+        bool isProtected;
+        typename std::list<Key>::iterator pos;
+    };
+    typedef std::unordered_map<Key,Entry> EntryMap;
+
+    void removeLocked(const Key &key)
+    {
+        typename EntryMap::iterator it = entries.find(key);
+        if (it == entries.end())
+            return;
+
+        Entry &entry = it->second;
+        if (entry.isProtected)
+        {
+            protectedList.erase(entry.pos);
+            protectedBytes -= entry.size;
+        } else {
+            probationList.erase(entry.pos);
+            probationBytes -= entry.size;
+        }
+        entries.erase(it);
+    }
+
+    std::mutex mutex;
+    size_t maxBytes,maxProtectedBytes;
+    // Most recently used at the front
+    std::list<Key> probationList,protectedList;
+    size_t probationBytes,protectedBytes;
+    EntryMap entries;
+    Stats stats;
+};
+
+#endif /* TileCache_h */
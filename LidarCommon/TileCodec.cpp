@@ -0,0 +1,572 @@
+//
+//  TileCodec.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "TileCodec.h"
+#include "TileDecoder.h"
+#include "TileKey.h"
+#include "PointKernels.h"
+#include <string.h>
+#include <algorithm>
+#include <zlib.h>
+
+/* Layout of a compact tile.  Everything is little endian.
+     "LTC1", number of points (u32), point format (u8), flags (u8), number of streams (u16)
+     Tile minimum corner in quantized coordinates (3 x i32)
+     Then each stream: uncompressed size (u32), compressed size (u32), deflated bytes
+   Streams are x, y, z (4 byte planes each), intensity (2), classification (1)
+   and then red, green, blue (2 each) if there's color.
+ 
+   A column of a columnar tile is
+     "LTCC", number of points (u32), TileColumn (u8), point format (u8), number of streams (u8), value width (u8)
+   The position column then has the minimum corner, like a compact tile.
+   The streams are the same sort of thing, in the order encodeColumns() writes them.
+  */
+static const char CompactTileMagic[4] = {'L','T','C','1'};
+static const size_t CompactTileHeaderSize = 24;
+static const uint8_t CompactTileHasColor = 1;
+static const char TileColumnMagic[4] = {'L','T','C','C'};
+static const size_t TileColumnHeaderSize = 12;
+
+// What's in the various point formats
+static bool PointFormatHasGPSTime(int pointDataFormat)
+{
+    return pointDataFormat == 1 || pointDataFormat >= 3;
+}
+
+static bool PointFormatHasNIR(int pointDataFormat)
+{
+    return pointDataFormat == 8 || pointDataFormat == 10;
+}
+
+template<typename T> static void AppendValue(std::string &out,T val)
+{
+    out.append((const char *)&val,sizeof(T));
+}
+
+template<typename T> static T ReadValue(const uint8_t *&pos)
+{
+    T val;
+    memcpy(&val,pos,sizeof(T));
+    pos += sizeof(T);
+    return val;
+}
+
+// Spread the bytes of each value out into planes: all the first bytes, then all the second bytes and so on
+static void ShuffleBytes(const uint8_t *in,size_t count,int width,uint8_t *out)
+{
+    for (int byte=0;byte<width;byte++)
+    {
+        uint8_t *plane = out + byte*count;
+        for (size_t ii=0;ii<count;ii++)
+            plane[ii] = in[ii*width+byte];
+    }
+}
+
+// Put the planes back together.  Four byte values have a kernel of their own.
+static void UnshuffleBytes(const uint8_t *in,size_t count,int width,uint8_t *out)
+{
+    for (int byte=0;byte<width;byte++)
+    {
+        const uint8_t *plane = in + byte*count;
+        for (size_t ii=0;ii<count;ii++)
+            out[ii*width+byte] = plane[ii];
+    }
+}
+
+TileQuantization::TileQuantization()
+{
+    for (int ii=0;ii<3;ii++)
+    {
+        scale[ii] = 1.0;
+        offset[ii] = 0.0;
+    }
+}
+
+TileQuantization::TileQuantization(double xScale,double yScale,double zScale,double xOffset,double yOffset,double zOffset)
+{
+    scale[0] = xScale;  scale[1] = yScale;  scale[2] = zScale;
+    offset[0] = xOffset;  offset[1] = yOffset;  offset[2] = zOffset;
+}
+
+bool IsCompactTile(const void *data,size_t len)
+{
+    return data && len >= CompactTileHeaderSize && !memcmp(data,CompactTileMagic,sizeof(CompactTileMagic));
+}
+
+bool IsTileColumn(const void *data,size_t len)
+{
+    return data && len >= TileColumnHeaderSize && !memcmp(data,TileColumnMagic,sizeof(TileColumnMagic));
+}
+
+CompactTileEncoder::CompactTileEncoder()
+: pointDataFormat(0), numExtraBytes(0), hasColor(false)
+{
+    minPt[0] = minPt[1] = minPt[2] = 0;
+}
+
+void CompactTileEncoder::reset(int inPointDataFormat,int inNumExtraBytes)
+{
+    pointDataFormat = inPointDataFormat;
+    numExtraBytes = std::max(inNumExtraBytes,0);
+    hasColor = PointFormatHasColor(pointDataFormat);
+    points.clear();
+    extraBytes.clear();
+}
+
+void CompactTileEncoder::addPoint(const laszip_point_struct *p)
+{
+    points.push_back(*p);
+    points.back().extra_bytes = NULL;
+    if (numExtraBytes > 0)
+    {
+        if (p->extra_bytes && p->num_extra_bytes >= numExtraBytes)
+            extraBytes.insert(extraBytes.end(),p->extra_bytes,p->extra_bytes+numExtraBytes);
+        else
+            extraBytes.resize(extraBytes.size()+numExtraBytes,0);
+    }
+}
+
+void CompactTileEncoder::sortPoints()
+{
+    size_t numPoints = points.size();
+    minPt[0] = minPt[1] = minPt[2] = 0;
+    if (numPoints > 0)
+    {
+        minPt[0] = minPt[1] = minPt[2] = INT32_MAX;
+        for (const auto &p : points)
+        {
+            minPt[0] = std::min(minPt[0],p.X);
+            minPt[1] = std::min(minPt[1],p.Y);
+            minPt[2] = std::min(minPt[2],p.Z);
+        }
+    }
+
+    // Walk the points along a Morton curve so neighbors in the stream are neighbors on the ground
+    order.resize(numPoints);
+    for (size_t ii=0;ii<numPoints;ii++)
+        order[ii] = std::make_pair(MortonEncode((uint32_t)points[ii].X-(uint32_t)minPt[0],(uint32_t)points[ii].Y-(uint32_t)minPt[1]),(uint32_t)ii);
+    std::sort(order.begin(),order.end());
+}
+
+bool CompactTileEncoder::addStream(const uint8_t *data,size_t len,std::string &out)
+{
+    uLongf compLen = compressBound(len);
+    compressed.resize(std::max((size_t)compLen,(size_t)1));
+    if (compress2(&compressed[0],&compLen,data,len,Z_DEFAULT_COMPRESSION) != Z_OK)
+        return false;
+    AppendValue<uint32_t>(out,(uint32_t)len);
+    AppendValue<uint32_t>(out,(uint32_t)compLen);
+    out.append((const char *)&compressed[0],compLen);
+
+    return true;
+}
+
+bool CompactTileEncoder::addValues(const void *inValues,int width,std::string &out)
+{
+    size_t numPoints = points.size();
+    planes.resize(numPoints*width);
+    ShuffleBytes((const uint8_t *)inValues,numPoints,width,planes.data());
+
+    return addStream(planes.data(),numPoints*width,out);
+}
+
+bool CompactTileEncoder::addCoordinate(int which,std::string &out)
+{
+    // Zigzagged deltas along the curve, starting from the minimum corner
+    size_t numPoints = points.size();
+    values.resize(4*numPoints);
+    uint32_t *deltas = (uint32_t *)values.data();
+    int32_t last = minPt[which];
+    for (size_t ii=0;ii<numPoints;ii++)
+    {
+        const laszip_point_struct &p = points[order[ii].second];
+        int32_t val = which == 0 ? p.X : (which == 1 ? p.Y : p.Z);
+        int32_t delta = (int32_t)((uint32_t)val - (uint32_t)last);
+        deltas[ii] = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        last = val;
+    }
+
+    return addValues(deltas,4,out);
+}
+
+// Pull one attribute out of the points in curve order
+template<typename T,typename Func> static void GatherValues(const std::vector<laszip_point_struct> &points,const std::vector<std::pair<uint64_t,uint32_t> > &order,std::vector<T> &out,Func func)
+{
+    out.resize(points.size());
+    for (size_t ii=0;ii<points.size();ii++)
+        out[ii] = func(points[order[ii].second]);
+}
+
+bool CompactTileEncoder::encode(std::string &out)
+{
+    out.clear();
+    size_t numPoints = points.size();
+    sortPoints();
+
+    out.append(CompactTileMagic,sizeof(CompactTileMagic));
+    AppendValue<uint32_t>(out,(uint32_t)numPoints);
+    AppendValue<uint8_t>(out,(uint8_t)pointDataFormat);
+    AppendValue<uint8_t>(out,hasColor ? CompactTileHasColor : 0);
+    AppendValue<uint16_t>(out,hasColor ? 8 : 5);
+    for (int ii=0;ii<3;ii++)
+        AppendValue<int32_t>(out,minPt[ii]);
+
+    for (int which=0;which<3;which++)
+        if (!addCoordinate(which,out))
+            return false;
+
+    // Attributes are stored as is, just in the new order
+    bool extended = pointDataFormat > 5;
+    std::vector<uint16_t> vals16;
+    std::vector<uint8_t> vals8;
+    GatherValues(points,order,vals16,[](const laszip_point_struct &p) { return p.intensity; });
+    if (!addValues(vals16.data(),2,out))
+        return false;
+    GatherValues(points,order,vals8,[extended](const laszip_point_struct &p) { return (uint8_t)(extended ? p.extended_classification : p.classification); });
+    if (!addValues(vals8.data(),1,out))
+        return false;
+    if (hasColor)
+        for (int which=0;which<3;which++)
+        {
+            GatherValues(points,order,vals16,[which](const laszip_point_struct &p) { return p.rgb[which]; });
+            if (!addValues(vals16.data(),2,out))
+                return false;
+        }
+
+    return true;
+}
+
+void CompactTileEncoder::startColumn(TileColumn column,int numStreams,int width,std::string &out)
+{
+    out.clear();
+    out.append(TileColumnMagic,sizeof(TileColumnMagic));
+    AppendValue<uint32_t>(out,(uint32_t)points.size());
+    AppendValue<uint8_t>(out,(uint8_t)column);
+    AppendValue<uint8_t>(out,(uint8_t)pointDataFormat);
+    AppendValue<uint8_t>(out,(uint8_t)numStreams);
+    AppendValue<uint8_t>(out,(uint8_t)width);
+}
+
+bool CompactTileEncoder::encodeColumns(std::vector<std::string> &columns)
+{
+    columns.clear();
+    columns.resize(TileColumnCount);
+    sortPoints();
+    bool extended = pointDataFormat > 5;
+    std::vector<uint16_t> vals16;
+    std::vector<int16_t> valsS16;
+    std::vector<uint8_t> vals8;
+    std::vector<double> valsF64;
+
+    // Positions, the same as a compact tile
+    std::string &posCol = columns[TileColumnPosition];
+    startColumn(TileColumnPosition,3,4,posCol);
+    for (int ii=0;ii<3;ii++)
+        AppendValue<int32_t>(posCol,minPt[ii]);
+    for (int which=0;which<3;which++)
+        if (!addCoordinate(which,posCol))
+            return false;
+
+    if (hasColor)
+    {
+        bool hasNIR = PointFormatHasNIR(pointDataFormat);
+        std::string &colorCol = columns[TileColumnColor];
+        startColumn(TileColumnColor,hasNIR ? 4 : 3,2,colorCol);
+        for (int which=0;which<(hasNIR ? 4 : 3);which++)
+        {
+            GatherValues(points,order,vals16,[which](const laszip_point_struct &p) { return p.rgb[which]; });
+            if (!addValues(vals16.data(),2,colorCol))
+                return false;
+        }
+    }
+
+    std::string &intensityCol = columns[TileColumnIntensity];
+    startColumn(TileColumnIntensity,1,2,intensityCol);
+    GatherValues(points,order,vals16,[](const laszip_point_struct &p) { return p.intensity; });
+    if (!addValues(vals16.data(),2,intensityCol))
+        return false;
+
+    std::string &classCol = columns[TileColumnClassification];
+    startColumn(TileColumnClassification,2,1,classCol);
+    GatherValues(points,order,vals8,[extended](const laszip_point_struct &p) { return (uint8_t)(extended ? p.extended_classification : p.classification); });
+    if (!addValues(vals8.data(),1,classCol))
+        return false;
+    GatherValues(points,order,vals8,[extended](const laszip_point_struct &p) {
+        return (uint8_t)(extended ? p.extended_classification_flags : (p.synthetic_flag | (p.keypoint_flag << 1) | (p.withheld_flag << 2))); });
+    if (!addValues(vals8.data(),1,classCol))
+        return false;
+
+    std::string &returnsCol = columns[TileColumnReturns];
+    startColumn(TileColumnReturns,3,1,returnsCol);
+    GatherValues(points,order,vals8,[extended](const laszip_point_struct &p) { return (uint8_t)(extended ? p.extended_return_number : p.return_number); });
+    if (!addValues(vals8.data(),1,returnsCol))
+        return false;
+    GatherValues(points,order,vals8,[extended](const laszip_point_struct &p) { return (uint8_t)(extended ? p.extended_number_of_returns : p.number_of_returns); });
+    if (!addValues(vals8.data(),1,returnsCol))
+        return false;
+    GatherValues(points,order,vals8,[](const laszip_point_struct &p) {
+        return (uint8_t)(p.scan_direction_flag | (p.edge_of_flight_line << 1) | (p.extended_scanner_channel << 2)); });
+    if (!addValues(vals8.data(),1,returnsCol))
+        return false;
+
+    std::string &angleCol = columns[TileColumnScanAngle];
+    startColumn(TileColumnScanAngle,1,2,angleCol);
+    GatherValues(points,order,valsS16,[extended](const laszip_point_struct &p) { return (int16_t)(extended ? p.extended_scan_angle : p.scan_angle_rank); });
+    if (!addValues(valsS16.data(),2,angleCol))
+        return false;
+
+    std::string &sourceCol = columns[TileColumnSource];
+    startColumn(TileColumnSource,2,1,sourceCol);
+    GatherValues(points,order,vals8,[](const laszip_point_struct &p) { return p.user_data; });
+    if (!addValues(vals8.data(),1,sourceCol))
+        return false;
+    GatherValues(points,order,vals16,[](const laszip_point_struct &p) { return p.point_source_ID; });
+    if (!addValues(vals16.data(),2,sourceCol))
+        return false;
+
+    if (PointFormatHasGPSTime(pointDataFormat))
+    {
+        std::string &timeCol = columns[TileColumnGPSTime];
+        startColumn(TileColumnGPSTime,1,8,timeCol);
+        GatherValues(points,order,valsF64,[](const laszip_point_struct &p) { return p.gps_time; });
+        if (!addValues(valsF64.data(),8,timeCol))
+            return false;
+    }
+
+    if (numExtraBytes > 0)
+    {
+        std::string &extraCol = columns[TileColumnExtraBytes];
+        startColumn(TileColumnExtraBytes,1,numExtraBytes,extraCol);
+        vals8.resize(points.size()*numExtraBytes);
+        for (size_t ii=0;ii<points.size();ii++)
+            memcpy(&vals8[ii*numExtraBytes],&extraBytes[order[ii].second*numExtraBytes],numExtraBytes);
+        if (!addValues(vals8.data(),numExtraBytes,extraCol))
+            return false;
+    }
+
+    return true;
+}
+
+CompactTileDecoder::CompactTileDecoder()
+: pos(NULL), end(NULL)
+{
+}
+
+bool CompactTileDecoder::nextStream(size_t expectLen)
+{
+    if (end - pos < 8)
+    {
+        error = "Compact tile is truncated";
+        return false;
+    }
+    uint32_t rawLen = ReadValue<uint32_t>(pos);
+    uint32_t compLen = ReadValue<uint32_t>(pos);
+    if (rawLen != expectLen || (size_t)(end - pos) < compLen)
+    {
+        error = "Compact tile stream is the wrong size";
+        return false;
+    }
+    planes.resize(std::max(expectLen,(size_t)1));
+    uLongf destLen = rawLen;
+    if (uncompress(&planes[0],&destLen,pos,compLen) != Z_OK || destLen != rawLen)
+    {
+        error = "Failed to inflate compact tile stream";
+        return false;
+    }
+    pos += compLen;
+
+    return true;
+}
+
+bool CompactTileDecoder::nextValues(size_t numPoints,int width,void *out)
+{
+    if (!nextStream(numPoints*width))
+        return false;
+    if (numPoints > 0)
+        UnshuffleBytes(planes.data(),numPoints,width,(uint8_t *)out);
+
+    return true;
+}
+
+bool CompactTileDecoder::readPositions(size_t numPoints,const int32_t minPt[3],const TileQuantization &quant,TilePoints &points)
+{
+    // Each coordinate is a few straight passes over the column: merge the planes,
+    //  undo the deltas and then scale.
+    rawX.resize(numPoints);  rawY.resize(numPoints);  rawZ.resize(numPoints);
+    std::vector<int32_t> *raws[3] = {&rawX,&rawY,&rawZ};
+    std::vector<double> *outs[3] = {&points.x,&points.y,&points.z};
+    values.resize(4*numPoints);
+    for (int which=0;which<3;which++)
+    {
+        if (!nextStream(4*numPoints))
+            return false;
+        uint32_t *zigzag = (uint32_t *)values.data();
+        MergeBytePlanes4(planes.data(),numPoints,zigzag);
+        int32_t *raw = raws[which]->data();
+        int32_t last = minPt[which];
+        for (size_t ii=0;ii<numPoints;ii++)
+        {
+            last = (int32_t)((uint32_t)last + ((zigzag[ii] >> 1) ^ (0 - (zigzag[ii] & 1))));
+            raw[ii] = last;
+        }
+        outs[which]->resize(numPoints);
+        ScaleOffsetInts(raw,numPoints,quant.scale[which],quant.offset[which],outs[which]->data());
+    }
+
+    // There's no header, so the bounds come from the points
+    if (numPoints > 0)
+    {
+        points.minX = *std::min_element(points.x.begin(),points.x.end());  points.maxX = *std::max_element(points.x.begin(),points.x.end());
+        points.minY = *std::min_element(points.y.begin(),points.y.end());  points.maxY = *std::max_element(points.y.begin(),points.y.end());
+        points.minZ = *std::min_element(points.z.begin(),points.z.end());  points.maxZ = *std::max_element(points.z.begin(),points.z.end());
+    }
+
+    return true;
+}
+
+bool CompactTileDecoder::decode(const void *data,size_t len,const TileQuantization &quant,TilePoints &points)
+{
+    points.clear();
+    if (!IsCompactTile(data,len))
+    {
+        error = "Not a compact tile";
+        return false;
+    }
+    pos = (const uint8_t *)data + sizeof(CompactTileMagic);
+    end = (const uint8_t *)data + len;
+    size_t numPoints = ReadValue<uint32_t>(pos);
+    int pointDataFormat = ReadValue<uint8_t>(pos);
+    bool hasColor = ReadValue<uint8_t>(pos) & CompactTileHasColor;
+    int numStreams = ReadValue<uint16_t>(pos);
+    int32_t minPt[3];
+    for (int ii=0;ii<3;ii++)
+        minPt[ii] = ReadValue<int32_t>(pos);
+    if (numStreams != (hasColor ? 8 : 5))
+    {
+        error = "Compact tile has the wrong number of streams";
+        return false;
+    }
+
+    points.resize(numPoints,hasColor);
+    points.pointDataFormat = pointDataFormat;
+    bool ok = readPositions(numPoints,minPt,quant,points) &&
+              nextValues(numPoints,2,points.intensity.data()) &&
+              nextValues(numPoints,1,points.classification.data());
+    if (ok && hasColor)
+        ok = nextValues(numPoints,2,points.red.data()) &&
+             nextValues(numPoints,2,points.green.data()) &&
+             nextValues(numPoints,2,points.blue.data());
+    if (!ok)
+        points.clear();
+
+    return ok;
+}
+
+bool CompactTileDecoder::decodeColumn(const void *data,size_t len,const TileQuantization &quant,TilePoints &points)
+{
+    if (!IsTileColumn(data,len))
+    {
+        error = "Not a tile column";
+        return false;
+    }
+    pos = (const uint8_t *)data + sizeof(TileColumnMagic);
+    end = (const uint8_t *)data + len;
+    size_t numPoints = ReadValue<uint32_t>(pos);
+    int column = ReadValue<uint8_t>(pos);
+    int pointDataFormat = ReadValue<uint8_t>(pos);
+    int numStreams = ReadValue<uint8_t>(pos);
+    int width = ReadValue<uint8_t>(pos);
+
+    if (column == TileColumnPosition)
+    {
+        points.clear();
+        if (numStreams != 3 || end - pos < 12)
+        {
+            error = "Position column is the wrong size";
+            return false;
+        }
+        int32_t minPt[3];
+        for (int ii=0;ii<3;ii++)
+            minPt[ii] = ReadValue<int32_t>(pos);
+        points.numPoints = numPoints;
+        points.pointDataFormat = pointDataFormat;
+        if (!readPositions(numPoints,minPt,quant,points))
+        {
+            points.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // Everything else hangs off the positions
+    if (points.numPoints != numPoints || points.x.size() != numPoints)
+    {
+        error = "Load the position column first";
+        return false;
+    }
+
+    bool ok = false;
+    switch (column)
+    {
+        case TileColumnColor:
+            points.red.resize(numPoints);  points.green.resize(numPoints);  points.blue.resize(numPoints);
+            ok = (numStreams == 3 || numStreams == 4) &&
+                 nextValues(numPoints,2,points.red.data()) &&
+                 nextValues(numPoints,2,points.green.data()) &&
+                 nextValues(numPoints,2,points.blue.data());
+            if (ok && numStreams == 4)
+            {
+                points.nir.resize(numPoints);
+                ok = nextValues(numPoints,2,points.nir.data());
+            }
+            break;
+        case TileColumnIntensity:
+            points.intensity.resize(numPoints);
+            ok = numStreams == 1 && nextValues(numPoints,2,points.intensity.data());
+            break;
+        case TileColumnClassification:
+            points.classification.resize(numPoints);  points.classFlags.resize(numPoints);
+            ok = numStreams == 2 &&
+                 nextValues(numPoints,1,points.classification.data()) &&
+                 nextValues(numPoints,1,points.classFlags.data());
+            break;
+        case TileColumnReturns:
+            points.returnNumber.resize(numPoints);  points.numberOfReturns.resize(numPoints);  points.scanFlags.resize(numPoints);
+            ok = numStreams == 3 &&
+                 nextValues(numPoints,1,points.returnNumber.data()) &&
+                 nextValues(numPoints,1,points.numberOfReturns.data()) &&
+                 nextValues(numPoints,1,points.scanFlags.data());
+            break;
+        case TileColumnScanAngle:
+            points.scanAngle.resize(numPoints);
+            ok = numStreams == 1 && nextValues(numPoints,2,points.scanAngle.data());
+            break;
+        case TileColumnSource:
+            points.userData.resize(numPoints);  points.pointSourceID.resize(numPoints);
+            ok = numStreams == 2 &&
+                 nextValues(numPoints,1,points.userData.data()) &&
+                 nextValues(numPoints,2,points.pointSourceID.data());
+            break;
+        case TileColumnGPSTime:
+            points.gpsTime.resize(numPoints);
+            ok = numStreams == 1 && nextValues(numPoints,8,points.gpsTime.data());
+            break;
+        case TileColumnExtraBytes:
+            points.numExtraBytes = width;
+            points.extraBytes.resize(numPoints*width);
+            ok = numStreams == 1 && width > 0 && nextValues(numPoints,width,points.extraBytes.data());
+            break;
+        default:
+            error = "Unknown tile column " + std::to_string(column);
+            return false;
+    }
+    if (!ok && error.empty())
+        error = "Tile column " + std::to_string(column) + " is the wrong size";
+
+    return ok;
+}
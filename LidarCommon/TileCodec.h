@@ -0,0 +1,164 @@
+//
+//  TileCodec.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TileCodec_h
+#define TileCodec_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "laszip_api.h"
+
+class TilePoints;
+
+/* How the tiles in a database are stored.  This goes in the manifest.
+    LAZ tiles are complete LAZ files, header and all.
+    Compact tiles leave the header out and keep the shared parts of it in the manifest.
+    Columnar tiles are like compact ones, but each TileColumn is a separate blob
+    and every attribute in the point record is kept.
+  */
+typedef enum {TileCodecLAZ=0,TileCodecCompact=1,TileCodecColumnar=2} TileCodec;
+
+/* The attributes of a columnar tile.  Each is stored and loaded on its own.
+    The value is the column's attr in the database.
+  */
+typedef enum {
+    TileColumnPosition=0,       // X, Y, Z.  Every tile has this and it has to be loaded first.
+    TileColumnColor,            // Red, green, blue and NIR, if the format has them
+    TileColumnIntensity,
+    TileColumnClassification,   // Classification and the synthetic/keypoint/withheld/overlap flags
+    TileColumnReturns,          // Return number, number of returns, scan direction, edge of flight line and scanner channel
+    TileColumnScanAngle,
+    TileColumnSource,           // User data and point source ID
+    TileColumnGPSTime,          // If the format has it
+    TileColumnExtraBytes,       // If the file has them
+    TileColumnCount
+} TileColumn;
+
+// Bit for a column in a mask of the columns to load
+inline uint32_t TileColumnBit(TileColumn column) { return ((uint32_t)1) << column; }
+
+// Everything, and just what a renderer needs
+static const uint32_t TileColumnsAll = (((uint32_t)1) << TileColumnCount) - 1;
+static const uint32_t TileColumnsRender = (((uint32_t)1) << TileColumnPosition) | (((uint32_t)1) << TileColumnColor);
+
+// Columns for a tile sit next to each other in the database under this key
+inline int64_t TileColumnKey(int64_t quadIndex,TileColumn column)
+{
+    return quadIndex * 16 + column;
+}
+
+/* Scale and offset from quantized coordinates to real ones.
+    Every tile in a database shares these, so they go in the manifest once.
+  */
+class TileQuantization
+{
+public:
+    TileQuantization();
+    TileQuantization(double xScale,double yScale,double zScale,double xOffset,double yOffset,double zOffset);
+
+    double scale[3],offset[3];
+};
+
+/* Builds compact or columnar tiles.
+    Coordinates are stored relative to the tile's minimum corner, sorted along a
+    Morton curve and delta coded, so neighboring points have small differences.
+    Each coordinate and attribute is its own stream, with the bytes of each value
+    split out into planes and then deflated.  The high bytes are mostly zero, which
+    deflate likes, and decoding is a few straight loops over whole columns.
+    A compact tile is one blob with the attributes the viewers use: intensity,
+    classification and color.  A columnar tile is one blob per TileColumn and keeps
+    everything.  Both have the points in the same order.
+  */
+class CompactTileEncoder
+{
+public:
+    CompactTileEncoder();
+
+    // Start a new tile with the given point format and number of extra bytes per point
+    void reset(int pointDataFormat,int numExtraBytes = 0);
+
+    // Add a point.  The coordinates should already be quantized with the manifest's scale and offset.
+    void addPoint(const laszip_point_struct *p);
+
+    size_t getNumPoints() { return points.size(); }
+
+    // Sort, delta code and compress what we've got into one compact blob.  Returns false if compression fails.
+    bool encode(std::string &out);
+
+    // Same, but one blob for each TileColumn.  Columns the point format doesn't have come back empty.
+    bool encodeColumns(std::vector<std::string> &columns);
+
+protected:
+    // Work out the Morton order and the minimum corner
+    void sortPoints();
+
+    // Deflate a stream and tack it on to the end of the output
+    bool addStream(const uint8_t *data,size_t len,std::string &out);
+
+    // Shuffle the bytes of a stream of values and add it
+    bool addValues(const void *values,int width,std::string &out);
+
+    // Delta code a quantized coordinate along the curve and add it
+    bool addCoordinate(int which,std::string &out);
+
+    // Header for one column blob
+    void startColumn(TileColumn column,int numStreams,int width,std::string &out);
+
+    int pointDataFormat,numExtraBytes;
+    bool hasColor;
+    std::vector<laszip_point_struct> points;
+    std::vector<laszip_U8> extraBytes;
+    int32_t minPt[3];
+    // Reused between tiles
+    std::vector<std::pair<uint64_t,uint32_t> > order;
+    std::vector<uint8_t> values,planes,compressed;
+};
+
+/* Decodes compact and columnar tiles into TilePoints.
+    Not thread safe, but it's cheap, so make one per thread.
+  */
+class CompactTileDecoder
+{
+public:
+    CompactTileDecoder();
+
+    // Decode a whole compact tile out of memory, using the quantization from the manifest
+    bool decode(const void *data,size_t len,const TileQuantization &quant,TilePoints &points);
+
+    // Decode one column of a columnar tile.  The position column has to come first and
+    //  sets up the points.  The others fill in their attributes and leave the rest alone.
+    bool decodeColumn(const void *data,size_t len,const TileQuantization &quant,TilePoints &points);
+
+    // Reason for the last failure
+    const std::string &getError() { return error; }
+
+protected:
+    // Inflate the next stream into planes.  It has to come out to exactly expectLen.
+    bool nextStream(size_t expectLen);
+
+    // Inflate the next stream and put the values back together
+    bool nextValues(size_t numPoints,int width,void *out);
+
+    // Read the three coordinate streams, then scale them and work out the bounds
+    bool readPositions(size_t numPoints,const int32_t minPt[3],const TileQuantization &quant,TilePoints &points);
+
+    const uint8_t *pos,*end;
+    std::vector<uint8_t> planes,values;
+    std::vector<int32_t> rawX,rawY,rawZ;
+    std::string error;
+};
+
+// True if the data starts like a compact tile, rather than a LAS file
+bool IsCompactTile(const void *data,size_t len);
+
+// True if the data is one column of a columnar tile
+bool IsTileColumn(const void *data,size_t len);
+
+#endif /* TileCodec_h */
@@ -0,0 +1,226 @@
+//
+//  TileDecoder.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "TileDecoder.h"
+#include <algorithm>
+
+MemoryStreamBuf::MemoryStreamBuf(const void *data,size_t len)
+{
+    // We never write through these, the streambuf interface just isn't const
+    char *start = (char *)data;
+    setg(start,start,start+len);
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type off,std::ios_base::seekdir dir,std::ios_base::openmode which)
+{
+    if (!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+
+    off_type newPos = 0;
+    switch (dir)
+    {
+        case std::ios_base::beg:
+            newPos = off;
+            break;
+        case std::ios_base::cur:
+            newPos = (gptr() - eback()) + off;
+            break;
+        case std::ios_base::end:
+            newPos = (egptr() - eback()) + off;
+            break;
+        default:
+            return pos_type(off_type(-1));
+    }
+    if (newPos < 0 || newPos > egptr() - eback())
+        return pos_type(off_type(-1));
+
+    setg(eback(),eback()+newPos,egptr());
+    return pos_type(newPos);
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type pos,std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos),std::ios_base::beg,which);
+}
+
+TilePoints::TilePoints()
+    : numPoints(0), minX(0.0), minY(0.0), minZ(0.0), maxX(0.0), maxY(0.0), maxZ(0.0), pointDataFormat(0), numExtraBytes(0)
+{
+}
+
+void TilePoints::resize(size_t inNumPoints,bool withColor)
+{
+    numPoints = inNumPoints;
+    x.resize(numPoints);  y.resize(numPoints);  z.resize(numPoints);
+    size_t numColors = withColor ? numPoints : 0;
+    red.resize(numColors);  green.resize(numColors);  blue.resize(numColors);
+    intensity.resize(numPoints);
+    classification.resize(numPoints);
+}
+
+void TilePoints::clear()
+{
+    resize(0,false);
+    minX = minY = minZ = maxX = maxY = maxZ = 0.0;
+    nir.clear();
+    classFlags.clear();
+    returnNumber.clear();  numberOfReturns.clear();  scanFlags.clear();
+    scanAngle.clear();
+    userData.clear();
+    pointSourceID.clear();
+    gpsTime.clear();
+    numExtraBytes = 0;
+    extraBytes.clear();
+}
+
+bool PointFormatHasColor(int pointDataFormat)
+{
+    switch (pointDataFormat)
+    {
+        case 2:
+        case 3:
+        case 5:
+        case 7:
+        case 8:
+        case 10:
+            return true;
+        default:
+            return false;
+    }
+}
+
+TileDecoder::TileDecoder()
+{
+}
+
+TileDecoder::~TileDecoder()
+{
+}
+
+bool TileDecoder::decode(const void *data,size_t len,TilePoints &points)
+{
+    points.clear();
+    if (!data || len == 0)
+    {
+        error = "Empty tile";
+        return false;
+    }
+    if (IsCompactTile(data,len))
+    {
+        if (compactDecoder.decode(data,len,quant,points))
+            return true;
+        error = compactDecoder.getError();
+        return false;
+    }
+
+    MemoryStreamBuf buf(data,len);
+    std::istream tileStream(&buf);
+
+    laszip_POINTER reader = NULL;
+    if (laszip_create(&reader))
+    {
+        error = "Failed to create LAZ reader";
+        return false;
+    }
+    laszip_BOOL isCompressed;
+    if (laszip_open_stream_reader(reader,&tileStream,&isCompressed))
+    {
+        laszip_CHAR *errMsg = NULL;
+        laszip_get_error(reader,&errMsg);
+        error = (std::string)"Failed to open tile: " + (errMsg ? errMsg : "unknown error");
+        laszip_destroy(reader);
+        return false;
+    }
+
+    laszip_header_struct *header;
+    laszip_get_header_pointer(reader,&header);
+    long long count = header->number_of_point_records ? header->number_of_point_records : header->extended_number_of_point_records;
+    bool ret = readPoints(reader,count,points);
+
+    laszip_close_reader(reader);
+    laszip_destroy(reader);
+
+    return ret;
+}
+
+bool TileDecoder::decodeColumn(const void *data,size_t len,TilePoints &points)
+{
+    if (compactDecoder.decodeColumn(data,len,quant,points))
+        return true;
+    error = compactDecoder.getError();
+    return false;
+}
+
+bool TileDecoder::decode(laszip_POINTER reader,long long start,long long count,TilePoints &points)
+{
+    points.clear();
+    if (laszip_seek_point(reader,start))
+    {
+        error = "Failed to seek to start of tile";
+        return false;
+    }
+
+    if (!readPoints(reader,count,points))
+        return false;
+
+    // The header covers the whole file, so work out the tile's bounds from its points
+    if (count > 0)
+    {
+        points.minX = *std::min_element(points.x.begin(),points.x.end());  points.maxX = *std::max_element(points.x.begin(),points.x.end());
+        points.minY = *std::min_element(points.y.begin(),points.y.end());  points.maxY = *std::max_element(points.y.begin(),points.y.end());
+        points.minZ = *std::min_element(points.z.begin(),points.z.end());  points.maxZ = *std::max_element(points.z.begin(),points.z.end());
+    }
+
+    return true;
+}
+
+bool TileDecoder::readPoints(laszip_POINTER reader,long long count,TilePoints &points)
+{
+    laszip_header_struct *header;
+    laszip_get_header_pointer(reader,&header);
+    laszip_point_struct *p;
+    laszip_get_point_pointer(reader,&p);
+
+    points.minX = header->min_x;  points.minY = header->min_y;  points.minZ = header->min_z;
+    points.maxX = header->max_x;  points.maxY = header->max_y;  points.maxZ = header->max_z;
+    points.pointDataFormat = header->point_data_format;
+    bool hasColor = PointFormatHasColor(header->point_data_format);
+    bool extended = header->point_data_format > 5;
+    points.resize(count,hasColor);
+    if (count == 0)
+        return true;
+    rawX.resize(count);  rawY.resize(count);  rawZ.resize(count);
+
+    // One pass through the points, pulling the attributes apart
+    for (long long which=0;which<count;which++)
+    {
+        if (laszip_read_point(reader))
+        {
+            error = "Failed to read point " + std::to_string(which);
+            points.clear();
+            return false;
+        }
+
+        rawX[which] = p->X;  rawY[which] = p->Y;  rawZ[which] = p->Z;
+        points.intensity[which] = p->intensity;
+        points.classification[which] = extended ? p->extended_classification : p->classification;
+        if (hasColor)
+        {
+            points.red[which] = p->rgb[0];
+            points.green[which] = p->rgb[1];
+            points.blue[which] = p->rgb[2];
+        }
+    }
+
+    // Then do the positions all at once
+    ScaleOffsetInts(&rawX[0],count,header->x_scale_factor,header->x_offset,&points.x[0]);
+    ScaleOffsetInts(&rawY[0],count,header->y_scale_factor,header->y_offset,&points.y[0]);
+    ScaleOffsetInts(&rawZ[0],count,header->z_scale_factor,header->z_offset,&points.z[0]);
+
+    return true;
+}
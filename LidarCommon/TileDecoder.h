@@ -0,0 +1,115 @@
+//
+//  TileDecoder.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TileDecoder_h
+#define TileDecoder_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <streambuf>
+#include <istream>
+#include <string>
+#include "laszip_api.h"
+#include "PointKernels.h"
+#include "TileCodec.h"
+
+/* Read only streambuf over a chunk of memory we don't own.
+    Lets laszip read a tile straight out of a SQLite blob without copying it.
+    The memory has to stay put until we're done with the stream.
+  */
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+    MemoryStreamBuf(const void *data,size_t len);
+
+protected:
+    // laszip seeks and tells, so we need these
+    virtual pos_type seekoff(off_type off,std::ios_base::seekdir dir,std::ios_base::openmode which);
+    virtual pos_type seekpos(pos_type pos,std::ios_base::openmode which);
+};
+
+/* The points in a tile, one array per attribute.
+    Positions have the scale and offset applied.
+  */
+class TilePoints
+{
+public:
+    TilePoints();
+
+    // Resize everything for this many points
+    void resize(size_t numPoints,bool withColor);
+
+    // Drop the points but keep the memory around for the next tile
+    void clear();
+
+    size_t numPoints;
+
+    // Bounding box and point format from the tile header
+    double minX,minY,minZ,maxX,maxY,maxZ;
+    int pointDataFormat;
+
+    std::vector<double> x,y,z;
+    // Empty if the point format doesn't have color
+    std::vector<uint16_t> red,green,blue;
+    std::vector<uint16_t> intensity;
+    std::vector<uint8_t> classification;
+
+    // Only filled in from columnar tiles, when those columns are asked for
+    std::vector<uint16_t> nir;
+    std::vector<uint8_t> classFlags;
+    std::vector<uint8_t> returnNumber,numberOfReturns,scanFlags;
+    std::vector<int16_t> scanAngle;
+    std::vector<uint8_t> userData;
+    std::vector<uint16_t> pointSourceID;
+    std::vector<double> gpsTime;
+    // numExtraBytes for each point, one after the other
+    int numExtraBytes;
+    std::vector<uint8_t> extraBytes;
+};
+
+/* Decodes LAS/LAZ or compact tiles into TilePoints in a single sequential pass.
+    Not thread safe, but it's cheap, so make one per thread.
+  */
+class TileDecoder
+{
+public:
+    TileDecoder();
+    ~TileDecoder();
+
+    // Compact tiles need the scale and offset from the manifest
+    void setQuantization(const TileQuantization &inQuant) { quant = inQuant; }
+    
+    // Decode a whole tile out of memory (e.g. a SQLite blob).  The memory isn't copied.
+    // This works out whether it's LAZ or compact.
+    bool decode(const void *data,size_t len,TilePoints &points);
+
+    // Decode one column of a columnar tile.  Start with TileColumnPosition, then add whatever else you need.
+    bool decodeColumn(const void *data,size_t len,TilePoints &points);
+
+    // Decode a run of points from a reader that's already open (e.g. a big indexed LAZ file).
+    // We seek once and then read sequentially.  The bounds come from the points, since the header covers the whole file.
+    bool decode(laszip_POINTER reader,long long start,long long count,TilePoints &points);
+
+    // Reason for the last failure
+    const std::string &getError() { return error; }
+
+protected:
+    bool readPoints(laszip_POINTER reader,long long count,TilePoints &points);
+
+    // Quantized positions, reused between tiles
+    std::vector<int32_t> rawX,rawY,rawZ;
+    TileQuantization quant;
+    CompactTileDecoder compactDecoder;
+    std::string error;
+};
+
+// Does point data format have RGB?
+bool PointFormatHasColor(int pointDataFormat);
+
+#endif /* TileDecoder_h */
@@ -0,0 +1,63 @@
+//
+//  TileGrid.cpp
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <math.h>
+#include <string.h>
+#include <limits>
+#include <algorithm>
+#include "TileGrid.h"
+
+TileGroundGrid::TileGroundGrid(int sizeX,int sizeY,double minX,double minY,double maxX,double maxY)
+    : sizeX(std::max(sizeX,0)), sizeY(std::max(sizeY,0)), minX(minX), minY(minY),
+    minZ(std::numeric_limits<double>::max()), maxZ(-std::numeric_limits<double>::max()), numPoints(0)
+{
+    cellX = this->sizeX > 0 ? (maxX-minX)/this->sizeX : 0.0;
+    cellY = this->sizeY > 0 ? (maxY-minY)/this->sizeY : 0.0;
+    cells.resize(this->sizeX*this->sizeY,std::numeric_limits<float>::quiet_NaN());
+}
+
+void TileGroundGrid::addPoint(double x,double y,double z)
+{
+    numPoints++;
+    minZ = std::min(minZ,z);
+    maxZ = std::max(maxZ,z);
+    if (cells.empty())
+        return;
+
+    // Snap to the edges
+    int whichX = cellX > 0.0 ? (int)((x-minX)/cellX) : 0;
+    int whichY = cellY > 0.0 ? (int)((y-minY)/cellY) : 0;
+    whichX = std::min(sizeX-1,std::max(0,whichX));
+    whichY = std::min(sizeY-1,std::max(0,whichY));
+
+    float &cell = cells[whichY*sizeX+whichX];
+    if (isnan(cell) || z < cell)
+        cell = (float)z;
+}
+
+std::string TileGroundGrid::encode() const
+{
+    // Everything we run on is little endian, so the floats go in as is
+    std::string blob;
+    blob.resize(cells.size()*sizeof(float));
+    if (!cells.empty())
+        memcpy(&blob[0],&cells[0],blob.size());
+
+    return blob;
+}
+
+bool TileGroundGrid::decode(const void *data,size_t len,int sizeX,int sizeY,std::vector<float> &cells)
+{
+    if (sizeX <= 0 || sizeY <= 0 || len != sizeX*sizeY*sizeof(float))
+        return false;
+
+    cells.resize(sizeX*sizeY);
+    memcpy(&cells[0],data,len);
+
+    return true;
+}
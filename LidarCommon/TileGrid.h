@@ -0,0 +1,50 @@
+//
+//  TileGrid.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TileGrid_h
+#define TileGrid_h
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* Height information for a tile, gathered while the sorter writes it out.
+    We keep the overall z range and the lowest point in each cell of a
+    grid over the tile.  The viewer uses the grid as a ground surface for picking.
+  */
+class TileGroundGrid
+{
+public:
+    // Grid of sizeX by sizeY cells over the given tile bounds
+    TileGroundGrid(int sizeX,int sizeY,double minX,double minY,double maxX,double maxY);
+
+    // Add a point (in the tile's coordinate system)
+    void addPoint(double x,double y,double z);
+
+    // Grid as a blob for the database.  Cells with no points are NaN.
+    std::string encode() const;
+
+    // Pull the cells back out of a blob.  Fails if it's not the size we expected.
+    static bool decode(const void *data,size_t len,int sizeX,int sizeY,std::vector<float> &cells);
+
+    int getSizeX() const { return sizeX; }
+    int getSizeY() const { return sizeY; }
+    double getMinZ() const { return minZ; }
+    double getMaxZ() const { return maxZ; }
+    long long getNumPoints() const { return numPoints; }
+
+protected:
+    int sizeX,sizeY;
+    double minX,minY;
+    double cellX,cellY;
+    double minZ,maxZ;
+    long long numPoints;
+    std::vector<float> cells;
+};
+
+#endif /* TileGrid_h */
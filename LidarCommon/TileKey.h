@@ -0,0 +1,163 @@
+//
+//  TileKey.h
+//  LidarCommon
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TileKey_h
+#define TileKey_h
+
+#include <stdint.h>
+
+/* Tile keys are how we find a tile (level, x, y) in the database.
+    Both the sorter and the viewers use these, so they need to agree.
+ 
+    A key is the number of tiles in all the levels above this one plus
+    the tile's position within its level.  Sorting by key sorts by level first.
+    Within a level the original scheme went row by row.  The Morton scheme
+    interleaves the x and y bits instead, so tiles that are close together
+    on the ground are close together in the database.
+ 
+    Octree databases can split a tile vertically too, so a tile is
+    (level, x, y, zCell).  Those keys count eight children per level and
+    interleave all three.  A tile in a column that's never been split vertically is zCell 0.
+  */
+typedef enum {TileKeyRowMajor=0,TileKeyMorton=1,TileKeyOctree=2} TileKeyScheme;
+
+// Deepest level we can represent in a 64 bit key
+static const int TileKeyMaxLevel = 30;
+
+// Same for octree keys, leaving room for the columns of a columnar tile (see TileColumnKey)
+static const int TileKeyOctreeMaxLevel = 19;
+
+// Number of tiles in all the levels above this one
+inline uint64_t TileKeyLevelOffset(int level)
+{
+    return ((((uint64_t)1) << (2*level)) - 1) / 3;
+}
+
+// Spread the bits of a 32 bit value out into the even bits of a 64 bit value
+inline uint64_t MortonSpreadBits(uint32_t val)
+{
+    uint64_t x = val;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2))  & 0x3333333333333333ULL;
+    x = (x | (x << 1))  & 0x5555555555555555ULL;
+    return x;
+}
+
+// Pull the even bits of a 64 bit value back together
+inline uint32_t MortonCompactBits(uint64_t x)
+{
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1))  & 0x3333333333333333ULL;
+    x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8))  & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return (uint32_t)x;
+}
+
+// Interleave x and y, x in the low bit
+inline uint64_t MortonEncode(uint32_t x,uint32_t y)
+{
+    return MortonSpreadBits(x) | (MortonSpreadBits(y) << 1);
+}
+
+inline void MortonDecode(uint64_t code,uint32_t &x,uint32_t &y)
+{
+    x = MortonCompactBits(code);
+    y = MortonCompactBits(code >> 1);
+}
+
+// Spread the low 21 bits of a value out into every third bit of a 64 bit value
+inline uint64_t MortonSpreadBits3(uint32_t val)
+{
+    uint64_t x = val & 0x1FFFFF;
+    x = (x | (x << 32)) & 0x001F00000000FFFFULL;
+    x = (x | (x << 16)) & 0x001F0000FF0000FFULL;
+    x = (x | (x << 8))  & 0x100F00F00F00F00FULL;
+    x = (x | (x << 4))  & 0x10C30C30C30C30C3ULL;
+    x = (x | (x << 2))  & 0x1249249249249249ULL;
+    return x;
+}
+
+// Pull every third bit of a 64 bit value back together
+inline uint32_t MortonCompactBits3(uint64_t x)
+{
+    x &= 0x1249249249249249ULL;
+    x = (x | (x >> 2))  & 0x10C30C30C30C30C3ULL;
+    x = (x | (x >> 4))  & 0x100F00F00F00F00FULL;
+    x = (x | (x >> 8))  & 0x001F0000FF0000FFULL;
+    x = (x | (x >> 16)) & 0x001F00000000FFFFULL;
+    x = (x | (x >> 32)) & 0x00000000001FFFFFULL;
+    return (uint32_t)x;
+}
+
+// Number of tiles in all the octree levels above this one
+inline uint64_t TileKeyOctreeLevelOffset(int level)
+{
+    return ((((uint64_t)1) << (3*level)) - 1) / 7;
+}
+
+// Key for a tile in an octree database
+inline int64_t TileKeyMakeOctree(int x,int y,int zCell,int level)
+{
+    uint64_t inLevel = MortonSpreadBits3(x) | (MortonSpreadBits3(y) << 1) | (MortonSpreadBits3(zCell) << 2);
+    
+    return (int64_t)(TileKeyOctreeLevelOffset(level) + inLevel);
+}
+
+// Go from an octree key back to the tile
+inline void TileKeyDecodeOctree(int64_t key,int &x,int &y,int &zCell,int &level)
+{
+    // The level offsets are (8^level-1)/7
+    uint64_t val = 7*(uint64_t)key + 1;
+    level = (63 - __builtin_clzll(val)) / 3;
+    uint64_t inLevel = (uint64_t)key - TileKeyOctreeLevelOffset(level);
+    x = MortonCompactBits3(inLevel);
+    y = MortonCompactBits3(inLevel >> 1);
+    zCell = MortonCompactBits3(inLevel >> 2);
+}
+
+// Key for a tile using the given scheme
+inline int64_t TileKeyMake(int x,int y,int level,TileKeyScheme scheme = TileKeyMorton)
+{
+    uint64_t inLevel;
+    if (scheme == TileKeyMorton)
+        inLevel = MortonEncode(x,y);
+    else
+        inLevel = ((uint64_t)y << level) + x;
+    
+    return (int64_t)(TileKeyLevelOffset(level) + inLevel);
+}
+
+// Level for a given key.  The level offsets are (4^level-1)/3, so this is just a log.
+inline int TileKeyLevel(int64_t key)
+{
+    uint64_t val = 3*(uint64_t)key + 1;
+    int highBit = 63 - __builtin_clzll(val);
+    return highBit / 2;
+}
+
+// Go from a key back to the tile
+inline void TileKeyDecode(int64_t key,int &x,int &y,int &level,TileKeyScheme scheme = TileKeyMorton)
+{
+    level = TileKeyLevel(key);
+    uint64_t inLevel = (uint64_t)key - TileKeyLevelOffset(level);
+    if (scheme == TileKeyMorton)
+    {
+        uint32_t ux,uy;
+        MortonDecode(inLevel,ux,uy);
+        x = ux;  y = uy;
+    } else {
+        x = (int)(inLevel & ((((uint64_t)1) << level) - 1));
+        y = (int)(inLevel >> level);
+    }
+}
+
+#endif /* TileKey_h */
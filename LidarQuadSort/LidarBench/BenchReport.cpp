@@ -0,0 +1,143 @@
+//
+//  BenchReport.cpp
+//  LidarBench
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "BenchReport.hpp"
+#include <math.h>
+
+// Quote and escape a string for JSON
+static std::string JSONString(const std::string &str)
+{
+    std::string out = "\"";
+    for (char c : str)
+    {
+        switch (c)
+        {
+            case '"':  out += "\\\"";  break;
+            case '\\': out += "\\\\";  break;
+            case '\n': out += "\\n";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if ((unsigned char)c < 0x20)
+                {
+                    char buf[8];
+                    sprintf(buf,"\\u%04x",(unsigned char)c);
+                    out += buf;
+                } else
+                    out += c;
+                break;
+        }
+    }
+    out += "\"";
+
+    return out;
+}
+
+// JSON doesn't do NaN or infinity, so those go out as null
+static std::string JSONNumber(double val)
+{
+    if (!isfinite(val))
+        return "null";
+    char buf[64];
+    sprintf(buf,"%.6g",val);
+
+    return buf;
+}
+
+BenchReport::Result &BenchReport::Result::param(const std::string &key,const std::string &val)
+{
+    params.push_back(std::make_pair(key,JSONString(val)));
+    return *this;
+}
+
+BenchReport::Result &BenchReport::Result::param(const std::string &key,long long val)
+{
+    params.push_back(std::make_pair(key,std::to_string(val)));
+    return *this;
+}
+
+BenchReport::Result &BenchReport::Result::value(const std::string &key,double val)
+{
+    values.push_back(std::make_pair(key,val));
+    return *this;
+}
+
+BenchReport::BenchReport()
+{
+}
+
+void BenchReport::setConfig(const std::string &key,const std::string &val)
+{
+    config.push_back(std::make_pair(key,JSONString(val)));
+}
+
+void BenchReport::setConfig(const std::string &key,long long val)
+{
+    config.push_back(std::make_pair(key,std::to_string(val)));
+}
+
+void BenchReport::setConfig(const std::string &key,double val)
+{
+    config.push_back(std::make_pair(key,JSONNumber(val)));
+}
+
+BenchReport::Result &BenchReport::addResult(const std::string &name)
+{
+    results.push_back(Result(name));
+    return results.back();
+}
+
+void BenchReport::print(const Result &result)
+{
+    std::string line = "  " + result.name;
+    for (const auto &param : result.params)
+        line += " " + param.first + "=" + param.second;
+    line += ":";
+    for (const auto &val : result.values)
+    {
+        char buf[128];
+        sprintf(buf," %s %.4g",val.first.c_str(),val.second);
+        line += buf;
+    }
+    fprintf(stdout,"%s\n",line.c_str());
+}
+
+bool BenchReport::write(const std::string &fileName)
+{
+    FILE *fp = fopen(fileName.c_str(),"w");
+    if (!fp)
+    {
+        fprintf(stderr,"Failed to open %s\n",fileName.c_str());
+        return false;
+    }
+
+    // One result per line, so a plain diff lines up too
+    fprintf(fp,"{\n  \"format\": 1,\n  \"config\": {");
+    for (unsigned int ii=0;ii<config.size();ii++)
+        fprintf(fp,"%s\n    %s: %s",ii > 0 ? "," : "",JSONString(config[ii].first).c_str(),config[ii].second.c_str());
+    fprintf(fp,"\n  },\n  \"results\": [");
+    for (unsigned int ii=0;ii<results.size();ii++)
+    {
+        const Result &result = results[ii];
+        fprintf(fp,"%s\n    {\"name\": %s, \"params\": {",ii > 0 ? "," : "",JSONString(result.name).c_str());
+        for (unsigned int jj=0;jj<result.params.size();jj++)
+            fprintf(fp,"%s%s: %s",jj > 0 ? ", " : "",JSONString(result.params[jj].first).c_str(),result.params[jj].second.c_str());
+        fprintf(fp,"}, \"values\": {");
+        for (unsigned int jj=0;jj<result.values.size();jj++)
+            fprintf(fp,"%s%s: %s",jj > 0 ? ", " : "",JSONString(result.values[jj].first).c_str(),JSONNumber(result.values[jj].second).c_str());
+        fprintf(fp,"}}");
+    }
+    fprintf(fp,"\n  ]\n}\n");
+
+    bool ret = !ferror(fp);
+    if (fclose(fp) != 0)
+        ret = false;
+    if (!ret)
+        fprintf(stderr,"Failed to write %s\n",fileName.c_str());
+
+    return ret;
+}
@@ -0,0 +1,66 @@
+//
+//  BenchReport.hpp
+//  LidarBench
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef BenchReport_hpp
+#define BenchReport_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <deque>
+
+/* Collects benchmark results and writes them out as JSON.
+    Each result has a name, the settings it ran with and what we measured.
+    Names and settings stay the same between releases, so two reports
+    can be lined up against each other to look for regressions.
+  */
+class BenchReport
+{
+public:
+    class Result
+    {
+    public:
+        Result(const std::string &name) : name(name) { }
+
+        // Settings for this run, like the thread count
+        Result &param(const std::string &key,const std::string &val);
+        Result &param(const std::string &key,long long val);
+
+        // Measurements, like seconds and points per second
+        Result &value(const std::string &key,double val);
+
+        std::string name;
+        std::vector<std::pair<std::string,std::string> > params;
+        std::vector<std::pair<std::string,double> > values;
+    };
+
+    BenchReport();
+
+    // Describe the data and the machine.  These go at the top of the report.
+    void setConfig(const std::string &key,const std::string &val);
+    void setConfig(const std::string &key,long long val);
+    void setConfig(const std::string &key,double val);
+
+    // Add a result.  Fill it in, then call print() if you want to see it.
+    Result &addResult(const std::string &name);
+
+    // One line summary of a result to stdout
+    void print(const Result &result);
+
+    // Write everything out.  Returns false if we can't.
+    bool write(const std::string &fileName);
+
+protected:
+    // Config values are written as is, so strings come in already quoted
+    std::vector<std::pair<std::string,std::string> > config;
+    // A deque, so the references addResult() hands out stay put
+    std::deque<Result> results;
+};
+
+#endif /* BenchReport_hpp */
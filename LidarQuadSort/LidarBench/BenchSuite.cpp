@@ -0,0 +1,435 @@
+//
+//  BenchSuite.cpp
+//  LidarBench
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "BenchSuite.hpp"
+#include "MortonSorter.hpp"
+#include "BuildMetrics.hpp"
+#include "SpillScheduler.hpp"
+#include "TileDecoder.h"
+#include "PointKernels.h"
+#include <chrono>
+#include <boost/filesystem.hpp>
+
+// Results from the read loops go here so they aren't optimized out
+static volatile long long BenchSink = 0;
+
+static double PerSecond(double count,double seconds)
+{
+    return seconds > 0.0 ? count / seconds : 0.0;
+}
+
+static const char *CodecName(TileCodec codec)
+{
+    switch (codec)
+    {
+        case TileCodecLAZ:
+            return "laz";
+        case TileCodecCompact:
+            return "compact";
+        case TileCodecColumnar:
+            return "columnar";
+    }
+
+    return "unknown";
+}
+
+BenchSuite::BenchSuite(const std::vector<std::string> &files,const std::string &tmpDir,BenchReport &report)
+: files(files), tmpDir(tmpDir), report(report), minPts(20000), maxPts(25000), numRuns(0), keptType(LidarDatabase::FullData)
+{
+}
+
+bool BenchSuite::runRead(int numDecoders)
+{
+    long long numBytes = 0;
+    for (const auto &file : files)
+        numBytes += TempFileSize(file);
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    LidarMultiWrapper input(files);
+    input.setScanOptions(4,"");
+    if (!input.init())
+    {
+        fprintf(stderr,"Failed to open input files\n");
+        return false;
+    }
+    double headerTime = TimeSince(startTime);
+    input.setDecodeThreads(numDecoders,true);
+
+    startTime = std::chrono::steady_clock::now();
+    PointBlock block;
+    long long numPoints = 0, sum = 0;
+    try {
+        while (int numRead = input.getNextBlock(block))
+        {
+            numPoints += numRead;
+            sum += block.x[0];
+        }
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+    double readTime = TimeSince(startTime);
+    BenchSink = sum;
+
+    BenchReport::Result &result = report.addResult("read");
+    result.param("decoders",(long long)numDecoders)
+          .value("points",numPoints)
+          .value("header_seconds",headerTime)
+          .value("seconds",readTime)
+          .value("mpts_per_sec",PerSecond(numPoints / 1e6,readTime))
+          .value("mb_per_sec",PerSecond(numBytes / (1024.0*1024.0),readTime));
+    report.print(result);
+
+    return true;
+}
+
+bool BenchSuite::runPartition()
+{
+    // Just the quantized positions, which is all the split looks at
+    LidarMultiWrapper input(files);
+    input.setScanOptions(4,"");
+    if (!input.init())
+    {
+        fprintf(stderr,"Failed to open input files\n");
+        return false;
+    }
+    const laszip_header_struct &header = input.header;
+    std::vector<int32_t> x,y;
+    PointBlock block;
+    try {
+        while (int numRead = input.getNextBlock(block))
+        {
+            x.insert(x.end(),block.x.begin(),block.x.begin()+numRead);
+            y.insert(y.end(),block.y.begin(),block.y.begin()+numRead);
+        }
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+    long long numPoints = x.size();
+    std::vector<int32_t> scratchX(numPoints),scratchY(numPoints);
+    std::vector<uint8_t> quads(numPoints);
+
+    // Each node keeps minPts for itself and splits the rest four ways, until it's small enough to stop
+    class Node
+    {
+    public:
+        long long start,count;
+        double minX,minY,maxX,maxY;
+    };
+    std::vector<Node> nodes(1),nextNodes;
+    nodes[0].start = 0;  nodes[0].count = numPoints;
+    nodes[0].minX = header.min_x;  nodes[0].minY = header.min_y;
+    nodes[0].maxX = header.max_x;  nodes[0].maxY = header.max_y;
+    for (int level=0;!nodes.empty() && level<32;level++)
+    {
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        long long numLevelPoints = 0;
+        nextNodes.clear();
+        for (const Node &node : nodes)
+        {
+            if (node.count <= maxPts)
+                continue;
+            long long start = node.start + minPts, count = node.count - minPts;
+            numLevelPoints += count;
+            double spanX_2 = (node.maxX - node.minX)/2.0, spanY_2 = (node.maxY - node.minY)/2.0;
+            int32_t splitX = QuantizedSplit(header.x_scale_factor,header.x_offset,node.minX,spanX_2);
+            int32_t splitY = QuantizedSplit(header.y_scale_factor,header.y_offset,node.minY,spanY_2);
+            ClassifyQuadrants(&x[start],&y[start],count,splitX,splitY,&quads[start]);
+
+            // Stable scatter into the quadrants and back again
+            long long quadCount[4] = {0,0,0,0};
+            for (long long ii=start;ii<start+count;ii++)
+                quadCount[quads[ii]]++;
+            long long quadPos[4];
+            quadPos[0] = start;
+            for (int qq=1;qq<4;qq++)
+                quadPos[qq] = quadPos[qq-1] + quadCount[qq-1];
+            long long quadStart[4] = {quadPos[0],quadPos[1],quadPos[2],quadPos[3]};
+            for (long long ii=start;ii<start+count;ii++)
+            {
+                long long dest = quadPos[quads[ii]]++;
+                scratchX[dest] = x[ii];
+                scratchY[dest] = y[ii];
+            }
+            std::copy(scratchX.begin()+start,scratchX.begin()+start+count,x.begin()+start);
+            std::copy(scratchY.begin()+start,scratchY.begin()+start+count,y.begin()+start);
+
+            for (int qq=0;qq<4;qq++)
+            {
+                if (quadCount[qq] == 0)
+                    continue;
+                Node child;
+                child.start = quadStart[qq];  child.count = quadCount[qq];
+                child.minX = (qq & 1) ? node.minX + spanX_2 : node.minX;
+                child.minY = (qq & 2) ? node.minY + spanY_2 : node.minY;
+                child.maxX = child.minX + spanX_2;
+                child.maxY = child.minY + spanY_2;
+                nextNodes.push_back(child);
+            }
+        }
+        double levelTime = TimeSince(startTime);
+        if (numLevelPoints > 0)
+        {
+            BenchReport::Result &result = report.addResult("partition");
+            result.param("level",(long long)level)
+                  .value("nodes",nodes.size())
+                  .value("points",numLevelPoints)
+                  .value("seconds",levelTime)
+                  .value("mpts_per_sec",PerSecond(numLevelPoints / 1e6,levelTime));
+            report.print(result);
+        }
+        nodes.swap(nextNodes);
+    }
+
+    return true;
+}
+
+bool BenchSuite::runSort(bool morton,int numThreads,long long memBudget,TileCodec codec)
+{
+    std::string runName = "sort_" + std::to_string(numRuns++);
+    std::string dbName = tmpDir + "/" + runName + ".sqlite";
+    std::string runTmpDir = tmpDir + "/" + runName;
+    mkdir(runTmpDir.c_str(),0775);
+    remove(dbName.c_str());
+
+    Kompex::SQLiteDatabase *sqliteDb = new Kompex::SQLiteDatabase(dbName, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
+    if (!sqliteDb->GetDatabaseHandle())
+    {
+        fprintf(stderr,"Invalid sqlite database: %s\n",dbName.c_str());
+        delete sqliteDb;
+        return false;
+    }
+    LidarDatabase *lidarDB = new LidarDatabase(sqliteDb,codec == TileCodecColumnar ? LidarDatabase::Columnar : LidarDatabase::FullData);
+
+    // Timed the same way as a real build, headers and all
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    LidarMultiWrapper input(files);
+    input.setScanOptions(std::max(4,numThreads),"");
+    std::unique_ptr<LidarSorter> sorter;
+    if (morton)
+        sorter.reset(new MortonSorter(runTmpDir.c_str()));
+    else
+        sorter.reset(new LidarSorter(runTmpDir.c_str()));
+    sorter->setPointLimit(minPts,maxPts);
+    sorter->setNumThreads(numThreads);
+    sorter->setMemoryBudget(memBudget);
+    sorter->setTileCodec(codec);
+    // The bench has its own report, so no progress lines
+    sorter->getMetrics().setProgressInterval(0.0);
+    bool ok = lidarDB->isValid() && input.init() && sorter->process(&input,lidarDB);
+    if (!lidarDB->flush())
+        ok = false;
+    double sortTime = TimeSince(startTime);
+
+    std::vector<LidarDatabase::TileEntry> index;
+    if (ok)
+        lidarDB->getTileIndex(index);
+    delete lidarDB;
+    try {
+        sqliteDb->Close();
+    }
+    catch (Kompex::SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to close database:\n%s\n",except.GetString().c_str());
+        ok = false;
+    }
+    delete sqliteDb;
+    boost::filesystem::remove_all(boost::filesystem::path(runTmpDir));
+    if (!ok)
+    {
+        fprintf(stderr,"Sort failed\n");
+        remove(dbName.c_str());
+        return false;
+    }
+
+    long long numPoints = sorter->getNumPointsWritten();
+    BenchReport::Result &result = report.addResult("sort");
+    result.param("engine",morton ? "morton" : "recursive")
+          .param("threads",(long long)numThreads)
+          .param("mem_mb",memBudget / (1024*1024))
+          .param("codec",CodecName(codec))
+          .value("points",numPoints)
+          .value("tiles",index.size())
+          .value("seconds",sortTime)
+          .value("mpts_per_sec",PerSecond(numPoints / 1e6,sortTime))
+          .value("peak_tmp_mb",sorter->getPeakTempSpace() / (1024.0*1024.0))
+          .value("db_mb",TempFileSize(dbName) / (1024.0*1024.0))
+          .value("read_s",sorter->getMetrics().getTime(BuildMetrics::TimeRead))
+          .value("partition_s",sorter->getMetrics().getTime(BuildMetrics::TimePartition))
+          .value("codec_s",sorter->getMetrics().getTime(BuildMetrics::TimeCodec))
+          .value("db_s",sorter->getMetrics().getTime(BuildMetrics::TimeDatabase));
+    report.print(result);
+
+    // Hang on to the first one for the database passes
+    if (keptDB.empty())
+        keptDB = dbName;
+    else
+        remove(dbName.c_str());
+
+    return true;
+}
+
+bool BenchSuite::loadTiles()
+{
+    if (!tiles.empty())
+        return true;
+    if (keptDB.empty())
+    {
+        fprintf(stderr,"Need a sort to run first\n");
+        return false;
+    }
+
+    Kompex::SQLiteDatabase *sqliteDb = new Kompex::SQLiteDatabase(keptDB, SQLITE_OPEN_READWRITE, 0);
+    LidarDatabase *lidarDB = new LidarDatabase(sqliteDb,LidarDatabase::WriteOptions());
+    std::vector<LidarDatabase::TileEntry> index;
+    bool ok = lidarDB->isValid() && lidarDB->getManifest(keptManifest) && lidarDB->getTileIndex(index);
+    keptType = lidarDB->getType();
+    if (ok && keptType == LidarDatabase::IndexOnly)
+    {
+        fprintf(stderr,"Can't benchmark the tiles in an index only database\n");
+        ok = false;
+    }
+    for (unsigned int ii=0;ok && ii<index.size();ii++)
+    {
+        LoadedTile tile;
+        tile.entry = index[ii];
+        const LidarDatabase::TileEntry &entry = index[ii];
+        if (keptType == LidarDatabase::Columnar)
+            ok = lidarDB->getTileColumns(entry.x,entry.y,entry.level,TileColumnsAll,tile.blobs);
+        else {
+            tile.blobs.resize(1);
+            ok = lidarDB->getTile(entry.x,entry.y,entry.level,tile.blobs[0]);
+        }
+        tiles.push_back(tile);
+    }
+    delete lidarDB;
+    sqliteDb->Close();
+    delete sqliteDb;
+    if (!ok)
+    {
+        fprintf(stderr,"Failed to read tiles from %s\n",keptDB.c_str());
+        tiles.clear();
+    }
+
+    return ok;
+}
+
+bool BenchSuite::runInsert(bool asyncWrites)
+{
+    if (!loadTiles())
+        return false;
+
+    std::string dbName = tmpDir + "/insert.sqlite";
+    remove(dbName.c_str());
+    Kompex::SQLiteDatabase *sqliteDb = new Kompex::SQLiteDatabase(dbName, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
+    LidarDatabase::WriteOptions options;
+    options.asyncWrites = asyncWrites;
+    LidarDatabase *lidarDB = new LidarDatabase(sqliteDb,keptType,options);
+    bool ok = lidarDB->isValid();
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    long long numBytes = 0;
+    for (unsigned int ii=0;ok && ii<tiles.size();ii++)
+    {
+        const LoadedTile &tile = tiles[ii];
+        for (unsigned int which=0;ok && which<tile.blobs.size();which++)
+        {
+            const std::string &blob = tile.blobs[which];
+            if (keptType == LidarDatabase::Columnar)
+            {
+                if (!blob.empty())
+                    ok = lidarDB->addTileColumn((TileColumn)which,blob.data(),(int)blob.size(),tile.entry.x,tile.entry.y,tile.entry.level);
+            } else
+                ok = lidarDB->addTile(blob.data(),(int)blob.size(),tile.entry.x,tile.entry.y,tile.entry.level);
+            numBytes += blob.size();
+        }
+    }
+    if (!lidarDB->flush())
+        ok = false;
+    double insertTime = TimeSince(startTime);
+    delete lidarDB;
+    sqliteDb->Close();
+    delete sqliteDb;
+    remove(dbName.c_str());
+    if (!ok)
+    {
+        fprintf(stderr,"Failed to insert tiles\n");
+        return false;
+    }
+
+    BenchReport::Result &result = report.addResult("insert");
+    result.param("async",asyncWrites ? 1LL : 0LL)
+          .param("codec",CodecName(keptManifest.tileCodec))
+          .value("tiles",tiles.size())
+          .value("mb",numBytes / (1024.0*1024.0))
+          .value("seconds",insertTime)
+          .value("tiles_per_sec",PerSecond(tiles.size(),insertTime))
+          .value("mb_per_sec",PerSecond(numBytes / (1024.0*1024.0),insertTime));
+    report.print(result);
+
+    return true;
+}
+
+bool BenchSuite::runDecode()
+{
+    if (!loadTiles())
+        return false;
+
+    // Columnar tiles get a second pass with just what the viewer draws
+    std::vector<uint32_t> masks(1,TileColumnsAll);
+    if (keptType == LidarDatabase::Columnar)
+        masks.push_back(TileColumnsRender);
+
+    TileDecoder decoder;
+    decoder.setQuantization(keptManifest.quant);
+    TilePoints points;
+    for (uint32_t mask : masks)
+    {
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        long long numPoints = 0;
+        double sum = 0.0;
+        for (const LoadedTile &tile : tiles)
+        {
+            bool ok = true;
+            if (keptType == LidarDatabase::Columnar)
+            {
+                for (int which=0;ok && which<TileColumnCount;which++)
+                    if ((mask & TileColumnBit((TileColumn)which)) && !tile.blobs[which].empty())
+                        ok = decoder.decodeColumn(tile.blobs[which].data(),tile.blobs[which].size(),points);
+            } else
+                ok = decoder.decode(tile.blobs[0].data(),tile.blobs[0].size(),points);
+            if (!ok)
+            {
+                fprintf(stderr,"Failed to decode tile %d: (%d,%d): %s\n",tile.entry.level,tile.entry.x,tile.entry.y,decoder.getError().c_str());
+                return false;
+            }
+            numPoints += points.numPoints;
+            if (points.numPoints > 0)
+                sum += points.x[0];
+        }
+        double decodeTime = TimeSince(startTime);
+        BenchSink = (long long)sum;
+
+        BenchReport::Result &result = report.addResult("decode");
+        result.param("codec",CodecName(keptManifest.tileCodec))
+              .param("columns",mask == TileColumnsAll ? "all" : "render")
+              .value("tiles",tiles.size())
+              .value("points",numPoints)
+              .value("seconds",decodeTime)
+              .value("mpts_per_sec",PerSecond(numPoints / 1e6,decodeTime))
+              .value("tiles_per_sec",PerSecond(tiles.size(),decodeTime));
+        report.print(result);
+    }
+
+    return true;
+}
@@ -0,0 +1,72 @@
+//
+//  BenchSuite.hpp
+//  LidarBench
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef BenchSuite_hpp
+#define BenchSuite_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "LidarSorter.hpp"
+#include "LidarDatabase.hpp"
+#include "BenchReport.hpp"
+
+/* The benchmarks LidarBench runs over a set of input files.
+    Each one adds its results to the report.  The database passes
+    work on the tiles from a database a sort pass has already built.
+  */
+class BenchSuite
+{
+public:
+    BenchSuite(const std::vector<std::string> &files,const std::string &tmpDir,BenchReport &report);
+
+    // Tile size limits for the sorts and the partition pass
+    void setPointLimit(int inMinPts,int inMaxPts) { minPts = inMinPts;  maxPts = inMaxPts; }
+
+    // Read every point through LidarMultiWrapper, decoding on this many threads
+    bool runRead(int numDecoders);
+
+    // Split the points into quadrants a level at a time, the way the in memory sorter does.
+    // Gives the partition rate for each level.
+    bool runPartition();
+
+    // Build a database from scratch and time it.  The first good one is kept for the database passes.
+    bool runSort(bool morton,int numThreads,long long memBudget,TileCodec codec);
+
+    // Write the kept database's tiles into a new database
+    bool runInsert(bool asyncWrites);
+
+    // Decode all of the kept database's tiles
+    bool runDecode();
+
+protected:
+    // A tile loaded out of the kept database.  Columnar tiles have a blob for each TileColumn.
+    class LoadedTile
+    {
+    public:
+        LidarDatabase::TileEntry entry;
+        std::vector<std::string> blobs;
+    };
+
+    // Pull the kept database's tiles into memory, so the database passes don't time reading it
+    bool loadTiles();
+
+    std::vector<std::string> files;
+    std::string tmpDir;
+    BenchReport &report;
+    int minPts,maxPts;
+    int numRuns;
+
+    // The kept database and what's in it
+    std::string keptDB;
+    LidarDatabase::Type keptType;
+    LidarDatabase::Manifest keptManifest;
+    std::vector<LoadedTile> tiles;
+};
+
+#endif /* BenchSuite_hpp */
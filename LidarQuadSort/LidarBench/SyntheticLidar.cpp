@@ -0,0 +1,205 @@
+//
+//  SyntheticLidar.cpp
+//  LidarBench
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "SyntheticLidar.hpp"
+#include "LidarSorter.hpp"
+#include <math.h>
+#include <float.h>
+#include <random>
+
+// Somewhere UTM-like, so the offsets look like real data
+static const double OriginX = 500000.0, OriginY = 4000000.0;
+static const double CoordScale = 0.01;
+
+SyntheticLidar::SyntheticLidar()
+: numPoints(1000000), numFiles(4), pointDataFormat(3), compressed(true), skew(0.5), numClusters(8), extent(2000.0), heightRange(100.0), seed(1)
+{
+}
+
+bool SyntheticLidar::isValid(std::string &reason)
+{
+    if (numPoints < 1)
+        reason = "Need at least one point";
+    else if (numFiles < 1 || numFiles > numPoints)
+        reason = "Need between one file and one file per point";
+    else if (pointDataFormat < 0 || pointDataFormat > 3)
+        reason = "Point format should be 0 through 3";
+    else if (skew < 0.0 || skew > 1.0)
+        reason = "Skew should be between 0 and 1";
+    else if (numClusters < 1)
+        reason = "Need at least one cluster";
+    else if (extent <= 0.0 || heightRange < 0.0)
+        reason = "Extent and height range can't be negative";
+    else
+        return true;
+
+    return false;
+}
+
+bool SyntheticLidar::write(const std::string &dir,std::vector<std::string> &fileNames)
+{
+    std::string reason;
+    if (!isValid(reason))
+    {
+        fprintf(stderr,"Bad synthetic data settings: %s\n",reason.c_str());
+        return false;
+    }
+
+    // Clusters are shared by all the files, so some strips end up much denser than others
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0,1.0);
+    clusters.clear();
+    for (int ii=0;ii<numClusters;ii++)
+    {
+        double x = unit(rng) * extent;
+        double y = unit(rng) * extent;
+        clusters.push_back(std::make_pair(x,y));
+    }
+
+    fileNames.clear();
+    for (int which=0;which<numFiles;which++)
+    {
+        char name[64];
+        sprintf(name,"/synthetic_%03d.%s",which,compressed ? "laz" : "las");
+        std::string fileName = dir + name;
+        long long numFilePoints = numPoints / numFiles + (which < numPoints % numFiles ? 1 : 0);
+        if (!writeFile(fileName,which,numFilePoints))
+            return false;
+        fileNames.push_back(fileName);
+    }
+
+    return true;
+}
+
+bool SyntheticLidar::writeFile(const std::string &fileName,int which,long long numFilePoints)
+{
+    laszip_header_struct header;
+    memset(&header,0,sizeof(header));
+    header.version_major = 1;
+    header.version_minor = 2;
+    header.header_size = 227;
+    header.offset_to_point_data = 227;
+    header.point_data_format = pointDataFormat;
+    header.point_data_record_length = PointRecordLength(pointDataFormat);
+    header.x_scale_factor = header.y_scale_factor = header.z_scale_factor = CoordScale;
+    header.x_offset = OriginX;
+    header.y_offset = OriginY;
+    header.z_offset = 0.0;
+    header.file_source_ID = which+1;
+    strncpy(header.system_identifier,"LidarBench",sizeof(header.system_identifier)-1);
+    strncpy(header.generating_software,"LidarBench synthetic",sizeof(header.generating_software)-1);
+
+    laszip_POINTER writer;
+    laszip_create(&writer);
+    if (laszip_set_header(writer,&header) ||
+        laszip_open_writer(writer,fileName.c_str(),compressed))
+    {
+        laszip_CHAR *errMsg = NULL;
+        laszip_get_error(writer,&errMsg);
+        fprintf(stderr,"Failed to open %s: %s\n",fileName.c_str(),errMsg ? errMsg : "unknown error");
+        laszip_destroy(writer);
+        return false;
+    }
+
+    // Each file gets its own stream, so they come out the same no matter the order
+    std::mt19937 rng(seed * 1000003 + which);
+    std::uniform_real_distribution<double> unit(0.0,1.0);
+    std::normal_distribution<double> nearCluster(0.0,extent * 0.01);
+    double stripMinX = which * extent / numFiles, stripMaxX = (which+1) * extent / numFiles;
+    double minPt[3] = {DBL_MAX,DBL_MAX,DBL_MAX}, maxPt[3] = {-DBL_MAX,-DBL_MAX,-DBL_MAX};
+    bool hasTime = pointDataFormat == 1 || pointDataFormat == 3;
+    bool hasColor = pointDataFormat == 2 || pointDataFormat == 3;
+
+    laszip_point_struct p;
+    bool ret = true;
+    for (long long ii=0;ii<numFilePoints && ret;ii++)
+    {
+        // Cluster points that fall outside our strip get spread out instead
+        double x = 0.0, y = 0.0;
+        bool placed = false;
+        if (unit(rng) < skew)
+        {
+            const auto &cluster = clusters[rng() % clusters.size()];
+            x = cluster.first + nearCluster(rng);
+            y = cluster.second + nearCluster(rng);
+            placed = x >= stripMinX && x < stripMaxX && y >= 0.0 && y < extent;
+        }
+        if (!placed)
+        {
+            x = stripMinX + unit(rng) * (stripMaxX - stripMinX);
+            y = unit(rng) * extent;
+        }
+
+        // Rolling ground with trees and buildings on it
+        double ground = heightRange * 0.25 * (sin(x / (extent * 0.13)) + cos(y / (extent * 0.07)) + 2.0);
+        double kind = unit(rng);
+        memset(&p,0,sizeof(p));
+        if (kind < 0.6)
+        {
+            p.classification = 2;
+            p.return_number = 1;
+            p.number_of_returns = 1;
+        } else if (kind < 0.85)
+        {
+            p.classification = 5;
+            ground += unit(rng) * 25.0;
+            p.number_of_returns = 1 + rng() % 3;
+            p.return_number = 1 + rng() % p.number_of_returns;
+        } else {
+            p.classification = 6;
+            ground += 5.0 + unit(rng) * 40.0;
+            p.return_number = 1;
+            p.number_of_returns = 1;
+        }
+        p.X = (laszip_I32)llround(x / CoordScale);
+        p.Y = (laszip_I32)llround(y / CoordScale);
+        p.Z = (laszip_I32)llround(ground / CoordScale);
+        p.intensity = (laszip_U16)(p.classification * 4000 + rng() % 4000);
+        p.scan_angle_rank = (laszip_I8)((x - (stripMinX + stripMaxX) / 2.0) / (stripMaxX - stripMinX) * 30.0);
+        p.point_source_ID = which+1;
+        if (hasTime)
+            p.gps_time = 1000.0 * (which+1) + ii * 1e-5;
+        if (hasColor)
+        {
+            int shade = rng() % 64;
+            p.rgb[0] = (laszip_U16)((p.classification == 6 ? 160 : 60) + shade) << 8;
+            p.rgb[1] = (laszip_U16)((p.classification == 5 ? 150 : 90) + shade) << 8;
+            p.rgb[2] = (laszip_U16)(60 + shade) << 8;
+        }
+
+        double pt[3] = {OriginX + p.X * CoordScale,OriginY + p.Y * CoordScale,p.Z * CoordScale};
+        for (int jj=0;jj<3;jj++)
+        {
+            minPt[jj] = std::min(minPt[jj],pt[jj]);
+            maxPt[jj] = std::max(maxPt[jj],pt[jj]);
+        }
+
+        if (laszip_set_point(writer,&p) ||
+            laszip_write_point(writer) ||
+            laszip_update_inventory(writer))
+        {
+            fprintf(stderr,"Failed to write point to %s\n",fileName.c_str());
+            ret = false;
+        }
+    }
+
+    // The inventory takes care of this for laszip, but set it anyway for anything that looks at the header
+    laszip_header_struct *outHeader;
+    laszip_get_header_pointer(writer,&outHeader);
+    outHeader->number_of_point_records = (laszip_U32)numFilePoints;
+    outHeader->min_x = minPt[0];  outHeader->min_y = minPt[1];  outHeader->min_z = minPt[2];
+    outHeader->max_x = maxPt[0];  outHeader->max_y = maxPt[1];  outHeader->max_z = maxPt[2];
+    if (laszip_close_writer(writer))
+    {
+        fprintf(stderr,"Failed to close %s\n",fileName.c_str());
+        ret = false;
+    }
+    laszip_destroy(writer);
+
+    return ret;
+}
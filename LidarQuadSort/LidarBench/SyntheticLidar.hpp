@@ -0,0 +1,57 @@
+//
+//  SyntheticLidar.hpp
+//  LidarBench
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef SyntheticLidar_hpp
+#define SyntheticLidar_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "laszip_api.h"
+
+/* Makes up LAS/LAZ files to benchmark against.
+    The area is split into strips along X, one per file, the way flight lines
+    or survey tiles come in.  Points are either spread evenly or pulled into
+    clusters, so the tree gets deep in some places and stays shallow in others.
+    Heights follow a rolling surface with some vegetation and buildings on it.
+    The same settings and seed always give the same files.
+  */
+class SyntheticLidar
+{
+public:
+    SyntheticLidar();
+
+    // Total points over all the files
+    long long numPoints;
+    int numFiles;
+    // LAS point format.  0 through 3.
+    int pointDataFormat;
+    // LAZ or plain LAS
+    bool compressed;
+    // Fraction of the points that land in clusters rather than evenly.  0 to 1.
+    double skew;
+    int numClusters;
+    // Size of the area and the height of the hills, in meters
+    double extent,heightRange;
+    unsigned int seed;
+
+    // Check the settings make sense
+    bool isValid(std::string &reason);
+
+    // Write the files out to the directory and return their names
+    bool write(const std::string &dir,std::vector<std::string> &fileNames);
+
+protected:
+    // Write one strip to one file
+    bool writeFile(const std::string &fileName,int which,long long numFilePoints);
+
+    // Cluster centers, from the seed
+    std::vector<std::pair<double,double> > clusters;
+};
+
+#endif /* SyntheticLidar_hpp */
@@ -0,0 +1,352 @@
+//
+//  main.cpp
+//  LidarBench
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <boost/filesystem.hpp>
+#include "SyntheticLidar.hpp"
+#include "BenchReport.hpp"
+#include "BenchSuite.hpp"
+
+// Parse a comma separated list of numbers, like "1,2,4"
+static bool ParseList(const char *str,std::vector<long long> &vals)
+{
+    vals.clear();
+    const char *start = str;
+    while (*start)
+    {
+        char *end = NULL;
+        long long val = strtoll(start,&end,10);
+        if (end == start || val < 0)
+            return false;
+        vals.push_back(val);
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return false;
+        start = end;
+    }
+
+    return !vals.empty();
+}
+
+int main(int argc, const char * argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,"syntax: %s -o <results_json> [-tmp <tmp_dir>] [-points <num>] [-files <num>] [-format 0-3] [-las] [-skew 0-1] [-clusters <num>] [-seed <num>] [-pts <min> <max>] [-threads <n,n,...>] [-mem <megabytes,...>] [-engine recursive|morton|both] [-codec laz|compact|columnar] [-decoders <num>] [-keep]\n",argv[0]);
+        return -1;
+    }
+
+    const char *outJSON = NULL;
+    std::string tmpDir = "lidarbench";
+    SyntheticLidar synth;
+    int inc = 0;
+    int minPts=20000,maxPts=25000;
+    std::vector<long long> threadList(1,1);
+    std::vector<long long> memList(1,0);
+    bool runRecursive = true, runMorton = false;
+    TileCodec tileCodec = TileCodecLAZ;
+    int numDecoders = 2;
+    bool keepFiles = false;
+    for (unsigned int arg=1;arg<argc;arg+=inc)
+    {
+        if (!strcmp(argv[arg],"-o"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -o\n");
+                return -1;
+            }
+            outJSON = argv[arg+1];
+        } else if (!strcmp(argv[arg],"-tmp"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -tmp\n");
+                return -1;
+            }
+            tmpDir = argv[arg+1];
+        } else if (!strcmp(argv[arg],"-points"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -points\n");
+                return -1;
+            }
+            synth.numPoints = atoll(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-files"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -files\n");
+                return -1;
+            }
+            synth.numFiles = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-format"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -format\n");
+                return -1;
+            }
+            synth.pointDataFormat = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-las"))
+        {
+            inc = 1;
+            synth.compressed = false;
+        } else if (!strcmp(argv[arg],"-skew"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -skew\n");
+                return -1;
+            }
+            synth.skew = atof(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-clusters"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -clusters\n");
+                return -1;
+            }
+            synth.numClusters = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-seed"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -seed\n");
+                return -1;
+            }
+            synth.seed = (unsigned int)strtoul(argv[arg+1],NULL,10);
+        } else if (!strcmp(argv[arg],"-pts"))
+        {
+            inc = 3;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting two arguments for -pts\n");
+                return -1;
+            }
+            minPts = atoi(argv[arg+1]);
+            maxPts = atoi(argv[arg+2]);
+        } else if (!strcmp(argv[arg],"-threads"))
+        {
+            inc = 2;
+            if (arg+inc > argc || !ParseList(argv[arg+1],threadList))
+            {
+                fprintf(stderr,"Expecting a list of thread counts for -threads, like 1,2,4\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-mem"))
+        {
+            inc = 2;
+            if (arg+inc > argc || !ParseList(argv[arg+1],memList))
+            {
+                fprintf(stderr,"Expecting a list of memory budgets for -mem, like 0,256\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-engine"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -engine\n");
+                return -1;
+            }
+            if (!strcmp(argv[arg+1],"recursive"))
+            {
+                runRecursive = true;  runMorton = false;
+            } else if (!strcmp(argv[arg+1],"morton"))
+            {
+                runRecursive = false;  runMorton = true;
+            } else if (!strcmp(argv[arg+1],"both"))
+            {
+                runRecursive = true;  runMorton = true;
+            } else {
+                fprintf(stderr,"-engine should be recursive, morton or both\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-codec"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -codec\n");
+                return -1;
+            }
+            if (!strcmp(argv[arg+1],"laz"))
+                tileCodec = TileCodecLAZ;
+            else if (!strcmp(argv[arg+1],"compact"))
+                tileCodec = TileCodecCompact;
+            else if (!strcmp(argv[arg+1],"columnar"))
+                tileCodec = TileCodecColumnar;
+            else {
+                fprintf(stderr,"-codec should be laz, compact or columnar\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-decoders"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -decoders\n");
+                return -1;
+            }
+            numDecoders = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-keep"))
+        {
+            inc = 1;
+            keepFiles = true;
+        } else {
+            fprintf(stderr,"Unknown argument: %s\n",argv[arg]);
+            return -1;
+        }
+    }
+
+    if (!outJSON)
+    {
+        fprintf(stderr,"Expecting -o argument for the results file.\n");
+        return -1;
+    }
+    std::string reason;
+    if (!synth.isValid(reason))
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        return -1;
+    }
+    if (minPts <= 0 || maxPts < minPts)
+    {
+        fprintf(stderr,"-pts arguments don't make sense.\n");
+        return -1;
+    }
+    if (numDecoders < 0)
+    {
+        fprintf(stderr,"-decoders can't be negative.\n");
+        return -1;
+    }
+    for (long long numThreads : threadList)
+        if (numThreads < 1)
+        {
+            fprintf(stderr,"-threads needs at least one thread.\n");
+            return -1;
+        }
+
+    // Each run gets its own directory, so a couple can share the temp dir
+    mkdir(tmpDir.c_str(),0775);
+    std::string runTmpTemplate = tmpDir + "/bench_XXXXXX";
+    std::vector<char> runTmpName(runTmpTemplate.begin(),runTmpTemplate.end());
+    runTmpName.push_back(0);
+    if (!mkdtemp(&runTmpName[0]))
+    {
+        fprintf(stderr,"Failed to make temp directory in %s\n",tmpDir.c_str());
+        return -1;
+    }
+    std::string runTmpDir = &runTmpName[0];
+
+    // What went into the numbers, so two reports can be compared fairly
+    BenchReport report;
+    report.setConfig("points",synth.numPoints);
+    report.setConfig("files",(long long)synth.numFiles);
+    report.setConfig("point_format",(long long)synth.pointDataFormat);
+    report.setConfig("compressed",synth.compressed ? 1LL : 0LL);
+    report.setConfig("skew",synth.skew);
+    report.setConfig("clusters",(long long)synth.numClusters);
+    report.setConfig("seed",(long long)synth.seed);
+    report.setConfig("min_pts",(long long)minPts);
+    report.setConfig("max_pts",(long long)maxPts);
+    report.setConfig("hardware_threads",(long long)std::thread::hardware_concurrency());
+#ifdef __VERSION__
+    report.setConfig("compiler",__VERSION__);
+#endif
+    time_t now = time(NULL);
+    char dateStr[64];
+    strftime(dateStr,sizeof(dateStr),"%Y-%m-%dT%H:%M:%SZ",gmtime(&now));
+    report.setConfig("date",dateStr);
+
+    fprintf(stdout,"Generating %lld points in %d files\n",synth.numPoints,synth.numFiles);
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    std::vector<std::string> files;
+    bool ok = synth.write(runTmpDir,files);
+    if (ok)
+    {
+        double genTime = TimeSince(startTime);
+        BenchReport::Result &result = report.addResult("generate");
+        result.value("points",synth.numPoints)
+              .value("seconds",genTime);
+        report.print(result);
+    }
+
+    BenchSuite suite(files,runTmpDir,report);
+    suite.setPointLimit(minPts,maxPts);
+
+    if (ok)
+    {
+        fprintf(stdout,"Reading\n");
+        ok = suite.runRead(0);
+        if (ok && numDecoders > 0)
+            ok = suite.runRead(numDecoders);
+    }
+    if (ok)
+    {
+        fprintf(stdout,"Partitioning\n");
+        ok = suite.runPartition();
+    }
+    if (ok)
+        fprintf(stdout,"Sorting\n");
+    for (int engine=0;engine<2 && ok;engine++)
+    {
+        bool morton = engine == 1;
+        if ((morton && !runMorton) || (!morton && !runRecursive))
+            continue;
+        for (unsigned int ii=0;ii<threadList.size() && ok;ii++)
+            for (unsigned int jj=0;jj<memList.size() && ok;jj++)
+                ok = suite.runSort(morton,(int)threadList[ii],memList[jj] * 1024 * 1024,tileCodec);
+    }
+    if (ok)
+    {
+        fprintf(stdout,"Writing tiles\n");
+        ok = suite.runInsert(true) && suite.runInsert(false);
+    }
+    if (ok)
+    {
+        fprintf(stdout,"Decoding tiles\n");
+        ok = suite.runDecode();
+    }
+
+    // Write out what we've got, even if a pass failed
+    if (!report.write(outJSON))
+        ok = false;
+
+    if (keepFiles)
+        fprintf(stdout,"Left the data in %s\n",runTmpDir.c_str());
+    else
+        boost::filesystem::remove_all(boost::filesystem::path(runTmpDir));
+
+    if (!ok)
+    {
+        fprintf(stderr,"Benchmark failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
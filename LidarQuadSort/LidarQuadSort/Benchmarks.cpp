@@ -0,0 +1,321 @@
+//
+//  Benchmarks.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "Benchmarks.hpp"
+#include "TileKey.h"
+#include "BuildMetrics.hpp"
+#include "SpillScheduler.hpp"
+#include <chrono>
+
+// Results from the read loops go here so they aren't optimized out
+static volatile long long BenchSink = 0;
+
+static void PrintBenchResult(const char *name,long long numPoints,double writeTime,double readTime,long long fileSize)
+{
+    fprintf(stdout,"  %-8s write %8.2f Mpts/s  read %8.2f Mpts/s  %10.2f MB  (%.1f bytes/pt)\n",name,
+            writeTime > 0.0 ? numPoints / writeTime / 1e6 : 0.0,
+            readTime > 0.0 ? numPoints / readTime / 1e6 : 0.0,
+            fileSize / (1024.0*1024.0),
+            numPoints > 0 ? (double)fileSize / numPoints : 0.0);
+}
+
+bool RunSpillBenchmark(LidarMultiWrapper *inputDB,long long maxPoints,const std::string &tmpDir)
+{
+    // Pull the points into memory so we're only timing the temp file formats
+    long long numPoints = std::min(maxPoints,getNumRecords(inputDB->header));
+    int numExtraBytes = std::max(0,(int)inputDB->header.point_data_record_length - PointRecordLength(inputDB->header.point_data_format));
+    std::vector<laszip_point_struct> points(numPoints);
+    std::vector<laszip_U8> extraBytes(numPoints*numExtraBytes);
+    try {
+        for (long long ii=0;ii<numPoints;ii++)
+        {
+            laszip_point_struct *p = inputDB->getNextPoint();
+            points[ii] = *p;
+            if (numExtraBytes > 0)
+            {
+                memcpy(&extraBytes[ii*numExtraBytes],p->extra_bytes,numExtraBytes);
+                points[ii].extra_bytes = &extraBytes[ii*numExtraBytes];
+            } else
+                points[ii].extra_bytes = NULL;
+        }
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+    fprintf(stdout,"Spill benchmark with %lld points\n",numPoints);
+    
+    // LAZ, the way the sorter used to do it
+    {
+        std::string fileName = tmpDir + "/bench_spill.laz";
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        laszip_POINTER writer;
+        laszip_create(&writer);
+        laszip_set_header(writer,&inputDB->header);
+        if (laszip_open_writer(writer,fileName.c_str(),true))
+        {
+            fprintf(stderr,"Failed to open %s\n",fileName.c_str());
+            return false;
+        }
+        for (auto &p : points)
+            if (laszip_set_point(writer,&p) ||
+                laszip_write_point(writer) ||
+                laszip_update_inventory(writer))
+            {
+                fprintf(stderr,"Failed to write LAZ point\n");
+                return false;
+            }
+        laszip_close_writer(writer);
+        laszip_destroy(writer);
+        double writeTime = TimeSince(startTime);
+
+        startTime = std::chrono::steady_clock::now();
+        laszip_POINTER reader;
+        laszip_create(&reader);
+        laszip_BOOL isCompressed;
+        long long sum = 0;
+        if (laszip_open_reader(reader,fileName.c_str(),&isCompressed))
+        {
+            fprintf(stderr,"Failed to read %s\n",fileName.c_str());
+            return false;
+        }
+        laszip_point_struct *p;
+        laszip_get_point_pointer(reader,&p);
+        for (long long ii=0;ii<numPoints;ii++)
+        {
+            laszip_read_point(reader);
+            sum += p->X;
+        }
+        laszip_close_reader(reader);
+        laszip_destroy(reader);
+        double readTime = TimeSince(startTime);
+
+        PrintBenchResult("laz",numPoints,writeTime,readTime,TempFileSize(fileName));
+        remove(fileName.c_str());
+        BenchSink = sum;
+    }
+    
+    // Raw spill file
+    {
+        std::string fileName = tmpDir + "/bench_spill.spill";
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        SpillWriter writer(fileName,inputDB->header.point_data_format,numExtraBytes);
+        if (!writer.isValid())
+        {
+            fprintf(stderr,"Failed to open %s\n",fileName.c_str());
+            return false;
+        }
+        for (auto &p : points)
+            if (!writer.addPoint(&p))
+            {
+                fprintf(stderr,"Failed to write spill point\n");
+                return false;
+            }
+        if (!writer.close())
+        {
+            fprintf(stderr,"Failed to close %s\n",fileName.c_str());
+            return false;
+        }
+        double writeTime = TimeSince(startTime);
+        
+        startTime = std::chrono::steady_clock::now();
+        long long sum = 0;
+        {
+            SpillReader reader(fileName);
+            if (!reader.open())
+            {
+                fprintf(stderr,"Failed to read %s\n",fileName.c_str());
+                return false;
+            }
+            for (long long ii=0;ii<numPoints;ii++)
+                sum += reader.getPoint(ii)->X;
+        }
+        double readTime = TimeSince(startTime);
+        
+        PrintBenchResult("raw",numPoints,writeTime,readTime,TempFileSize(fileName));
+        remove(fileName.c_str());
+        BenchSink = sum;
+    }
+    
+    return true;
+}
+
+bool RunCodecBenchmark(LidarMultiWrapper *inputDB,long long maxPoints,int tileSize)
+{
+    const laszip_header_struct &header = inputDB->header;
+    long long numPoints = std::min(maxPoints,getNumRecords(inputDB->header));
+    if (numPoints <= 0 || tileSize <= 0)
+        return false;
+    int numExtraBytes = std::max(0,(int)header.point_data_record_length - PointRecordLength(header.point_data_format));
+    std::vector<laszip_point_struct> points(numPoints);
+    std::vector<laszip_U8> extraBytes(numPoints*numExtraBytes);
+    std::vector<std::pair<uint64_t,long long> > order(numPoints);
+    double cellX = std::max(header.max_x - header.min_x,1e-9) / (1<<16), cellY = std::max(header.max_y - header.min_y,1e-9) / (1<<16);
+    try {
+        for (long long ii=0;ii<numPoints;ii++)
+        {
+            laszip_point_struct *p = inputDB->getNextPoint();
+            points[ii] = *p;
+            if (numExtraBytes > 0)
+            {
+                memcpy(&extraBytes[ii*numExtraBytes],p->extra_bytes,numExtraBytes);
+                points[ii].extra_bytes = &extraBytes[ii*numExtraBytes];
+            } else
+                points[ii].extra_bytes = NULL;
+            // Sort along a Morton curve so each run of tileSize points is a plausible tile
+            double x = p->X * header.x_scale_factor + header.x_offset, y = p->Y * header.y_scale_factor + header.y_offset;
+            uint32_t cx = (uint32_t)std::min(std::max((x - header.min_x)/cellX,0.0),65535.0);
+            uint32_t cy = (uint32_t)std::min(std::max((y - header.min_y)/cellY,0.0),65535.0);
+            order[ii] = std::make_pair(MortonEncode(cx,cy),ii);
+        }
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+    std::sort(order.begin(),order.end());
+    long long numTiles = (numPoints + tileSize - 1) / tileSize;
+    fprintf(stdout,"Codec benchmark with %lld points in %lld tiles\n",numPoints,numTiles);
+    
+    // LAZ, with the full header in every tile the way the sorter writes them
+    std::vector<std::string> lazTiles(numTiles);
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    for (long long tile=0;tile<numTiles;tile++)
+    {
+        long long start = tile*tileSize, end = std::min(start+tileSize,numPoints);
+        std::stringstream ofs(std::stringstream::out);
+        laszip_POINTER writer;
+        laszip_create(&writer);
+        laszip_set_header(writer,&header);
+        laszip_open_stream_writer(writer,&ofs,true);
+        for (long long ii=start;ii<end;ii++)
+        {
+            laszip_set_point(writer,&points[order[ii].second]);
+            laszip_write_point(writer);
+        }
+        laszip_header_struct *tileHeader;
+        laszip_get_header_pointer(writer,&tileHeader);
+        tileHeader->number_of_point_records = (laszip_U32)(end - start);
+        laszip_close_writer(writer);
+        laszip_destroy(writer);
+        lazTiles[tile] = ofs.str();
+    }
+    double lazEncodeTime = TimeSince(startTime);
+    
+    // Compact tiles
+    std::vector<std::string> compactTiles(numTiles);
+    startTime = std::chrono::steady_clock::now();
+    CompactTileEncoder encoder;
+    for (long long tile=0;tile<numTiles;tile++)
+    {
+        long long start = tile*tileSize, end = std::min(start+tileSize,numPoints);
+        encoder.reset(header.point_data_format,numExtraBytes);
+        for (long long ii=start;ii<end;ii++)
+            encoder.addPoint(&points[order[ii].second]);
+        if (!encoder.encode(compactTiles[tile]))
+        {
+            fprintf(stderr,"Failed to encode compact tile\n");
+            return false;
+        }
+    }
+    double compactEncodeTime = TimeSince(startTime);
+    
+    // Columnar tiles, which keep everything
+    std::vector<std::vector<std::string> > columnTiles(numTiles);
+    startTime = std::chrono::steady_clock::now();
+    for (long long tile=0;tile<numTiles;tile++)
+    {
+        long long start = tile*tileSize, end = std::min(start+tileSize,numPoints);
+        encoder.reset(header.point_data_format,numExtraBytes);
+        for (long long ii=start;ii<end;ii++)
+            encoder.addPoint(&points[order[ii].second]);
+        if (!encoder.encodeColumns(columnTiles[tile]))
+        {
+            fprintf(stderr,"Failed to encode columnar tile\n");
+            return false;
+        }
+    }
+    double columnEncodeTime = TimeSince(startTime);
+    
+    // Decode them the way the viewer does
+    TileDecoder decoder;
+    decoder.setQuantization(TileQuantization(header.x_scale_factor,header.y_scale_factor,header.z_scale_factor,header.x_offset,header.y_offset,header.z_offset));
+    TilePoints tilePoints;
+    const std::vector<std::string> *tileSets[2] = {&lazTiles,&compactTiles};
+    double decodeTimes[2];
+    long long totalSizes[2];
+    double sums[2];
+    for (int which=0;which<2;which++)
+    {
+        const std::vector<std::string> &tiles = *tileSets[which];
+        double sum = 0.0;
+        totalSizes[which] = 0;
+        startTime = std::chrono::steady_clock::now();
+        for (const auto &tile : tiles)
+        {
+            if (!decoder.decode(tile.data(),tile.size(),tilePoints))
+            {
+                fprintf(stderr,"Failed to decode tile: %s\n",decoder.getError().c_str());
+                return false;
+            }
+            for (size_t ii=0;ii<tilePoints.numPoints;ii++)
+                sum += tilePoints.x[ii];
+            totalSizes[which] += tile.size();
+        }
+        decodeTimes[which] = TimeSince(startTime);
+        sums[which] = sum;
+    }
+    
+    // Columnar tiles, once with everything and once with just what a renderer reads
+    const uint32_t masks[2] = {TileColumnsAll,TileColumnsRender};
+    double columnDecodeTimes[2];
+    long long columnSizes[2];
+    double columnSums[2];
+    for (int which=0;which<2;which++)
+    {
+        double sum = 0.0;
+        columnSizes[which] = 0;
+        startTime = std::chrono::steady_clock::now();
+        for (const auto &columns : columnTiles)
+        {
+            for (int column=0;column<TileColumnCount;column++)
+            {
+                if (!(masks[which] & TileColumnBit((TileColumn)column)) || columns[column].empty())
+                    continue;
+                if (!decoder.decodeColumn(columns[column].data(),columns[column].size(),tilePoints))
+                {
+                    fprintf(stderr,"Failed to decode tile column: %s\n",decoder.getError().c_str());
+                    return false;
+                }
+                columnSizes[which] += columns[column].size();
+            }
+            for (size_t ii=0;ii<tilePoints.numPoints;ii++)
+                sum += tilePoints.x[ii];
+        }
+        columnDecodeTimes[which] = TimeSince(startTime);
+        columnSums[which] = sum;
+    }
+    BenchSink = (long long)sums[0];
+
+    PrintBenchResult("laz",numPoints,lazEncodeTime,decodeTimes[0],totalSizes[0]);
+    PrintBenchResult("compact",numPoints,compactEncodeTime,decodeTimes[1],totalSizes[1]);
+    PrintBenchResult("columnar",numPoints,columnEncodeTime,columnDecodeTimes[0],columnSizes[0]);
+    // Encoding is the same, this is just the bytes a renderer reads
+    PrintBenchResult("render",numPoints,columnEncodeTime,columnDecodeTimes[1],columnSizes[1]);
+    // The points come back in a different order, but they should add up to the same thing
+    double tolerance = 1e-6 * std::max(fabs(sums[0]),1.0);
+    if (fabs(sums[0] - sums[1]) > tolerance || fabs(sums[0] - columnSums[0]) > tolerance || fabs(sums[0] - columnSums[1]) > tolerance)
+    {
+        fprintf(stderr,"Compact tiles didn't decode to the same points\n");
+        return false;
+    }
+    
+    return true;
+}
@@ -0,0 +1,25 @@
+//
+//  Benchmarks.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef Benchmarks_hpp
+#define Benchmarks_hpp
+
+#include <stdio.h>
+#include <string>
+#include "LidarSorter.hpp"
+#include "TileDecoder.h"
+
+// Compare writing and reading the intermediate tiles as LAZ against the raw spill format.
+// Uses up to maxPoints from the input.
+bool RunSpillBenchmark(LidarMultiWrapper *inputDB,long long maxPoints,const std::string &tmpDir);
+
+// Compare LAZ tiles against compact tiles for size, encode and decode speed.
+// Uses up to maxPoints from the input, grouped into tiles of tileSize nearby points.
+bool RunCodecBenchmark(LidarMultiWrapper *inputDB,long long maxPoints,int tileSize);
+
+#endif /* Benchmarks_hpp */
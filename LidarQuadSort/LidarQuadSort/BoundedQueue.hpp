@@ -0,0 +1,98 @@
+//
+//  BoundedQueue.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef BoundedQueue_hpp
+#define BoundedQueue_hpp
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/* A fixed capacity queue for handing work between threads.
+    Producers block when it's full, consumers block when it's empty.
+    Once closed, pushes fail and pops drain whatever is left.
+  */
+template<typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity) : capacity(std::max(capacity,(size_t)1)), closed(false), numBlockedPushes(0) { }
+    
+    // Add an item, waiting for room if we need to.  Returns false if the queue was closed.
+    bool push(T &&item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (items.size() >= capacity && !closed)
+        {
+            numBlockedPushes++;
+            notFull.wait(lock,[this]{ return items.size() < capacity || closed; });
+        }
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    
+    // Take the next item, waiting for one if we need to.  Returns false once closed and empty.
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock,[this]{ return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    // Take the next item if there is one
+    bool tryPop(T &item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    // No more items will be added
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+    
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+    
+    // Number of times a producer had to wait for room
+    long long getNumBlockedPushes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return numBlockedPushes;
+    }
+    
+protected:
+    size_t capacity;
+    bool closed;
+    long long numBlockedPushes;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty,notFull;
+};
+
+#endif /* BoundedQueue_hpp */
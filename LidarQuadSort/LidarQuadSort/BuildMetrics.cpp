@@ -0,0 +1,342 @@
+//
+//  BuildMetrics.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "BuildMetrics.hpp"
+#include <sys/resource.h>
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+
+double TimeSince(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+static const double MB = 1024.0*1024.0;
+
+static const char *TimeNames[BuildMetrics::TimeNone] = {"read","partition","codec","database"};
+
+// Bump an atomic up to at least the given value
+static void AtomicMax(std::atomic<long long> &atom,long long val)
+{
+    long long cur = atom.load(std::memory_order_relaxed);
+    while (val > cur && !atom.compare_exchange_weak(cur,val,std::memory_order_relaxed)) ;
+}
+
+static void AtomicMin(std::atomic<long long> &atom,long long val)
+{
+    long long cur = atom.load(std::memory_order_relaxed);
+    while (val < cur && !atom.compare_exchange_weak(cur,val,std::memory_order_relaxed)) ;
+}
+
+// Bucket 0 is zero and below, bucket b holds [2^(b-1),2^b)
+static inline int WhichBucket(long long val)
+{
+    if (val <= 0)
+        return 0;
+    return std::min(64 - __builtin_clzll((unsigned long long)val),BuildMetrics::Histogram::NumBuckets-1);
+}
+
+static inline long long BucketTop(int bucket)
+{
+    if (bucket <= 0)
+        return 0;
+    if (bucket >= 63)
+        return LLONG_MAX;
+    return (1LL << bucket) - 1;
+}
+
+BuildMetrics::Histogram::Histogram()
+: count(0), sum(0), minVal(LLONG_MAX), maxVal(0)
+{
+    for (int ii=0;ii<NumBuckets;ii++)
+        buckets[ii] = 0;
+}
+
+void BuildMetrics::Histogram::add(long long val)
+{
+    buckets[WhichBucket(val)].fetch_add(1,std::memory_order_relaxed);
+    count.fetch_add(1,std::memory_order_relaxed);
+    sum.fetch_add(val,std::memory_order_relaxed);
+    AtomicMin(minVal,val);
+    AtomicMax(maxVal,val);
+}
+
+long long BuildMetrics::Histogram::getPercentile(double frac)
+{
+    long long total = count;
+    if (total == 0)
+        return 0;
+
+    long long want = (long long)ceil(frac * total), seen = 0;
+    for (int ii=0;ii<NumBuckets;ii++)
+    {
+        seen += buckets[ii];
+        if (seen >= want)
+            return std::min(BucketTop(ii),(long long)maxVal);
+    }
+
+    return maxVal;
+}
+
+void BuildMetrics::Histogram::writeJSON(FILE *fp)
+{
+    long long total = count;
+    fprintf(fp,"{\"count\": %lld, \"min\": %lld, \"max\": %lld, \"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"buckets\": [",
+            total,getMin(),getMax(),total > 0 ? (double)sum / total : 0.0,getPercentile(0.5),getPercentile(0.9),getPercentile(0.99));
+    // Just the buckets with something in them, as [top of bucket, count]
+    bool first = true;
+    for (int ii=0;ii<NumBuckets;ii++)
+    {
+        long long num = buckets[ii];
+        if (num == 0)
+            continue;
+        fprintf(fp,"%s[%lld, %lld]",first ? "" : ", ",BucketTop(ii),num);
+        first = false;
+    }
+    fprintf(fp,"]}");
+}
+
+BuildMetrics::Stopwatch::Stopwatch(BuildMetrics *metrics,TimeCategory category)
+: metrics(metrics), category(category), last(std::chrono::steady_clock::now())
+{
+    for (int ii=0;ii<TimeNone;ii++)
+        times[ii] = 0.0;
+}
+
+BuildMetrics::Stopwatch::~Stopwatch()
+{
+    switchTo(TimeNone);
+}
+
+void BuildMetrics::Stopwatch::switchTo(TimeCategory newCategory)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (category != TimeNone)
+        times[category] += std::chrono::duration<double>(now - last).count();
+    category = newCategory;
+    last = now;
+
+    // Pausing hands what we've got to the metrics, so the progress lines stay current
+    if (newCategory == TimeNone && metrics)
+        for (int ii=0;ii<TimeNone;ii++)
+            if (times[ii] > 0.0)
+            {
+                metrics->addTime((TimeCategory)ii,times[ii]);
+                times[ii] = 0.0;
+            }
+}
+
+BuildMetrics::ScopedTimer::ScopedTimer(BuildMetrics *metrics,TimeCategory category)
+: metrics(metrics), category(category)
+{
+    if (metrics)
+        startTime = std::chrono::steady_clock::now();
+}
+
+BuildMetrics::ScopedTimer::~ScopedTimer()
+{
+    if (metrics)
+        metrics->addTime(category,std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+}
+
+BuildMetrics::BuildMetrics()
+: maxLevel(-1), totalPoints(0), startTime(std::chrono::steady_clock::now()), progressInterval(5.0), progressDone(false)
+{
+    for (int ii=0;ii<CounterCount;ii++)
+        counters[ii] = 0;
+    for (int ii=0;ii<TimeNone;ii++)
+        times[ii] = 0;
+    for (int ii=0;ii<MaxLevels;ii++)
+    {
+        levelTiles[ii] = 0;
+        levelInput[ii] = 0;
+        levelKept[ii] = 0;
+        levelTime[ii] = 0;
+    }
+}
+
+BuildMetrics::~BuildMetrics()
+{
+    stop();
+}
+
+void BuildMetrics::start(long long inTotalPoints)
+{
+    stop();
+    totalPoints = inTotalPoints;
+    startTime = std::chrono::steady_clock::now();
+
+    if (progressInterval > 0.0)
+    {
+        progressDone = false;
+        progressThread = std::thread(&BuildMetrics::runProgress,this);
+    }
+}
+
+void BuildMetrics::stop()
+{
+    if (!progressThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progressDone = true;
+    }
+    progressCond.notify_all();
+    progressThread.join();
+}
+
+void BuildMetrics::setMax(Counter counter,long long val)
+{
+    AtomicMax(counters[counter],val);
+}
+
+void BuildMetrics::addTime(TimeCategory category,double seconds)
+{
+    if (category < TimeNone)
+        times[category].fetch_add((long long)(seconds * 1e9),std::memory_order_relaxed);
+}
+
+double BuildMetrics::getTime(TimeCategory category)
+{
+    return category < TimeNone ? times[category].load(std::memory_order_relaxed) / 1e9 : 0.0;
+}
+
+void BuildMetrics::addTile(int level,long long numInput,long long numKept,long long numBytes)
+{
+    int which = std::min(std::max(level,0),MaxLevels-1);
+    levelTiles[which].fetch_add(1,std::memory_order_relaxed);
+    levelInput[which].fetch_add(numInput,std::memory_order_relaxed);
+    levelKept[which].fetch_add(numKept,std::memory_order_relaxed);
+    int cur = maxLevel.load(std::memory_order_relaxed);
+    while (which > cur && !maxLevel.compare_exchange_weak(cur,which,std::memory_order_relaxed)) ;
+
+    add(PointsPlaced,numKept);
+    add(TilesWritten,1);
+    tilePoints.add(numKept);
+    tileBytes.add(numBytes);
+}
+
+void BuildMetrics::addLevelTime(int level,double seconds)
+{
+    int which = std::min(std::max(level,0),MaxLevels-1);
+    levelTime[which].fetch_add((long long)(seconds * 1e9),std::memory_order_relaxed);
+}
+
+long long BuildMetrics::PeakRSS()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF,&usage))
+        return 0;
+#ifdef __APPLE__
+    // Bytes on the Mac, kilobytes most everywhere else
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024LL;
+#endif
+}
+
+double BuildMetrics::elapsed()
+{
+    return TimeSince(startTime);
+}
+
+void BuildMetrics::runProgress()
+{
+    std::unique_lock<std::mutex> lock(progressMutex);
+    while (!progressCond.wait_for(lock,std::chrono::duration<double>(progressInterval),[this]{ return progressDone; }))
+        printProgress();
+}
+
+void BuildMetrics::printProgress()
+{
+    double seconds = elapsed();
+    long long placed = get(PointsPlaced);
+    char percent[32] = "";
+    if (totalPoints > 0)
+        sprintf(percent," (%.0f%%)",100.0 * placed / totalPoints);
+    long long tempInUse = std::max(get(TempWritten) - get(TempFreed),0LL);
+
+    fprintf(stdout,"[%7.1fs] %.2fM of %.2fM points%s  %lld tiles  depth %d  %.2f Mpts/s  tmp %.1fMB  db %.1fMB  rss %.0fMB\n",
+            seconds,placed/1e6,totalPoints/1e6,percent,get(TilesWritten),(int)maxLevel,
+            seconds > 0.0 ? placed / 1e6 / seconds : 0.0,
+            tempInUse/MB,get(DatabaseBytes)/MB,PeakRSS()/MB);
+    fflush(stdout);
+}
+
+void BuildMetrics::printSummary()
+{
+    double seconds = elapsed();
+    long long placed = get(PointsPlaced);
+    fprintf(stdout,"Placed %lld points in %lld tiles in %.2fs (%.2f Mpts/s), peak RSS %.0fMB\n",
+            placed,get(TilesWritten),seconds,seconds > 0.0 ? placed / 1e6 / seconds : 0.0,PeakRSS()/MB);
+    fprintf(stdout,"  time (all threads):");
+    for (int ii=0;ii<TimeNone;ii++)
+        fprintf(stdout," %s %.2fs",TimeNames[ii],getTime((TimeCategory)ii));
+    fprintf(stdout,"\n");
+    fprintf(stdout,"  bytes: input %.1fMB  temp written %.1fMB  temp read %.1fMB  temp peak %.1fMB  database %.1fMB\n",
+            get(InputBytes)/MB,get(TempWritten)/MB,get(TempRead)/MB,get(TempPeak)/MB,get(DatabaseBytes)/MB);
+    fprintf(stdout,"  tile points: p50 %lld  p90 %lld  p99 %lld  max %lld   tile bytes: p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+            tilePoints.getPercentile(0.5),tilePoints.getPercentile(0.9),tilePoints.getPercentile(0.99),tilePoints.getMax(),
+            tileBytes.getPercentile(0.5),tileBytes.getPercentile(0.9),tileBytes.getPercentile(0.99),tileBytes.getMax());
+    for (int ii=0;ii<=maxLevel;ii++)
+    {
+        double levelSeconds = levelTime[ii] / 1e9;
+        fprintf(stdout,"  level %2d: %8lld tiles  %12lld points in  %10lld kept",ii,(long long)levelTiles[ii],(long long)levelInput[ii],(long long)levelKept[ii]);
+        if (levelSeconds > 0.0)
+            fprintf(stdout,"  %8.2f Mpts/s",levelInput[ii] / 1e6 / levelSeconds);
+        fprintf(stdout,"\n");
+    }
+}
+
+bool BuildMetrics::writeJSON(const std::string &fileName)
+{
+    FILE *fp = fopen(fileName.c_str(),"w");
+    if (!fp)
+    {
+        fprintf(stderr,"Failed to open %s\n",fileName.c_str());
+        return false;
+    }
+
+    double seconds = elapsed();
+    long long placed = get(PointsPlaced);
+    fprintf(fp,"{\n  \"format\": 1,\n  \"seconds\": %.3f,\n  \"points\": %lld,\n  \"points_placed\": %lld,\n  \"tiles\": %lld,\n  \"mpts_per_sec\": %.4f,\n  \"peak_rss_bytes\": %lld,\n",
+            seconds,totalPoints,placed,get(TilesWritten),seconds > 0.0 ? placed / 1e6 / seconds : 0.0,PeakRSS());
+    fprintf(fp,"  \"time\": {");
+    for (int ii=0;ii<TimeNone;ii++)
+        fprintf(fp,"%s\"%s\": %.3f",ii > 0 ? ", " : "",TimeNames[ii],getTime((TimeCategory)ii));
+    fprintf(fp,"},\n");
+    fprintf(fp,"  \"bytes\": {\"input\": %lld, \"temp_written\": %lld, \"temp_read\": %lld, \"temp_peak\": %lld, \"database\": %lld, \"database_rows\": %lld},\n",
+            get(InputBytes),get(TempWritten),get(TempRead),get(TempPeak),get(DatabaseBytes),get(DatabaseRows));
+    fprintf(fp,"  \"levels\": [");
+    for (int ii=0;ii<=maxLevel;ii++)
+    {
+        double levelSeconds = levelTime[ii] / 1e9;
+        fprintf(fp,"%s\n    {\"level\": %d, \"tiles\": %lld, \"points_in\": %lld, \"points_kept\": %lld, \"seconds\": %.4f, \"mpts_per_sec\": ",
+                ii > 0 ? "," : "",ii,(long long)levelTiles[ii],(long long)levelInput[ii],(long long)levelKept[ii],levelSeconds);
+        // Not every engine times the levels separately
+        if (levelSeconds > 0.0)
+            fprintf(fp,"%.4f}",levelInput[ii] / 1e6 / levelSeconds);
+        else
+            fprintf(fp,"null}");
+    }
+    fprintf(fp,"\n  ],\n  \"tile_points\": ");
+    tilePoints.writeJSON(fp);
+    fprintf(fp,",\n  \"tile_bytes\": ");
+    tileBytes.writeJSON(fp);
+    fprintf(fp,"\n}\n");
+
+    bool ret = !ferror(fp);
+    if (fclose(fp) != 0)
+        ret = false;
+    if (!ret)
+        fprintf(stderr,"Failed to write %s\n",fileName.c_str());
+
+    return ret;
+}
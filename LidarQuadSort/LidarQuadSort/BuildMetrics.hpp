@@ -0,0 +1,180 @@
+//
+//  BuildMetrics.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef BuildMetrics_hpp
+#define BuildMetrics_hpp
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+// Seconds since the given time
+double TimeSince(std::chrono::steady_clock::time_point startTime);
+
+/* Counters and histograms for a build.
+    While the build runs a background thread prints a one line progress
+    report every so often, and at the end we can print a summary or write
+    the whole thing out as JSON.
+    The sorters update these once per block or once per tile, never per
+    point, and everything is a relaxed atomic, so the workers never wait
+    on each other to record something.
+  */
+class BuildMetrics
+{
+public:
+    // Where the time goes.  These are summed over all the threads, so together they can add up to more than the wall time.
+    // Partition is splitting points up into tiles: the quadrant split for the recursive engine, the sort and merges for the Morton one.
+    typedef enum {TimeRead,TimePartition,TimeCodec,TimeDatabase,TimeNone} TimeCategory;
+
+    typedef enum {
+        InputBytes,     // Size of the input files
+        TempWritten,    // Bytes written to temp files
+        TempRead,       // Bytes read back from temp files
+        TempFreed,      // Bytes of temp files removed
+        TempPeak,       // Most temp space reserved at once
+        DatabaseBytes,  // Blob bytes handed to SQLite
+        DatabaseRows,   // Rows inserted
+        PointsPlaced,   // Points written to a tile
+        TilesWritten,
+        CounterCount
+    } Counter;
+
+    static const int MaxLevels = 32;
+
+    /* Counts values in power of two buckets.
+        Good enough for a size distribution and cheap enough to add to from any thread.
+      */
+    class Histogram
+    {
+    public:
+        static const int NumBuckets = 64;
+
+        Histogram();
+
+        void add(long long val);
+
+        long long getCount() { return count; }
+        long long getSum() { return sum; }
+        long long getMin() { return count > 0 ? (long long)minVal : 0; }
+        long long getMax() { return maxVal; }
+
+        // Value below which the given fraction of samples fall, rounded up to the end of its bucket
+        long long getPercentile(double frac);
+
+        // Write out as a JSON object
+        void writeJSON(FILE *fp);
+
+    protected:
+        std::atomic<long long> buckets[NumBuckets];
+        std::atomic<long long> count,sum,minVal,maxVal;
+    };
+
+    /* Splits a stretch of work between the time categories.
+        Call switchTo() at the boundaries, which costs one clock read.
+        Totals go to the metrics when it pauses or goes out of scope.
+      */
+    class Stopwatch
+    {
+    public:
+        Stopwatch(BuildMetrics *metrics,TimeCategory category);
+        ~Stopwatch();
+
+        // Charge the time since the last switch and start on the new category.
+        // TimeNone pauses and hands the totals so far to the metrics.
+        void switchTo(TimeCategory newCategory);
+
+    protected:
+        BuildMetrics *metrics;
+        TimeCategory category;
+        std::chrono::steady_clock::time_point last;
+        double times[TimeNone];
+    };
+
+    /* Charge everything until it goes out of scope to a single category.
+        A NULL metrics is fine and does nothing.
+      */
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(BuildMetrics *metrics,TimeCategory category);
+        ~ScopedTimer();
+
+    protected:
+        BuildMetrics *metrics;
+        TimeCategory category;
+        std::chrono::steady_clock::time_point startTime;
+    };
+
+    BuildMetrics();
+    ~BuildMetrics();
+
+    // Seconds between progress lines.  0 turns them off.
+    void setProgressInterval(double seconds) { progressInterval = seconds; }
+
+    // The build is starting, with this many points to place.  Starts the progress reports.
+    void start(long long totalPoints);
+
+    // The sorter is done.  Stops the progress reports.  The database may still be writing.
+    void stop();
+
+    void add(Counter counter,long long val) { counters[counter].fetch_add(val,std::memory_order_relaxed); }
+    void setMax(Counter counter,long long val);
+    long long get(Counter counter) { return counters[counter].load(std::memory_order_relaxed); }
+
+    void addTime(TimeCategory category,double seconds);
+    double getTime(TimeCategory category);
+
+    // A tile is done.  Input is the points that reached it, kept is how many it held onto.
+    void addTile(int level,long long numInput,long long numKept,long long numBytes);
+
+    // Time spent working on a tile at this level, not counting its children
+    void addLevelTime(int level,double seconds);
+
+    // Most memory we've had resident
+    static long long PeakRSS();
+
+    // Print a short summary to stdout
+    void printSummary();
+
+    // Write everything out as JSON.  Returns false if we can't.
+    bool writeJSON(const std::string &fileName);
+
+protected:
+    // Background thread that prints the progress lines
+    void runProgress();
+
+    // Print one progress line
+    void printProgress();
+
+    // Seconds since start(), which includes the database catching up once the sorter is done
+    double elapsed();
+
+    std::atomic<long long> counters[CounterCount];
+    // Nanoseconds, so we can keep them in integer atomics
+    std::atomic<long long> times[TimeNone];
+
+    std::atomic<long long> levelTiles[MaxLevels],levelInput[MaxLevels],levelKept[MaxLevels],levelTime[MaxLevels];
+    std::atomic<int> maxLevel;
+
+    Histogram tilePoints,tileBytes;
+
+    long long totalPoints;
+    std::chrono::steady_clock::time_point startTime;
+
+    double progressInterval;
+    std::thread progressThread;
+    std::mutex progressMutex;
+    std::condition_variable progressCond;
+    bool progressDone;
+};
+
+#endif /* BuildMetrics_hpp */
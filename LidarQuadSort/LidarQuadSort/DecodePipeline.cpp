@@ -0,0 +1,191 @@
+//
+//  DecodePipeline.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "DecodePipeline.hpp"
+#include "LidarSorter.hpp"
+
+DecodePipeline::DecodePipeline(const std::vector<std::string> &files,int inNumThreads,bool ordered,int batchSize,int queueDepth)
+: files(files), ordered(ordered), batchSize(std::max(batchSize,1)), queueDepth(std::max(queueDepth,1)), started(false),
+  nextFile(0), numRunning(0), failed(false), curPoint(0), curFile(0)
+{
+    // No point in more decoders than files
+    numThreads = std::max(1,std::min(inNumThreads,(int)files.size()));
+}
+
+DecodePipeline::~DecodePipeline()
+{
+    stop();
+    for (auto queue : queues)
+        delete queue;
+    queues.clear();
+}
+
+void DecodePipeline::start()
+{
+    started = true;
+    int numQueues = ordered ? numThreads : 1;
+    for (int ii=0;ii<numQueues;ii++)
+        queues.push_back(new BatchQueue(queueDepth * (ordered ? 1 : numThreads)));
+    numRunning = numThreads;
+    for (int ii=0;ii<numThreads;ii++)
+        threads.push_back(std::thread(&DecodePipeline::runDecoder,this,ii));
+}
+
+void DecodePipeline::stop()
+{
+    for (auto queue : queues)
+        queue->close();
+    for (auto &thread : threads)
+        thread.join();
+    threads.clear();
+}
+
+long long DecodePipeline::getNumBlockedPushes()
+{
+    long long numBlocked = 0;
+    for (auto queue : queues)
+        numBlocked += queue->getNumBlockedPushes();
+    return numBlocked;
+}
+
+void DecodePipeline::setFailed(const std::string &reason)
+{
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!failed)
+            failReason = reason;
+        failed = true;
+    }
+
+    // Wakes up the reader and anyone waiting to push
+    for (auto queue : queues)
+        queue->close();
+}
+
+void DecodePipeline::runDecoder(int which)
+{
+    if (ordered)
+    {
+        // Every Nth file, in order, so the reader knows which queue to look in
+        BatchQueue *queue = queues[which];
+        for (size_t whichFile=which;whichFile<files.size();whichFile+=numThreads)
+            if (!decodeFile(whichFile,queue))
+                break;
+        queue->close();
+    } else {
+        BatchQueue *queue = queues[0];
+        size_t whichFile;
+        while ((whichFile = nextFile++) < files.size())
+            if (!decodeFile(whichFile,queue))
+                break;
+        if (--numRunning == 0)
+            queue->close();
+    }
+}
+
+bool DecodePipeline::decodeFile(size_t whichFile,BatchQueue *queue)
+{
+    const std::string &fileName = files[whichFile];
+
+    laszip_POINTER reader;
+    laszip_create(&reader);
+    laszip_BOOL is_compressed;
+    if (laszip_open_reader(reader, fileName.c_str(), &is_compressed))
+    {
+        laszip_destroy(reader);
+        setFailed((std::string)"failed to open file " + fileName);
+        return false;
+    }
+    laszip_header_struct *header;
+    laszip_get_header_pointer(reader,&header);
+    long long numPoints = getNumRecords(header);
+    int numExtraBytes = std::max(0,(int)header->point_data_record_length - PointRecordLength(header->point_data_format));
+    laszip_point_struct *p;
+    laszip_get_point_pointer(reader, &p);
+
+    bool ret = true;
+    long long whichPoint = 0;
+    do {
+        PointBatchRef batch = std::make_shared<PointBatch>();
+        batch->whichFile = (int)whichFile;
+        batch->numExtraBytes = numExtraBytes;
+        long long numInBatch = std::min((long long)batchSize,numPoints-whichPoint);
+        batch->points.resize(numInBatch);
+        batch->extraBytes.resize(numInBatch*numExtraBytes);
+        for (long long ii=0;ii<numInBatch;ii++)
+        {
+            if (laszip_read_point(reader))
+            {
+                setFailed((std::string)"Unable to read input point in " + fileName);
+                ret = false;
+                break;
+            }
+            batch->points[ii] = *p;
+            batch->points[ii].extra_bytes = NULL;
+            if (numExtraBytes > 0)
+                memcpy(&batch->extraBytes[ii*numExtraBytes],p->extra_bytes,numExtraBytes);
+        }
+        if (!ret)
+            break;
+        whichPoint += numInBatch;
+        batch->lastInFile = whichPoint >= numPoints;
+
+        // Waits here if the reader is behind.  Fails if we've been stopped.
+        if (!queue->push(std::move(batch)))
+        {
+            ret = false;
+            break;
+        }
+    } while (whichPoint < numPoints);
+
+    laszip_close_reader(reader);
+    laszip_destroy(reader);
+
+    return ret;
+}
+
+laszip_point_struct *DecodePipeline::getNextPoint()
+{
+    if (!started)
+        start();
+
+    while (!curBatch || curPoint >= curBatch->points.size())
+    {
+        BatchQueue *queue = queues[0];
+        if (ordered)
+        {
+            // Done with this file, move on to the next one
+            if (curBatch && curBatch->lastInFile)
+                curFile++;
+            if (curFile >= files.size())
+                return NULL;
+            queue = queues[curFile % numThreads];
+        }
+
+        curBatch.reset();
+        curPoint = 0;
+        if (!queue->pop(curBatch))
+        {
+            if (failed)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                throw failReason;
+            }
+            if (ordered)
+                throw (std::string)"Decoder stopped before finishing " + files[curFile];
+            return NULL;
+        }
+    }
+
+    laszip_point_struct *p = &curBatch->points[curPoint];
+    if (curBatch->numExtraBytes > 0)
+        p->extra_bytes = &curBatch->extraBytes[curPoint*curBatch->numExtraBytes];
+    curPoint++;
+
+    return p;
+}
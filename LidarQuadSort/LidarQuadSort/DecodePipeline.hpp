@@ -0,0 +1,92 @@
+//
+//  DecodePipeline.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef DecodePipeline_hpp
+#define DecodePipeline_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#import "laszip_api.h"
+#include "BoundedQueue.hpp"
+
+/* Decodes a group of LAZ files on background threads.
+    Each decoder thread works on its own input file and hands points
+    back in batches through a bounded queue, so decoding runs ahead of
+    the caller but only by so much.
+
+    Ordered delivery returns the points in the same order a single
+    reader would.  Each decoder gets every Nth file and its own queue,
+    and we read the queues in file order.  Unordered delivery shares one
+    queue and decoders grab whatever file is next, which keeps them all
+    busy when the files vary a lot in size.
+  */
+class DecodePipeline
+{
+public:
+    DecodePipeline(const std::vector<std::string> &files,int numThreads,bool ordered,int batchSize = 16384,int queueDepth = 4);
+    ~DecodePipeline();
+
+    // Next point, or NULL once every file is done.  Good until the next call.
+    // Throws a string if a decoder failed.
+    laszip_point_struct *getNextPoint();
+
+    // Stop the decoders, even if they're not done
+    void stop();
+
+    // Number of times a decoder had to wait for the reader to catch up
+    long long getNumBlockedPushes();
+
+protected:
+    // Points decoded from one file, with their extra bytes copied out
+    class PointBatch
+    {
+    public:
+        PointBatch() : whichFile(0), numExtraBytes(0), lastInFile(false) { }
+        int whichFile;
+        int numExtraBytes;
+        std::vector<laszip_point_struct> points;
+        std::vector<laszip_U8> extraBytes;
+        // Set on the final batch for a file (which may be empty)
+        bool lastInFile;
+    };
+    typedef std::shared_ptr<PointBatch> PointBatchRef;
+    typedef BoundedQueue<PointBatchRef> BatchQueue;
+
+    void start();
+    void runDecoder(int which);
+    bool decodeFile(size_t whichFile,BatchQueue *queue);
+    void setFailed(const std::string &reason);
+
+    std::vector<std::string> files;
+    int numThreads;
+    bool ordered;
+    int batchSize,queueDepth;
+    bool started;
+
+    std::vector<std::thread> threads;
+    // One per decoder when ordered, just the one otherwise
+    std::vector<BatchQueue *> queues;
+    std::atomic<size_t> nextFile;
+    std::atomic<int> numRunning;
+
+    std::mutex errorMutex;
+    std::atomic<bool> failed;
+    std::string failReason;
+
+    // What the caller is reading now
+    PointBatchRef curBatch;
+    size_t curPoint;
+    size_t curFile;
+};
+
+#endif /* DecodePipeline_hpp */
@@ -0,0 +1,232 @@
+//
+//  HeaderScan.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "HeaderScan.hpp"
+#include "LidarSorter.hpp"
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
+
+static const char *ManifestMagic = "LidarQuadSort manifest 1";
+
+// The projection code isn't safe to call from more than one thread
+static std::mutex projMutex;
+
+InputFileInfo::InputFileInfo()
+: fileSize(0), modTime(0), numPoints(0), pointDataFormat(0), pointDataRecordLength(0),
+  minX(0.0), minY(0.0), minZ(0.0), maxX(0.0), maxY(0.0), maxZ(0.0)
+{
+    for (unsigned int ii=0;ii<3;ii++)
+    {
+        scale[ii] = 1.0;
+        offset[ii] = 0.0;
+    }
+}
+
+HeaderScanner::HeaderScanner(const std::string &manifestFile,int numThreads)
+: manifestFile(manifestFile), numThreads(std::max(numThreads,1)), numFromManifest(0)
+{
+}
+
+bool HeaderScanner::scanFile(const std::string &fileName,InputFileInfo &info)
+{
+    laszip_POINTER reader;
+    laszip_create(&reader);
+    laszip_BOOL is_compressed;
+    if (laszip_open_reader(reader, fileName.c_str(), &is_compressed))
+    {
+        laszip_destroy(reader);
+        return false;
+    }
+    laszip_header_struct *header;
+    laszip_get_header_pointer(reader,&header);
+
+    info.numPoints = getNumRecords(header);
+    info.pointDataFormat = header->point_data_format;
+    info.pointDataRecordLength = header->point_data_record_length;
+    info.minX = header->min_x;  info.minY = header->min_y;  info.minZ = header->min_z;
+    info.maxX = header->max_x;  info.maxY = header->max_y;  info.maxZ = header->max_z;
+    info.scale[0] = header->x_scale_factor;  info.scale[1] = header->y_scale_factor;  info.scale[2] = header->z_scale_factor;
+    info.offset[0] = header->x_offset;  info.offset[1] = header->y_offset;  info.offset[2] = header->z_offset;
+    {
+        std::lock_guard<std::mutex> lock(projMutex);
+        GenerateProjStr(header,info.projStr);
+    }
+
+    // Done with it, so don't hold on to the file
+    laszip_close_reader(reader);
+    laszip_destroy(reader);
+
+    return true;
+}
+
+bool HeaderScanner::scan(const std::vector<std::string> &files,std::vector<InputFileInfo> &infos)
+{
+    numFromManifest = 0;
+    infos.clear();
+    infos.resize(files.size());
+
+    // Anything that hasn't changed since the last run comes from the manifest
+    std::vector<InputFileInfo> entries;
+    std::unordered_map<std::string,const InputFileInfo *> entryMap;
+    if (readManifest(entries))
+        for (const auto &entry : entries)
+            entryMap[entry.fileName] = &entry;
+
+    std::vector<int> toScan;
+    for (unsigned int ii=0;ii<files.size();ii++)
+    {
+        struct stat statBuf;
+        if (stat(files[ii].c_str(),&statBuf))
+        {
+            fprintf(stderr,"Failed to find file %s\n",files[ii].c_str());
+            return false;
+        }
+
+        auto it = entryMap.find(files[ii]);
+        if (it != entryMap.end() && it->second->fileSize == statBuf.st_size && it->second->modTime == statBuf.st_mtime)
+        {
+            infos[ii] = *(it->second);
+            numFromManifest++;
+        } else {
+            infos[ii].fileName = files[ii];
+            infos[ii].fileSize = statBuf.st_size;
+            infos[ii].modTime = statBuf.st_mtime;
+            toScan.push_back(ii);
+        }
+    }
+
+    // Open up the rest a few at a time
+    std::atomic<size_t> nextScan(0);
+    std::atomic<bool> failed(false);
+    std::mutex failMutex;
+    std::string failFile;
+    auto scanFunc = [&]{
+        size_t which;
+        while (!failed && (which = nextScan++) < toScan.size())
+        {
+            InputFileInfo &info = infos[toScan[which]];
+            if (!scanFile(info.fileName,info))
+            {
+                std::lock_guard<std::mutex> lock(failMutex);
+                if (!failed)
+                    failFile = info.fileName;
+                failed = true;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    int numToStart = std::min(numThreads,(int)toScan.size());
+    for (int ii=0;ii<numToStart;ii++)
+        threads.push_back(std::thread(scanFunc));
+    for (auto &thread : threads)
+        thread.join();
+    if (failed)
+    {
+        fprintf(stderr,"Failed to open file %s\n",failFile.c_str());
+        return false;
+    }
+
+    if (!manifestFile.empty() && (!toScan.empty() || entries.size() != infos.size()))
+        if (!writeManifest(infos))
+            fprintf(stderr,"Failed to write manifest %s.  Continuing anyway.\n",manifestFile.c_str());
+
+    return true;
+}
+
+// Break a line up on tabs
+static void SplitLine(const std::string &line,std::vector<std::string> &fields)
+{
+    fields.clear();
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = line.find('\t',start);
+        if (end == std::string::npos)
+        {
+            fields.push_back(line.substr(start));
+            break;
+        }
+        fields.push_back(line.substr(start,end-start));
+        start = end+1;
+    }
+}
+
+bool HeaderScanner::readManifest(std::vector<InputFileInfo> &entries)
+{
+    if (manifestFile.empty())
+        return false;
+    std::ifstream ifs(manifestFile);
+    if (!ifs)
+        return false;
+
+    std::string line;
+    if (!std::getline(ifs,line) || line != ManifestMagic)
+    {
+        fprintf(stderr,"Ignoring manifest %s from a different version\n",manifestFile.c_str());
+        return false;
+    }
+
+    std::vector<std::string> fields;
+    while (std::getline(ifs,line))
+    {
+        SplitLine(line,fields);
+        if (fields.size() != 19)
+        {
+            fprintf(stderr,"Ignoring bad manifest %s\n",manifestFile.c_str());
+            entries.clear();
+            return false;
+        }
+
+        InputFileInfo info;
+        info.fileName = fields[0];
+        info.fileSize = atoll(fields[1].c_str());
+        info.modTime = atoll(fields[2].c_str());
+        info.numPoints = atoll(fields[3].c_str());
+        info.pointDataFormat = atoi(fields[4].c_str());
+        info.pointDataRecordLength = atoi(fields[5].c_str());
+        info.minX = atof(fields[6].c_str());  info.minY = atof(fields[7].c_str());  info.minZ = atof(fields[8].c_str());
+        info.maxX = atof(fields[9].c_str());  info.maxY = atof(fields[10].c_str());  info.maxZ = atof(fields[11].c_str());
+        for (unsigned int ii=0;ii<3;ii++)
+        {
+            info.scale[ii] = atof(fields[12+ii].c_str());
+            info.offset[ii] = atof(fields[15+ii].c_str());
+        }
+        info.projStr = fields[18];
+        entries.push_back(info);
+    }
+
+    return true;
+}
+
+bool HeaderScanner::writeManifest(const std::vector<InputFileInfo> &infos)
+{
+    // Write it off to the side so a crash doesn't leave half a manifest
+    std::string tmpFile = manifestFile + ".tmp";
+    FILE *fp = fopen(tmpFile.c_str(),"w");
+    if (!fp)
+        return false;
+
+    fprintf(fp,"%s\n",ManifestMagic);
+    for (const auto &info : infos)
+    {
+        fprintf(fp,"%s\t%lld\t%lld\t%lld\t%d\t%d",info.fileName.c_str(),info.fileSize,info.modTime,info.numPoints,info.pointDataFormat,info.pointDataRecordLength);
+        fprintf(fp,"\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g",info.minX,info.minY,info.minZ,info.maxX,info.maxY,info.maxZ);
+        fprintf(fp,"\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g",info.scale[0],info.scale[1],info.scale[2],info.offset[0],info.offset[1],info.offset[2]);
+        fprintf(fp,"\t%s\n",info.projStr.c_str());
+    }
+    bool ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+    if (!ok || rename(tmpFile.c_str(),manifestFile.c_str()))
+    {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,62 @@
+//
+//  HeaderScan.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef HeaderScan_hpp
+#define HeaderScan_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/* What we need to know about an input file before we start sorting.
+  */
+class InputFileInfo
+{
+public:
+    InputFileInfo();
+
+    std::string fileName;
+    // Used to tell if the manifest entry is still good
+    long long fileSize,modTime;
+
+    long long numPoints;
+    int pointDataFormat,pointDataRecordLength;
+    double minX,minY,minZ,maxX,maxY,maxZ;
+    double scale[3],offset[3];
+    std::string projStr;
+};
+
+/* Reads just the headers of a group of input files, several at a time,
+    closing each one as soon as we're done with it.
+    The results go into a manifest file next to the inputs.  On the next
+    run any file that hasn't changed size or modification time comes out
+    of the manifest instead of being opened again.
+  */
+class HeaderScanner
+{
+public:
+    // Manifest can be empty, in which case we always scan
+    HeaderScanner(const std::string &manifestFile,int numThreads);
+
+    // Fill in the info for each file, in the same order.  Returns false if one couldn't be read.
+    bool scan(const std::vector<std::string> &files,std::vector<InputFileInfo> &infos);
+
+    // Number of files we found in the manifest on the last scan
+    int getNumFromManifest() { return numFromManifest; }
+
+protected:
+    bool readManifest(std::vector<InputFileInfo> &entries);
+    bool writeManifest(const std::vector<InputFileInfo> &infos);
+    bool scanFile(const std::string &fileName,InputFileInfo &info);
+
+    std::string manifestFile;
+    int numThreads;
+    int numFromManifest;
+};
+
+#endif /* HeaderScan_hpp */
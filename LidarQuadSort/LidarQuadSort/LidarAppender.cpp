@@ -0,0 +1,654 @@
+//
+//  LidarAppender.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "LidarAppender.hpp"
+#include "TileKey.h"
+#include <chrono>
+#include <limits>
+
+// Move a coordinate into the database's quantization
+static int32_t Requantize(double val,double scale,double offset)
+{
+    double quant = round((val - offset)/scale);
+    if (quant < (double)INT32_MIN || quant > (double)INT32_MAX)
+        throw (std::string)"New points don't fit in the coordinate range of the database";
+
+    return (int32_t)quant;
+}
+
+static std::string TileName(TileIdent tileID)
+{
+    return std::to_string(tileID.z) + ": (" + std::to_string(tileID.x) + "," + std::to_string(tileID.y) + ")";
+}
+
+LidarAppender::LidarAppender(const char *tmp_dir)
+: LidarSorter(tmp_dir), numRewritten(0), numAdded(0)
+{
+}
+
+bool LidarAppender::process(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB)
+{
+    LidarDatabase::Manifest manifest;
+    if (lidarDB->getType() != LidarDatabase::FullData || !lidarDB->getManifest(manifest))
+    {
+        fprintf(stderr,"Can only append to a database with tile data and a manifest.\n");
+        return false;
+    }
+    if (manifest.tileCodec != TileCodecLAZ)
+    {
+        fprintf(stderr,"Tiles in this database use the compact codec.  Rebuild it with LAZ tiles to append.\n");
+        return false;
+    }
+    if (manifest.tileKey == TileKeyOctree)
+    {
+        fprintf(stderr,"This database is an octree.  Appending only works on a quadtree.\n");
+        return false;
+    }
+    if (manifest.tileKey != TileKeyMorton)
+    {
+        fprintf(stderr,"Tiles in this database use an older key scheme.  Rebuild it to append.\n");
+        return false;
+    }
+    if (inputDB->getProj4Str() != manifest.srs)
+    {
+        fprintf(stderr,"Projection of new files doesn't match the database.\n");
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    // Carry on with the settings the database was built with
+    fullMinX = manifest.minX;  fullMinY = manifest.minY;  fullMinZ = manifest.minZ;
+    fullMaxX = manifest.maxX;  fullMaxY = manifest.maxY;  fullMaxZ = manifest.maxZ;
+    minPointLimit = manifest.minPoints;
+    maxPointLimit = manifest.maxPoints;
+    maxLevel = manifest.maxLevel;
+    maxColor = manifest.maxColor;
+    rootProjStr = manifest.srs;
+    // Merged leaves are handed to the regular build as spill files
+    spillFormat = SpillRaw;
+    lidarDB->setMetrics(&metrics);
+    metrics.start(getNumRecords(inputDB->header));
+    scheduler.reset(new SpillScheduler(tempBudget,&metrics));
+
+    tiles.clear();
+    originalTiles.clear();
+    writtenTiles.clear();
+    numRewritten = numAdded = 0;
+    if (!lidarDB->getTileIndex(tiles) || tiles.empty())
+    {
+        fprintf(stderr,"No tiles in database to append to.\n");
+        return false;
+    }
+    // Moving tiles, rewriting them and the new header all go in together, or not at all
+    if (!lidarDB->beginTransaction())
+        return false;
+
+    bool ret = true;
+    try {
+        // Scale, offset and point format come from the tiles that are already there
+        TilePoints rootPoints;
+        rootHeader.reset();
+        if (!readTile(TileIdent(0,0,0),lidarDB,rootPoints,&rootHeader))
+            throw (std::string)"Failed to read root tile from database";
+        const laszip_header_struct &dbHeader = rootHeader->header;
+        if (inputDB->header.point_data_format != dbHeader.point_data_format ||
+            inputDB->header.point_data_record_length != dbHeader.point_data_record_length)
+            throw (std::string)"Point format of new files doesn't match the database";
+
+        std::string newFile = tmpDir + "/append_src.spill";
+        double newBounds[6];
+        if (!copyNewPoints(inputDB,newFile,newBounds))
+            throw (std::string)"Failed to copy new points";
+
+        // Double the extent toward the new points until they fit
+        int growLevels = 0, oldX = 0, oldY = 0;
+        while (newBounds[0] < fullMinX || newBounds[1] < fullMinY || newBounds[3] > fullMaxX || newBounds[4] > fullMaxY)
+        {
+            double spanX = fullMaxX - fullMinX, spanY = fullMaxY - fullMinY;
+            if (spanX <= 0.0 || spanY <= 0.0 || maxLevel + growLevels >= TileKeyMaxLevel)
+                throw (std::string)"New points are too far outside the existing extent";
+            int growX = newBounds[0] < fullMinX ? 1 : 0;
+            int growY = newBounds[1] < fullMinY ? 1 : 0;
+            fullMinX -= growX * spanX;  fullMaxX = fullMinX + 2.0*spanX;
+            fullMinY -= growY * spanY;  fullMaxY = fullMinY + 2.0*spanY;
+            oldX += growX << growLevels;
+            oldY += growY << growLevels;
+            growLevels++;
+        }
+        fullMinZ = std::min(fullMinZ,newBounds[2]);
+        fullMaxZ = std::max(fullMaxZ,newBounds[5]);
+        if (growLevels > 0)
+        {
+            if (!lidarDB->relocateTiles(growLevels,oldX,oldY))
+                throw (std::string)"Failed to move existing tiles";
+            for (auto &tile : tiles)
+            {
+                tile.x += oldX << tile.level;
+                tile.y += oldY << tile.level;
+                tile.level += growLevels;
+            }
+            maxLevel += growLevels;
+            fprintf(stdout,"New points are outside the extent.  Moved %d tiles down %d levels.\n",(int)tiles.size(),growLevels);
+        }
+        for (const auto &tile : tiles)
+            originalTiles.insert(TileKeyMake(tile.x,tile.y,tile.level));
+        if (growLevels > 0 && !spreadRoot(TileIdent(oldX,oldY,growLevels),lidarDB))
+            throw (std::string)"Failed to share out old root tile";
+        buildCounts();
+
+        // Now route the new points down the tree
+        ret = appendSubFile(newFile,TileIdent(0,0,0),lidarDB);
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        ret = false;
+    }
+    if (failed)
+    {
+        fprintf(stderr,"%s\n",failReason.c_str());
+        ret = false;
+    }
+    metrics.stop();
+    scheduler->report();
+    peakTempSpace = scheduler->getPeak();
+    scheduler.reset();
+
+    for (auto key : writtenTiles)
+    {
+        if (originalTiles.find(key) != originalTiles.end())
+            numRewritten++;
+        else
+            numAdded++;
+    }
+    fprintf(stdout,"Rewrote %lld of %d existing tiles and added %lld new ones in %.2fs\n",numRewritten,(int)originalTiles.size(),numAdded,
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+
+    if (ret && !lidarDB->setHeader(manifest.srs.c_str(),manifest.name.c_str(),
+                                   fullMinX, fullMinY, fullMinZ,
+                                   fullMaxX, fullMaxY, fullMaxZ,
+                                   0, maxLevel,
+                                   minPointLimit,maxPointLimit,
+                                   manifest.pointType,maxColor))
+        ret = false;
+    if (!lidarDB->endTransaction(ret))
+    {
+        fprintf(stderr,"Append failed.  The database is unchanged.\n");
+        ret = false;
+    }
+
+    return ret;
+}
+
+void LidarAppender::finishTile(laszip_POINTER tileW,TileBufferRef buffer,TileIdent tileID,long long numCopiedToTile,long long numInput,int tileMaxColor,const TileGroundGrid &grid,LidarDatabase *lidarDB)
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        writtenTiles.insert(TileKeyMake(tileID.x,tileID.y,tileID.z));
+    }
+
+    LidarSorter::finishTile(tileW,std::move(buffer),tileID,numCopiedToTile,numInput,tileMaxColor,grid,lidarDB);
+}
+
+bool LidarAppender::readTile(TileIdent tileID,LidarDatabase *lidarDB,TilePoints &tilePoints,std::shared_ptr<LasHeaderCopy> *header)
+{
+    std::string data;
+    if (!lidarDB->getTile(tileID.x,tileID.y,tileID.z,data))
+    {
+        fprintf(stderr,"Failed to read tile %s from database\n",TileName(tileID).c_str());
+        return false;
+    }
+
+    // laszip wants a file to read from
+    std::string tileFile = tmpDir + "/tile_" + std::to_string(tileID.z) + "_" + std::to_string(tileID.x) + "_" + std::to_string(tileID.y) + ".laz";
+    FILE *fp = fopen(tileFile.c_str(),"wb");
+    if (!fp)
+    {
+        fprintf(stderr,"Failed to open temp file %s\n",tileFile.c_str());
+        return false;
+    }
+    bool written = fwrite(data.data(),1,data.size(),fp) == data.size();
+    written = !fclose(fp) && written;
+    if (!written)
+    {
+        fprintf(stderr,"Failed to write temp file %s\n",tileFile.c_str());
+        remove(tileFile.c_str());
+        return false;
+    }
+
+    laszip_POINTER reader;
+    laszip_create(&reader);
+    laszip_BOOL is_compressed;
+    if (laszip_open_reader(reader, tileFile.c_str(), &is_compressed))
+    {
+        fprintf(stderr,"Failed to decode tile %s\n",TileName(tileID).c_str());
+        laszip_destroy(reader);
+        remove(tileFile.c_str());
+        return false;
+    }
+    laszip_header_struct *tileHeader;
+    laszip_get_header_pointer(reader,&tileHeader);
+    if (header)
+        *header = std::make_shared<LasHeaderCopy>(*tileHeader);
+    laszip_point_struct *p;
+    laszip_get_point_pointer(reader,&p);
+
+    tilePoints.numExtraBytes = std::max(0,(int)tileHeader->point_data_record_length - PointRecordLength(tileHeader->point_data_format));
+    long long numPoints = getNumRecords(tileHeader);
+    bool ok = true;
+    tilePoints.points.reserve(numPoints);
+    for (long long ii=0;ii<numPoints;ii++)
+    {
+        if (laszip_read_point(reader))
+        {
+            fprintf(stderr,"Failed to read point from tile %s\n",TileName(tileID).c_str());
+            ok = false;
+            break;
+        }
+        tilePoints.points.push_back(*p);
+        tilePoints.points.back().extra_bytes = NULL;
+        if (tilePoints.numExtraBytes > 0)
+            tilePoints.extraBytes.insert(tilePoints.extraBytes.end(),p->extra_bytes,p->extra_bytes+tilePoints.numExtraBytes);
+    }
+
+    laszip_close_reader(reader);
+    laszip_destroy(reader);
+    remove(tileFile.c_str());
+
+    return ok;
+}
+
+laszip_header_struct LidarAppender::tileHeader(TileIdent tileID)
+{
+    laszip_header_struct header = rootHeader->header;
+    getTileBounds(tileID,header.min_x,header.min_y,header.max_x,header.max_y);
+    header.min_z = fullMinZ;
+    header.max_z = fullMaxZ;
+    header.number_of_point_records = 0;
+    header.extended_number_of_point_records = 0;
+
+    return header;
+}
+
+void LidarAppender::writeTile(TileIdent tileID,TilePoints &tilePoints,LidarDatabase *lidarDB)
+{
+    laszip_header_struct header = tileHeader(tileID);
+    TileBufferRef buffer;
+    laszip_POINTER tileW = startTile(&header,buffer);
+    TileGroundGrid grid(gridSize,gridSize,header.min_x,header.min_y,header.max_x,header.max_y);
+
+    int tileMaxColor = 0;
+    for (unsigned int ii=0;ii<tilePoints.points.size();ii++)
+    {
+        laszip_point_struct *p = &tilePoints.points[ii];
+        if (tilePoints.numExtraBytes > 0)
+            p->extra_bytes = &tilePoints.extraBytes[ii*tilePoints.numExtraBytes];
+        if (header.point_data_format > 2)
+            tileMaxColor = PointMaxColor(tileMaxColor,p);
+        if (laszip_set_point(tileW,p) ||
+            laszip_write_point(tileW) ||
+            laszip_update_inventory(tileW))
+            throw (std::string)"Failed to write point in tile";
+        grid.addPoint(p->X * header.x_scale_factor + header.x_offset,p->Y * header.y_scale_factor + header.y_offset,p->Z * header.z_scale_factor + header.z_offset);
+        p->extra_bytes = NULL;
+    }
+
+    finishTile(tileW,std::move(buffer),tileID,tilePoints.points.size(),tilePoints.points.size(),tileMaxColor,grid,lidarDB);
+}
+
+bool LidarAppender::copyNewPoints(LidarMultiWrapper *inputDB,const std::string &spillFile,double newBounds[6])
+{
+    const laszip_header_struct &inHeader = inputDB->header;
+    const laszip_header_struct &dbHeader = rootHeader->header;
+    int numExtraBytes = std::max(0,(int)dbHeader.point_data_record_length - PointRecordLength(dbHeader.point_data_format));
+    bool sameQuant = inHeader.x_scale_factor == dbHeader.x_scale_factor && inHeader.x_offset == dbHeader.x_offset &&
+                     inHeader.y_scale_factor == dbHeader.y_scale_factor && inHeader.y_offset == dbHeader.y_offset &&
+                     inHeader.z_scale_factor == dbHeader.z_scale_factor && inHeader.z_offset == dbHeader.z_offset;
+
+    for (unsigned int ii=0;ii<3;ii++)
+    {
+        newBounds[ii] = std::numeric_limits<double>::max();
+        newBounds[ii+3] = -std::numeric_limits<double>::max();
+    }
+
+    long long estimate = sizeof(SpillFileHeader) + getNumRecords(inputDB->header) * (long long)SpillRecordSize(numExtraBytes);
+    if (!scheduler->startSplit(estimate))
+        return false;
+    SpillWriter spillW(spillFile,dbHeader.point_data_format,numExtraBytes);
+    bool ok = spillW.isValid();
+    try {
+        PointBlock block;
+        while (ok && inputDB->getNextBlock(block) > 0)
+            for (int ii=0;ii<block.getNumPoints();ii++)
+            {
+                laszip_point_struct p = block.points[ii];
+                if (!sameQuant)
+                {
+                    p.X = Requantize(p.X * inHeader.x_scale_factor + inHeader.x_offset,dbHeader.x_scale_factor,dbHeader.x_offset);
+                    p.Y = Requantize(p.Y * inHeader.y_scale_factor + inHeader.y_offset,dbHeader.y_scale_factor,dbHeader.y_offset);
+                    p.Z = Requantize(p.Z * inHeader.z_scale_factor + inHeader.z_offset,dbHeader.z_scale_factor,dbHeader.z_offset);
+                }
+                double coords[3] = {p.X * dbHeader.x_scale_factor + dbHeader.x_offset,
+                                    p.Y * dbHeader.y_scale_factor + dbHeader.y_offset,
+                                    p.Z * dbHeader.z_scale_factor + dbHeader.z_offset};
+                for (unsigned int ci=0;ci<3;ci++)
+                {
+                    newBounds[ci] = std::min(newBounds[ci],coords[ci]);
+                    newBounds[ci+3] = std::max(newBounds[ci+3],coords[ci]);
+                }
+                if (!spillW.addPoint(&p))
+                {
+                    ok = false;
+                    break;
+                }
+            }
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        ok = false;
+    }
+    ok = spillW.close() && ok;
+    scheduler->finishSplit(estimate,spillW.getFileSize());
+    if (ok && spillW.getNumPoints() == 0)
+    {
+        fprintf(stderr,"No new points to add.\n");
+        ok = false;
+    }
+
+    return ok;
+}
+
+bool LidarAppender::spreadRoot(TileIdent oldRoot,LidarDatabase *lidarDB)
+{
+    TilePoints oldPoints;
+    if (!readTile(oldRoot,lidarDB,oldPoints))
+        return false;
+
+    // The old root's points were picked by priority at level 0, so their priorities are all low.
+    // Shuffle them with the hash for where the tile is now and hand out equal shares.
+    int numLevels = oldRoot.z+1;
+    std::vector<std::pair<uint64_t,unsigned int> > order;
+    for (unsigned int ii=0;ii<oldPoints.points.size();ii++)
+        order.push_back(std::make_pair(PointPriority(oldRoot.x,oldRoot.y,oldRoot.z,&oldPoints.points[ii]),ii));
+    std::sort(order.begin(),order.end());
+    std::vector<TilePoints> shares(numLevels);
+    for (auto &share : shares)
+        share.numExtraBytes = oldPoints.numExtraBytes;
+    for (unsigned int oi=0;oi<order.size();oi++)
+    {
+        unsigned int ii = order[oi].second;
+        int level = (int)(((long long)oi * numLevels) / order.size());
+        shares[level].points.push_back(oldPoints.points[ii]);
+        if (oldPoints.numExtraBytes > 0)
+        {
+            auto extraStart = oldPoints.extraBytes.begin() + ii*oldPoints.numExtraBytes;
+            shares[level].extraBytes.insert(shares[level].extraBytes.end(),extraStart,extraStart+oldPoints.numExtraBytes);
+        }
+    }
+
+    try {
+        for (int level=0;level<numLevels;level++)
+        {
+            int shift = oldRoot.z - level;
+            TileIdent tileID(oldRoot.x >> shift,oldRoot.y >> shift,level);
+            writeTile(tileID,shares[level],lidarDB);
+
+            // The index needs to know about these for the counts
+            if (level == oldRoot.z)
+            {
+                for (auto &tile : tiles)
+                    if (tile.level == oldRoot.z && tile.x == oldRoot.x && tile.y == oldRoot.y)
+                        tile.count = shares[level].points.size();
+            } else {
+                LidarDatabase::TileEntry tile;
+                tile.x = tileID.x;  tile.y = tileID.y;  tile.level = tileID.z;
+                tile.count = shares[level].points.size();
+                tiles.push_back(tile);
+            }
+        }
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void LidarAppender::buildCounts()
+{
+    tileCounts.clear();
+    subtreeCounts.clear();
+    for (const auto &tile : tiles)
+    {
+        // Tiles without metadata count as the minimum
+        long long count = tile.count >= 0 ? tile.count : minPointLimit;
+        tileCounts[TileKeyMake(tile.x,tile.y,tile.level)] = count;
+        for (int level=tile.level;level>=0;level--)
+        {
+            int shift = tile.level - level;
+            subtreeCounts[TileKeyMake(tile.x >> shift,tile.y >> shift,level)] += count;
+        }
+    }
+}
+
+long long LidarAppender::subtreeCount(TileIdent tileID)
+{
+    auto it = subtreeCounts.find(TileKeyMake(tileID.x,tileID.y,tileID.z));
+    return it == subtreeCounts.end() ? 0 : it->second;
+}
+
+bool LidarAppender::appendSubFile(const std::string &subFile,TileIdent subIdent,LidarDatabase *lidarDB)
+{
+    std::unique_ptr<LidarMultiWrapper> subWrap(new LidarMultiWrapper(subFile,rootHeader,rootProjStr));
+    if (!subWrap->init())
+    {
+        setFailed((std::string)"Failed to read temp tile file " + TileName(subIdent));
+        return false;
+    }
+    if (!appendNode(subWrap.get(),subIdent,lidarDB,true))
+    {
+        setFailed((std::string)"Failed to add to tile " + TileName(subIdent));
+        return false;
+    }
+
+    return true;
+}
+
+bool LidarAppender::appendNode(LidarMultiWrapper *inputDB,TileIdent tileID,LidarDatabase *lidarDB,bool removeAfterDone)
+{
+    // Nothing here before, so this is just a regular build
+    long long numOld = subtreeCount(tileID);
+    if (numOld == 0)
+        return LidarSorter::process(inputDB,tileID,SampleGridRef(),lidarDB,removeAfterDone);
+
+    long long splitReserved = 0;
+    try {
+        TilePoints oldPoints;
+        if (tileCounts.find(TileKeyMake(tileID.x,tileID.y,tileID.z)) != tileCounts.end() &&
+            !readTile(tileID,lidarDB,oldPoints))
+            throw (std::string)"Failed to read tile " + TileName(tileID);
+
+        TileIdent subTileIDs[4];
+        bool hasChildren = false;
+        for (unsigned int sy=0;sy<2;sy++)
+            for (unsigned int sx=0;sx<2;sx++)
+            {
+                TileIdent &subIdent = subTileIDs[sy*2+sx];
+                subIdent = TileIdent(2*tileID.x + sx,2*tileID.y + sy,tileID.z+1);
+                if (subtreeCount(subIdent) > 0)
+                    hasChildren = true;
+            }
+
+        const laszip_header_struct &inHeader = inputDB->header;
+        long long numNew = getNumRecords(inputDB->header);
+        int numExtraBytes = std::max(0,(int)inHeader.point_data_record_length - PointRecordLength(inHeader.point_data_format));
+
+        // A leaf that's too big now gets split up like any other tile, old points and new together
+        if (!hasChildren && (long long)oldPoints.points.size() + numNew > maxPointLimit)
+        {
+            std::string mergeFile = tmpDir + "/merge_" + std::to_string(tileID.x) + "_" + std::to_string(tileID.y) + "_" + std::to_string(tileID.z) + ".spill";
+            long long estimate = sizeof(SpillFileHeader) + (oldPoints.points.size() + numNew) * (long long)SpillRecordSize(numExtraBytes);
+            if (!scheduler->startSplit(estimate))
+                throw (std::string)"Out of temp space merging tile " + TileName(tileID);
+            splitReserved = estimate;
+
+            SpillWriter mergeW(mergeFile,inHeader.point_data_format,numExtraBytes);
+            bool ok = mergeW.isValid();
+            for (unsigned int ii=0;ok && ii<oldPoints.points.size();ii++)
+            {
+                laszip_point_struct *p = &oldPoints.points[ii];
+                if (numExtraBytes > 0)
+                    p->extra_bytes = &oldPoints.extraBytes[ii*numExtraBytes];
+                ok = mergeW.addPoint(p);
+            }
+            PointBlock block;
+            while (ok && inputDB->getNextBlock(block) > 0)
+                for (int ii=0;ok && ii<block.getNumPoints();ii++)
+                    ok = mergeW.addPoint(&block.points[ii]);
+            ok = mergeW.close() && ok;
+            scheduler->finishSplit(splitReserved,mergeW.getFileSize());
+            splitReserved = 0;
+            if (!ok)
+                throw (std::string)"Failed to write merge file " + mergeFile;
+
+            if (removeAfterDone)
+                removeInput(inputDB);
+
+            return processSubFile(mergeFile,tileID,SampleGridRef(),lidarDB);
+        }
+
+        // Keep all the old points and take the new ones at the rate we'd use for everything together
+        bool allPoints = !hasChildren;
+        PointSampler sampler(PointSampler::Random,tileID.x,tileID.y,tileID.z,numOld+numNew,minPointLimit,SampleGridRef());
+
+        laszip_header_struct header = tileHeader(tileID);
+        TileBufferRef buffer;
+        laszip_POINTER tileW = startTile(&header,buffer);
+        TileGroundGrid grid(gridSize,gridSize,header.min_x,header.min_y,header.max_x,header.max_y);
+        int tileMaxColor = 0;
+        long long numCopiedToTile = 0;
+        auto writePoint = [&](const laszip_point_struct *p,double x,double y)
+        {
+            if (header.point_data_format > 2)
+                tileMaxColor = PointMaxColor(tileMaxColor,p);
+            if (laszip_set_point(tileW,p) ||
+                laszip_write_point(tileW) ||
+                laszip_update_inventory(tileW))
+                throw (std::string)"Failed to write point in tile";
+            grid.addPoint(x,y,p->Z * header.z_scale_factor + header.z_offset);
+            numCopiedToTile++;
+            totalWrittenPoints++;
+        };
+        for (unsigned int ii=0;ii<oldPoints.points.size();ii++)
+        {
+            laszip_point_struct *p = &oldPoints.points[ii];
+            if (numExtraBytes > 0)
+                p->extra_bytes = &oldPoints.extraBytes[ii*numExtraBytes];
+            writePoint(p,p->X * header.x_scale_factor + header.x_offset,p->Y * header.y_scale_factor + header.y_offset);
+        }
+
+        std::unique_ptr<SpillWriter> subSpills[4];
+        std::string subTileNames[4];
+        long long subTileCount[4] = {0,0,0,0};
+        if (!allPoints)
+        {
+            long long estimate = 4*sizeof(SpillFileHeader) + numNew * (long long)SpillRecordSize(numExtraBytes);
+            if (!scheduler->startSplit(estimate))
+                throw (std::string)"Out of temp space splitting tile " + TileName(tileID);
+            splitReserved = estimate;
+            for (unsigned int ii=0;ii<4;ii++)
+            {
+                const TileIdent &subIdent = subTileIDs[ii];
+                subTileNames[ii] = tmpDir + "/app_" + std::to_string(subIdent.x) + "_" + std::to_string(subIdent.y) + "_" + std::to_string(subIdent.z) + ".spill";
+                subSpills[ii].reset(new SpillWriter(subTileNames[ii],inHeader.point_data_format,numExtraBytes));
+                if (!subSpills[ii]->isValid())
+                    throw (std::string)"Failed to open spill file " + subTileNames[ii];
+            }
+        }
+
+        double spanX_2 = (header.max_x-header.min_x)/2.0;
+        double spanY_2 = (header.max_y-header.min_y)/2.0;
+        int32_t splitX = QuantizedSplit(header.x_scale_factor,header.x_offset,header.min_x,spanX_2);
+        int32_t splitY = QuantizedSplit(header.y_scale_factor,header.y_offset,header.min_y,spanY_2);
+        PointBlock block;
+        std::vector<double> blockX(block.getCapacity()),blockY(block.getCapacity());
+        std::vector<uint8_t> blockQuads(block.getCapacity());
+        while (int numInBlock = inputDB->getNextBlock(block))
+        {
+            ScaleOffsetInts(&block.x[0],numInBlock,header.x_scale_factor,header.x_offset,&blockX[0]);
+            ScaleOffsetInts(&block.y[0],numInBlock,header.y_scale_factor,header.y_offset,&blockY[0]);
+            if (!allPoints)
+                ClassifyQuadrants(&block.x[0],&block.y[0],numInBlock,splitX,splitY,&blockQuads[0]);
+
+            for (int ii=0;ii<numInBlock;ii++)
+            {
+                laszip_point_struct *p = &block.points[ii];
+                if (allPoints || sampler.keepPoint(p,blockX[ii],blockY[ii]))
+                    writePoint(p,blockX[ii],blockY[ii]);
+                else {
+                    int whichTile = blockQuads[ii];
+                    subTileCount[whichTile]++;
+                    if (!subSpills[whichTile]->addPoint(p))
+                        throw (std::string)"Failed to write point in spill file";
+                }
+            }
+        }
+
+        finishTile(tileW,std::move(buffer),tileID,numCopiedToTile,oldPoints.points.size()+numNew,tileMaxColor,grid,lidarDB);
+
+        if (!allPoints)
+        {
+            long long actual = 0;
+            bool closed = true;
+            for (unsigned int ii=0;ii<4;ii++)
+            {
+                closed = subSpills[ii]->close() && closed;
+                subSpills[ii].reset();
+                if (subTileCount[ii] == 0)
+                {
+                    std::remove(subTileNames[ii].c_str());
+                    subTileNames[ii] = "";
+                } else
+                    actual += TempFileSize(subTileNames[ii]);
+            }
+            scheduler->finishSplit(splitReserved,actual);
+            splitReserved = 0;
+            if (!closed)
+                throw (std::string)"Failed to finish spill files for tile " + TileName(tileID);
+        }
+
+        if (removeAfterDone)
+            removeInput(inputDB);
+
+        // Smallest first, to keep the temp space down
+        if (!allPoints)
+        {
+            int order[4] = {0,1,2,3};
+            std::stable_sort(order,order+4,[&](int a,int b){ return subTileCount[a] < subTileCount[b]; });
+            for (unsigned int oi=0;oi<4;oi++)
+            {
+                int which = order[oi];
+                if (!subTileNames[which].empty() && !appendSubFile(subTileNames[which],subTileIDs[which],lidarDB))
+                    return false;
+            }
+        }
+    }
+    catch (const std::string &reason)
+    {
+        if (splitReserved > 0)
+            scheduler->finishSplit(splitReserved,splitReserved);
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+
+    return true;
+}
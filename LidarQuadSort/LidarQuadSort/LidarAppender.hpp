@@ -0,0 +1,94 @@
+//
+//  LidarAppender.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef LidarAppender_hpp
+#define LidarAppender_hpp
+
+#include "LidarSorter.hpp"
+#include <unordered_map>
+#include <unordered_set>
+
+/* Adds new points to a tile database we've already built, rather than starting over.
+
+    The new points are routed down the existing tree.  A tile they pass through
+    keeps its old points and takes a share of the new ones, sampled at the rate
+    it would have used for all of them together.  The rest go on to its children.
+    A leaf that ends up with too many points is split the usual way, and any area
+    the tree didn't reach before is built from scratch.  Tiles the new points don't
+    reach are left alone.
+
+    If the new points fall outside the existing extent, the extent doubles until
+    they fit and the old tiles move down a level each time.  The old root's points
+    are shared out between it and the new tiles above it, so there's still
+    something to look at from a distance.
+  */
+class LidarAppender : public LidarSorter
+{
+public:
+    LidarAppender(const char *tmp_dir);
+
+    // Add the points from inputDB to lidarDB, which needs to be a full data database we built
+    virtual bool process(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB);
+    using LidarSorter::process;
+
+    // Number of tiles that were already there and got written again
+    long long getNumTilesRewritten() { return numRewritten; }
+
+    // Number of tiles that weren't there before
+    long long getNumTilesAdded() { return numAdded; }
+
+protected:
+    /* Points from a tile in the database.
+      */
+    class TilePoints
+    {
+    public:
+        TilePoints() : numExtraBytes(0) { }
+        std::vector<laszip_point_struct> points;
+        std::vector<laszip_U8> extraBytes;
+        int numExtraBytes;
+    };
+
+    // Keep track of which tiles we wrote
+    virtual void finishTile(laszip_POINTER tileW,TileBufferRef buffer,TileIdent tileID,long long numCopiedToTile,long long numInput,int tileMaxColor,const TileGroundGrid &grid,LidarDatabase *lidarDB);
+
+    // Read the points for a tile out of the database, and optionally its header
+    bool readTile(TileIdent tileID,LidarDatabase *lidarDB,TilePoints &tilePoints,std::shared_ptr<LasHeaderCopy> *header = NULL);
+
+    // Write a tile containing just these points
+    void writeTile(TileIdent tileID,TilePoints &tilePoints,LidarDatabase *lidarDB);
+
+    // Copy the new points into a spill file using the database's scale and offset
+    bool copyNewPoints(LidarMultiWrapper *inputDB,const std::string &spillFile,double newBounds[6]);
+
+    // Share the old root's points out between it and the new tiles above it
+    bool spreadRoot(TileIdent oldRoot,LidarDatabase *lidarDB);
+
+    // Add new points to a tile that has existing points under it
+    bool appendNode(LidarMultiWrapper *inputDB,TileIdent tileID,LidarDatabase *lidarDB,bool removeAfterDone);
+
+    // Open a spill file of new points and add them under the given tile
+    bool appendSubFile(const std::string &subFile,TileIdent subIdent,LidarDatabase *lidarDB);
+
+    // Work out how many existing points there are under each tile
+    void buildCounts();
+
+    // Number of existing points in the given tile and everything under it
+    long long subtreeCount(TileIdent tileID);
+
+    // Header for a tile we're writing
+    laszip_header_struct tileHeader(TileIdent tileID);
+
+    // Tiles in the database, with their point counts
+    std::vector<LidarDatabase::TileEntry> tiles;
+    std::unordered_map<int64_t,long long> tileCounts,subtreeCounts;
+    std::unordered_set<int64_t> originalTiles,writtenTiles;
+    long long numRewritten,numAdded;
+};
+
+#endif /* LidarAppender_hpp */
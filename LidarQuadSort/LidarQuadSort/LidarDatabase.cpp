@@ -7,13 +7,36 @@
 //
 
 #include "LidarDatabase.hpp"
+#include "TileKey.h"
+#include <algorithm>
 
 using namespace Kompex;
 
-LidarDatabase::LidarDatabase(Kompex::SQLiteDatabase *db,Type type)
-    : valid(true), insertStmt(NULL), db(db)
+// Run a pragma (or VACUUM).  Some of these return rows, which Kompex doesn't like, so go straight to sqlite.
+static bool RunPragma(Kompex::SQLiteDatabase *db,const std::string &pragma)
+{
+    char *errMsg = NULL;
+    if (sqlite3_exec(db->GetDatabaseHandle(),pragma.c_str(),NULL,NULL,&errMsg) != SQLITE_OK)
+    {
+        fprintf(stderr,"Failed to run %s: %s\n",pragma.c_str(),errMsg ? errMsg : "unknown error");
+        sqlite3_free(errMsg);
+        return false;
+    }
+    
+    return true;
+}
+
+LidarDatabase::LidarDatabase(Kompex::SQLiteDatabase *db,Type type,const WriteOptions &options,TileKeyScheme tileKey)
+    : type(type), tileKey(tileKey), valid(true), tileCodec(TileCodecLAZ), db(db), options(options), metrics(NULL), insertStmt(NULL), metaStmt(NULL), queue(NULL), writerFailed(false), inBatch(false), batchCount(0), holdBatch(false), numQueued(0), numWritten(0)
 {
     SQLiteStatement stmt(db);
+    
+    // Set up for bulk loading.  Page size has to go in before the tables do.
+    if (options.pageSize > 0)
+        RunPragma(db,"PRAGMA page_size=" + std::to_string(options.pageSize) + ";");
+    if (!options.journalMode.empty())
+        RunPragma(db,"PRAGMA journal_mode=" + options.journalMode + ";");
+    RunPragma(db,options.synchronous ? "PRAGMA synchronous=FULL;" : "PRAGMA synchronous=OFF;");
 
     // Create the manifest (table)
     try {
@@ -26,94 +49,694 @@ LidarDatabase::LidarDatabase(Kompex::SQLiteDatabase *db,Type type)
         stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD pointtype INTEGER DEFAULT 0 NOT NULL;");
         stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD name TEXT DEFAULT '' NOT NULL;");
         stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD maxcolor INTEGER DEFAULT 0 NOT NULL;");
+        // Which TileKeyScheme the quadindex column uses.  Older databases don't have this and are row major.
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD tilekey INTEGER DEFAULT 0 NOT NULL;");
+        // For IndexOnly, the LAZ file with the points in it, relative to the database
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD lazfile TEXT DEFAULT '' NOT NULL;");
+        // TileCodec for the blobs.  Compact tiles don't have headers, so the quantization lives here.
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD tilecodec INTEGER DEFAULT 0 NOT NULL;");
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD xscale REAL DEFAULT 1.0 NOT NULL;");
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD yscale REAL DEFAULT 1.0 NOT NULL;");
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD zscale REAL DEFAULT 1.0 NOT NULL;");
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD xoffset REAL DEFAULT 0.0 NOT NULL;");
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD yoffset REAL DEFAULT 0.0 NOT NULL;");
+        stmt.SqlStatement((std::string)"ALTER TABLE manifest ADD zoffset REAL DEFAULT 0.0 NOT NULL;");
 
+        // Octree tiles can share a level, x and y, so they need their vertical cell too
+        std::string zCellCol = (tileKey == TileKeyOctree) ? "zcell INTEGER," : "";
         switch (type)
         {
             case FullData:
-                stmt.SqlStatement("CREATE TABLE lidartiles (data BLOB,level INTEGER,x INTEGER,y INTEGER,quadindex INTEGER PRIMARY KEY);");
+                stmt.SqlStatement("CREATE TABLE lidartiles (data BLOB,level INTEGER,x INTEGER,y INTEGER," + zCellCol + "quadindex INTEGER PRIMARY KEY);");
                 break;
             case IndexOnly:
-                stmt.SqlStatement("CREATE TABLE tileaddress (start BIGINT, count INTEGER, level INTEGER,x INTEGER,y INTEGER,quadindex INTEGER PRIMARY KEY);");
+                stmt.SqlStatement("CREATE TABLE tileaddress (start BIGINT, count INTEGER, level INTEGER,x INTEGER,y INTEGER," + zCellCol + "quadindex INTEGER PRIMARY KEY);");
+                break;
+            case Columnar:
+                // Keyed so the columns of a tile sit together and a reader only touches the ones it asks for
+                stmt.SqlStatement("CREATE TABLE lidarcolumns (data BLOB,attr INTEGER,level INTEGER,x INTEGER,y INTEGER," + zCellCol + "quadindex INTEGER,columnkey INTEGER PRIMARY KEY);");
                 break;
         }
+        // Height range and ground grid for each tile, so readers don't need the points for that
+        stmt.SqlStatement("CREATE TABLE tilemeta (minz REAL,maxz REAL,count INTEGER,gridx INTEGER,gridy INTEGER,grid BLOB,quadindex INTEGER PRIMARY KEY);");
     } catch (SQLiteException &exc) {
         fprintf(stderr,"Failed to write to database:\n%s\n",exc.GetString().c_str());
         valid = false;
+        return;
+    }
+    
+    startWriter();
+}
+
+LidarDatabase::LidarDatabase(Kompex::SQLiteDatabase *db,const WriteOptions &options)
+    : type(FullData), tileKey(TileKeyMorton), valid(true), tileCodec(TileCodecLAZ), db(db), options(options), metrics(NULL), insertStmt(NULL), metaStmt(NULL), queue(NULL), writerFailed(false), inBatch(false), batchCount(0), holdBatch(false), numQueued(0), numWritten(0)
+{
+    // This database has data we can't rebuild, so a crash part way through has to leave it intact.
+    // That rules out the bulk load settings: the journal goes on disk and we keep the syncs.
+    RunPragma(db,"PRAGMA journal_mode=DELETE;");
+    RunPragma(db,options.synchronous ? "PRAGMA synchronous=FULL;" : "PRAGMA synchronous=NORMAL;");
+
+    // Figure out what kind of database this is from the tables
+    try {
+        SQLiteStatement stmt(db);
+        bool hasTiles = false, hasAddresses = false, hasColumns = false;
+        stmt.Sql("SELECT name FROM sqlite_master WHERE type='table';");
+        while (stmt.FetchRow())
+        {
+            std::string name = stmt.GetColumnString(0);
+            if (name == "lidartiles")
+                hasTiles = true;
+            else if (name == "tileaddress")
+                hasAddresses = true;
+            else if (name == "lidarcolumns")
+                hasColumns = true;
+        }
+        stmt.FreeQuery();
+        if (!hasTiles && !hasAddresses && !hasColumns)
+        {
+            fprintf(stderr,"No tiles in existing database.\n");
+            valid = false;
+            return;
+        }
+        type = hasTiles ? FullData : (hasAddresses ? IndexOnly : Columnar);
+        
+        // Older databases won't have the metadata
+        stmt.SqlStatement("CREATE TABLE IF NOT EXISTS tilemeta (minz REAL,maxz REAL,count INTEGER,gridx INTEGER,gridy INTEGER,grid BLOB,quadindex INTEGER PRIMARY KEY);");
+    } catch (SQLiteException &exc) {
+        fprintf(stderr,"Failed to read existing database:\n%s\n",exc.GetString().c_str());
+        valid = false;
+        return;
+    }
+    
+    // Keys we add have to match the ones already there.  Older databases don't say and are row major.
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("SELECT tilekey FROM manifest;");
+        if (stmt.FetchRow())
+            tileKey = (TileKeyScheme)stmt.GetColumnInt(0);
+        stmt.FreeQuery();
+    }
+    catch (SQLiteException &)
+    {
+        tileKey = TileKeyRowMajor;
+    }
+    
+    startWriter();
+}
+
+void LidarDatabase::startWriter()
+{
+    // Tiles go through the queue to a writer thread
+    if (options.asyncWrites)
+    {
+        queue = new BoundedQueue<PendingTile>(options.queueSize);
+        writerThread = std::thread(&LidarDatabase::runWriter,this);
     }
+}
 
-    valid = true;
+LidarDatabase::~LidarDatabase()
+{
+    flush();
+}
+
+std::string LidarDatabase::tileTable()
+{
+    switch (type)
+    {
+        case FullData:
+            return "lidartiles";
+        case IndexOnly:
+            return "tileaddress";
+        case Columnar:
+            return "lidarcolumns";
+    }
+    
+    return "lidartiles";
+}
+
+int64_t LidarDatabase::makeKey(int x,int y,int zCell,int level)
+{
+    if (tileKey == TileKeyOctree)
+        return TileKeyMakeOctree(x,y,zCell,level);
+    
+    return TileKeyMake(x,y,level,tileKey);
+}
+
+std::string LidarDatabase::tileInsertSql(const std::string &table,std::vector<std::string> columns)
+{
+    if (tileKey == TileKeyOctree)
+        columns.push_back("zcell");
+    std::string names,values;
+    for (const auto &column : columns)
+    {
+        names += (names.empty() ? "" : ",") + column;
+        values += (values.empty() ? "@" : ",@") + column;
+    }
+    
+    return "INSERT OR REPLACE INTO " + table + " (" + names + ") VALUES (" + values + ");";
 }
 
 bool LidarDatabase::setHeader(const char *srs,const char *name,double minX,double minY,double minZ,double maxX,double maxY,double maxZ,int minLevel,int maxLevel,int minPoints,int maxPoints,int pointType,int maxColor)
 {
+    drainQueue();
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
     SQLiteStatement stmt(db);
 
+    // There's only ever one header, so appending to a database replaces it
     char stmtStr[1024];
-    sprintf(stmtStr,"INSERT INTO manifest (minx,miny,minz,maxx,maxy,maxz,minlevel,maxlevel,minpoints,maxpoints,srs,name,pointtype,maxcolor) VALUES (%f,%f,%f,%f,%f,%f,%d,%d,%d,%d,'%s','%s',%d,%d);",minX,minY,minZ,maxX,maxY,maxZ,minLevel,maxLevel,minPoints,maxPoints,(srs ? srs : ""),name,pointType,maxColor);
-    stmt.SqlStatement(stmtStr);
+    sprintf(stmtStr,"INSERT INTO manifest (minx,miny,minz,maxx,maxy,maxz,minlevel,maxlevel,minpoints,maxpoints,srs,name,pointtype,maxcolor,tilekey) VALUES (%f,%f,%f,%f,%f,%f,%d,%d,%d,%d,'%s','%s',%d,%d,%d);",minX,minY,minZ,maxX,maxY,maxZ,minLevel,maxLevel,minPoints,maxPoints,(srs ? srs : ""),name,pointType,maxColor,(int)tileKey);
+    try {
+        stmt.SqlStatement((std::string)"DELETE FROM manifest;");
+        stmt.SqlStatement(stmtStr);
+        // Older databases don't have this column, but they don't have a LAZ file either
+        if (!lazFile.empty())
+        {
+            stmt.Sql("UPDATE manifest SET lazfile=@lazfile;");
+            stmt.BindString(1, lazFile);
+            stmt.ExecuteAndFree();
+        }
+        if (tileCodec != TileCodecLAZ)
+        {
+            stmt.Sql("UPDATE manifest SET tilecodec=@tilecodec,xscale=@xscale,yscale=@yscale,zscale=@zscale,xoffset=@xoffset,yoffset=@yoffset,zoffset=@zoffset;");
+            stmt.BindInt(1, (int)tileCodec);
+            for (int ii=0;ii<3;ii++)
+            {
+                stmt.BindDouble(2+ii, tileQuant.scale[ii]);
+                stmt.BindDouble(5+ii, tileQuant.offset[ii]);
+            }
+            stmt.ExecuteAndFree();
+        }
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to write manifest to database:\n%s\n",except.GetString().c_str());
+        return false;
+    }
     
     return true;
 }
 
-bool LidarDatabase::addTile(const void *tileData,int dataSize,int x,int y,int level)
+bool LidarDatabase::getManifest(Manifest &manifest)
 {
-    // Calculate a quad index for later use
-    int quadIndex = 0;
-    for (int iq=0;iq<level;iq++)
-        quadIndex += (1<<iq)*(1<<iq);
-    quadIndex += y*(1<<level) + x;
+    drainQueue();
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    bool found = false;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("SELECT minx,miny,minz,maxx,maxy,maxz,minlevel,maxlevel,minpoints,maxpoints,srs,name,pointtype,maxcolor FROM manifest;");
+        if (stmt.FetchRow())
+        {
+            manifest.minX = stmt.GetColumnDouble(0);  manifest.minY = stmt.GetColumnDouble(1);  manifest.minZ = stmt.GetColumnDouble(2);
+            manifest.maxX = stmt.GetColumnDouble(3);  manifest.maxY = stmt.GetColumnDouble(4);  manifest.maxZ = stmt.GetColumnDouble(5);
+            manifest.minLevel = stmt.GetColumnInt(6);
+            manifest.maxLevel = stmt.GetColumnInt(7);
+            manifest.minPoints = stmt.GetColumnInt(8);
+            manifest.maxPoints = stmt.GetColumnInt(9);
+            manifest.srs = stmt.GetColumnString(10);
+            manifest.name = stmt.GetColumnString(11);
+            manifest.pointType = stmt.GetColumnInt(12);
+            manifest.maxColor = stmt.GetColumnInt(13);
+            found = true;
+        }
+        stmt.FreeQuery();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to read manifest from database:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    
+    // Older databases won't have the key scheme either, and they're all row major
+    manifest.tileKey = TileKeyRowMajor;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("SELECT tilekey FROM manifest;");
+        if (stmt.FetchRow())
+            manifest.tileKey = stmt.GetColumnInt(0);
+        stmt.FreeQuery();
+    }
+    catch (SQLiteException &)
+    {
+    }
+    
+    // Older databases won't have the codec columns, and they're all LAZ
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("SELECT tilecodec,xscale,yscale,zscale,xoffset,yoffset,zoffset FROM manifest;");
+        if (stmt.FetchRow())
+        {
+            manifest.tileCodec = (TileCodec)stmt.GetColumnInt(0);
+            for (int ii=0;ii<3;ii++)
+            {
+                manifest.quant.scale[ii] = stmt.GetColumnDouble(1+ii);
+                manifest.quant.offset[ii] = stmt.GetColumnDouble(4+ii);
+            }
+        }
+        stmt.FreeQuery();
+    }
+    catch (SQLiteException &)
+    {
+    }
+    
+    return found;
+}
 
-    if (!insertStmt)
+bool LidarDatabase::getTileIndex(std::vector<TileEntry> &tiles)
+{
+    drainQueue();
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    try {
+        SQLiteStatement stmt(db);
+        std::string table = tileTable();
+        // Every columnar tile has positions, so that row stands in for the tile
+        std::string where = (type == Columnar ? " WHERE lidarcolumns.attr=" + std::to_string((int)TileColumnPosition) : "");
+        stmt.Sql("SELECT " + table + ".level," + table + ".x," + table + ".y,tilemeta.count FROM " + table + " LEFT JOIN tilemeta ON " + table + ".quadindex = tilemeta.quadindex" + where + ";");
+        while (stmt.FetchRow())
+        {
+            TileEntry tile;
+            tile.level = stmt.GetColumnInt(0);
+            tile.x = stmt.GetColumnInt(1);
+            tile.y = stmt.GetColumnInt(2);
+            tile.count = (stmt.GetColumnType(3) == SQLITE_NULL) ? -1 : stmt.GetColumnInt64(3);
+            tiles.push_back(tile);
+        }
+        stmt.FreeQuery();
+    }
+    catch (SQLiteException &except)
     {
-        insertStmt = new SQLiteStatement(db);
-        insertStmt->Sql("INSERT INTO lidartiles (data,level,x,y,quadindex) VALUES (@data,@level,@x,@y,@quadindex);");
+        fprintf(stderr,"Failed to read tiles from database:\n%s\n",except.GetString().c_str());
+        return false;
     }
+    
+    return true;
+}
 
-    // Here we've got data to insert
-    if (tileData)
+bool LidarDatabase::getTile(int x,int y,int level,std::string &data)
+{
+    if (type != FullData)
+        return false;
+    
+    drainQueue();
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    bool found = false;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("SELECT data FROM lidartiles WHERE quadindex=@quadindex;");
+        stmt.BindInt64(1, makeKey(x,y,0,level));
+        if (stmt.FetchRow())
+        {
+            const char *blob = (const char *)stmt.GetColumnBlob(0);
+            data.assign(blob ? blob : "",stmt.GetColumnBytes(0));
+            found = true;
+        }
+        stmt.FreeQuery();
+    }
+    catch (SQLiteException &except)
     {
-        // Now insert the samples into the database as a blob
-        try {
-            insertStmt->BindBlob(1, tileData, dataSize);
-            insertStmt->BindInt(2, level);
-            insertStmt->BindInt(3, x);
-            insertStmt->BindInt(4, y);
-            insertStmt->BindInt(5, quadIndex);
-            insertStmt->Execute();
-            insertStmt->Reset();
+        fprintf(stderr,"Failed to read tile from database:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    
+    return found;
+}
+
+bool LidarDatabase::getTileColumns(int x,int y,int level,uint32_t mask,std::vector<std::string> &columns)
+{
+    columns.clear();
+    columns.resize(TileColumnCount);
+    if (type != Columnar)
+        return false;
+    
+    drainQueue();
+    
+    // Only the rows we want, so SQLite never reads the other columns' pages
+    int64_t quadIndex = makeKey(x,y,0,level);
+    std::string keys;
+    for (int column=0;column<TileColumnCount;column++)
+        if (mask & TileColumnBit((TileColumn)column))
+            keys += (keys.empty() ? "" : ",") + std::to_string(TileColumnKey(quadIndex,(TileColumn)column));
+    if (keys.empty())
+        return true;
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    bool found = false;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("SELECT attr,data FROM lidarcolumns WHERE columnkey IN (" + keys + ");");
+        while (stmt.FetchRow())
+        {
+            int column = stmt.GetColumnInt(0);
+            if (column < 0 || column >= TileColumnCount)
+                continue;
+            const char *blob = (const char *)stmt.GetColumnBlob(1);
+            columns[column].assign(blob ? blob : "",stmt.GetColumnBytes(1));
+            if (column == TileColumnPosition)
+                found = true;
         }
-        catch (SQLiteException &except)
+        stmt.FreeQuery();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to read tile columns from database:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    
+    // Without positions there's no tile, even if we didn't ask for them
+    return found || !(mask & TileColumnBit(TileColumnPosition));
+}
+
+bool LidarDatabase::relocateTiles(int levels,int offX,int offY)
+{
+    if (levels <= 0)
+        return true;
+    
+    std::vector<TileEntry> tiles;
+    if (!getTileIndex(tiles))
+        return false;
+    
+    // Deepest first, so a tile never lands on one that hasn't moved yet
+    std::sort(tiles.begin(),tiles.end(),[](const TileEntry &a,const TileEntry &b){ return a.level > b.level; });
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    if (!beginBatch())
+        return false;
+    try {
+        std::string table = tileTable();
+        SQLiteStatement tileStmt(db),metaStmt(db);
+        if (type == Columnar)
+            tileStmt.Sql("UPDATE lidarcolumns SET level=@level,x=@x,y=@y,quadindex=@newindex,columnkey=@newindex*16+attr WHERE columnkey BETWEEN @quadindex*16 AND @quadindex*16+15;");
+        else
+            tileStmt.Sql("UPDATE " + table + " SET level=@level,x=@x,y=@y,quadindex=@newindex WHERE quadindex=@quadindex;");
+        metaStmt.Sql("UPDATE tilemeta SET quadindex=@newindex WHERE quadindex=@quadindex;");
+        for (const auto &tile : tiles)
         {
-            fprintf(stderr,"Failed to write blob to database:\n%s\n",except.GetString().c_str());
-            return false;
+            int newX = (offX << tile.level) + tile.x, newY = (offY << tile.level) + tile.y, newLevel = tile.level + levels;
+            int64_t oldIndex = makeKey(tile.x,tile.y,0,tile.level);
+            int64_t newIndex = makeKey(newX,newY,0,newLevel);
+            
+            tileStmt.BindInt(1, newLevel);
+            tileStmt.BindInt(2, newX);
+            tileStmt.BindInt(3, newY);
+            tileStmt.BindInt64(4, newIndex);
+            tileStmt.BindInt64(5, oldIndex);
+            tileStmt.Execute();
+            tileStmt.Reset();
+            
+            metaStmt.BindInt64(1, newIndex);
+            metaStmt.BindInt64(2, oldIndex);
+            metaStmt.Execute();
+            metaStmt.Reset();
         }
+        tileStmt.FreeQuery();
+        metaStmt.FreeQuery();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to move tiles in database:\n%s\n",except.GetString().c_str());
+        // Half moved tiles are worse than none
+        rollbackBatch();
+        return false;
+    }
+    
+    return commitBatch();
+}
+
+bool LidarDatabase::queueTile(PendingTile &tile)
+{
+    // Only the queue can make us wait, and only when it's full
+    if (writerFailed)
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(countMutex);
+        numQueued++;
+    }
+    if (!queue->push(std::move(tile)))
+    {
+        std::lock_guard<std::mutex> lock(countMutex);
+        numQueued--;
+        writtenCond.notify_all();
+        return false;
+    }
+    
+    return true;
+}
+
+bool LidarDatabase::addTile(const void *tileData,int dataSize,int x,int y,int level,int zCell)
+{
+    // Here we've got data to insert
+    if (!tileData)
+        return true;
+    
+    if (queue)
+    {
+        PendingTile tile;
+        tile.kind = PendingTile::TileData;
+        tile.x = x;  tile.y = y;  tile.level = level;  tile.zCell = zCell;
+        tile.data.assign((const char *)tileData,dataSize);
+        return queueTile(tile);
+    }
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    return writeTile(tileData,dataSize,x,y,level,zCell);
+}
+
+bool LidarDatabase::addTile(TileBufferRef buffer,int x,int y,int level,int zCell)
+{
+    if (!buffer)
+        return true;
+    
+    if (queue)
+    {
+        PendingTile tile;
+        tile.kind = PendingTile::TileData;
+        tile.x = x;  tile.y = y;  tile.level = level;  tile.zCell = zCell;
+        tile.buffer = buffer;
+        return queueTile(tile);
+    }
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    return writeTile(buffer->getData(),(int)buffer->getSize(),x,y,level,zCell);
+}
+
+bool LidarDatabase::addTileColumn(TileColumn column,const void *data,int dataSize,int x,int y,int level,int zCell)
+{
+    if (!data)
+        return true;
+    
+    PendingTile tile;
+    tile.kind = PendingTile::TileColumnData;
+    tile.x = x;  tile.y = y;  tile.level = level;  tile.zCell = zCell;
+    tile.column = column;
+    tile.data.assign((const char *)data,dataSize);
+    if (queue)
+        return queueTile(tile);
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    return writeTileColumn(tile);
+}
+
+bool LidarDatabase::addTileColumn(TileColumn column,TileBufferRef buffer,int x,int y,int level,int zCell)
+{
+    if (!buffer)
+        return true;
+    
+    PendingTile tile;
+    tile.kind = PendingTile::TileColumnData;
+    tile.x = x;  tile.y = y;  tile.level = level;  tile.zCell = zCell;
+    tile.column = column;
+    tile.buffer = buffer;
+    if (queue)
+        return queueTile(tile);
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    return writeTileColumn(tile);
+}
+
+bool LidarDatabase::addTileOffset(long long start,int length,int x,int y,int level,int zCell)
+{
+    PendingTile tile;
+    tile.kind = PendingTile::TileOffset;
+    tile.x = x;  tile.y = y;  tile.level = level;  tile.zCell = zCell;
+    tile.start = start;  tile.count = length;
+    if (queue)
+        return queueTile(tile);
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    return writeTileOffset(start,length,x,y,level,zCell);
+}
+
+bool LidarDatabase::addTileMeta(int x,int y,int level,double minZ,double maxZ,long long count,int gridX,int gridY,const std::string &grid,int zCell)
+{
+    PendingTile tile;
+    tile.kind = PendingTile::TileMeta;
+    tile.x = x;  tile.y = y;  tile.level = level;  tile.zCell = zCell;
+    tile.minZ = minZ;  tile.maxZ = maxZ;
+    tile.count = count;
+    tile.gridX = gridX;  tile.gridY = gridY;
+    tile.data = grid;
+    if (queue)
+        return queueTile(tile);
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    return writeTileMeta(tile);
+}
+
+bool LidarDatabase::beginBatch()
+{
+    if (inBatch)
+        return true;
+    
+    try {
+        SQLiteStatement stmt(db);
+        stmt.SqlStatement((std::string)"BEGIN TRANSACTION;");
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to start transaction:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    inBatch = true;
+    batchCount = 0;
+    
+    return true;
+}
+
+bool LidarDatabase::commitBatch()
+{
+    if (!inBatch)
+        return true;
+    // Keep going in the same transaction
+    if (holdBatch)
+    {
+        batchCount = 0;
+        return true;
+    }
+    
+    inBatch = false;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.SqlStatement((std::string)"END TRANSACTION;");
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to commit transaction:\n%s\n",except.GetString().c_str());
+        return false;
     }
+    
+    return true;
+}
 
+void LidarDatabase::rollbackBatch()
+{
+    if (!inBatch)
+        return;
+    
+    inBatch = false;
+    RunPragma(db,"ROLLBACK;");
+}
+
+bool LidarDatabase::beginTransaction()
+{
+    drainQueue();
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    // Whatever came before goes in on its own
+    if (!commitBatch() || !beginBatch())
+        return false;
+    holdBatch = true;
+    
     return true;
 }
 
-bool LidarDatabase::addTileOffset(long long start,int length,int x,int y,int level)
+bool LidarDatabase::endTransaction(bool commit)
 {
-    // Calculate a quad index for later use
-    int quadIndex = 0;
-    for (int iq=0;iq<level;iq++)
-        quadIndex += (1<<iq)*(1<<iq);
-    quadIndex += y*(1<<level) + x;
+    drainQueue();
     
-    if (!insertStmt)
+    std::lock_guard<std::mutex> lock(dbMutex);
+    holdBatch = false;
+    if (!commit || writerFailed)
     {
-        insertStmt = new SQLiteStatement(db);
-        insertStmt->Sql("INSERT INTO tileaddress (start,count,level,x,y,quadindex) VALUES (@start,@count,@level,@x,@y,@quadindex);");
+        rollbackBatch();
+        return false;
     }
+    
+    return commitBatch();
+}
+
+bool LidarDatabase::writeTile(const void *tileData,int dataSize,int x,int y,int level,int zCell)
+{
+    BuildMetrics::ScopedTimer timer(metrics,BuildMetrics::TimeDatabase);
+    // Morton ordered key, so nearby tiles end up near each other in the file
+    int64_t quadIndex = makeKey(x,y,zCell,level);
+
+    if (!beginBatch())
+        return false;
 
     // Now insert the samples into the database as a blob
     try {
+        if (!insertStmt)
+        {
+            insertStmt = new SQLiteStatement(db);
+            insertStmt->Sql(tileInsertSql("lidartiles",{"data","level","x","y","quadindex"}));
+        }
+
+        // The data sticks around until the insert is done, so SQLite doesn't need its own copy
+        insertStmt->BindBlob(1, tileData, dataSize, SQLITE_STATIC);
+        insertStmt->BindInt(2, level);
+        insertStmt->BindInt(3, x);
+        insertStmt->BindInt(4, y);
+        insertStmt->BindInt64(5, quadIndex);
+        if (tileKey == TileKeyOctree)
+            insertStmt->BindInt(6, zCell);
+        insertStmt->Execute();
+        insertStmt->Reset();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to write blob to database:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    if (metrics)
+    {
+        metrics->add(BuildMetrics::DatabaseBytes,dataSize);
+        metrics->add(BuildMetrics::DatabaseRows,1);
+    }
+
+    if (++batchCount >= options.batchSize)
+        return commitBatch();
+
+    return true;
+}
+
+bool LidarDatabase::writeTileOffset(long long start,int length,int x,int y,int level,int zCell)
+{
+    BuildMetrics::ScopedTimer timer(metrics,BuildMetrics::TimeDatabase);
+    // Morton ordered key, so nearby tiles end up near each other in the file
+    int64_t quadIndex = makeKey(x,y,zCell,level);
+    
+    if (!beginBatch())
+        return false;
+
+    // Now insert the samples into the database as a blob
+    try {
+        if (!insertStmt)
+        {
+            insertStmt = new SQLiteStatement(db);
+            insertStmt->Sql(tileInsertSql("tileaddress",{"start","count","level","x","y","quadindex"}));
+        }
+
         insertStmt->BindInt64(1, start);
         insertStmt->BindInt(2, length);
         insertStmt->BindInt(3, level);
         insertStmt->BindInt(4, x);
         insertStmt->BindInt(5, y);
-        insertStmt->BindInt(6, quadIndex);
+        insertStmt->BindInt64(6, quadIndex);
+        if (tileKey == TileKeyOctree)
+            insertStmt->BindInt(7, zCell);
         insertStmt->Execute();
         insertStmt->Reset();
     }
@@ -122,13 +745,256 @@ bool LidarDatabase::addTileOffset(long long start,int length,int x,int y,int lev
         fprintf(stderr,"Failed to write blob to database:\n%s\n",except.GetString().c_str());
         return false;
     }
+    if (metrics)
+        metrics->add(BuildMetrics::DatabaseRows,1);
+
+    if (++batchCount >= options.batchSize)
+        return commitBatch();
+
+    return true;
+}
+
+bool LidarDatabase::writeTileMeta(const PendingTile &tile)
+{
+    BuildMetrics::ScopedTimer timer(metrics,BuildMetrics::TimeDatabase);
+    int64_t quadIndex = makeKey(tile.x,tile.y,tile.zCell,tile.level);
+    
+    if (!beginBatch())
+        return false;
+    
+    try {
+        if (!metaStmt)
+        {
+            metaStmt = new SQLiteStatement(db);
+            metaStmt->Sql("INSERT OR REPLACE INTO tilemeta (minz,maxz,count,gridx,gridy,grid,quadindex) VALUES (@minz,@maxz,@count,@gridx,@gridy,@grid,@quadindex);");
+        }
+        
+        metaStmt->BindDouble(1, tile.minZ);
+        metaStmt->BindDouble(2, tile.maxZ);
+        metaStmt->BindInt64(3, tile.count);
+        metaStmt->BindInt(4, tile.gridX);
+        metaStmt->BindInt(5, tile.gridY);
+        metaStmt->BindBlob(6, tile.getData(), tile.getSize(), SQLITE_STATIC);
+        metaStmt->BindInt64(7, quadIndex);
+        metaStmt->Execute();
+        metaStmt->Reset();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to write tile metadata to database:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    if (metrics)
+    {
+        metrics->add(BuildMetrics::DatabaseBytes,tile.getSize());
+        metrics->add(BuildMetrics::DatabaseRows,1);
+    }
+    
+    if (++batchCount >= options.batchSize)
+        return commitBatch();
+    
+    return true;
+}
 
+bool LidarDatabase::writeTileColumn(const PendingTile &tile)
+{
+    BuildMetrics::ScopedTimer timer(metrics,BuildMetrics::TimeDatabase);
+    int64_t quadIndex = makeKey(tile.x,tile.y,tile.zCell,tile.level);
+    
+    if (!beginBatch())
+        return false;
+    
+    try {
+        if (!insertStmt)
+        {
+            insertStmt = new SQLiteStatement(db);
+            insertStmt->Sql(tileInsertSql("lidarcolumns",{"data","attr","level","x","y","quadindex","columnkey"}));
+        }
+        
+        insertStmt->BindBlob(1, tile.getData(), tile.getSize(), SQLITE_STATIC);
+        insertStmt->BindInt(2, (int)tile.column);
+        insertStmt->BindInt(3, tile.level);
+        insertStmt->BindInt(4, tile.x);
+        insertStmt->BindInt(5, tile.y);
+        insertStmt->BindInt64(6, quadIndex);
+        insertStmt->BindInt64(7, TileColumnKey(quadIndex,tile.column));
+        if (tileKey == TileKeyOctree)
+            insertStmt->BindInt(8, tile.zCell);
+        insertStmt->Execute();
+        insertStmt->Reset();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to write tile column to database:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    if (metrics)
+    {
+        metrics->add(BuildMetrics::DatabaseBytes,tile.getSize());
+        metrics->add(BuildMetrics::DatabaseRows,1);
+    }
+    
+    if (++batchCount >= options.batchSize)
+        return commitBatch();
+    
     return true;
 }
 
-void LidarDatabase::flush()
+void LidarDatabase::runWriter()
+{
+    PendingTile tile;
+    while (queue->pop(tile))
+    {
+        bool ok = false;
+        if (!writerFailed)
+        {
+            std::lock_guard<std::mutex> lock(dbMutex);
+            switch (tile.kind)
+            {
+                case PendingTile::TileData:
+                    ok = writeTile(tile.getData(),tile.getSize(),tile.x,tile.y,tile.level,tile.zCell);
+                    break;
+                case PendingTile::TileOffset:
+                    ok = writeTileOffset(tile.start,(int)tile.count,tile.x,tile.y,tile.level,tile.zCell);
+                    break;
+                case PendingTile::TileMeta:
+                    ok = writeTileMeta(tile);
+                    break;
+                case PendingTile::TileColumnData:
+                    ok = writeTileColumn(tile);
+                    break;
+            }
+        }
+        if (!ok)
+            writerFailed = true;
+        // Send the buffer back to its pool now, rather than when the next tile replaces it
+        tile.buffer.reset();
+        std::lock_guard<std::mutex> lock(countMutex);
+        numWritten++;
+        writtenCond.notify_all();
+    }
+}
+
+void LidarDatabase::drainQueue()
 {
+    if (!queue)
+        return;
+    
+    std::unique_lock<std::mutex> lock(countMutex);
+    writtenCond.wait(lock,[this]{ return numWritten >= numQueued; });
+}
+
+bool LidarDatabase::flush()
+{
+    // Let the writer finish up what's queued
+    if (queue)
+    {
+        queue->close();
+        writerThread.join();
+        delete queue;
+        queue = NULL;
+    }
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
     if (insertStmt)
         delete insertStmt;
-    insertStmt = NULL;    
+    insertStmt = NULL;
+    if (metaStmt)
+        delete metaStmt;
+    metaStmt = NULL;
+    BuildMetrics::ScopedTimer timer(metrics,BuildMetrics::TimeDatabase);
+    if (!commitBatch())
+        writerFailed = true;
+    
+    return !writerFailed;
+}
+
+bool LidarDatabase::mergeShard(const std::string &shardFile,int &shardMaxLevel,int &shardMaxColor)
+{
+    drainQueue();
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    BuildMetrics::ScopedTimer timer(metrics,BuildMetrics::TimeDatabase);
+    // Can't attach in the middle of a transaction
+    if (!commitBatch())
+        return false;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("ATTACH DATABASE @file AS shard;");
+        stmt.BindString(1, shardFile);
+        stmt.ExecuteAndFree();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to open shard %s:\n%s\n",shardFile.c_str(),except.GetString().c_str());
+        return false;
+    }
+    
+    // The shard was set up by the same code, so the columns line up
+    bool ok = false;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("SELECT maxlevel,maxcolor FROM shard.manifest;");
+        if (stmt.FetchRow())
+        {
+            shardMaxLevel = stmt.GetColumnInt(0);
+            shardMaxColor = stmt.GetColumnInt(1);
+            ok = true;
+        }
+        stmt.FreeQuery();
+        if (!ok)
+            fprintf(stderr,"Shard %s has no header.  It didn't finish.\n",shardFile.c_str());
+        else
+        {
+            stmt.SqlStatement((std::string)"BEGIN TRANSACTION;");
+            stmt.SqlStatement("INSERT OR REPLACE INTO " + tileTable() + " SELECT * FROM shard." + tileTable() + ";");
+            stmt.SqlStatement((std::string)"INSERT OR REPLACE INTO tilemeta SELECT * FROM shard.tilemeta;");
+            stmt.SqlStatement((std::string)"END TRANSACTION;");
+        }
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to merge shard %s:\n%s\n",shardFile.c_str(),except.GetString().c_str());
+        if (ok)
+            RunPragma(db,"ROLLBACK;");
+        ok = false;
+    }
+    if (!RunPragma(db,"DETACH DATABASE shard;"))
+        ok = false;
+    
+    return ok;
+}
+
+bool LidarDatabase::setDepth(int maxLevel,int maxColor)
+{
+    drainQueue();
+    
+    std::lock_guard<std::mutex> lock(dbMutex);
+    if (!commitBatch())
+        return false;
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql("UPDATE manifest SET maxlevel=@maxlevel,maxcolor=@maxcolor;");
+        stmt.BindInt(1, maxLevel);
+        stmt.BindInt(2, maxColor);
+        stmt.ExecuteAndFree();
+    }
+    catch (SQLiteException &except)
+    {
+        fprintf(stderr,"Failed to update manifest:\n%s\n",except.GetString().c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+bool LidarDatabase::orderTiles()
+{
+    if (!flush())
+        return false;
+    
+    // Tiles went in whatever order the workers finished them.
+    // Rebuilding the file lays the table pages out in key order.
+    std::lock_guard<std::mutex> lock(dbMutex);
+    return RunPragma(db,"VACUUM;");
 }
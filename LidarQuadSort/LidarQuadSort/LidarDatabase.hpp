@@ -10,6 +10,11 @@
 #define LidarDatabase_hpp
 
 #include <stdio.h>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
 #include "KompexSQLitePrerequisites.h"
 #include "KompexSQLiteDatabase.h"
 #include "KompexSQLiteStatement.h"
@@ -17,43 +22,243 @@
 #include "KompexSQLiteStreamRedirection.h"
 #include "KompexSQLiteBlob.h"
 #include "KompexSQLiteException.h"
+#include "BoundedQueue.hpp"
+#include "TileCodec.h"
+#include "TileKey.h"
+#include "BuildMetrics.hpp"
+#include "TileBuffer.hpp"
 
 /* Interface to sqlite LIDAR database.
+    Calls are serialized, so tiles can be added from multiple threads.
+    With async writes on, tiles are queued up and a writer thread commits
+    them in batches.
  */
 class LidarDatabase
 {
 public:
-    typedef enum {FullData,IndexOnly} Type;
+    // Columnar is FullData with each TileColumn of a tile in its own row
+    typedef enum {FullData,IndexOnly,Columnar} Type;
+    
+    /* Settings for bulk loading the database.
+        The pragmas go in before we create the tables.
+      */
+    class WriteOptions
+    {
+    public:
+        WriteOptions() : pageSize(65536), journalMode("MEMORY"), synchronous(false), asyncWrites(true), queueSize(256), batchSize(1000) { }
+        
+        // Page size for the new database.  0 leaves it alone.
+        int pageSize;
+        // Journal mode pragma.  Empty leaves it alone.
+        std::string journalMode;
+        // Wait for the disk on every commit
+        bool synchronous;
+        // Queue tiles up for a writer thread
+        bool asyncWrites;
+        // Number of tiles we'll queue up before producers have to wait
+        int queueSize;
+        // Number of tiles in each transaction
+        int batchSize;
+    };
+    
+    /* The header info from the manifest table.
+      */
+    class Manifest
+    {
+    public:
+        Manifest() : minX(0.0), minY(0.0), minZ(0.0), maxX(0.0), maxY(0.0), maxZ(0.0), minLevel(0), maxLevel(0), minPoints(0), maxPoints(0), pointType(0), maxColor(0), tileKey(0), tileCodec(TileCodecLAZ) { }
+        
+        std::string srs,name;
+        double minX,minY,minZ,maxX,maxY,maxZ;
+        int minLevel,maxLevel;
+        int minPoints,maxPoints;
+        int pointType,maxColor;
+        int tileKey;
+        // Older databases don't have these and are LAZ
+        TileCodec tileCodec;
+        TileQuantization quant;
+    };
+    
+    /* A tile that's already in the database.
+      */
+    class TileEntry
+    {
+    public:
+        TileEntry() : x(0), y(0), level(0), count(-1) { }
+        int x,y,level;
+        // Number of points in the tile, -1 if there's no metadata for it
+        long long count;
+    };
     
     // Construct with an empty SQLite database and the type.
     // If this is FullData we'll store data in it
     // If not, we'll just store offsets into another file.
-    LidarDatabase(Kompex::SQLiteDatabase *db,Type type);
+    // Octree keys give the tile tables a zcell column for the vertical cell.
+    LidarDatabase(Kompex::SQLiteDatabase *db,Type type,const WriteOptions &options = WriteOptions(),TileKeyScheme tileKey = TileKeyMorton);
+    
+    // Open up a database we've already built so we can add to it.
+    // The page size option is ignored, since it's too late to change it.
+    // So is the journal mode.  The journal stays on disk, since we're changing data we can't rebuild.
+    LidarDatabase(Kompex::SQLiteDatabase *db,const WriteOptions &options);
+    ~LidarDatabase();
+    
+    // Read the header info back out of an existing database
+    bool getManifest(Manifest &manifest);
+    
+    // Every tile in the database, with its point count
+    bool getTileIndex(std::vector<TileEntry> &tiles);
+    
+    // Data for a single tile.  Returns false if it's not there.
+    bool getTile(int x,int y,int level,std::string &data);
+    
+    // For Columnar, just the columns in the mask (see TileColumnBit) for a tile.
+    // The columns come back indexed by TileColumn and are empty if they weren't asked for or aren't there.
+    // Returns false if the tile isn't there.
+    bool getTileColumns(int x,int y,int level,uint32_t mask,std::vector<std::string> &columns);
     
-    // Set the header info after creation
+    // Push every tile down the given number of levels, so the old root ends up at (offX,offY).
+    // This is how we grow the extent when new data falls outside of it.
+    bool relocateTiles(int levels,int offX,int offY);
+    
+    // Set the header info after creation.  This replaces any header already there.
     bool setHeader(const char *srs,const char *name,double minX,double minY,double minZ,double maxX,double maxY,double maxZ,int minLevel,int maxLevel,int minPoints,int maxPoints,int pointType,int maxColor);
     
+    // For IndexOnly, the LAZ file the offsets point into.  Goes in the manifest with the rest of the header.
+    void setLAZFile(const std::string &fileName) { lazFile = fileName; }
+    const std::string &getLAZFile() { return lazFile; }
+    
+    // How the tile blobs are encoded, and the quantization for compact tiles.  Also goes in with the header.
+    void setTileCodec(TileCodec codec,const TileQuantization &quant) { tileCodec = codec;  tileQuant = quant; }
+    
+    // How tiles are keyed.  Octree tiles take a vertical cell (zCell) along with x, y and level.
+    TileKeyScheme getTileKey() { return tileKey; }
+    
     // Add data for a tile
-    bool addTile(const void *tileData,int dataSize,int x,int y,int level);
+    bool addTile(const void *tileData,int dataSize,int x,int y,int level,int zCell = 0);
+    
+    // Add data for a tile, holding on to the buffer until it's written instead of copying it
+    bool addTile(TileBufferRef buffer,int x,int y,int level,int zCell = 0);
+    
+    // Add one column of a Columnar tile
+    bool addTileColumn(TileColumn column,const void *data,int dataSize,int x,int y,int level,int zCell = 0);
+    bool addTileColumn(TileColumn column,TileBufferRef buffer,int x,int y,int level,int zCell = 0);
     
     // Add tile offset information
-    bool addTileOffset(long long start,int length,int x,int y,int level);
+    bool addTileOffset(long long start,int length,int x,int y,int level,int zCell = 0);
+    
+    // Add the height range, point count and ground grid for a tile
+    bool addTileMeta(int x,int y,int level,double minZ,double maxZ,long long count,int gridX,int gridY,const std::string &grid,int zCell = 0);
     
-    // Close any open statements and such
-    void flush();
+    // Hold everything written from here on in one transaction, so it all goes in or none of it does.
+    // Batches don't commit until endTransaction.
+    bool beginTransaction();
+    
+    // Commit the transaction from beginTransaction, or roll it back.
+    // Also rolls back if any of the writes failed, and returns false then.
+    bool endTransaction(bool commit);
+    
+    // Write out anything queued, commit and close any open statements and such.
+    // Returns false if any of the writes failed.
+    bool flush();
+    
+    // Copy all the tiles from a shard built by another process into this database.
+    // Returns the depth and max color from the shard's header.
+    bool mergeShard(const std::string &shardFile,int &shardMaxLevel,int &shardMaxColor);
+    
+    // Update the depth and max color in the header, once shards are merged in
+    bool setDepth(int maxLevel,int maxColor);
+    
+    // Flush and then rebuild the database so the tiles are stored in key order.
+    // Neighboring tiles end up on neighboring pages, which is nicer for readers.
+    bool orderTiles();
     
     Type getType() { return type; }
     
+    // Time and bytes for the writes go here.  Set before adding tiles.
+    void setMetrics(BuildMetrics *inMetrics) { metrics = inMetrics; }
+    
     // Check this after opening
     bool isValid() { return valid; }
 
 protected:
+    // A tile waiting for the writer thread
+    class PendingTile
+    {
+    public:
+        typedef enum {TileData,TileOffset,TileMeta,TileColumnData} Kind;
+        
+        PendingTile() : kind(TileData), x(0), y(0), level(0), zCell(0), column(TileColumnPosition), start(0), count(0), minZ(0.0), maxZ(0.0), gridX(0), gridY(0) { }
+        Kind kind;
+        int x,y,level,zCell;
+        TileColumn column;
+        // Tile data or ground grid.  Tiles from the sorter come in their own buffer instead.
+        std::string data;
+        TileBufferRef buffer;
+        const char *getData() const { return buffer ? buffer->getData() : data.data(); }
+        int getSize() const { return buffer ? (int)buffer->getSize() : (int)data.size(); }
+        long long start;
+        long long count;
+        double minZ,maxZ;
+        int gridX,gridY;
+    };
+    
+    // These expect the database lock to be held
+    bool writeTile(const void *tileData,int dataSize,int x,int y,int level,int zCell);
+    bool writeTileOffset(long long start,int length,int x,int y,int level,int zCell);
+    bool writeTileMeta(const PendingTile &tile);
+    bool writeTileColumn(const PendingTile &tile);
+    bool queueTile(PendingTile &tile);
+    bool beginBatch();
+    bool commitBatch();
+    void rollbackBatch();
+    
+    // Table with one row per tile for our type
+    std::string tileTable();
+    
+    // Key for a tile in our scheme
+    int64_t makeKey(int x,int y,int zCell,int level);
+    
+    // Insert into a tile table.  Octree tiles get their zcell on the end.
+    std::string tileInsertSql(const std::string &table,std::vector<std::string> columns);
+    
+    // Start up the writer thread, if we're using one
+    void startWriter();
+
+    // Writer thread main loop
+    void runWriter();
+    
+    // Wait for the writer to catch up with the queue
+    void drainQueue();
+    
     Type type;
+    TileKeyScheme tileKey;
     bool valid;
+    std::string lazFile;
+    TileCodec tileCodec;
+    TileQuantization tileQuant;
     Kompex::SQLiteDatabase *db;
+    std::mutex dbMutex;
+    WriteOptions options;
+    BuildMetrics *metrics;
     
-    // Precompiled insert statement
+    // Precompiled insert statements
     Kompex::SQLiteStatement *insertStmt;
+    Kompex::SQLiteStatement *metaStmt;
+    
+    // Async writer
+    BoundedQueue<PendingTile> *queue;
+    std::thread writerThread;
+    // Producers check this without the database lock, so they never wait on a write
+    std::atomic<bool> writerFailed;
+    bool inBatch;
+    int batchCount;
+    // Set between beginTransaction and endTransaction, when batches stay open
+    bool holdBatch;
+    // Tiles pushed and tiles written, so we can tell when the writer has caught up.
+    // These have their own lock, since the writer holds the database lock through a commit.
+    std::mutex countMutex;
+    long long numQueued,numWritten;
+    std::condition_variable writtenCond;
 };
 
 #endif /* LidarDatabase_hpp */
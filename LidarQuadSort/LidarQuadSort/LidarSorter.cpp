@@ -7,38 +7,63 @@
 //
 
 #include "LidarSorter.hpp"
+#include <chrono>
+
+// Closes and frees a laszip writer, so one left open by an error doesn't leak
+class LasWriterCloser
+{
+public:
+    void operator()(void *writer) const
+    {
+        laszip_close_writer(writer);
+        laszip_destroy(writer);
+    }
+};
+typedef std::unique_ptr<void,LasWriterCloser> LasWriterRef;
 
 LidarMultiWrapper::LidarMultiWrapper(const std::string &file)
-: reader(NULL)
+: reader(NULL), readerPoint(NULL), numPointsInFile(0), scanThreads(1), spillReader(NULL), decodeThreads(0), decodeOrdered(true), pipeline(NULL)
 {
     files.push_back(file);
 }
 
 LidarMultiWrapper::LidarMultiWrapper(const std::vector<std::string> &files)
-: files(files), reader(NULL)
+: files(files), reader(NULL), readerPoint(NULL), numPointsInFile(0), scanThreads(1), spillReader(NULL), decodeThreads(0), decodeOrdered(true), pipeline(NULL)
+{
+}
+
+LidarMultiWrapper::LidarMultiWrapper(const std::string &spillFile,std::shared_ptr<LasHeaderCopy> baseHeader,const std::string &projStr)
+: reader(NULL), readerPoint(NULL), numPointsInFile(0), projStr(projStr), scanThreads(1), baseHeader(baseHeader), spillReader(NULL), decodeThreads(0), decodeOrdered(true), pipeline(NULL)
 {
+    files.push_back(spillFile);
 }
 
 LidarMultiWrapper::~LidarMultiWrapper()
 {
-    for (auto &openReader : openReaders)
-    {
-        laszip_close_reader(openReader);
-        laszip_destroy(openReader);
-    }
-    openReaders.clear();
+    if (pipeline)
+        delete pipeline;
+    pipeline = NULL;
     if (reader)
     {
         laszip_close_reader(reader);
         laszip_destroy(reader);
     }
     reader = NULL;
+    if (spillReader)
+        delete spillReader;
+    spillReader = NULL;
 }
 
-void LidarMultiWrapper::removeFile()
+long long LidarMultiWrapper::removeFile()
 {
+    long long size = 0;
     for (const auto &file : files)
+    {
+        size += TempFileSize(file);
         remove(file.c_str());
+    }
+    
+    return size;
 }
 
 long long getNumRecords(laszip_header_struct *header)
@@ -61,14 +86,57 @@ long long getNumRecords(laszip_header_struct &header)
     return getNumRecords(&header);
 }
 
-// Generate a proj4 compatible string
+int PointRecordLength(int pointDataFormat)
+{
+    static const int recordLengths[] = {20,28,26,34,57,63,30,36,38,59,67};
+    if (pointDataFormat < 0 || pointDataFormat > 10)
+        return 0;
+    return recordLengths[pointDataFormat];
+}
+
+LasHeaderCopy::LasHeaderCopy(const laszip_header_struct &inHeader)
+: header(inHeader)
+{
+    // Copy the variable length records so they outlive whatever reader they came from
+    vlrs.resize(header.number_of_variable_length_records);
+    vlrData.resize(header.number_of_variable_length_records);
+    for (unsigned int ii=0;ii<header.number_of_variable_length_records;ii++)
+    {
+        vlrs[ii] = inHeader.vlrs[ii];
+        if (inHeader.vlrs[ii].data && inHeader.vlrs[ii].record_length_after_header > 0)
+        {
+            vlrData[ii].assign(inHeader.vlrs[ii].data,inHeader.vlrs[ii].data+inHeader.vlrs[ii].record_length_after_header);
+            vlrs[ii].data = &vlrData[ii][0];
+        } else
+            vlrs[ii].data = NULL;
+    }
+    header.vlrs = vlrs.empty() ? NULL : &vlrs[0];
+    
+    if (inHeader.user_data_in_header && inHeader.user_data_in_header_size > 0)
+    {
+        userDataInHeader.assign(inHeader.user_data_in_header,inHeader.user_data_in_header+inHeader.user_data_in_header_size);
+        header.user_data_in_header = &userDataInHeader[0];
+    } else {
+        header.user_data_in_header = NULL;
+        header.user_data_in_header_size = 0;
+    }
+    if (inHeader.user_data_after_header && inHeader.user_data_after_header_size > 0)
+    {
+        userDataAfterHeader.assign(inHeader.user_data_after_header,inHeader.user_data_after_header+inHeader.user_data_after_header_size);
+        header.user_data_after_header = &userDataAfterHeader[0];
+    } else {
+        header.user_data_after_header = NULL;
+        header.user_data_after_header_size = 0;
+    }
+}
+
 bool GenerateProjStr(laszip_header_struct *thisHeader,std::string &str)
 {
     ST_TIFF *tags = ST_Create();
     
     // Work through the VLRS
     // Heavily inpsired by liblas (spatialreference.cpp)
-    for (int ii = 0; ii< thisHeader->number_of_variable_length_records;ii++)
+    for (laszip_U32 ii = 0; ii< thisHeader->number_of_variable_length_records;ii++)
     {
         laszip_vlr_struct *vlrs = &thisHeader->vlrs[ii];
         std::string uid = vlrs->user_id;
@@ -116,89 +184,124 @@ bool GenerateProjStr(laszip_header_struct *thisHeader,std::string &str)
     // Now for something that works with proj4
     GTIFDefn defn;
     GTIF *geoTags = GTIFNewSimpleTags(tags);
+    bool ret = false;
     if (GTIFGetDefn(geoTags, &defn))
     {
         char *proj4 = GTIFGetProj4Defn(&defn);
         str = std::string(proj4);
         GTIFFreeMemory(proj4);
-        return true;
+        ret = true;
     }
     GTIFFree(geoTags);
     ST_Destroy(tags);
     
-    return false;
+    return ret;
 }
 
 bool LidarMultiWrapper::init()
 {
     valid = false;
     
-    bool firstFile = true;
-    for (auto &fileName : files)
+    // Spill files get most of their header from the original input
+    if (baseHeader)
+    {
+        spillReader = new SpillReader(files[0]);
+        if (!spillReader->open())
+        {
+            fprintf(stderr,"Failed to open spill file %s\n",files[0].c_str());
+            return false;
+        }
+        const SpillFileHeader &spillHeader = spillReader->getHeader();
+        header = baseHeader->header;
+        header.extended_number_of_point_records = spillHeader.numPoints;
+        header.number_of_point_records = (laszip_U32)header.extended_number_of_point_records;
+        if (header.number_of_point_records != header.extended_number_of_point_records)
+            header.number_of_point_records = 0;
+        if (spillHeader.numPoints > 0)
+        {
+            header.min_x = spillHeader.minX * header.x_scale_factor + header.x_offset;
+            header.min_y = spillHeader.minY * header.y_scale_factor + header.y_offset;
+            header.min_z = spillHeader.minZ * header.z_scale_factor + header.z_offset;
+            header.max_x = spillHeader.maxX * header.x_scale_factor + header.x_offset;
+            header.max_y = spillHeader.maxY * header.y_scale_factor + header.y_offset;
+            header.max_z = spillHeader.maxZ * header.z_scale_factor + header.z_offset;
+        }
+        
+        valid = true;
+        whichFile = 0;
+        whichPointInFile = 0;
+        whichPointOverall = 0;
+        
+        return valid;
+    }
+    
+    // Just the headers, and we only need to open the ones that changed since last time
+    std::vector<InputFileInfo> infos;
+    HeaderScanner scanner(manifestFile,scanThreads);
+    if (!scanner.scan(files,infos))
+        return false;
+    if (infos.empty())
+    {
+        fprintf(stderr,"No input files\n");
+        return false;
+    }
+    
+    // We still want the variable length records from one of them
     {
         laszip_POINTER thisReader;
         laszip_create(&thisReader);
         laszip_BOOL is_compressed;
-        if (laszip_open_reader(thisReader, fileName.c_str(), &is_compressed))
+        if (laszip_open_reader(thisReader, files[0].c_str(), &is_compressed))
         {
-            fprintf(stderr,"Failed to open file %s\n",fileName.c_str());
+            fprintf(stderr,"Failed to open file %s\n",files[0].c_str());
+            laszip_destroy(thisReader);
             return false;
         }
-        fprintf(stdout,"Opened file %s\n",fileName.c_str());
         laszip_header_struct *thisHeader;
         laszip_get_header_pointer(thisReader,&thisHeader);
+        firstHeader = std::make_shared<LasHeaderCopy>(*thisHeader);
+        laszip_close_reader(thisReader);
+        laszip_destroy(thisReader);
+    }
+    header = firstHeader->header;
+    projStr = infos[0].projStr;
+    
+    for (unsigned int ii=1;ii<infos.size();ii++)
+    {
+        const InputFileInfo &info = infos[ii];
+        if (projStr != info.projStr)
+        {
+            fprintf(stderr,"Projection doesn't match for all input files.\n");
+            return false;
+        }
         
-        openReaders.push_back(thisReader);
-        
-        GenerateProjStr(thisHeader,projStr);
-        
-        if (firstFile)
+        if (header.x_offset != info.offset[0] ||
+            header.y_offset != info.offset[1] ||
+            header.z_offset != info.offset[2])
         {
-            header = *thisHeader;
-            firstFile = false;
-        } else {
-            std::string thisProjStr;
-            GenerateProjStr(thisHeader,thisProjStr);
-            if (projStr != thisProjStr)
-            {
-                fprintf(stderr,"Projection doesn't match for all input files.\n");
-                return false;
-            }
-            
-            if (header.x_offset != thisHeader->x_offset ||
-                header.y_offset != thisHeader->y_offset ||
-                header.z_offset != thisHeader->z_offset)
-            {
-                fprintf(stderr,"Offset doesn't match for all input files.\n");
-                return false;
-            }
-            if (header.x_scale_factor != thisHeader->x_scale_factor ||
-                header.y_scale_factor != thisHeader->y_scale_factor ||
-                header.z_scale_factor != thisHeader->z_scale_factor)
-            {
-                fprintf(stderr,"Scale doesn't match for all input files.\n");
-                return false;
-            }
-            
-            // Merge in bounding box
-            double minX,minY,maxX,maxY,minZ,maxZ;
-            minX = std::min(header.min_x,thisHeader->min_x);
-            minY = std::min(header.min_y,thisHeader->min_y);
-            minZ = std::min(header.min_z,thisHeader->min_z);
-            maxX = std::max(header.max_x,thisHeader->max_x);
-            maxY = std::max(header.max_y,thisHeader->max_y);
-            maxZ = std::max(header.max_z,thisHeader->max_z);
-            header.min_x = minX;  header.min_y = minY;  header.min_z = minZ;
-            header.max_x = maxX;  header.max_y = maxY;  header.max_z = maxZ;
-            
-            // Add in the point count
-            header.extended_number_of_point_records = getNumRecords(header)+getNumRecords(thisHeader);
-            header.number_of_point_records = (laszip_U32)header.extended_number_of_point_records;
-            if (header.number_of_point_records != header.extended_number_of_point_records)
-                header.number_of_point_records = 0;
+            fprintf(stderr,"Offset doesn't match for all input files.\n");
+            return false;
+        }
+        if (header.x_scale_factor != info.scale[0] ||
+            header.y_scale_factor != info.scale[1] ||
+            header.z_scale_factor != info.scale[2])
+        {
+            fprintf(stderr,"Scale doesn't match for all input files.\n");
+            return false;
         }
+        
+        // Merge in bounding box
+        header.min_x = std::min(header.min_x,info.minX);  header.min_y = std::min(header.min_y,info.minY);  header.min_z = std::min(header.min_z,info.minZ);
+        header.max_x = std::max(header.max_x,info.maxX);  header.max_y = std::max(header.max_y,info.maxY);  header.max_z = std::max(header.max_z,info.maxZ);
+        
+        // Add in the point count
+        header.extended_number_of_point_records = getNumRecords(header)+info.numPoints;
+        header.number_of_point_records = (laszip_U32)header.extended_number_of_point_records;
+        if (header.number_of_point_records != header.extended_number_of_point_records)
+            header.number_of_point_records = 0;
     }
     
+    fprintf(stdout,"Scanned %ld files (%d from manifest)\n",files.size(),scanner.getNumFromManifest());
     fprintf(stdout,"Checked all %ld files for %lld points\n",files.size(),getNumRecords(header));
     
     valid = true;    
@@ -216,9 +319,42 @@ bool LidarMultiWrapper::hasNextPoint()
 
 laszip_point_struct *LidarMultiWrapper::getNextPoint()
 {
-    // Open the next (or first) file
-    if (whichFile < 0 || whichPointInFile >= getNumRecords(reader))
+    if (spillReader)
+    {
+        laszip_point_struct *p = spillReader->getPoint(whichPointOverall);
+        if (!p)
+            throw (std::string)"Unable to read spill point";
+        whichPointOverall++;
+        return p;
+    }
+    
+    // Decoders run ahead of us in the background
+    if (decodeThreads > 0)
     {
+        if (!pipeline)
+            pipeline = new DecodePipeline(files,decodeThreads,decodeOrdered);
+        laszip_point_struct *p = pipeline->getNextPoint();
+        if (!p)
+            throw (std::string)"Ran out of input points";
+        whichPointOverall++;
+        return p;
+    }
+
+    if (whichFile < 0 || whichPointInFile >= numPointsInFile)
+        openNextFile();
+    
+    whichPointInFile++;
+    whichPointOverall++;
+    if (laszip_read_point(reader))
+        throw (std::string)"Unable to read input point";
+
+    return readerPoint;
+}
+
+void LidarMultiWrapper::openNextFile()
+{
+    // Skipping any empty ones
+    do {
         whichFile++;
         if (reader)
         {
@@ -227,6 +363,8 @@ laszip_point_struct *LidarMultiWrapper::getNextPoint()
             reader = NULL;
         }
         whichPointInFile = 0;
+        if ((size_t)whichFile >= files.size())
+            throw (std::string)"Ran out of input points";
 
         const std::string &fileName = files[whichFile];
 
@@ -236,169 +374,800 @@ laszip_point_struct *LidarMultiWrapper::getNextPoint()
         {
             throw (std::string)"failed to open file " + fileName;
         }
+        numPointsInFile = getNumRecords(reader);
+        laszip_get_point_pointer(reader, &readerPoint);
+    } while (numPointsInFile == 0);
+}
+
+int LidarMultiWrapper::getNextBlock(PointBlock &block)
+{
+    block.reset(std::max(0,(int)header.point_data_record_length - PointRecordLength(header.point_data_format)));
+    long long numLeft = getNumRecords(header) - whichPointOverall;
+    int numToRead = (int)std::min((long long)block.getCapacity(),numLeft);
+    
+    if (spillReader)
+    {
+        for (int ii=0;ii<numToRead;ii++)
+        {
+            laszip_point_struct *p = spillReader->getPoint(whichPointOverall);
+            if (!p)
+                throw (std::string)"Unable to read spill point";
+            block.addPoint(p);
+            whichPointOverall++;
+        }
+    } else if (decodeThreads > 0)
+    {
+        for (int ii=0;ii<numToRead;ii++)
+            block.addPoint(getNextPoint());
+    } else {
+        // Read straight through to the end of each file without checking per point
+        while (block.getNumPoints() < numToRead)
+        {
+            if (whichFile < 0 || whichPointInFile >= numPointsInFile)
+                openNextFile();
+            long long numFromFile = std::min((long long)(numToRead - block.getNumPoints()),numPointsInFile - whichPointInFile);
+            for (long long ii=0;ii<numFromFile;ii++)
+            {
+                if (laszip_read_point(reader))
+                    throw (std::string)"Unable to read input point";
+                block.addPoint(readerPoint);
+            }
+            whichPointInFile += numFromFile;
+            whichPointOverall += numFromFile;
+        }
     }
     
-    whichPointInFile++;
-    whichPointOverall++;
-    if (laszip_read_point(reader))
-        throw "Unable to read input point";
+    return block.getNumPoints();
+}
 
-    laszip_point_struct *p;
-    laszip_get_point_pointer(reader, &p);
-    return p;
+void LidarMultiWrapper::rewind()
+{
+    if (pipeline)
+        delete pipeline;
+    pipeline = NULL;
+    if (reader)
+    {
+        laszip_close_reader(reader);
+        laszip_destroy(reader);
+        reader = NULL;
+    }
+    
+    // Spill files are read by index, so there's nothing to reopen
+    whichFile = spillReader ? 0 : -1;
+    whichPointInFile = 0;
+    whichPointOverall = 0;
 }
 
 LidarSorter::LidarSorter(const char *tmp_dir)
-: tmpDir(tmp_dir), minPointLimit(1000), maxPointLimit(1500), totalWrittenPoints(0),maxLevel(0), maxColor(0)
+: minPointLimit(1000), maxPointLimit(1500), maxLevel(0), tmpDir(tmp_dir), totalWrittenPoints(0), maxColor(0),
+  numThreads(1), pool(NULL), failed(false), memoryBudget(0), memoryInUse(0), spillFormat(SpillRaw), fullMinZ(0.0), fullMaxZ(0.0), octreeRatio(0.0),
+  gridSize(10), sampleMode(PointSampler::Grid), tempBudget(0), peakTempSpace(0), masterChunkSize(MasterLAZFile::DefaultChunkSize), tileCodec(TileCodecLAZ), verbose(false),
+  bufferPool(std::make_shared<TileBufferPool>()), shardLevel(0)
 {
 }
 
 bool LidarSorter::process(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB)
+{
+    shardTiles.clear();
+    bool ret = runBuild(inputDB,lidarDB,getNumRecords(inputDB->header),[&]{
+        return process(inputDB,TileIdent(0,0,0),SampleGridRef(),lidarDB,false);
+    });
+    
+    // Biggest first, which is the order they should be handed out
+    std::stable_sort(shardTiles.begin(),shardTiles.end(),[](const ShardTile &a,const ShardTile &b){ return a.numPoints > b.numPoints; });
+    
+    return ret;
+}
+
+bool LidarSorter::processShard(LidarMultiWrapper *inputDB,const std::vector<ShardTile> &tiles,LidarDatabase *lidarDB)
+{
+    long long numPoints = 0;
+    for (const auto &tile : tiles)
+        numPoints += tile.numPoints;
+    
+    return runBuild(inputDB,lidarDB,numPoints,[&]{
+        // Sample grids get rebuilt from the files, the same as the coordinator would have had them
+        for (const auto &tile : tiles)
+        {
+            std::string fileName = tile.fileName;
+            TileIdent tileID = tile.tileID;
+            if (pool)
+                pool->submit([this,fileName,tileID,lidarDB]{
+                    if (!failed)
+                        processSubFile(fileName,tileID,SampleGridRef(),lidarDB);
+                });
+            else if (!processSubFile(fileName,tileID,SampleGridRef(),lidarDB))
+                return false;
+        }
+        return true;
+    });
+}
+
+bool LidarSorter::runBuild(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB,long long numPoints,const std::function<bool()> &work)
 {
     fullMinX = inputDB->header.min_x;
     fullMinY = inputDB->header.min_y;
     fullMaxX = inputDB->header.max_x;
     fullMaxY = inputDB->header.max_y;
+    fullMinZ = inputDB->header.min_z;
+    fullMaxZ = inputDB->header.max_z;
+    
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    
+    rootHeader = std::make_shared<LasHeaderCopy>(inputDB->header);
+    rootProjStr = inputDB->getProj4Str();
+    if (!startOutput(lidarDB))
+        return false;
+    lidarDB->setMetrics(&metrics);
+    metrics.start(numPoints);
+
+    // Subtrees get handed off to the pool as they're split out
+    if (numThreads > 1)
+        pool = new WorkStealingPool(numThreads);
+    scheduler.reset(new SpillScheduler(tempBudget,&metrics));
+    
+    bool ret = work();
+    
+    if (pool)
+    {
+        pool->wait();
+        reportScaling(std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+        delete pool;
+        pool = NULL;
+    }
+    if (failed)
+    {
+        fprintf(stderr,"%s\n",failReason.c_str());
+        ret = false;
+    }
+    metrics.stop();
+    scheduler->report();
+    peakTempSpace = scheduler->getPeak();
+    scheduler.reset();
+    ret = finishOutput(ret);
+
+    // Now that everything is written we know the depth and can set up the output header
+    if (ret)
+        writeHeader(inputDB,lidarDB);
+    
+    return ret;
+}
+
+bool LidarSorter::startOutput(LidarDatabase *lidarDB)
+{
+    masterFile.reset();
+    if ((octreeRatio > 0.0) != (lidarDB->getTileKey() == TileKeyOctree))
+    {
+        fprintf(stderr,"Octree builds need a database with octree keys and nothing else does.\n");
+        return false;
+    }
+    // Columnar tiles only go in a columnar database, and that's all it takes
+    if (lidarDB->getType() == LidarDatabase::Columnar)
+        tileCodec = TileCodecColumnar;
+    else if (tileCodec == TileCodecColumnar)
+    {
+        fprintf(stderr,"Columnar tiles need a columnar database.\n");
+        return false;
+    }
+    if (lidarDB->getType() != LidarDatabase::IndexOnly)
+    {
+        // Compact tiles leave out the header, so the scale and offset go in the manifest
+        const laszip_header_struct &header = rootHeader->header;
+        lidarDB->setTileCodec(tileCodec,TileQuantization(header.x_scale_factor,header.y_scale_factor,header.z_scale_factor,
+                                                         header.x_offset,header.y_offset,header.z_offset));
+        return true;
+    }
+    if (masterFileName.empty())
+    {
+        fprintf(stderr,"Need a LAZ file to put the points in for an index only database.\n");
+        return false;
+    }
+
+    masterFile.reset(new MasterLAZFile(masterFileName,masterChunkSize));
+    if (!masterFile->open(rootHeader->header))
+    {
+        masterFile.reset();
+        return false;
+    }
+    lidarDB->setLAZFile(masterFile->getBaseName());
+
+    return true;
+}
+
+bool LidarSorter::finishOutput(bool success)
+{
+    if (!masterFile)
+        return success;
+
+    if (!masterFile->close())
+        success = false;
+    else
+        fprintf(stdout,"Wrote %lld points to %s, %lld of them padding out LAZ chunks\n",masterFile->getNumPoints(),masterFileName.c_str(),masterFile->getNumPadding());
+    masterFile.reset();
+
+    return success;
+}
+
+void LidarSorter::writeHeader(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB)
+{
+    std::string proj4Str = inputDB->getProj4Str();
+    lidarDB->setHeader(proj4Str.c_str(),inputDB->header.system_identifier,
+                       inputDB->header.min_x, inputDB->header.min_y, inputDB->header.min_z,
+                       inputDB->header.max_x, inputDB->header.max_y, inputDB->header.max_z,
+                       0, maxLevel,
+                       minPointLimit,maxPointLimit,
+                       (int)inputDB->header.point_data_format,maxColor);
+}
+
+void LidarSorter::removeInput(LidarMultiWrapper *inputDB)
+{
+    // We only remove temp files once we've read all the way through them
+    long long size = inputDB->removeFile();
+    metrics.add(BuildMetrics::TempRead,size);
+    if (scheduler)
+        scheduler->removeFiles(size);
+}
+
+void LidarSorter::setFailed(const std::string &reason)
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (!failed)
+        failReason = reason;
+    failed = true;
+}
+
+void LidarSorter::reportScaling(double wallTime)
+{
+    std::vector<WorkStealingPool::WorkerStats> stats = pool->getStats();
+    double busyTime = 0.0;
+    long long tasksRun = 0, tasksStolen = 0;
+    for (auto &stat : stats)
+    {
+        busyTime += stat.busyTime;
+        tasksRun += stat.tasksRun;
+        tasksStolen += stat.tasksStolen;
+    }
+
+    fprintf(stdout,"Parallel build: %d threads, %lld subtrees (%lld stolen) in %.2fs\n",(int)stats.size(),tasksRun,tasksStolen,wallTime);
+    if (wallTime > 0.0)
+        fprintf(stdout,"  effective parallelism %.2fx, efficiency %.0f%%\n",busyTime/wallTime,100.0*busyTime/(wallTime*stats.size()));
+    for (unsigned int ii=0;ii<stats.size();ii++)
+        fprintf(stdout,"  worker %d: %lld subtrees, %lld stolen, busy %.2fs\n",ii,stats[ii].tasksRun,stats[ii].tasksStolen,stats[ii].busyTime);
+}
+
+bool LidarSorter::processSubFile(const std::string &subFile,TileIdent subIdent,SampleGridRef sampleGrid,LidarDatabase *lidarDB)
+{
+    std::unique_ptr<LidarMultiWrapper> subWrap;
+    if (spillFormat == SpillRaw)
+        subWrap.reset(new LidarMultiWrapper(subFile,rootHeader,rootProjStr));
+    else
+        subWrap.reset(new LidarMultiWrapper(subFile));
+    if (!subWrap->init())
+    {
+        setFailed((std::string)"Failed to read temp tile file " + std::to_string(subIdent.z) + ": (" + std::to_string(subIdent.x) + "," + std::to_string(subIdent.y) + ")");
+        return false;
+    }
+    if (!process(subWrap.get(),subIdent,sampleGrid,lidarDB,true))
+    {
+        setFailed((std::string)"Failed to write tile " + std::to_string(subIdent.z) + ": (" + std::to_string(subIdent.x) + "," + std::to_string(subIdent.y) + ")");
+        return false;
+    }
+    
+    return true;
+}
+
+void LidarSorter::getTileBounds(TileIdent tileID,double &tileXmin,double &tileYmin,double &tileXmax,double &tileYmax)
+{
+    double spanX = (fullMaxX-fullMinX)/(1<<tileID.z);
+    double spanY = (fullMaxY-fullMinY)/(1<<tileID.z);
+    tileXmin = spanX * tileID.x + fullMinX;  tileXmax = spanX * (tileID.x+1) + fullMinX;
+    tileYmin = spanY * tileID.y + fullMinY;  tileYmax = spanY * (tileID.y+1) + fullMinY;
+}
+
+bool LidarSorter::splitsVertically(TileIdent tileID,double minZ,double maxZ)
+{
+    if (octreeRatio <= 0.0 || maxZ <= minZ)
+        return false;
+    
+    double tileXmin,tileYmin,tileXmax,tileYmax;
+    getTileBounds(tileID,tileXmin,tileYmin,tileXmax,tileYmax);
+    double width = std::max(tileXmax-tileXmin,tileYmax-tileYmin);
+    
+    return maxZ-minZ >= octreeRatio * width;
+}
+
+std::string LidarSorter::subTileFile(TileIdent tileID)
+{
+    std::string name = tmpDir + "/" + "src_" + std::to_string(tileID.x) + "_" + std::to_string(tileID.y) + "_" + std::to_string(tileID.z);
+    if (tileID.zCell > 0)
+        name += "_" + std::to_string(tileID.zCell);
+    
+    return name + (spillFormat == SpillRaw ? ".spill" : ".las");
+}
+
+SampleGridRef LidarSorter::makeSampleGrid(TileIdent tileID)
+{
+    double tileXmin,tileYmin,tileXmax,tileYmax;
+    getTileBounds(tileID,tileXmin,tileYmin,tileXmax,tileYmax);
+    
+    return std::make_shared<SampleGrid>(minPointLimit,tileXmin,tileYmin,tileXmax,tileYmax);
+}
+
+// Room for the header on each child file
+static const long long SpillHeaderReserve = 4096;
+
+// Note a point in a tile's sample grid
+static inline void AddSamplePoint(SampleGrid *sampleGrid,TileIdent tileID,const laszip_point_struct *p,double x,double y)
+{
+    sampleGrid->addPoint(sampleGrid->whichCell(x,y),PointPriority(tileID.x,tileID.y,tileID.z,p));
+}
+
+// Figure out which of the four sub-tiles a point goes in
+static inline int WhichSubTile(const laszip_point_struct *p,const laszip_header_struct &header,double tileXmin,double tileYmin,double spanX_2,double spanY_2)
+{
+    double x = p->X * header.x_scale_factor + header.x_offset;
+    double y = p->Y * header.y_scale_factor + header.y_offset;
+    int whichX = (x-tileXmin)/spanX_2;
+    int whichY = (y-tileYmin)/spanY_2;
+    // Shouldn't be necessary, but you can't be too careful
+    whichX = std::min(whichX,1); whichY = std::min(whichY,1);
+    whichX = std::max(whichX,0); whichY = std::max(whichY,0);
+    
+    return whichY*2+whichX;
+}
+
+// Upper or lower half of a tile's height, for an octree split
+static inline int WhichZHalf(const laszip_point_struct *p,const laszip_header_struct &header,double tileZmin,double spanZ_2)
+{
+    double z = p->Z * header.z_scale_factor + header.z_offset;
+    int whichZ = (z-tileZmin)/spanZ_2;
+    whichZ = std::min(whichZ,1);
+    whichZ = std::max(whichZ,0);
+    
+    return whichZ;
+}
+
+int32_t QuantizedSplit(double scale,double offset,double tileMin,double span_2)
+{
+    auto isUpper = [&](long long val) { return ((val * scale + offset) - tileMin)/span_2 >= 1.0; };
+    
+    double guess = ceil((tileMin + span_2 - offset)/scale);
+    long long split = (long long)std::max((double)INT32_MIN,std::min((double)INT32_MAX,guess));
+    // Rounding might put us off by one either way
+    for (int ii=0;ii<4 && split > INT32_MIN && isUpper(split-1);ii++)
+        split--;
+    for (int ii=0;ii<4 && split < INT32_MAX && !isUpper(split);ii++)
+        split++;
+    
+    return (int32_t)split;
+}
+
+laszip_POINTER LidarSorter::startTile(const laszip_header_struct *header,TileBufferRef &buffer)
+{
+    buffer = bufferPool->get();
+    laszip_POINTER tileW;
+    laszip_create(&tileW);
+    laszip_set_header(tileW,header);
+    // Tiles bound for the master file or the compact codec only live long enough to be copied, so don't bother compressing them
+    laszip_open_stream_writer(tileW,buffer->getStream(),!masterFile && tileCodec == TileCodecLAZ);
     
-    bool ret = process(inputDB,TileIdent(0,0,0),lidarDB,false);
+    return tileW;
+}
+
+void LidarSorter::finishTile(laszip_POINTER tileW,TileBufferRef buffer,TileIdent tileID,long long numCopiedToTile,long long numInput,int tileMaxColor,const TileGroundGrid &grid,LidarDatabase *lidarDB)
+{
+    if (verbose)
+    {
+        std::string indent(tileID.z,' ');
+        fprintf(stdout,"%sTile %d: (%d,%d) saved %lld of %llu points\n",indent.c_str(),tileID.z,tileID.x,tileID.y,numCopiedToTile,numInput);
+    }
+
+    // Close out the tile file and encode it.  The database times its own writes.
+    // Whatever we hand the database is a pooled buffer it holds on to until the row is in,
+    //  so the bytes don't get copied on the way.
+    TileBufferRef encoded;
+    std::vector<TileBufferRef> columns;
+    long long start = 0, count = 0;
+    long long numBytes = 0;
+    {
+        BuildMetrics::ScopedTimer timer(&metrics,BuildMetrics::TimeCodec);
+        laszip_header_struct *header;
+        laszip_get_header_pointer(tileW, &header);
+        header->number_of_point_records = (laszip_U32)numCopiedToTile;
+        laszip_close_writer(tileW);
+        laszip_destroy(tileW);
+        numBytes = buffer->getSize();
+        if (masterFile)
+        {
+            // The points go in the master file and the database just gets where they are
+            if (!masterFile->addTile(buffer->getData(),buffer->getSize(),start,count))
+                throw (std::string)"Failed to write tile " + std::to_string(tileID.z) + ": (" + std::to_string(tileID.x) + "," + std::to_string(tileID.y) + ") to master file";
+        } else if (tileCodec == TileCodecCompact)
+        {
+            // Encode straight into the storage of another pooled buffer
+            CompactTileEncoder encoder;
+            encoded = bufferPool->get();
+            std::string compactStr;
+            encoded->swap(compactStr);
+            bool ok = loadCompactTile(buffer->getData(),buffer->getSize(),encoder) && encoder.encode(compactStr);
+            encoded->swap(compactStr);
+            if (!ok)
+                throw (std::string)"Failed to encode tile " + std::to_string(tileID.z) + ": (" + std::to_string(tileID.x) + "," + std::to_string(tileID.y) + ")";
+            numBytes = encoded->getSize();
+        } else if (tileCodec == TileCodecColumnar)
+        {
+            CompactTileEncoder encoder;
+            std::vector<std::string> columnStrs;
+            if (!loadCompactTile(buffer->getData(),buffer->getSize(),encoder) || !encoder.encodeColumns(columnStrs))
+                throw (std::string)"Failed to encode tile " + std::to_string(tileID.z) + ": (" + std::to_string(tileID.x) + "," + std::to_string(tileID.y) + ")";
+            // Skip the columns this point format doesn't have
+            numBytes = 0;
+            columns.resize(columnStrs.size());
+            for (unsigned int column=0;column<columnStrs.size();column++)
+                if (!columnStrs[column].empty())
+                {
+                    columns[column] = bufferPool->get();
+                    columns[column]->swap(columnStrs[column]);
+                    numBytes += columns[column]->getSize();
+                }
+        }
+    }
+    metrics.addTile(tileID.z,numInput,numCopiedToTile,numBytes);
+
+    if (masterFile)
+        lidarDB->addTileOffset(start, (int)count, tileID.x, tileID.y, tileID.z, tileID.zCell);
+    else if (tileCodec == TileCodecCompact)
+        lidarDB->addTile(encoded, tileID.x, tileID.y, tileID.z, tileID.zCell);
+    else if (tileCodec == TileCodecColumnar)
+    {
+        // One row per column
+        for (unsigned int column=0;column<columns.size();column++)
+            if (columns[column])
+                lidarDB->addTileColumn((TileColumn)column, columns[column], tileID.x, tileID.y, tileID.z, tileID.zCell);
+    } else
+        lidarDB->addTile(buffer, tileID.x, tileID.y, tileID.z, tileID.zCell);
     
+    // Heights for the viewer, so it doesn't have to look at the points
+    if (numCopiedToTile > 0)
+        lidarDB->addTileMeta(tileID.x, tileID.y, tileID.z, grid.getMinZ(), grid.getMaxZ(), numCopiedToTile, grid.getSizeX(), grid.getSizeY(), grid.encode(), tileID.zCell);
+
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        maxLevel = std::max(maxLevel,tileID.z);
+        maxColor = std::max(maxColor,tileMaxColor);
+    }
+}
+
+bool LidarSorter::loadCompactTile(const char *tileData,size_t tileSize,CompactTileEncoder &encoder)
+{
+    TileReadBuffer tileBuf(tileData,tileSize);
+    std::istream tileStream(&tileBuf);
+    laszip_POINTER reader = NULL;
+    laszip_create(&reader);
+    laszip_BOOL isCompressed;
+    if (laszip_open_stream_reader(reader,&tileStream,&isCompressed))
+    {
+        laszip_destroy(reader);
+        return false;
+    }
+    laszip_header_struct *header;
+    laszip_get_header_pointer(reader,&header);
+    laszip_point_struct *p;
+    laszip_get_point_pointer(reader,&p);
+    long long numPoints = getNumRecords(header);
+
+    encoder.reset(header->point_data_format,p->num_extra_bytes);
+    bool ret = true;
+    for (long long which=0;which<numPoints;which++)
+    {
+        if (laszip_read_point(reader))
+        {
+            ret = false;
+            break;
+        }
+        encoder.addPoint(p);
+    }
+    laszip_close_reader(reader);
+    laszip_destroy(reader);
+
     return ret;
 }
 
-bool LidarSorter::process(LidarMultiWrapper *inputDB,TileIdent tileID,LidarDatabase *lidarDB,bool removeAfterDone)
+bool LidarSorter::reserveMemory(long long size)
+{
+    if (memoryBudget <= 0)
+        return false;
+    
+    long long inUse = memoryInUse;
+    do {
+        if (inUse + size > memoryBudget)
+            return false;
+    } while (!memoryInUse.compare_exchange_weak(inUse,inUse+size));
+    
+    return true;
+}
+
+long long LidarSorter::memoryPerPoint(const laszip_header_struct &header)
+{
+    int numExtraBytes = std::max(0,(int)header.point_data_record_length - PointRecordLength(header.point_data_format));
+
+    // Point, scratch copy for partitioning and where it's going
+    return 2*(sizeof(laszip_point_struct) + numExtraBytes) + 1;
+}
+
+LidarSorter::PointBuffer::PointBuffer(LidarSorter *sorter,const laszip_header_struct &inHeader,long long numPoints,long long reserved)
+: sorter(sorter), header(inHeader), numPoints(numPoints), reserved(reserved)
+{
+    numExtraBytes = std::max(0,(int)header.header.point_data_record_length - PointRecordLength(header.header.point_data_format));
+    points.resize(numPoints);
+    scratch.resize(numPoints);
+    if (numExtraBytes > 0)
+    {
+        extraBytes.resize(numPoints*numExtraBytes);
+        scratchExtraBytes.resize(numPoints*numExtraBytes);
+    }
+}
+
+LidarSorter::PointBuffer::~PointBuffer()
 {
+    sorter->memoryInUse -= reserved;
+}
+
+bool LidarSorter::process(LidarMultiWrapper *inputDB,TileIdent tileID,SampleGridRef sampleGrid,LidarDatabase *lidarDB,bool removeAfterDone)
+{
+    // If this node will fit in memory, we can build the whole subtree there
+    long long numPoints = getNumRecords(inputDB->header);
+    long long memSize = numPoints * memoryPerPoint(inputDB->header);
+    // The subtrees a sharded build leaves behind need to end up in files, so don't go to memory above them
+    if (numPoints > maxPointLimit && shardLevel <= 0 && reserveMemory(memSize))
+    {
+        PointBufferRef buffer;
+        try {
+            BuildMetrics::Stopwatch stopwatch(&metrics,BuildMetrics::TimeRead);
+            buffer = std::make_shared<PointBuffer>(this,inputDB->header,numPoints,memSize);
+            PointBlock block;
+            long long ii = 0;
+            while (inputDB->getNextBlock(block) > 0)
+                for (int bi=0;bi<block.getNumPoints();bi++,ii++)
+                {
+                    const laszip_point_struct *p = &block.points[bi];
+                    laszip_point_struct &dest = buffer->points[ii];
+                    dest = *p;
+                    if (buffer->numExtraBytes > 0)
+                        memcpy(&buffer->extraBytes[ii*buffer->numExtraBytes],p->extra_bytes,buffer->numExtraBytes);
+                    dest.extra_bytes = NULL;
+                }
+        }
+        catch (const std::string &reason)
+        {
+            fprintf(stderr,"%s\n",reason.c_str());
+            return false;
+        }
+        catch (const std::bad_alloc &)
+        {
+            if (!buffer)
+                memoryInUse -= memSize;
+            fprintf(stderr,"Ran out of memory loading tile %d: (%d,%d)\n",tileID.z,tileID.x,tileID.y);
+            return false;
+        }
+
+        // Don't need the input file any more
+        if (removeAfterDone)
+            removeInput(inputDB);
+        
+        return processInMemory(buffer,0,numPoints,tileID,inputDB->header.min_z,inputDB->header.max_z,lidarDB);
+    }
+
+    // Temp space we're holding for the children until they're written
+    long long splitReserved = 0;
+    // Children's files, which we clean up if we don't get as far as handing them off
+    std::string subTileNames[8];
+    std::chrono::steady_clock::time_point tileStart = std::chrono::steady_clock::now();
     try {
+        if (octreeRatio > 0.0 && tileID.z > TileKeyOctreeMaxLevel)
+            throw (std::string)"Octree is too deep at tile " + std::to_string(tileID.z) + ": (" + std::to_string(tileID.x) + "," + std::to_string(tileID.y) + ")";
+
+        BuildMetrics::Stopwatch stopwatch(&metrics,BuildMetrics::TimePartition);
         std::string proj4Str = inputDB->getProj4Str();
         
         // Tile output
-        std::stringstream *ofs = NULL;
-        ofs = new std::stringstream(std::stringstream::out);
-        if (!(*ofs))
-        {
-            fprintf(stderr,"Unable to open string stream.");
-            return false;
-        }
-        laszip_POINTER tileW;
-        laszip_create(&tileW);
-        laszip_set_header(tileW,&inputDB->header);
-        laszip_open_stream_writer(tileW,ofs,true);
+        TileBufferRef tileBuffer;
+        LasWriterRef tileW(startTile(&inputDB->header,tileBuffer));
         
         // Figure out which points we're keeping and which we're outputting
         bool allPoints = getNumRecords(inputDB->header) <= maxPointLimit;
-        float fracToKeep = (float)minPointLimit / (float)getNumRecords(inputDB->header);
+        bool sampleGrids = !allPoints && sampleMode == PointSampler::Grid;
+        const laszip_header_struct &inHeader = inputDB->header;
+        int numExtraBytes = std::max(0,(int)inHeader.point_data_record_length - PointRecordLength(inHeader.point_data_format));
+        // Octree tiles can split vertically too, for eight children instead of four.
+        // The input's header has the height range of our points.
+        double tileZmin = inHeader.min_z, tileZmax = inHeader.max_z;
+        bool splitZ = splitsVertically(tileID,tileZmin,tileZmax);
+        int numSubTiles = splitZ ? 8 : 4;
+        
+        // Make sure there's room for the children before we read anything
+        if (!allPoints)
+        {
+            long long estimate = getNumRecords(inputDB->header) * (spillFormat == SpillRaw ? SpillRecordSize(numExtraBytes) : inHeader.point_data_record_length) + numSubTiles*SpillHeaderReserve;
+            if (!scheduler->startSplit(estimate))
+                throw (std::string)"Out of temp space splitting tile " + std::to_string(tileID.z) + ": (" + std::to_string(tileID.x) + "," + std::to_string(tileID.y) + ")";
+            splitReserved = estimate;
+        }
+        
+        // Points come in a block at a time, with the coordinates worked out for the whole block
+        PointBlock block;
+        std::vector<double> blockX(block.getCapacity()),blockY(block.getCapacity());
+        std::vector<uint8_t> blockQuads(block.getCapacity());
+        
+        // The grid has to see every point before we can pick any.  Only the top level should need this.
+        if (sampleGrids && !sampleGrid)
+        {
+            sampleGrid = makeSampleGrid(tileID);
+            while (true)
+            {
+                stopwatch.switchTo(BuildMetrics::TimeRead);
+                int numInBlock = inputDB->getNextBlock(block);
+                stopwatch.switchTo(BuildMetrics::TimePartition);
+                if (numInBlock == 0)
+                    break;
+                ScaleOffsetInts(&block.x[0],numInBlock,inHeader.x_scale_factor,inHeader.x_offset,&blockX[0]);
+                ScaleOffsetInts(&block.y[0],numInBlock,inHeader.y_scale_factor,inHeader.y_offset,&blockY[0]);
+                for (int ii=0;ii<numInBlock;ii++)
+                    AddSamplePoint(sampleGrid.get(),tileID,&block.points[ii],blockX[ii],blockY[ii]);
+            }
+            inputDB->rewind();
+        }
+        PointSampler sampler(sampleMode,tileID.x,tileID.y,tileID.z,getNumRecords(inputDB->header),minPointLimit,sampleGrid);
+        
+        int tileMaxColor = 0;
 
-        laszip_POINTER subTiles[4] = {NULL,NULL,NULL,NULL};
-        long long subTileCount[4] = {0,0,0,0};
-        TileIdent subTileIDs[4];
-        std::string subTileNames[4];
+        // Quadrant, plus four for the upper half when we split vertically
+        LasWriterRef subTiles[8];
+        std::unique_ptr<SpillWriter> subSpills[8];
+        long long subTileCount[8] = {0,0,0,0,0,0,0,0};
+        TileIdent subTileIDs[8];
+        // Filled in for the children as we hand them points, so they don't need their own pass
+        SampleGridRef subSampleGrids[8];
         
-        double spanX = (fullMaxX-fullMinX)/(1<<tileID.z);
-        double spanY = (fullMaxY-fullMinY)/(1<<tileID.z);
-        double tileXmin = spanX * tileID.x + fullMinX, tileXmax = spanX * (tileID.x+1) + fullMinX;
-        double tileYmin = spanY * tileID.y + fullMinY, tileYmax = spanY * (tileID.y+1) + fullMinY;
-        double spanX_2 = spanX/2.0;
-        double spanY_2 = spanY/2.0;
+        double tileXmin,tileYmin,tileXmax,tileYmax;
+        getTileBounds(tileID,tileXmin,tileYmin,tileXmax,tileYmax);
+        double spanX_2 = (tileXmax-tileXmin)/2.0;
+        double spanY_2 = (tileYmax-tileYmin)/2.0;
+        double spanZ_2 = (tileZmax-tileZmin)/2.0;
+        TileGroundGrid grid(gridSize,gridSize,tileXmin,tileYmin,tileXmax,tileYmax);
+        int32_t splitX = QuantizedSplit(inHeader.x_scale_factor,inHeader.x_offset,tileXmin,spanX_2);
+        int32_t splitY = QuantizedSplit(inHeader.y_scale_factor,inHeader.y_offset,tileYmin,spanY_2);
+        int32_t splitZVal = splitZ ? QuantizedSplit(inHeader.z_scale_factor,inHeader.z_offset,tileZmin,spanZ_2) : 0;
         
         if (!allPoints)
         {
-            for (unsigned int sy=0;sy<2;sy++)
-                for (unsigned int sx=0;sx<2;sx++)
+            for (int which=0;which<numSubTiles;which++)
+            {
+                int sx = which & 1, sy = (which >> 1) & 1, sz = which >> 2;
+                TileIdent &subIdent = subTileIDs[which];
+                subIdent.x = 2*tileID.x + sx;  subIdent.y = 2*tileID.y + sy;  subIdent.z = tileID.z+1;
+                subIdent.zCell = 2*tileID.zCell + sz;
+                if (sampleGrids)
+                    subSampleGrids[which] = makeSampleGrid(subIdent);
+
+                // Set up the write for this sub-tile
+                std::string subFile = subTileFile(subIdent);
+                subTileNames[which] = subFile;
+                
+                if (spillFormat == SpillRaw)
+                {
+                    subSpills[which].reset(new SpillWriter(subFile,inputDB->header.point_data_format,numExtraBytes));
+                    if (!subSpills[which]->isValid())
+                        throw (std::string)"Failed to open spill file " + subFile;
+                    continue;
+                }
+
+                laszip_POINTER subW;
+                laszip_create(&subW);
+                subTiles[which].reset(subW);
+                laszip_set_header(subW, &inputDB->header);
+
+                // Note:  Set this to false to make it faster
+                bool outCompress = true;
+                laszip_open_writer(subW, subFile.c_str(), outCompress);
+                laszip_header_struct *subHeader;
+                laszip_get_header_pointer(subW, &subHeader);
+
+                subHeader->number_of_point_records = 0;
+                subHeader->extended_number_of_point_records = 0;
+                subHeader->number_of_point_records = 0;
+                subHeader->min_x = tileXmin;
+                subHeader->min_y = tileYmin;
+                subHeader->max_x = tileXmax;
+                subHeader->max_y = tileYmax;
+                if (splitZ)
                 {
-                    TileIdent &subIdent = subTileIDs[sy*2+sx];
-                    subIdent.x = 2*tileID.x + sx;  subIdent.y = 2*tileID.y + sy;  subIdent.z = tileID.z+1;
-
-                    // Set up the write for this sub-tile
-                    std::string subFile = tmpDir + "/" + "src_" + std::to_string(subIdent.x) + "_" + std::to_string(subIdent.y) + "_" + std::to_string(subIdent.z) + ".las";
-                    subTileNames[sy*2+sx] = subFile;
-
-                    laszip_POINTER subW;
-                    laszip_create(&subW);
-                    laszip_set_header(subW, &inputDB->header);
-
-                    // Note:  Set this to false to make it faster
-                    bool outCompress = true;
-                    laszip_open_writer(subW, subFile.c_str(), outCompress);
-                    laszip_header_struct *subHeader;
-                    laszip_get_header_pointer(subW, &subHeader);
-
-                    subHeader->number_of_point_records = 0;
-                    subHeader->extended_number_of_point_records = 0;
-                    subHeader->number_of_point_records = 0;
-                    subHeader->min_x = tileXmin;
-                    subHeader->min_y = tileYmin;
+                    subHeader->min_z = tileZmin + sz*spanZ_2;
+                    subHeader->max_z = tileZmin + (sz+1)*spanZ_2;
+                } else {
                     subHeader->min_z = inputDB->header.min_z;
-                    subHeader->max_x = tileXmax;
-                    subHeader->max_y = tileYmax;
                     subHeader->max_z = inputDB->header.max_z;
-
-                    subTiles[sy*2+sx] = subW;
                 }
+            }
         }
         
         // Work through the points in the input file
         long long numToCopy = getNumRecords(inputDB->header);
         long long numCopiedToTile = 0;
-        for (long long ii=0;ii<numToCopy;ii++)
+        while (true)
         {
-            laszip_point_struct *p = inputDB->getNextPoint();
-            if (inputDB->header.point_data_format > 2)
-                maxColor = std::max(std::max(std::max(std::max(maxColor,(int)p->rgb[0]),(int)p->rgb[1]),(int)p->rgb[2]),(int)p->rgb[3]);
-            double randNum = drand48();
-            bool tilePoint = randNum <= fracToKeep;
-            // This point goes out to the tile
-            if (tilePoint || allPoints)
+            // Only switch at block boundaries, so timing costs nothing per point
+            stopwatch.switchTo(BuildMetrics::TimeRead);
+            int numInBlock = inputDB->getNextBlock(block);
+            stopwatch.switchTo(BuildMetrics::TimePartition);
+            if (numInBlock == 0)
+                break;
+            ScaleOffsetInts(&block.x[0],numInBlock,inHeader.x_scale_factor,inHeader.x_offset,&blockX[0]);
+            ScaleOffsetInts(&block.y[0],numInBlock,inHeader.y_scale_factor,inHeader.y_offset,&blockY[0]);
+            if (!allPoints)
             {
-                if (laszip_set_point(tileW,p) ||
-                    laszip_write_point(tileW) ||
-                    laszip_update_inventory(tileW))
-                    throw (std::string)"Failed to write point in tile";
-                numCopiedToTile++;
-                totalWrittenPoints++;
-            } else {
-                double x = p->X * inputDB->header.x_scale_factor + inputDB->header.x_offset;
-                double y = p->Y * inputDB->header.y_scale_factor + inputDB->header.y_offset;
-                // This point goes in one of the subtiles
-                int whichX = (x-tileXmin)/spanX_2;
-                int whichY = (y-tileYmin)/spanY_2;
-                // Shouldn't be necessary, but you can't be too careful
-                whichX = std::min(whichX,1); whichY = std::min(whichY,1);
-                whichX = std::max(whichX,0); whichY = std::max(whichY,0);
-                
-                int whichTile = whichY*2+whichX;
-                laszip_POINTER w = subTiles[whichTile];
-                subTileCount[whichTile]++;
-                if (laszip_set_point(w, p) ||
-                    laszip_write_point(w) ||
-                    laszip_update_inventory(w))
-                    throw (std::string)"Failed to write point in sub tile";
+                ClassifyQuadrants(&block.x[0],&block.y[0],numInBlock,splitX,splitY,&blockQuads[0]);
+                if (splitZ)
+                    for (int ii=0;ii<numInBlock;ii++)
+                        blockQuads[ii] |= (block.z[ii] >= splitZVal) << 2;
+            }
+            
+            for (int ii=0;ii<numInBlock;ii++)
+            {
+                laszip_point_struct *p = &block.points[ii];
+                if (inHeader.point_data_format > 2)
+                    tileMaxColor = PointMaxColor(tileMaxColor,p);
+                double x = blockX[ii], y = blockY[ii];
+                // This point goes out to the tile
+                if (allPoints || sampler.keepPoint(p,x,y))
+                {
+                    if (laszip_set_point(tileW.get(),p) ||
+                        laszip_write_point(tileW.get()) ||
+                        laszip_update_inventory(tileW.get()))
+                        throw (std::string)"Failed to write point in tile";
+                    grid.addPoint(x,y,p->Z * inHeader.z_scale_factor + inHeader.z_offset);
+                    numCopiedToTile++;
+                } else {
+                    // This point goes in one of the subtiles
+                    int whichTile = blockQuads[ii];
+                    subTileCount[whichTile]++;
+                    if (subSampleGrids[whichTile])
+                        AddSamplePoint(subSampleGrids[whichTile].get(),subTileIDs[whichTile],p,x,y);
+                    if (subSpills[whichTile])
+                    {
+                        if (!subSpills[whichTile]->addPoint(p))
+                            throw (std::string)"Failed to write point in spill file";
+                    } else {
+                        laszip_POINTER w = subTiles[whichTile].get();
+                        if (laszip_set_point(w, p) ||
+                            laszip_write_point(w) ||
+                            laszip_update_inventory(w))
+                            throw (std::string)"Failed to write point in sub tile";
+                    }
+                }
             }
         }
         
-        std::string indent = "";
-        for (int ii=0;ii<tileID.z;ii++)
-            indent += " ";
-        fprintf(stdout,"%sTile %d: (%d,%d) saved %lld of %llu points\n",indent.c_str(),tileID.z,tileID.x,tileID.y,numCopiedToTile,getNumRecords(inputDB->header));
-
-        // Save the tile and close out the in-memory tile file
-        {
-            laszip_header_struct *header;
-            laszip_get_header_pointer(tileW, &header);
-            header->number_of_point_records = (laszip_U32)numCopiedToTile;
-            laszip_close_writer(tileW);
-            laszip_destroy(tileW);
-        }
-        std::string tileStr = ofs->str();
-        lidarDB->addTile(tileStr.c_str(), (int)tileStr.size(), tileID.x, tileID.y, tileID.z);
-        delete ofs;
+        totalWrittenPoints += numCopiedToTile;
+        
+        // The tile times its own encoding
+        stopwatch.switchTo(BuildMetrics::TimeNone);
+        // The tile closes its own writer
+        finishTile(tileW.release(),std::move(tileBuffer),tileID,numCopiedToTile,numToCopy,tileMaxColor,grid,lidarDB);
+        stopwatch.switchTo(BuildMetrics::TimePartition);
         
         // Close down the subtiles
-        for (unsigned int ii=0;ii<4;ii++)
-            if (subTiles[ii])
+        for (unsigned int ii=0;ii<8;ii++)
+            if (subTiles[ii] || subSpills[ii])
             {
-                laszip_POINTER lasFile = subTiles[ii];
-                
-                laszip_close_writer(lasFile);
-                laszip_destroy(lasFile);
+                if (subSpills[ii])
+                {
+                    bool closed = subSpills[ii]->close();
+                    subSpills[ii].reset();
+                    if (!closed)
+                        throw (std::string)"Failed to finish spill file " + subTileNames[ii];
+                } else
+                    subTiles[ii].reset();
                 
                 // Remove the file if there were no points
                 if (subTileCount[ii] == 0)
@@ -407,46 +1176,216 @@ bool LidarSorter::process(LidarMultiWrapper *inputDB,TileIdent tileID,LidarDatab
                     subTileNames[ii] = "";
                 }
             }
+        if (splitReserved > 0)
+        {
+            long long actual = 0;
+            for (unsigned int ii=0;ii<8;ii++)
+                if (!subTileNames[ii].empty())
+                    actual += TempFileSize(subTileNames[ii]);
+            scheduler->finishSplit(splitReserved,actual);
+            splitReserved = 0;
+        }
         
-        // Now keep going recursively
+        // The children have everything we need, so the input can go before we recurse
+        if (removeAfterDone)
+            removeInput(inputDB);
+        stopwatch.switchTo(BuildMetrics::TimeNone);
+        metrics.addLevelTime(tileID.z,std::chrono::duration<double>(std::chrono::steady_clock::now() - tileStart).count());
+        
+        // Now keep going recursively.  Queueing children expands the tree breadth first,
+        //  which keeps more threads busy but holds more temp files, so stop once space gets tight.
+        // Going depth first, the small children finish and free their files before the big one
+        //  starts, which keeps the peak down.  The pool runs our own tasks last in first out,
+        //  so queued children go in biggest first for the same effect.
         if (!allPoints)
-            for (unsigned int sy=0;sy<2;sy++)
-                for (unsigned int sx=0;sx<2;sx++)
+        {
+            int order[8] = {0,1,2,3,4,5,6,7};
+            std::stable_sort(order,order+numSubTiles,[&](int a,int b){ return subTileCount[a] < subTileCount[b]; });
+            bool depthFirst = !pool || scheduler->preferDepthFirst();
+            for (int oi=0;oi<numSubTiles;oi++)
+            {
+                int which = depthFirst ? order[oi] : order[numSubTiles-1-oi];
+                TileIdent subIdent = subTileIDs[which];
+                std::string subFile = subTileNames[which];
+                SampleGridRef subSampleGrid = subSampleGrids[which];
+                if (subFile.empty())
+                    continue;
+                
+                // Leave it for one of the shards
+                if (shardLevel > 0 && subIdent.z >= shardLevel)
                 {
-                    TileIdent subIdent(2*tileID.x + sx,2*tileID.y + sy,tileID.z+1);
-                    
-                    std::string subFile = subTileNames[sy*2+sx];
-                    if (!subFile.empty())
-                    {
-                        LidarMultiWrapper subWrap(subFile);
-                        if (!subWrap.init())
-                            throw (std::string)"Failed to read temp tile file " + std::to_string(subIdent.z) + ": (" + std::to_string(subIdent.x) + "," + std::to_string(subIdent.y) + ")";
-                        if (!process(&subWrap,subIdent,lidarDB,true))
-                            throw (std::string)"Failed to write tile " + std::to_string(subIdent.z) + ": (" + std::to_string(subIdent.x) + "," + std::to_string(subIdent.y) + ")";
-                    }
+                    ShardTile shardTile;
+                    shardTile.tileID = subIdent;
+                    shardTile.fileName = subFile;
+                    shardTile.numPoints = subTileCount[which];
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    shardTiles.push_back(shardTile);
+                    continue;
                 }
+                
+                // In parallel mode each subtree is its own task
+                if (!depthFirst)
+                    pool->submit([this,subFile,subIdent,subSampleGrid,lidarDB]{
+                        if (!failed)
+                            processSubFile(subFile,subIdent,subSampleGrid,lidarDB);
+                    });
+                else if (!processSubFile(subFile,subIdent,subSampleGrid,lidarDB))
+                    return false;
+            }
+        }
+    }
+    catch (const std::string &reason)
+    {
+        // The writers closed on the way out, so the partial files can go
+        for (unsigned int ii=0;ii<8;ii++)
+            if (!subTileNames[ii].empty())
+                std::remove(subTileNames[ii].c_str());
+        if (splitReserved > 0)
+            scheduler->finishSplit(splitReserved,splitReserved);
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+bool LidarSorter::processInMemory(PointBufferRef buffer,long long start,long long numPoints,TileIdent tileID,double tileZmin,double tileZmax,LidarDatabase *lidarDB)
+{
+    std::chrono::steady_clock::time_point tileStart = std::chrono::steady_clock::now();
+    try {
+        if (octreeRatio > 0.0 && tileID.z > TileKeyOctreeMaxLevel)
+            throw (std::string)"Octree is too deep at tile " + std::to_string(tileID.z) + ": (" + std::to_string(tileID.x) + "," + std::to_string(tileID.y) + ")";
+        BuildMetrics::Stopwatch stopwatch(&metrics,BuildMetrics::TimePartition);
+        const laszip_header_struct &header = buffer->header.header;
+        int numExtraBytes = buffer->numExtraBytes;
         
-        // Note: Remove the starting file if we need to
-        if (removeAfterDone)
-            inputDB->removeFile();
+        TileBufferRef tileBuffer;
+        laszip_POINTER tileW = startTile(&header,tileBuffer);
         
-        maxLevel = std::max(maxLevel,tileID.z);
+        // Same decisions as the file based version, so the output matches
+        bool allPoints = numPoints <= maxPointLimit;
+        int tileMaxColor = 0;
+        
+        double tileXmin,tileYmin,tileXmax,tileYmax;
+        getTileBounds(tileID,tileXmin,tileYmin,tileXmax,tileYmax);
+        double spanX_2 = (tileXmax-tileXmin)/2.0;
+        double spanY_2 = (tileYmax-tileYmin)/2.0;
+        double spanZ_2 = (tileZmax-tileZmin)/2.0;
+        bool splitZ = splitsVertically(tileID,tileZmin,tileZmax);
+        int numSubTiles = splitZ ? 8 : 4;
+        TileGroundGrid grid(gridSize,gridSize,tileXmin,tileYmin,tileXmax,tileYmax);
+        
+        // Points are already in memory, so filling in the sample grid is cheap
+        SampleGridRef sampleGrid;
+        if (!allPoints && sampleMode == PointSampler::Grid)
+        {
+            sampleGrid = makeSampleGrid(tileID);
+            for (long long ii=0;ii<numPoints;ii++)
+            {
+                const laszip_point_struct *p = &buffer->points[start+ii];
+                AddSamplePoint(sampleGrid.get(),tileID,p,
+                               p->X * header.x_scale_factor + header.x_offset,
+                               p->Y * header.y_scale_factor + header.y_offset);
+            }
+        }
+        PointSampler sampler(sampleMode,tileID.x,tileID.y,tileID.z,numPoints,minPointLimit,sampleGrid);
+        
+        // Write out the tile points and figure out where the rest go
+        std::vector<signed char> whichTiles(numPoints);
+        long long subTileCount[8] = {0,0,0,0,0,0,0,0};
+        // Height range of each child's points, which is what a spill file would have told it
+        int32_t subMinZ[8],subMaxZ[8];
+        std::fill(subMinZ,subMinZ+8,INT32_MAX);
+        std::fill(subMaxZ,subMaxZ+8,INT32_MIN);
+        long long numCopiedToTile = 0;
+        for (long long ii=0;ii<numPoints;ii++)
+        {
+            laszip_point_struct *p = &buffer->points[start+ii];
+            if (header.point_data_format > 2)
+                tileMaxColor = PointMaxColor(tileMaxColor,p);
+            double x = p->X * header.x_scale_factor + header.x_offset;
+            double y = p->Y * header.y_scale_factor + header.y_offset;
+            if (allPoints || sampler.keepPoint(p,x,y))
+            {
+                if (numExtraBytes > 0)
+                    p->extra_bytes = &buffer->extraBytes[(start+ii)*numExtraBytes];
+                if (laszip_set_point(tileW,p) ||
+                    laszip_write_point(tileW) ||
+                    laszip_update_inventory(tileW))
+                    throw (std::string)"Failed to write point in tile";
+                grid.addPoint(x,y,p->Z * header.z_scale_factor + header.z_offset);
+                numCopiedToTile++;
+                whichTiles[ii] = -1;
+            } else {
+                int whichTile = WhichSubTile(p,header,tileXmin,tileYmin,spanX_2,spanY_2);
+                if (splitZ)
+                    whichTile += 4*WhichZHalf(p,header,tileZmin,spanZ_2);
+                subTileCount[whichTile]++;
+                subMinZ[whichTile] = std::min(subMinZ[whichTile],p->Z);
+                subMaxZ[whichTile] = std::max(subMaxZ[whichTile],p->Z);
+                whichTiles[ii] = whichTile;
+            }
+        }
+        
+        totalWrittenPoints += numCopiedToTile;
+        
+        stopwatch.switchTo(BuildMetrics::TimeNone);
+        finishTile(tileW,std::move(tileBuffer),tileID,numCopiedToTile,numPoints,tileMaxColor,grid,lidarDB);
+        stopwatch.switchTo(BuildMetrics::TimePartition);
+        
+        if (allPoints)
+        {
+            metrics.addLevelTime(tileID.z,std::chrono::duration<double>(std::chrono::steady_clock::now() - tileStart).count());
+            return true;
+        }
+        
+        // Shuffle the remaining points into their sub-tiles, keeping them in order
+        long long subTileStart[8],subTilePos[8];
+        subTileStart[0] = start;
+        for (unsigned int ii=1;ii<8;ii++)
+            subTileStart[ii] = subTileStart[ii-1] + subTileCount[ii-1];
+        std::copy(subTileStart,subTileStart+8,subTilePos);
+        for (long long ii=0;ii<numPoints;ii++)
+        {
+            int whichTile = whichTiles[ii];
+            if (whichTile < 0)
+                continue;
+            long long dest = subTilePos[whichTile]++;
+            buffer->scratch[dest] = buffer->points[start+ii];
+            if (numExtraBytes > 0)
+                memcpy(&buffer->scratchExtraBytes[dest*numExtraBytes],&buffer->extraBytes[(start+ii)*numExtraBytes],numExtraBytes);
+        }
+        long long numLeft = numPoints - numCopiedToTile;
+        std::copy(buffer->scratch.begin()+start,buffer->scratch.begin()+start+numLeft,buffer->points.begin()+start);
+        if (numExtraBytes > 0)
+            std::copy(buffer->scratchExtraBytes.begin()+start*numExtraBytes,buffer->scratchExtraBytes.begin()+(start+numLeft)*numExtraBytes,buffer->extraBytes.begin()+start*numExtraBytes);
+        whichTiles.clear();
+        stopwatch.switchTo(BuildMetrics::TimeNone);
+        metrics.addLevelTime(tileID.z,std::chrono::duration<double>(std::chrono::steady_clock::now() - tileStart).count());
 
-        // If this is the top file, we'll set up the output header
-        if (!removeAfterDone)
+        // Now keep going recursively on our own part of the buffer
+        for (int which=0;which<numSubTiles;which++)
         {
-            std::string proj4Str = inputDB->getProj4Str();
-            lidarDB->setHeader(proj4Str.c_str(),inputDB->header.system_identifier,
-                               inputDB->header.min_x, inputDB->header.min_y, inputDB->header.min_z,
-                               inputDB->header.max_x, inputDB->header.max_y, inputDB->header.max_z,
-                               0, maxLevel,
-                               minPointLimit,maxPointLimit,
-                               (int)inputDB->header.point_data_format,maxColor);
+            if (subTileCount[which] == 0)
+                continue;
+            int sx = which & 1, sy = (which >> 1) & 1, sz = which >> 2;
+            TileIdent subIdent(2*tileID.x + sx,2*tileID.y + sy,tileID.z+1,2*tileID.zCell + sz);
+            long long subStart = subTileStart[which], subCount = subTileCount[which];
+            double subZmin = subMinZ[which] * header.z_scale_factor + header.z_offset;
+            double subZmax = subMaxZ[which] * header.z_scale_factor + header.z_offset;
+
+            if (pool)
+                pool->submit([this,buffer,subStart,subCount,subIdent,subZmin,subZmax,lidarDB]{
+                    if (!failed)
+                        processInMemory(buffer,subStart,subCount,subIdent,subZmin,subZmax,lidarDB);
+                });
+            else if (!processInMemory(buffer,subStart,subCount,subIdent,subZmin,subZmax,lidarDB))
+                return false;
         }
     }
     catch (const std::string &reason)
     {
-        fprintf(stderr,"%s\n",reason.c_str());
+        setFailed(reason);
         return false;
     }
     
@@ -17,6 +17,11 @@
 #include <iostream>
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <functional>
 
 #include <geotiff.h>
 #include <geo_simpletags.h>
@@ -25,15 +30,71 @@
 #include <geovalues.h>
 
 #import "laszip_api.h"
+#include "WorkStealingPool.hpp"
+#include "SpillFile.hpp"
+#include "SpillScheduler.hpp"
+#include "MasterLAZFile.hpp"
+#include "DecodePipeline.hpp"
+#include "HeaderScan.hpp"
+#include "PointBlock.hpp"
+#include "PointKernels.h"
+#include "TileGrid.h"
+#include "PointSampler.hpp"
+#include "BuildMetrics.hpp"
+#include "TileBuffer.hpp"
 
 class TileIdent
 {
 public:
-    TileIdent() { }
-    TileIdent(int x,int y,int z) : x(x), y(y), z(z) { }
+    TileIdent() : zCell(0) { }
+    TileIdent(int x,int y,int z,int zCell = 0) : x(x), y(y), z(z), zCell(zCell) { }
+    // z is the level
     int x,y,z;
+    // Vertical cell in an octree build, 0 otherwise.  Children are 2*zCell, plus one for
+    //  the upper half when a tile splits vertically, so every cell in a column is distinct.
+    int zCell;
 };
 
+/* Deep copy of a LAS header, including the variable length records.
+    laszip hands out headers that point into the reader, so use this
+    when the header needs to outlive the reader.
+  */
+class LasHeaderCopy
+{
+public:
+    LasHeaderCopy(const laszip_header_struct &header);
+    
+    laszip_header_struct header;
+    
+protected:
+    LasHeaderCopy(const LasHeaderCopy &);
+    LasHeaderCopy &operator = (const LasHeaderCopy &);
+
+    std::vector<laszip_vlr_struct> vlrs;
+    std::vector<std::vector<laszip_U8> > vlrData;
+    std::vector<laszip_U8> userDataInHeader,userDataAfterHeader;
+};
+
+// Size of the standard part of a point record for the given format
+int PointRecordLength(int pointDataFormat);
+
+// Number of points in a file, using the extended count if it's there
+long long getNumRecords(laszip_header_struct *header);
+long long getNumRecords(laszip_header_struct &header);
+
+// Largest color value, to tell 8 bit color from 16 bit
+inline int PointMaxColor(int maxColor,const laszip_point_struct *p)
+{
+    return std::max(std::max(std::max(std::max(maxColor,(int)p->rgb[0]),(int)p->rgb[1]),(int)p->rgb[2]),(int)p->rgb[3]);
+}
+
+// Smallest quantized coordinate that lands in the upper half of a tile.
+// Lets us sort out quadrants on the integers and still get the same answer as the doubles.
+int32_t QuantizedSplit(double scale,double offset,double tileMin,double span_2);
+
+// Generate a proj4 compatible string from the GeoTIFF records
+bool GenerateProjStr(laszip_header_struct *thisHeader,std::string &str);
+
 /* The LIDAR multi wrapper opens a group of files and makes
     up a header to describe them all.
   */
@@ -46,8 +107,15 @@ public:
     // Construct with the filenames to open
     LidarMultiWrapper(const std::vector<std::string> &files);
     
+    // Construct for a spill file.  Those don't have a full header, so we
+    //  take the rest of it from the original input.
+    LidarMultiWrapper(const std::string &spillFile,std::shared_ptr<LasHeaderCopy> baseHeader,const std::string &projStr);
+    
     ~LidarMultiWrapper();
     
+    // Read the headers this many at a time and cache them in the manifest file (if set).  Call before init().
+    void setScanOptions(int numThreads,const std::string &inManifestFile) { scanThreads = numThreads;  manifestFile = inManifestFile; }
+    
     // Open the files and figure out the various header parameters
     //  to describe them all.
     bool init();
@@ -58,16 +126,29 @@ public:
     // Fetch the next point, irrespective of the file it's in
     laszip_point_struct *getNextPoint();
     
+    // Fill in a block with as many of the next points as will fit.  Returns the number read, 0 at the end.
+    int getNextBlock(PointBlock &block);
+    
+    // Go back to the first point
+    void rewind();
+    
+    // Decode the input files on this many background threads.  0 reads them on the caller's thread.
+    // Unordered delivery keeps the decoders busier, but the points come back in a different order each run.
+    void setDecodeThreads(int numThreads,bool ordered) { decodeThreads = numThreads;  decodeOrdered = ordered; }
+    
     // Header to cover the whole area
     laszip_header_struct header;
     
-    // Remove the input file
-    void removeFile();
+    // Remove the input file.  Returns the number of bytes freed up.
+    long long removeFile();
     
     // Return a proj4 compatible string (if we were able to make one)
     std::string getProj4Str() { return projStr; }
     
 protected:
+    // Move on to the next file with points in it
+    void openNextFile();
+    
     std::vector<std::string> files;
     bool valid;
 
@@ -75,8 +156,23 @@ protected:
     long long whichPointOverall;
     long long whichPointInFile;
     laszip_POINTER reader;
+    laszip_point_struct *readerPoint;
+    long long numPointsInFile;
     std::string projStr;
-    std::vector<laszip_POINTER> openReaders;
+    
+    // Full header of the first file.  The merged header points into this.
+    std::shared_ptr<LasHeaderCopy> firstHeader;
+    int scanThreads;
+    std::string manifestFile;
+    
+    // Set if we're reading a spill file
+    std::shared_ptr<LasHeaderCopy> baseHeader;
+    SpillReader *spillReader;
+    
+    // Set if we're decoding in the background
+    int decodeThreads;
+    bool decodeOrdered;
+    DecodePipeline *pipeline;
 };
 
 /* The Lidar sorter recursively sorts LIDAR point files.
@@ -84,27 +180,207 @@ protected:
 class LidarSorter
 {
 public:
+    // How we store the intermediate tiles for the next level down
+    typedef enum {SpillLAZ,SpillRaw} SpillFormat;
+
+    /* A subtree split off for another process to build.
+        Its points are waiting in a temp file.
+      */
+    class ShardTile
+    {
+    public:
+        ShardTile() : numPoints(0) { }
+        TileIdent tileID;
+        std::string fileName;
+        long long numPoints;
+    };
+
     LidarSorter(const char *tmp_dir);
+    virtual ~LidarSorter() { }
     
     // Maximum number of points in a tile
     void setPointLimit(int minLimit,int maxLimit) { minPointLimit = minLimit; maxPointLimit = maxLimit; }
     
+    // Number of threads to build subtrees with.  1 means the old serial recursion.
+    void setNumThreads(int inNumThreads) { numThreads = inNumThreads; }
+    
+    // Bytes we can use to hold points in memory.  Once a node fits in what's left
+    //  we load it and build the rest of its subtree without temp files.  0 turns this off.
+    void setMemoryBudget(long long budget) { memoryBudget = budget; }
+    
+    // Format for the temp files.  Raw is faster, LAZ is smaller.
+    void setSpillFormat(SpillFormat format) { spillFormat = format; }
+    
+    // Cells on a side of the ground grid we store for each tile.  0 skips the grid, but not the z range.
+    void setGridSize(int size) { gridSize = size; }
+    
+    // How tiles pick the points they keep.  Grid spreads them out evenly, but needs an extra pass over the top level input.
+    void setSampleMode(PointSampler::Mode mode) { sampleMode = mode; }
+    
+    // Bytes we can use for temp files.  0 means no limit.
+    void setTempBudget(long long budget) { tempBudget = budget; }
+    
+    // For an IndexOnly database, the LAZ file the points go in and the LAZ chunk size to use.
+    void setMasterFile(const std::string &fileName,int chunkSize) { masterFileName = fileName;  masterChunkSize = chunkSize; }
+    
+    // How to encode tiles in a FullData database.  Compact is smaller and faster to decode, but only keeps what the viewers use.
+    // A Columnar database always gets columnar tiles.
+    void setTileCodec(TileCodec codec) { tileCodec = codec; }
+    
+    // Print a line for every tile as it's written, rather than just the periodic progress line
+    void setVerbose(bool inVerbose) { verbose = inVerbose; }
+    
+    // Counters and timing for the build.  Set the progress interval before process(), report after the database is flushed.
+    BuildMetrics &getMetrics() { return metrics; }
+    
+    // Build an octree, splitting tiles vertically as well while they're taller than this times their width.
+    // The database needs octree keys to go with it.  0 builds a quadtree.
+    void setOctree(double ratio) { octreeRatio = ratio; }
+    
+    // Stop at this level and leave the subtrees there in their temp files, for a sharded build.  0 builds the whole tree.
+    void setShardLevel(int level) { shardLevel = level; }
+    
+    // Subtrees left for the shards by the last process() with a shard level
+    const std::vector<ShardTile> &getShardTiles() { return shardTiles; }
+    
     // Process the top level file and recurse from there
-    bool process(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB);
+    virtual bool process(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB);
+    
+    // Build just the given subtrees, as split off by a coordinator with a shard level.
+    // The input is the same set of files the coordinator started with.  Removes the temp files as it goes.
+    bool processShard(LidarMultiWrapper *inputDB,const std::vector<ShardTile> &tiles,LidarDatabase *lidarDB);
     
     // Number of points written in various files
     long long getNumPointsWritten() { return totalWrittenPoints; }
     
+    // Most temp space we used at once
+    long long getPeakTempSpace() { return peakTempSpace; }
+    
 protected:
-    bool process(LidarMultiWrapper *inputDB,TileIdent tileID,LidarDatabase *lidarDB,bool removeAfterDone);
+    /* Points for a subtree we're building in memory.
+        Children work on their own ranges of the same buffer.
+      */
+    class PointBuffer
+    {
+    public:
+        PointBuffer(LidarSorter *sorter,const laszip_header_struct &header,long long numPoints,long long reserved);
+        ~PointBuffer();
+        
+        LidarSorter *sorter;
+        LasHeaderCopy header;
+        long long numPoints;
+        // Bytes we reserved from the memory budget
+        long long reserved;
+        int numExtraBytes;
+        std::vector<laszip_point_struct> points,scratch;
+        std::vector<laszip_U8> extraBytes,scratchExtraBytes;
+    };
+    typedef std::shared_ptr<PointBuffer> PointBufferRef;
+
+    // The sample grid is filled in by the parent as it writes our points.  Without it we make an extra pass.
+    bool process(LidarMultiWrapper *inputDB,TileIdent tileID,SampleGridRef sampleGrid,LidarDatabase *lidarDB,bool removeAfterDone);
+    
+    // Build a subtree from points already in memory.  The height range is for just these points.
+    bool processInMemory(PointBufferRef buffer,long long start,long long numPoints,TileIdent tileID,double tileZmin,double tileZmax,LidarDatabase *lidarDB);
+    
+    // Set up for a build from this input, run the work and then write the header
+    bool runBuild(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB,long long numPoints,const std::function<bool()> &work);
+    
+    // Fill in the database header once all the tiles are written
+    void writeHeader(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB);
+    
+    // Bounds of the given tile in the source coordinate system
+    void getTileBounds(TileIdent tileID,double &tileXmin,double &tileYmin,double &tileXmax,double &tileYmax);
+    
+    // An octree tile splits vertically when its points are tall compared to its footprint
+    bool splitsVertically(TileIdent tileID,double minZ,double maxZ);
+    
+    // Temp file for a tile's points
+    std::string subTileFile(TileIdent tileID);
+    
+    // Set up a LAZ writer for a tile, writing into a buffer from the pool
+    laszip_POINTER startTile(const laszip_header_struct *header,TileBufferRef &buffer);
+    
+    // Set up the tile codec and, for an IndexOnly database, the master LAZ file.  Call once the root header is set.
+    bool startOutput(LidarDatabase *lidarDB);
+    
+    // Close the master LAZ file, if there is one
+    bool finishOutput(bool success);
+    
+    // Load the points from an uncompressed LAS tile into a compact or columnar encoder
+    bool loadCompactTile(const char *tileData,size_t tileSize,CompactTileEncoder &encoder);
+    
+    // Close out the tile writer and store the tile
+    virtual void finishTile(laszip_POINTER tileW,TileBufferRef buffer,TileIdent tileID,long long numCopiedToTile,long long numInput,int tileMaxColor,const TileGroundGrid &grid,LidarDatabase *lidarDB);
+    
+    // Try to take some of the memory budget
+    bool reserveMemory(long long size);
+    
+    // How much memory one point takes in the in-memory build
+    long long memoryPerPoint(const laszip_header_struct &header);
+    
+    // Open up a temp tile file and process it (and its children)
+    bool processSubFile(const std::string &subFile,TileIdent subIdent,SampleGridRef sampleGrid,LidarDatabase *lidarDB);
+    
+    // Empty sample grid over the given tile
+    SampleGridRef makeSampleGrid(TileIdent tileID);
+    
+    // Remove a temp file we've finished reading and give back its space
+    void removeInput(LidarMultiWrapper *inputDB);
+    
+    // Note a failure from a worker thread
+    void setFailed(const std::string &reason);
+    
+    // Print out how well the parallel build scaled
+    void reportScaling(double wallTime);
 
     int minPointLimit,maxPointLimit;
     int maxLevel;
     std::string tmpDir;
-    long long totalWrittenPoints;
+    std::atomic<long long> totalWrittenPoints;
     int maxColor;
     
+    // Parallel build.  Workers share maxLevel and maxColor through the mutex.
+    int numThreads;
+    WorkStealingPool *pool;
+    std::mutex stateMutex;
+    std::atomic<bool> failed;
+    std::string failReason;
+    
+    long long memoryBudget;
+    std::atomic<long long> memoryInUse;
+    
+    // Spill files need the header and projection from the original input
+    SpillFormat spillFormat;
+    std::shared_ptr<LasHeaderCopy> rootHeader;
+    std::string rootProjStr;
+    
     double fullMinX,fullMinY,fullMaxX,fullMaxY;
+    double fullMinZ,fullMaxZ;
+    // Octree build.  A tile splits vertically when its points are at least this many times as tall as it is wide.
+    double octreeRatio;
+    int gridSize;
+    PointSampler::Mode sampleMode;
+    
+    // Temp space tracking for the current build
+    long long tempBudget,peakTempSpace;
+    std::unique_ptr<SpillScheduler> scheduler;
+    
+    // Points for an IndexOnly database go here rather than in the tiles
+    std::string masterFileName;
+    int masterChunkSize;
+    std::unique_ptr<MasterLAZFile> masterFile;
+    
+    TileCodec tileCodec;
+    
+    bool verbose;
+    BuildMetrics metrics;
+    // Tiles are written into these, so we're not allocating a stream for each one
+    TileBufferPoolRef bufferPool;
+    
+    // Sharded build.  Subtrees at the shard level are left here rather than built.
+    int shardLevel;
+    std::vector<ShardTile> shardTiles;
 };
 
 #endif /* LidarSorter_hpp */
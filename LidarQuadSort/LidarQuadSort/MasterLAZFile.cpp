@@ -0,0 +1,160 @@
+//
+//  MasterLAZFile.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "MasterLAZFile.hpp"
+#include <string.h>
+#include <istream>
+#include "TileBuffer.hpp"
+
+MasterLAZFile::MasterLAZFile(const std::string &fileName,int chunkSize)
+: fileName(fileName), chunkSize(chunkSize > 0 ? chunkSize : DefaultChunkSize), writer(NULL), numPoints(0), numPadding(0)
+{
+    memset(&lastPoint,0,sizeof(lastPoint));
+}
+
+MasterLAZFile::~MasterLAZFile()
+{
+    close();
+}
+
+bool MasterLAZFile::open(const laszip_header_struct &inHeader)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (writer)
+        return false;
+
+    // The inventory fills the counts and bounds back in when we close
+    laszip_header_struct header = inHeader;
+    header.number_of_point_records = 0;
+    header.extended_number_of_point_records = 0;
+    memset(header.number_of_points_by_return,0,sizeof(header.number_of_points_by_return));
+    memset(header.extended_number_of_points_by_return,0,sizeof(header.extended_number_of_points_by_return));
+
+    laszip_create(&writer);
+    if (laszip_set_header(writer,&header) ||
+        laszip_set_chunk_size(writer,chunkSize) ||
+        laszip_open_writer(writer,fileName.c_str(),true))
+    {
+        laszip_CHAR *errMsg = NULL;
+        laszip_get_error(writer,&errMsg);
+        fprintf(stderr,"Failed to open %s: %s\n",fileName.c_str(),errMsg ? errMsg : "unknown error");
+        laszip_destroy(writer);
+        writer = NULL;
+        return false;
+    }
+    numPoints = 0;
+    numPadding = 0;
+
+    return true;
+}
+
+bool MasterLAZFile::writePoint(const laszip_point_struct *p)
+{
+    if (laszip_set_point(writer,p) || laszip_write_point(writer) || laszip_update_inventory(writer))
+    {
+        fprintf(stderr,"Failed to write point %lld to %s\n",numPoints,fileName.c_str());
+        return false;
+    }
+    numPoints++;
+
+    return true;
+}
+
+bool MasterLAZFile::padToChunk()
+{
+    long long numPad = (chunkSize - numPoints % chunkSize) % chunkSize;
+    if (numPad == 0)
+        return true;
+
+    laszip_point_struct pad = lastPoint;
+    pad.withheld_flag = 1;
+    pad.extended_classification_flags |= 0x4;
+    pad.extra_bytes = lastExtraBytes.empty() ? NULL : &lastExtraBytes[0];
+    for (long long ii=0;ii<numPad;ii++)
+        if (!writePoint(&pad))
+            return false;
+    numPadding += numPad;
+
+    return true;
+}
+
+bool MasterLAZFile::addTile(const char *tileData,size_t tileSize,long long &start,long long &count)
+{
+    TileReadBuffer tileBuf(tileData,tileSize);
+    std::istream tileStream(&tileBuf);
+    laszip_POINTER reader = NULL;
+    laszip_create(&reader);
+    laszip_BOOL isCompressed;
+    if (laszip_open_stream_reader(reader,&tileStream,&isCompressed))
+    {
+        fprintf(stderr,"Failed to read tile for %s\n",fileName.c_str());
+        laszip_destroy(reader);
+        return false;
+    }
+    laszip_header_struct *header;
+    laszip_get_header_pointer(reader,&header);
+    laszip_point_struct *p;
+    laszip_get_point_pointer(reader,&p);
+    long long numTilePoints = header->number_of_point_records ? header->number_of_point_records : header->extended_number_of_point_records;
+
+    bool ret = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!writer)
+            ret = false;
+        if (ret && numTilePoints > 0)
+            ret = padToChunk();
+        start = numPoints;
+        count = 0;
+        for (long long which=0;which<numTilePoints && ret;which++)
+        {
+            if (laszip_read_point(reader))
+            {
+                fprintf(stderr,"Failed to read tile point for %s\n",fileName.c_str());
+                ret = false;
+                break;
+            }
+            ret = writePoint(p);
+            count++;
+        }
+        if (count > 0)
+        {
+            lastPoint = *p;
+            lastExtraBytes.assign(p->extra_bytes,p->extra_bytes + (p->extra_bytes ? p->num_extra_bytes : 0));
+        }
+    }
+
+    laszip_close_reader(reader);
+    laszip_destroy(reader);
+
+    return ret;
+}
+
+bool MasterLAZFile::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!writer)
+        return true;
+
+    bool ret = true;
+    if (laszip_close_writer(writer))
+    {
+        fprintf(stderr,"Failed to close %s\n",fileName.c_str());
+        ret = false;
+    }
+    laszip_destroy(writer);
+    writer = NULL;
+
+    return ret;
+}
+
+std::string MasterLAZFile::getBaseName()
+{
+    size_t slash = fileName.find_last_of('/');
+    return slash == std::string::npos ? fileName : fileName.substr(slash+1);
+}
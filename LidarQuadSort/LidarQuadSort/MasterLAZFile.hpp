@@ -0,0 +1,69 @@
+//
+//  MasterLAZFile.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef MasterLAZFile_hpp
+#define MasterLAZFile_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "laszip_api.h"
+
+/* One big LAZ file holding the points for every tile, for an IndexOnly database.
+    Each tile's points go in together and start on a LAZ chunk boundary, so a
+    reader can seek straight to a tile without decompressing anything in front of it.
+    The gaps in front of a tile are filled with withheld copies of the last point,
+    which other LAS tools will skip.  Repeats of the same point compress to next
+    to nothing, so the padding costs little on disk.
+    Tiles can be added from multiple threads.
+  */
+class MasterLAZFile
+{
+public:
+    // Points per LAZ chunk.  Smaller wastes less on padding, bigger compresses a little better.
+    static const int DefaultChunkSize = 5000;
+
+    MasterLAZFile(const std::string &fileName,int chunkSize = DefaultChunkSize);
+    ~MasterLAZFile();
+
+    // Open the file.  Tiles need to use the scale, offset and point format from this header.
+    bool open(const laszip_header_struct &header);
+
+    // Copy a tile's points into the file.  The tile is a LAS or LAZ file in memory.
+    // Returns the index of its first point and the number of points.
+    bool addTile(const char *tileData,size_t tileSize,long long &start,long long &count);
+
+    // Write out the header and close the file
+    bool close();
+
+    // Name of the file, without the directory
+    std::string getBaseName();
+
+    long long getNumPoints() { return numPoints; }
+    long long getNumPadding() { return numPadding; }
+
+protected:
+    // Write a point and add it to the header bounds and counts
+    bool writePoint(const laszip_point_struct *p);
+
+    // Fill in up to the next chunk boundary
+    bool padToChunk();
+
+    std::mutex mutex;
+    std::string fileName;
+    int chunkSize;
+    laszip_POINTER writer;
+    // Total points in the file, including padding
+    long long numPoints,numPadding;
+    // Last real point we wrote, for padding
+    laszip_point_struct lastPoint;
+    std::vector<laszip_U8> lastExtraBytes;
+};
+
+#endif /* MasterLAZFile_hpp */
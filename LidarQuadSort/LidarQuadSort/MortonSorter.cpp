@@ -0,0 +1,478 @@
+//
+//  MortonSorter.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "MortonSorter.hpp"
+#include "TileKey.h"
+#include <queue>
+#include <chrono>
+
+// Cells on a side are 2^MortonDepth.  Tiles that still have too many points at this level keep them all.
+static const int MortonDepth = 24;
+
+// Key for a tile in the counts table
+static inline uint64_t CountKey(int level,uint64_t prefix)
+{
+    return ((uint64_t)level << 56) | prefix;
+}
+
+// Shallowest level at which two point keys are in different tiles.  MortonDepth+1 if they're in the same cell.
+static inline int FirstDifferentLevel(uint64_t key,uint64_t lastKey)
+{
+    uint64_t diff = key ^ lastKey;
+    if (diff == 0)
+        return MortonDepth+1;
+    int highBit = 63 - __builtin_clzll(diff);
+    return MortonDepth - highBit/2;
+}
+
+MortonSorter::MortonSorter(const char *tmp_dir)
+: LidarSorter(tmp_dir), mergeFanIn(64), runIndex(0), numExtraBytes(0), cellSizeX(1.0), cellSizeY(1.0)
+{
+}
+
+bool MortonSorter::process(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB)
+{
+    fullMinX = inputDB->header.min_x;
+    fullMinY = inputDB->header.min_y;
+    fullMaxX = inputDB->header.max_x;
+    fullMaxY = inputDB->header.max_y;
+    rootHeader = std::make_shared<LasHeaderCopy>(inputDB->header);
+    rootProjStr = inputDB->getProj4Str();
+    numExtraBytes = std::max(0,(int)inputDB->header.point_data_record_length - PointRecordLength(inputDB->header.point_data_format));
+    if (!startOutput(lidarDB))
+        return false;
+
+    cellSizeX = (fullMaxX-fullMinX)/(1<<MortonDepth);
+    cellSizeY = (fullMaxY-fullMinY)/(1<<MortonDepth);
+    if (cellSizeX <= 0.0)
+        cellSizeX = 1.0;
+    if (cellSizeY <= 0.0)
+        cellSizeY = 1.0;
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    auto elapsed = [&]{ return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(); };
+
+    lidarDB->setMetrics(&metrics);
+    metrics.start(getNumRecords(inputDB->header));
+    scheduler.reset(new SpillScheduler(tempBudget,&metrics));
+
+    std::vector<std::string> runs;
+    bool ret = makeRuns(inputDB,runs);
+    if (ret)
+    {
+        fprintf(stdout,"Sorted points into %d runs in %.2fs\n",(int)runs.size(),elapsed());
+        ret = reduceRuns(runs);
+    }
+    if (ret)
+    {
+        ret = countTiles(runs);
+        fprintf(stdout,"Counted %d tiles in %.2fs\n",(int)counts.size(),elapsed());
+    }
+    if (ret)
+    {
+        ret = writeTiles(runs,lidarDB);
+        fprintf(stdout,"Wrote tiles in %.2fs\n",elapsed());
+    }
+
+    for (const auto &run : runs)
+        removeRun(run);
+    counts.clear();
+    metrics.stop();
+    scheduler->report();
+    peakTempSpace = scheduler->getPeak();
+    scheduler.reset();
+    ret = finishOutput(ret);
+
+    if (ret)
+        writeHeader(inputDB,lidarDB);
+
+    return ret;
+}
+
+uint64_t MortonSorter::pointKey(const laszip_point_struct *p)
+{
+    const laszip_header_struct &header = rootHeader->header;
+    double x = p->X * header.x_scale_factor + header.x_offset;
+    double y = p->Y * header.y_scale_factor + header.y_offset;
+    long long cellX = (long long)floor((x-fullMinX)/cellSizeX);
+    long long cellY = (long long)floor((y-fullMinY)/cellSizeY);
+    long long maxCell = (1<<MortonDepth)-1;
+    cellX = std::min(std::max(cellX,0LL),maxCell);
+    cellY = std::min(std::max(cellY,0LL),maxCell);
+
+    return MortonEncode((uint32_t)cellX,(uint32_t)cellY);
+}
+
+void MortonSorter::removeRun(const std::string &runFile)
+{
+    scheduler->removeFiles(TempFileSize(runFile));
+    remove(runFile.c_str());
+}
+
+TileIdent MortonSorter::prefixToTile(int level,uint64_t prefix)
+{
+    uint32_t x,y;
+    MortonDecode(prefix,x,y);
+    return TileIdent(x,y,level);
+}
+
+long long MortonSorter::tileCount(int level,uint64_t prefix)
+{
+    auto it = counts.find(CountKey(level,prefix));
+    return it == counts.end() ? 0 : it->second;
+}
+
+bool MortonSorter::makeRuns(LidarMultiWrapper *inputDB,std::vector<std::string> &runs)
+{
+    // Points, their extra bytes and the keys we sort on all come out of the budget
+    long long budget = memoryBudget > 0 ? memoryBudget : 1024LL*1024*1024;
+    long long perPoint = sizeof(laszip_point_struct) + numExtraBytes + sizeof(std::pair<uint64_t,uint32_t>);
+    PointBlock block;
+    size_t runSize = (size_t)std::min(std::max(budget/perPoint,(long long)block.getCapacity()),(long long)UINT32_MAX);
+
+    // The runs hold a copy of the whole input, so there's no point starting if that won't fit
+    long long totalSize = getNumRecords(inputDB->header) * SpillRecordSize(numExtraBytes);
+    if (tempBudget > 0 && totalSize > tempBudget)
+    {
+        fprintf(stderr,"Temp budget of %.1fMB is too small.  Sort runs need %.1fMB.\n",tempBudget/(1024.0*1024.0),totalSize/(1024.0*1024.0));
+        return false;
+    }
+
+    std::vector<laszip_point_struct> points;
+    std::vector<laszip_U8> extraBytes;
+    std::vector<std::pair<uint64_t,uint32_t> > order;
+
+    try {
+        // Everything but reading counts as partitioning, including writing out the runs
+        BuildMetrics::Stopwatch stopwatch(&metrics,BuildMetrics::TimePartition);
+        points.reserve(runSize);
+        order.reserve(runSize);
+        extraBytes.reserve(runSize*numExtraBytes);
+
+        while (true)
+        {
+            stopwatch.switchTo(BuildMetrics::TimeRead);
+            int numInBlock = inputDB->getNextBlock(block);
+            stopwatch.switchTo(BuildMetrics::TimePartition);
+            for (int ii=0;ii<numInBlock;ii++)
+            {
+                const laszip_point_struct *p = &block.points[ii];
+                order.push_back(std::make_pair(pointKey(p),(uint32_t)points.size()));
+                points.push_back(*p);
+                points.back().extra_bytes = NULL;
+                if (numExtraBytes > 0)
+                    extraBytes.insert(extraBytes.end(),p->extra_bytes,p->extra_bytes+numExtraBytes);
+            }
+
+            // Sort what we've got and write it out.  Ties stay in input order.
+            if ((numInBlock == 0 || points.size() + block.getCapacity() > runSize) && !points.empty())
+            {
+                std::sort(order.begin(),order.end());
+                std::string runFile = tmpDir + "/run_" + std::to_string(runIndex++) + ".spill";
+                long long estimate = sizeof(SpillFileHeader) + points.size() * (long long)SpillRecordSize(numExtraBytes);
+                if (!scheduler->startSplit(estimate))
+                    throw (std::string)"Out of temp space for run file " + runFile;
+                SpillWriter runW(runFile,rootHeader->header.point_data_format,numExtraBytes);
+                runs.push_back(runFile);
+                if (!runW.isValid())
+                    throw (std::string)"Failed to open run file " + runFile;
+                for (const auto &entry : order)
+                {
+                    laszip_point_struct &p = points[entry.second];
+                    if (numExtraBytes > 0)
+                        p.extra_bytes = &extraBytes[entry.second*(size_t)numExtraBytes];
+                    if (!runW.addPoint(&p))
+                        throw (std::string)"Failed to write point in run file " + runFile;
+                }
+                bool closed = runW.close();
+                scheduler->finishSplit(estimate,runW.getFileSize());
+                if (!closed)
+                    throw (std::string)"Failed to finish run file " + runFile;
+
+                points.clear();
+                extraBytes.clear();
+                order.clear();
+            }
+
+            if (numInBlock == 0)
+                break;
+        }
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        return false;
+    }
+    catch (const std::bad_alloc &)
+    {
+        fprintf(stderr,"Ran out of memory sorting runs.  Try a smaller -mem.\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool MortonSorter::mergeRuns(const std::vector<std::string> &runs,const PointFunc &func)
+{
+    std::vector<std::unique_ptr<SpillReader> > readers;
+    std::vector<long long> pos(runs.size(),0);
+    for (const auto &run : runs)
+    {
+        metrics.add(BuildMetrics::TempRead,TempFileSize(run));
+        readers.push_back(std::unique_ptr<SpillReader>(new SpillReader(run)));
+        if (!readers.back()->open())
+        {
+            fprintf(stderr,"Failed to open run file %s\n",run.c_str());
+            return false;
+        }
+    }
+
+    // Smallest key on top.  Ties go to the earlier run, which keeps input order.
+    typedef std::pair<uint64_t,int> HeapEntry;
+    std::priority_queue<HeapEntry,std::vector<HeapEntry>,std::greater<HeapEntry> > heap;
+    for (unsigned int ii=0;ii<readers.size();ii++)
+        if (readers[ii]->getNumPoints() > 0)
+            heap.push(HeapEntry(pointKey(readers[ii]->getPoint(0)),ii));
+
+    while (!heap.empty())
+    {
+        HeapEntry entry = heap.top();
+        heap.pop();
+        int which = entry.second;
+        laszip_point_struct *p = readers[which]->getPoint(pos[which]);
+        if (!p)
+        {
+            fprintf(stderr,"Failed to read point from run file %s\n",runs[which].c_str());
+            return false;
+        }
+        func(p,entry.first);
+
+        if (++pos[which] < readers[which]->getNumPoints())
+            heap.push(HeapEntry(pointKey(readers[which]->getPoint(pos[which])),which));
+    }
+
+    return true;
+}
+
+bool MortonSorter::reduceRuns(std::vector<std::string> &runs)
+{
+    BuildMetrics::ScopedTimer timer(&metrics,BuildMetrics::TimePartition);
+    size_t fanIn = std::max(mergeFanIn,2);
+    while (runs.size() > fanIn)
+    {
+        std::vector<std::string> newRuns;
+        for (size_t start=0;start<runs.size();start+=fanIn)
+        {
+            std::vector<std::string> group(runs.begin()+start,runs.begin()+std::min(start+fanIn,runs.size()));
+            if (group.size() == 1)
+            {
+                newRuns.push_back(group[0]);
+                continue;
+            }
+
+            std::string runFile = tmpDir + "/run_" + std::to_string(runIndex++) + ".spill";
+            // The merged run is the same size as the group, and they're both around until it's done
+            long long groupSize = 0;
+            for (const auto &run : group)
+                groupSize += TempFileSize(run);
+            if (!scheduler->startSplit(groupSize))
+                return false;
+            SpillWriter runW(runFile,rootHeader->header.point_data_format,numExtraBytes);
+            bool ok = runW.isValid();
+            if (ok)
+                ok = mergeRuns(group,[&](const laszip_point_struct *p,uint64_t){
+                    if (ok && !runW.addPoint(p))
+                        ok = false;
+                });
+            ok = runW.close() && ok;
+            scheduler->finishSplit(groupSize,TempFileSize(runFile));
+            if (!ok)
+            {
+                fprintf(stderr,"Failed to merge into run file %s\n",runFile.c_str());
+                removeRun(runFile);
+                return false;
+            }
+
+            for (const auto &run : group)
+                removeRun(run);
+            newRuns.push_back(runFile);
+        }
+        fprintf(stdout,"Merged %d runs into %d\n",(int)runs.size(),(int)newRuns.size());
+        runs = newRuns;
+    }
+
+    return true;
+}
+
+bool MortonSorter::countTiles(const std::vector<std::string> &runs)
+{
+    BuildMetrics::ScopedTimer timer(&metrics,BuildMetrics::TimePartition);
+    counts.clear();
+
+    // Tile we're in at each level and its count so far.  Counts roll up into the parent as tiles close.
+    std::vector<uint64_t> curPrefix(MortonDepth+1,0);
+    std::vector<long long> curCount(MortonDepth+1,0);
+    // Children of the tile open at the level above
+    std::vector<std::vector<std::pair<uint64_t,long long> > > closedChildren(MortonDepth+2);
+
+    // We only need counts for the tiles the write pass might open.
+    // Those are the ones with too many points and their children.
+    auto closeLevel = [&](int level)
+    {
+        uint64_t prefix = curPrefix[level];
+        long long count = curCount[level];
+        if (count > maxPointLimit || level == 0)
+        {
+            counts[CountKey(level,prefix)] = count;
+            for (const auto &child : closedChildren[level+1])
+                counts[CountKey(level+1,child.first)] = child.second;
+        }
+        closedChildren[level+1].clear();
+        closedChildren[level].push_back(std::make_pair(prefix,count));
+        if (level > 0)
+            curCount[level-1] += count;
+        curCount[level] = 0;
+    };
+
+    bool first = true;
+    uint64_t lastKey = 0;
+    bool ret = mergeRuns(runs,[&](const laszip_point_struct *,uint64_t key){
+        int level = first ? 0 : FirstDifferentLevel(key,lastKey);
+        if (!first)
+            for (int ii=MortonDepth;ii>=level;ii--)
+                closeLevel(ii);
+        for (int ii=level;ii<=MortonDepth;ii++)
+            curPrefix[ii] = key >> (2*(MortonDepth-ii));
+        curCount[MortonDepth]++;
+        first = false;
+        lastKey = key;
+    });
+    if (ret && !first)
+        for (int ii=MortonDepth;ii>=0;ii--)
+            closeLevel(ii);
+
+    return ret;
+}
+
+void MortonSorter::openTile(int level,uint64_t prefix)
+{
+    OpenTile &tile = path[level];
+    tile.valid = true;
+    tile.prefix = prefix;
+    tile.numCopied = 0;
+    tile.numReached = 0;
+    tile.maxColor = 0;
+
+    // Points that get here have priorities above everything our ancestors took.
+    // Take enough of the rest to fill the tile, or all of them if there aren't too many.
+    long long count = tileCount(level,prefix);
+    tile.lo = level == 0 ? 0.0 : path[level-1].hi;
+    double numLeft = count * (1.0 - tile.lo);
+    if (level == MortonDepth || count == 0 || numLeft <= maxPointLimit)
+        tile.hi = 1.0;
+    else
+        tile.hi = std::min(1.0,tile.lo + (double)minPointLimit / (double)count);
+
+    TileIdent tileID = prefixToTile(level,prefix);
+    double tileXmin,tileYmin,tileXmax,tileYmax;
+    getTileBounds(tileID,tileXmin,tileYmin,tileXmax,tileYmax);
+    tile.grid.reset(new TileGroundGrid(gridSize,gridSize,tileXmin,tileYmin,tileXmax,tileYmax));
+    tile.tileW = startTile(&rootHeader->header,tile.buffer);
+}
+
+void MortonSorter::closeTile(int level,LidarDatabase *lidarDB)
+{
+    OpenTile &tile = path[level];
+    totalWrittenPoints += tile.numCopied;
+    finishTile(tile.tileW,std::move(tile.buffer),prefixToTile(level,tile.prefix),tile.numCopied,tile.numReached,tile.maxColor,*tile.grid,lidarDB);
+    tile.valid = false;
+    tile.tileW = NULL;
+    tile.buffer.reset();
+    tile.grid.reset();
+}
+
+bool MortonSorter::writeTiles(const std::vector<std::string> &runs,LidarDatabase *lidarDB)
+{
+    path.clear();
+    path.resize(MortonDepth+1);
+    const laszip_header_struct &header = rootHeader->header;
+
+    bool ret = true;
+    try {
+        // Walking the merge is partitioning, but the tiles time their own encoding
+        BuildMetrics::Stopwatch stopwatch(&metrics,BuildMetrics::TimePartition);
+        auto finish = [&](int level)
+        {
+            stopwatch.switchTo(BuildMetrics::TimeNone);
+            closeTile(level,lidarDB);
+            stopwatch.switchTo(BuildMetrics::TimePartition);
+        };
+
+        bool first = true;
+        uint64_t lastKey = 0;
+        ret = mergeRuns(runs,[&](const laszip_point_struct *p,uint64_t key){
+            // Finish the tiles we've moved out of
+            if (!first)
+            {
+                int level = FirstDifferentLevel(key,lastKey);
+                for (int ii=MortonDepth;ii>=level;ii--)
+                    if (path[ii].valid)
+                        finish(ii);
+            }
+            first = false;
+            lastKey = key;
+
+            // Walk down until a tile takes it
+            double priority = PriorityToUnit(PointPriority(0,0,0,p));
+            for (int ii=0;ii<=MortonDepth;ii++)
+            {
+                if (!path[ii].valid)
+                    openTile(ii,key >> (2*(MortonDepth-ii)));
+                OpenTile &tile = path[ii];
+                tile.numReached++;
+                if (priority < tile.hi)
+                {
+                    if (laszip_set_point(tile.tileW,p) ||
+                        laszip_write_point(tile.tileW) ||
+                        laszip_update_inventory(tile.tileW))
+                        throw (std::string)"Failed to write point in tile";
+                    tile.grid->addPoint(p->X * header.x_scale_factor + header.x_offset,
+                                        p->Y * header.y_scale_factor + header.y_offset,
+                                        p->Z * header.z_scale_factor + header.z_offset);
+                    if (header.point_data_format > 2)
+                        tile.maxColor = PointMaxColor(tile.maxColor,p);
+                    tile.numCopied++;
+                    break;
+                }
+            }
+        });
+
+        if (ret)
+            for (int ii=MortonDepth;ii>=0;ii--)
+                if (path[ii].valid)
+                    finish(ii);
+    }
+    catch (const std::string &reason)
+    {
+        fprintf(stderr,"%s\n",reason.c_str());
+        ret = false;
+    }
+
+    // Anything left open didn't make it
+    for (auto &tile : path)
+        if (tile.valid)
+        {
+            laszip_close_writer(tile.tileW);
+            laszip_destroy(tile.tileW);
+            tile.buffer.reset();
+            tile.valid = false;
+        }
+    path.clear();
+
+    return ret;
+}
@@ -0,0 +1,101 @@
+//
+//  MortonSorter.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef MortonSorter_hpp
+#define MortonSorter_hpp
+
+#include "LidarSorter.hpp"
+#include <functional>
+#include <unordered_map>
+
+/* Builds the tile pyramid from an external sort rather than by recursion.
+
+    Every point gets a Morton key for its cell at MortonDepth, and the points
+    are sorted by key in runs that fit in the memory budget, then merged.
+    In key order each tile at every level is a contiguous stretch of the
+    stream, so one sweep can count the tiles and another can write them,
+    with only the tiles along the current path open at once.
+
+    Which level a point lands in comes from a single per-point priority.
+    Each tile takes the points whose priority falls in its own slice of
+    [0,1), sized from its point count to keep about the minimum point limit.
+    The I/O is one read of the input, one write and two reads of the runs
+    (plus a read and write per extra merge pass), no matter how deep the tree goes.
+  */
+class MortonSorter : public LidarSorter
+{
+public:
+    MortonSorter(const char *tmp_dir);
+
+    // Maximum number of runs we'll merge at once
+    void setMergeFanIn(int fanIn) { mergeFanIn = fanIn; }
+
+    // Sort, count and write out the tiles
+    virtual bool process(LidarMultiWrapper *inputDB,LidarDatabase *lidarDB);
+
+protected:
+    // Called for each point in key order
+    typedef std::function<void(const laszip_point_struct *p,uint64_t key)> PointFunc;
+
+    // A tile along the path we're writing
+    class OpenTile
+    {
+    public:
+        OpenTile() : valid(false), prefix(0), lo(0.0), hi(0.0), tileW(NULL), numCopied(0), numReached(0), maxColor(0) { }
+        bool valid;
+        uint64_t prefix;
+        // Slice of the priorities this tile takes
+        double lo,hi;
+        laszip_POINTER tileW;
+        TileBufferRef buffer;
+        std::unique_ptr<TileGroundGrid> grid;
+        long long numCopied,numReached;
+        int maxColor;
+    };
+
+    // Key for the cell a point is in at MortonDepth
+    uint64_t pointKey(const laszip_point_struct *p);
+
+    // Read the input and write out sorted runs
+    bool makeRuns(LidarMultiWrapper *inputDB,std::vector<std::string> &runs);
+
+    // Merge groups of runs into bigger ones until there are few enough for one merge
+    bool reduceRuns(std::vector<std::string> &runs);
+
+    // Merge the runs, handing points back in key order
+    bool mergeRuns(const std::vector<std::string> &runs,const PointFunc &func);
+
+    // Counts for the tiles we'll need in the write pass
+    bool countTiles(const std::vector<std::string> &runs);
+
+    // Assign points to tiles and write them out
+    bool writeTiles(const std::vector<std::string> &runs,LidarDatabase *lidarDB);
+
+    // Start a tile on the path and work out its slice
+    void openTile(int level,uint64_t prefix);
+
+    // Write out a tile on the path
+    void closeTile(int level,LidarDatabase *lidarDB);
+
+    // Remove a run file and give back its space
+    void removeRun(const std::string &runFile);
+
+    TileIdent prefixToTile(int level,uint64_t prefix);
+
+    // Number of points in a tile, 0 if we didn't count it
+    long long tileCount(int level,uint64_t prefix);
+
+    int mergeFanIn;
+    int runIndex;
+    int numExtraBytes;
+    double cellSizeX,cellSizeY;
+    std::unordered_map<uint64_t,long long> counts;
+    std::vector<OpenTile> path;
+};
+
+#endif /* MortonSorter_hpp */
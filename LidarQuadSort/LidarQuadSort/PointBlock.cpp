@@ -0,0 +1,49 @@
+//
+//  PointBlock.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "PointBlock.hpp"
+#include <string.h>
+#include <algorithm>
+
+PointBlock::PointBlock(int inCapacity)
+: capacity(std::max(inCapacity,1)), numPoints(0), numExtraBytes(0)
+{
+    points.resize(capacity);
+    x.resize(capacity);  y.resize(capacity);  z.resize(capacity);
+    red.resize(capacity);  green.resize(capacity);  blue.resize(capacity);
+    intensity.resize(capacity);
+    classification.resize(capacity);
+}
+
+void PointBlock::reset(int inNumExtraBytes)
+{
+    numPoints = 0;
+    if (inNumExtraBytes != numExtraBytes)
+    {
+        numExtraBytes = inNumExtraBytes;
+        extraBytes.resize(capacity*numExtraBytes);
+    }
+}
+
+void PointBlock::addPoint(const laszip_point_struct *p)
+{
+    int which = numPoints++;
+    laszip_point_struct &dest = points[which];
+    dest = *p;
+    if (numExtraBytes > 0)
+    {
+        dest.extra_bytes = &extraBytes[which*numExtraBytes];
+        memcpy(dest.extra_bytes,p->extra_bytes,numExtraBytes);
+    } else
+        dest.extra_bytes = NULL;
+
+    x[which] = p->X;  y[which] = p->Y;  z[which] = p->Z;
+    red[which] = p->rgb[0];  green[which] = p->rgb[1];  blue[which] = p->rgb[2];
+    intensity[which] = p->intensity;
+    classification[which] = p->classification;
+}
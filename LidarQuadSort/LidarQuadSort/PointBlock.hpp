@@ -0,0 +1,53 @@
+//
+//  PointBlock.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef PointBlock_hpp
+#define PointBlock_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#import "laszip_api.h"
+
+/* A block of points read in one go.
+    The fields we look at a lot are split out into their own arrays so we
+    can run over them with vector code.  The full records are kept too,
+    for writing the points back out.
+  */
+class PointBlock
+{
+public:
+    PointBlock(int capacity = 8192);
+
+    // Empty it out and set up for points with this many extra bytes
+    void reset(int numExtraBytes);
+
+    // Copy a point in.  The caller checks there's room.
+    void addPoint(const laszip_point_struct *p);
+
+    int getNumPoints() const { return numPoints; }
+    int getCapacity() const { return capacity; }
+    bool isFull() const { return numPoints >= capacity; }
+
+    // Full records.  Their extra_bytes point into this block.
+    std::vector<laszip_point_struct> points;
+
+    // Quantized coordinates
+    std::vector<int32_t> x,y,z;
+    std::vector<uint16_t> red,green,blue;
+    std::vector<uint16_t> intensity;
+    std::vector<uint8_t> classification;
+
+protected:
+    int capacity;
+    int numPoints;
+    int numExtraBytes;
+    std::vector<laszip_U8> extraBytes;
+};
+
+#endif /* PointBlock_hpp */
@@ -0,0 +1,92 @@
+//
+//  PointSampler.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "PointSampler.hpp"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// splitmix64 finalizer
+static inline uint64_t MixBits(uint64_t val)
+{
+    val ^= val >> 30;
+    val *= 0xbf58476d1ce4e5b9ULL;
+    val ^= val >> 27;
+    val *= 0x94d049bb133111ebULL;
+    val ^= val >> 31;
+    return val;
+}
+
+uint64_t PointPriority(int tileX,int tileY,int tileLevel,const laszip_point_struct *p)
+{
+    // Each tile gets its own sequence, otherwise the children would only
+    //  see the high priority points their parent passed on
+    uint64_t hash = MixBits(((uint64_t)tileLevel << 58) ^ ((uint64_t)(uint32_t)tileX << 29) ^ (uint64_t)(uint32_t)tileY);
+
+    uint64_t gpsBits;
+    memcpy(&gpsBits,&p->gps_time,sizeof(gpsBits));
+    hash = MixBits(hash ^ (((uint64_t)(uint32_t)p->X << 32) | (uint32_t)p->Y));
+    hash = MixBits(hash ^ (((uint64_t)(uint32_t)p->Z << 32) | ((uint64_t)p->intensity << 16) | p->point_source_ID));
+    hash = MixBits(hash ^ gpsBits);
+
+    return hash;
+}
+
+SampleGrid::SampleGrid(int targetPoints,double minX,double minY,double maxX,double maxY)
+    : minX(minX), minY(minY), numOccupied(0), numPoints(0)
+{
+    size = std::max(1,(int)sqrt((double)targetPoints));
+    cellX = (maxX-minX)/size;
+    cellY = (maxY-minY)/size;
+    cells.resize(size*size,UINT64_MAX);
+}
+
+int SampleGrid::whichCell(double x,double y) const
+{
+    int whichX = cellX > 0.0 ? (int)((x-minX)/cellX) : 0;
+    int whichY = cellY > 0.0 ? (int)((y-minY)/cellY) : 0;
+    whichX = std::min(size-1,std::max(0,whichX));
+    whichY = std::min(size-1,std::max(0,whichY));
+
+    return whichY*size+whichX;
+}
+
+void SampleGrid::addPoint(int cell,uint64_t priority)
+{
+    numPoints++;
+    uint64_t &cellPriority = cells[cell];
+    if (cellPriority == UINT64_MAX)
+        numOccupied++;
+    cellPriority = std::min(cellPriority,priority);
+}
+
+PointSampler::PointSampler(Mode mode,int tileX,int tileY,int tileLevel,long long numPoints,int targetPoints,SampleGridRef grid)
+    : mode(mode), tileX(tileX), tileY(tileY), tileLevel(tileLevel), grid(grid), fracToKeep(0.0)
+{
+    if (mode == Grid && grid)
+    {
+        // One point from each occupied cell, then top off at random if there are empty ones
+        long long numLeft = grid->getNumPoints() - grid->getNumOccupied();
+        long long numShort = targetPoints - grid->getNumOccupied();
+        if (numLeft > 0 && numShort > 0)
+            fracToKeep = (double)numShort / (double)numLeft;
+    } else {
+        this->mode = Random;
+        if (numPoints > 0)
+            fracToKeep = (double)targetPoints / (double)numPoints;
+    }
+}
+
+bool PointSampler::keepPoint(const laszip_point_struct *p,double x,double y) const
+{
+    uint64_t priority = PointPriority(tileX,tileY,tileLevel,p);
+    if (mode == Grid && priority == grid->getCellPriority(grid->whichCell(x,y)))
+        return true;
+
+    return PriorityToUnit(priority) < fracToKeep;
+}
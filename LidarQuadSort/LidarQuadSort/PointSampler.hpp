@@ -0,0 +1,84 @@
+//
+//  PointSampler.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef PointSampler_hpp
+#define PointSampler_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#import "laszip_api.h"
+
+// Hash of a point's contents mixed with the tile it's in.
+// Doesn't depend on what order we see the points in, so neither does the output.
+uint64_t PointPriority(int tileX,int tileY,int tileLevel,const laszip_point_struct *p);
+
+// Map a priority into [0,1)
+inline double PriorityToUnit(uint64_t priority)
+{
+    return (priority >> 11) * (1.0/9007199254740992.0);
+}
+
+/* A grid over a tile that tracks the lowest priority point in each cell.
+    The point that wins each cell is kept, which spreads the tile's
+    points out evenly rather than piling them up where the data is dense.
+  */
+class SampleGrid
+{
+public:
+    // Grid sized for about the given number of points
+    SampleGrid(int targetPoints,double minX,double minY,double maxX,double maxY);
+
+    // Cell a point (in real coordinates) falls in
+    int whichCell(double x,double y) const;
+
+    // Note a point and its priority
+    void addPoint(int cell,uint64_t priority);
+
+    // Lowest priority in the cell
+    uint64_t getCellPriority(int cell) const { return cells[cell]; }
+
+    // Number of cells with at least one point in them
+    int getNumOccupied() const { return numOccupied; }
+
+    // Number of points we've seen
+    long long getNumPoints() const { return numPoints; }
+
+protected:
+    int size;
+    double minX,minY;
+    double cellX,cellY;
+    std::vector<uint64_t> cells;
+    int numOccupied;
+    long long numPoints;
+};
+typedef std::shared_ptr<SampleGrid> SampleGridRef;
+
+/* Decides which points a tile keeps for itself.  The rest go down to the children.
+  */
+class PointSampler
+{
+public:
+    typedef enum {Random,Grid} Mode;
+
+    // Random keeps about targetPoints of numPoints.  Grid needs the grid filled in with every point first.
+    PointSampler(Mode mode,int tileX,int tileY,int tileLevel,long long numPoints,int targetPoints,SampleGridRef grid);
+
+    // Should the tile keep this point?  x and y are the real coordinates.
+    bool keepPoint(const laszip_point_struct *p,double x,double y) const;
+
+protected:
+    Mode mode;
+    int tileX,tileY,tileLevel;
+    SampleGridRef grid;
+    // Random selection below this, for the random mode or to top off the grid
+    double fracToKeep;
+};
+
+#endif /* PointSampler_hpp */
@@ -0,0 +1,398 @@
+//
+//  ShardBuild.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "ShardBuild.hpp"
+#include <stdlib.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <boost/filesystem.hpp>
+
+extern char **environ;
+
+static const char *PlanMagic = "LidarQuadSort shard plan 2";
+
+// Split a tab separated line
+static void SplitFields(const std::string &line,std::vector<std::string> &fields)
+{
+    fields.clear();
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = line.find('\t',start);
+        if (end == std::string::npos)
+        {
+            fields.push_back(line.substr(start));
+            break;
+        }
+        fields.push_back(line.substr(start,end-start));
+        start = end+1;
+    }
+}
+
+ShardPlan::ShardPlan()
+: numWorkers(0)
+{
+}
+
+void ShardPlan::assign(const std::vector<LidarSorter::ShardTile> &inTiles,int inNumWorkers)
+{
+    tiles = inTiles;
+    std::stable_sort(tiles.begin(),tiles.end(),[](const LidarSorter::ShardTile &a,const LidarSorter::ShardTile &b){ return a.numPoints > b.numPoints; });
+    numWorkers = std::min(inNumWorkers,(int)tiles.size());
+
+    std::vector<long long> load(numWorkers,0);
+    workers.resize(tiles.size());
+    for (unsigned int ii=0;ii<tiles.size();ii++)
+    {
+        int which = (int)(std::min_element(load.begin(),load.end()) - load.begin());
+        workers[ii] = which;
+        load[which] += tiles[ii].numPoints;
+    }
+}
+
+bool ShardPlan::write(const std::string &inFileName)
+{
+    fileName = inFileName;
+
+    // Written off to the side, so a worker never sees half a plan
+    std::string tmpFile = fileName + ".tmp";
+    FILE *fp = fopen(tmpFile.c_str(),"w");
+    if (!fp)
+    {
+        fprintf(stderr,"Failed to write shard plan %s\n",fileName.c_str());
+        return false;
+    }
+
+    fprintf(fp,"%s\n",PlanMagic);
+    fprintf(fp,"%d\n",numWorkers);
+    for (unsigned int ii=0;ii<tiles.size();ii++)
+    {
+        const LidarSorter::ShardTile &tile = tiles[ii];
+        fprintf(fp,"%d\t%d\t%d\t%d\t%d\t%lld\t%s\n",workers[ii],tile.tileID.x,tile.tileID.y,tile.tileID.z,tile.tileID.zCell,tile.numPoints,tile.fileName.c_str());
+    }
+    bool ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+    if (!ok || rename(tmpFile.c_str(),fileName.c_str()))
+    {
+        fprintf(stderr,"Failed to write shard plan %s\n",fileName.c_str());
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool ShardPlan::read(const std::string &inFileName)
+{
+    fileName = inFileName;
+    tiles.clear();
+    workers.clear();
+
+    std::ifstream ifs(fileName);
+    std::string line;
+    if (!ifs || !std::getline(ifs,line) || line != PlanMagic)
+    {
+        fprintf(stderr,"Can't read shard plan %s\n",fileName.c_str());
+        return false;
+    }
+    if (!std::getline(ifs,line))
+    {
+        fprintf(stderr,"Bad shard plan %s\n",fileName.c_str());
+        return false;
+    }
+    numWorkers = atoi(line.c_str());
+
+    std::vector<std::string> fields;
+    while (std::getline(ifs,line))
+    {
+        SplitFields(line,fields);
+        if (fields.size() != 7)
+        {
+            fprintf(stderr,"Bad shard plan %s\n",fileName.c_str());
+            return false;
+        }
+        LidarSorter::ShardTile tile;
+        workers.push_back(atoi(fields[0].c_str()));
+        tile.tileID = TileIdent(atoi(fields[1].c_str()),atoi(fields[2].c_str()),atoi(fields[3].c_str()),atoi(fields[4].c_str()));
+        tile.numPoints = atoll(fields[5].c_str());
+        tile.fileName = fields[6];
+        tiles.push_back(tile);
+    }
+
+    return true;
+}
+
+std::vector<LidarSorter::ShardTile> ShardPlan::getTiles(int worker)
+{
+    std::vector<LidarSorter::ShardTile> ret;
+    for (unsigned int ii=0;ii<tiles.size();ii++)
+        if (workers[ii] == worker)
+            ret.push_back(tiles[ii]);
+
+    return ret;
+}
+
+long long ShardPlan::getNumPoints(int worker)
+{
+    long long numPoints = 0;
+    for (unsigned int ii=0;ii<tiles.size();ii++)
+        if (workers[ii] == worker)
+            numPoints += tiles[ii].numPoints;
+
+    return numPoints;
+}
+
+std::string ShardPlan::getShardDB(int worker)
+{
+    return fileName + "_" + std::to_string(worker) + ".sqlite";
+}
+
+std::string ShardPlan::getDoneFile(int worker)
+{
+    return fileName + "_" + std::to_string(worker) + ".done";
+}
+
+bool ShardPlan::markDone(int worker,bool success)
+{
+    std::string doneFile = getDoneFile(worker);
+    std::string tmpFile = doneFile + ".tmp";
+    FILE *fp = fopen(tmpFile.c_str(),"w");
+    if (!fp)
+        return false;
+    fprintf(fp,"%s\n",success ? "ok" : "failed");
+    bool ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+    if (!ok || rename(tmpFile.c_str(),doneFile.c_str()))
+    {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int ShardPlan::checkDone(int worker)
+{
+    std::ifstream ifs(getDoneFile(worker));
+    if (!ifs)
+        return -1;
+    std::string line;
+    std::getline(ifs,line);
+
+    return line == "ok" ? 1 : 0;
+}
+
+ShardCoordinator::ShardCoordinator(ShardPlan &plan)
+: plan(plan)
+{
+}
+
+std::vector<std::string> ShardCoordinator::workerArgs(const std::vector<std::string> &args,int worker)
+{
+    std::vector<std::string> ret = args;
+    ret.push_back("-shardworker");
+    ret.push_back(plan.getFileName());
+    ret.push_back(std::to_string(worker));
+
+    return ret;
+}
+
+bool ShardCoordinator::launch(const std::vector<std::string> &args)
+{
+    pids.assign(plan.getNumWorkers(),0);
+    for (int worker=0;worker<plan.getNumWorkers();worker++)
+    {
+        std::vector<std::string> cmdArgs = workerArgs(args,worker);
+        std::vector<char *> argv;
+        for (auto &arg : cmdArgs)
+            argv.push_back(&arg[0]);
+        argv.push_back(NULL);
+
+        pid_t pid = 0;
+        if (posix_spawnp(&pid,argv[0],NULL,NULL,&argv[0],environ))
+        {
+            fprintf(stderr,"Failed to start shard worker %d\n",worker);
+            // Nobody's coming for the rest of them, so don't wait
+            for (;worker<plan.getNumWorkers();worker++)
+                plan.markDone(worker,false);
+            return false;
+        }
+        pids[worker] = pid;
+        fprintf(stdout,"Started shard worker %d with %lld points\n",worker,plan.getNumPoints(worker));
+    }
+
+    return true;
+}
+
+void ShardCoordinator::printCommands(const std::vector<std::string> &args)
+{
+    fprintf(stdout,"Waiting for %d shard workers.  Start them from this directory on any machine that can see %s:\n",plan.getNumWorkers(),plan.getFileName().c_str());
+    for (int worker=0;worker<plan.getNumWorkers();worker++)
+    {
+        std::string cmd;
+        for (const auto &arg : workerArgs(args,worker))
+        {
+            if (!cmd.empty())
+                cmd += " ";
+            if (arg.find_first_of(" \t'\"") != std::string::npos)
+                cmd += "'" + arg + "'";
+            else
+                cmd += arg;
+        }
+        fprintf(stdout,"  %s\n",cmd.c_str());
+    }
+    // Whoever's starting them may be watching a log
+    fflush(stdout);
+}
+
+// Check on a local worker process.  -1 if it's still running, 1 if it exited cleanly, 0 if not.
+static int ReapWorker(pid_t &pid,bool block)
+{
+    int procStatus = 0;
+    if (waitpid(pid,&procStatus,block ? 0 : WNOHANG) != pid)
+        return -1;
+    pid = 0;
+
+    return (WIFEXITED(procStatus) && WEXITSTATUS(procStatus) == 0) ? 1 : 0;
+}
+
+bool ShardCoordinator::wait(double timeout)
+{
+    int numWorkers = plan.getNumWorkers();
+    std::vector<bool> done(numWorkers,false);
+    int numLeft = numWorkers;
+    bool ret = true;
+    auto startTime = std::chrono::steady_clock::now();
+    while (numLeft > 0)
+    {
+        for (int worker=0;worker<numWorkers;worker++)
+        {
+            if (done[worker])
+                continue;
+            int status = plan.checkDone(worker);
+
+            // Local workers count once they've exited, since they can die before or after saying they're done
+            if ((size_t)worker < pids.size() && pids[worker] > 0)
+            {
+                int exitStatus = ReapWorker(pids[worker],false);
+                if (exitStatus < 0)
+                    continue;
+                if (status < 0)
+                    status = plan.checkDone(worker);
+                if (status < 0)
+                {
+                    fprintf(stderr,"Shard worker %d exited without finishing\n",worker);
+                    status = 0;
+                } else if (status > 0 && exitStatus == 0)
+                {
+                    fprintf(stderr,"Shard worker %d finished but exited with an error\n",worker);
+                    status = 0;
+                }
+            }
+            if (status < 0)
+                continue;
+
+            done[worker] = true;
+            numLeft--;
+            if (status == 0)
+                ret = false;
+            fprintf(stdout,"Shard worker %d %s, %d of %d left\n",worker,status ? "finished" : "failed",numLeft,numWorkers);
+        }
+        if (numLeft == 0)
+            break;
+
+        if (timeout > 0.0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() > timeout)
+        {
+            fprintf(stderr,"Timed out waiting for shard workers after %g seconds.  Still running:",timeout);
+            for (int worker=0;worker<numWorkers;worker++)
+                if (!done[worker])
+                    fprintf(stderr," %d",worker);
+            fprintf(stderr,"\n");
+
+            // Don't leave our own workers writing into the plan directory
+            for (auto &pid : pids)
+                if (pid > 0)
+                {
+                    kill(pid,SIGTERM);
+                    ReapWorker(pid,true);
+                }
+            ret = false;
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+    pids.clear();
+
+    return ret;
+}
+
+bool ShardCoordinator::merge(LidarDatabase *lidarDB)
+{
+    LidarDatabase::Manifest manifest;
+    if (!lidarDB->getManifest(manifest))
+    {
+        fprintf(stderr,"Need the header in place to merge shards.\n");
+        return false;
+    }
+
+    int maxLevel = manifest.maxLevel, maxColor = manifest.maxColor;
+    for (int worker=0;worker<plan.getNumWorkers();worker++)
+    {
+        std::string shardDB = plan.getShardDB(worker);
+        int shardMaxLevel = 0, shardMaxColor = 0;
+        if (!lidarDB->mergeShard(shardDB,shardMaxLevel,shardMaxColor))
+            return false;
+        maxLevel = std::max(maxLevel,shardMaxLevel);
+        maxColor = std::max(maxColor,shardMaxColor);
+        boost::filesystem::remove(boost::filesystem::path(shardDB));
+        boost::filesystem::remove(boost::filesystem::path(plan.getDoneFile(worker)));
+    }
+    fprintf(stdout,"Merged %d shards\n",plan.getNumWorkers());
+
+    return lidarDB->setDepth(maxLevel,maxColor);
+}
+
+ShardWorker::ShardWorker(const std::string &planFile,int worker)
+: planFile(planFile), worker(worker), valid(false), finished(false)
+{
+}
+
+ShardWorker::~ShardWorker()
+{
+    if (!finished)
+        finish(false);
+}
+
+bool ShardWorker::init()
+{
+    valid = plan.read(planFile);
+    if (!valid)
+        return false;
+    if (worker < 0 || worker >= plan.getNumWorkers())
+    {
+        fprintf(stderr,"Shard plan %s doesn't have a worker %d\n",planFile.c_str(),worker);
+        valid = false;
+        return false;
+    }
+
+    return true;
+}
+
+void ShardWorker::finish(bool success)
+{
+    finished = true;
+    if (valid && !plan.markDone(worker,success))
+        fprintf(stderr,"Failed to write %s\n",plan.getDoneFile(worker).c_str());
+}
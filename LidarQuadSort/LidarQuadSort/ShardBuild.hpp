@@ -0,0 +1,121 @@
+//
+//  ShardBuild.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef ShardBuild_hpp
+#define ShardBuild_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "LidarSorter.hpp"
+#include "LidarDatabase.hpp"
+
+/* Which worker builds which subtrees in a sharded build.
+    The coordinator builds the top of the tree and writes this out next to
+    the temp files holding the subtrees.  Workers on this machine, or any
+    machine that shares the file system, read it to find their share.
+    Each worker builds its own shard database, which sits next to the plan.
+  */
+class ShardPlan
+{
+public:
+    ShardPlan();
+
+    // Hand out the subtrees to this many workers, biggest first, each to the one with the fewest points so far.
+    // There won't be more workers than subtrees.
+    void assign(const std::vector<LidarSorter::ShardTile> &tiles,int numWorkers);
+
+    bool write(const std::string &fileName);
+    bool read(const std::string &fileName);
+
+    const std::string &getFileName() { return fileName; }
+    int getNumWorkers() { return numWorkers; }
+
+    // Subtrees for one worker and how many points are in them
+    std::vector<LidarSorter::ShardTile> getTiles(int worker);
+    long long getNumPoints(int worker);
+
+    // Database a worker builds
+    std::string getShardDB(int worker);
+
+    // File a worker leaves when it's done, saying whether it worked
+    std::string getDoneFile(int worker);
+
+    // Write the done file
+    bool markDone(int worker,bool success);
+
+    // Check the done file.  -1 if it isn't there yet, otherwise 1 for success and 0 for failure.
+    int checkDone(int worker);
+
+protected:
+    std::string fileName;
+    int numWorkers;
+    std::vector<LidarSorter::ShardTile> tiles;
+    // Worker for each tile
+    std::vector<int> workers;
+};
+
+/* Runs the workers for a sharded build and pulls what they build into the main database.
+    Workers are this same program run with -shardworker, either started here or
+    on other machines from the commands printCommands() gives.
+  */
+class ShardCoordinator
+{
+public:
+    ShardCoordinator(ShardPlan &plan);
+
+    // Start all the workers on this machine.  Args is our own command line, which they get too.
+    bool launch(const std::vector<std::string> &args);
+
+    // Print the commands to start the workers somewhere else
+    void printCommands(const std::vector<std::string> &args);
+
+    // Wait for every worker to finish.  A local worker that exits without saying it's done, or with an error, has failed.
+    // Gives up after timeout seconds, stopping any local workers.  0 waits forever.
+    bool wait(double timeout = 0.0);
+
+    // Copy every shard into the database and update the header to cover them
+    bool merge(LidarDatabase *lidarDB);
+
+protected:
+    // Command line for a worker
+    std::vector<std::string> workerArgs(const std::vector<std::string> &args,int worker);
+
+    ShardPlan &plan;
+    // Local worker processes, if we started them
+    std::vector<pid_t> pids;
+};
+
+/* The worker side of a sharded build.
+    If it goes away without finish() being called, the coordinator hears the worker failed.
+  */
+class ShardWorker
+{
+public:
+    ShardWorker(const std::string &planFile,int worker);
+    ~ShardWorker();
+
+    // Read the plan.  Returns false if we can't, or if we're not in it.
+    bool init();
+
+    // Where the shard goes and what goes in it
+    std::string getShardDB() { return plan.getShardDB(worker); }
+    std::vector<LidarSorter::ShardTile> getTiles() { return plan.getTiles(worker); }
+
+    // Let the coordinator know how it went
+    void finish(bool success);
+
+protected:
+    std::string planFile;
+    int worker;
+    ShardPlan plan;
+    bool valid,finished;
+};
+
+#endif /* ShardBuild_hpp */
@@ -0,0 +1,173 @@
+//
+//  SpillFile.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "SpillFile.hpp"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits>
+#include <algorithm>
+
+static const char *SpillMagic = "LQSSPILL";
+static const uint32_t SpillVersion = 1;
+
+// Records are padded out so every point in the mapped file is aligned
+uint32_t SpillRecordSize(int numExtraBytes)
+{
+    uint32_t size = (uint32_t)(sizeof(laszip_point_struct) + numExtraBytes);
+    return (size + 7) & ~7;
+}
+
+SpillWriter::SpillWriter(const std::string &fileName,int pointDataFormat,int numExtraBytes,size_t bufferSize)
+: fileName(fileName), fp(NULL), bufferUsed(0)
+{
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,SpillMagic,8);
+    header.version = SpillVersion;
+    header.recordSize = SpillRecordSize(numExtraBytes);
+    header.numExtraBytes = numExtraBytes;
+    header.pointDataFormat = pointDataFormat;
+    header.minX = header.minY = header.minZ = std::numeric_limits<int32_t>::max();
+    header.maxX = header.maxY = header.maxZ = std::numeric_limits<int32_t>::min();
+    
+    buffer.resize(std::max(bufferSize,(size_t)header.recordSize));
+
+    fp = fopen(fileName.c_str(),"wb");
+    if (!fp)
+        return;
+    // Placeholder header, filled in when we close
+    if (fwrite(&header,sizeof(header),1,fp) != 1)
+    {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+SpillWriter::~SpillWriter()
+{
+    close();
+}
+
+bool SpillWriter::flushBuffer()
+{
+    if (bufferUsed > 0)
+    {
+        if (fwrite(&buffer[0],1,bufferUsed,fp) != bufferUsed)
+            return false;
+        bufferUsed = 0;
+    }
+    
+    return true;
+}
+
+bool SpillWriter::addPoint(const laszip_point_struct *p)
+{
+    if (!fp)
+        return false;
+    
+    if (bufferUsed + header.recordSize > buffer.size())
+        if (!flushBuffer())
+            return false;
+    
+    char *rec = &buffer[bufferUsed];
+    memcpy(rec,p,sizeof(laszip_point_struct));
+    ((laszip_point_struct *)rec)->extra_bytes = NULL;
+    if (header.numExtraBytes > 0)
+        memcpy(rec+sizeof(laszip_point_struct),p->extra_bytes,header.numExtraBytes);
+    bufferUsed += header.recordSize;
+    
+    header.numPoints++;
+    header.minX = std::min(header.minX,p->X);  header.maxX = std::max(header.maxX,p->X);
+    header.minY = std::min(header.minY,p->Y);  header.maxY = std::max(header.maxY,p->Y);
+    header.minZ = std::min(header.minZ,p->Z);  header.maxZ = std::max(header.maxZ,p->Z);
+    
+    return true;
+}
+
+bool SpillWriter::close()
+{
+    if (!fp)
+        return false;
+    
+    bool ret = flushBuffer();
+    if (ret)
+        ret = fseek(fp,0,SEEK_SET) == 0 && fwrite(&header,sizeof(header),1,fp) == 1;
+    if (fclose(fp) != 0)
+        ret = false;
+    fp = NULL;
+    
+    return ret;
+}
+
+long long SpillWriter::getFileSize()
+{
+    return sizeof(SpillFileHeader) + header.numPoints * (long long)header.recordSize;
+}
+
+SpillReader::SpillReader(const std::string &fileName)
+: fileName(fileName), fd(-1), data(NULL), dataSize(0), header(NULL)
+{
+    memset(&scratchPoint,0,sizeof(scratchPoint));
+}
+
+SpillReader::~SpillReader()
+{
+    if (data)
+        munmap(data,dataSize);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool SpillReader::open()
+{
+    fd = ::open(fileName.c_str(),O_RDONLY);
+    if (fd < 0)
+        return false;
+    
+    struct stat fileStat;
+    if (fstat(fd,&fileStat) != 0 || fileStat.st_size < (off_t)sizeof(SpillFileHeader))
+        return false;
+    dataSize = fileStat.st_size;
+    
+    // Private and writable so nobody faults if they poke at a point.
+    //  We don't write to it ourselves, so the pages stay shared with the file.
+    void *mapped = mmap(NULL,dataSize,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+    if (mapped == MAP_FAILED)
+        return false;
+    data = (char *)mapped;
+    madvise(data,dataSize,MADV_SEQUENTIAL);
+    
+    header = (const SpillFileHeader *)data;
+    if (memcmp(header->magic,SpillMagic,8) || header->version != SpillVersion ||
+        header->recordSize != SpillRecordSize(header->numExtraBytes) ||
+        header->numPoints < 0 ||
+        (long long)sizeof(SpillFileHeader) + header->numPoints * (long long)header->recordSize > (long long)dataSize)
+    {
+        header = NULL;
+        return false;
+    }
+    
+    return true;
+}
+
+laszip_point_struct *SpillReader::getPoint(long long which)
+{
+    if (!header || which < 0 || which >= header->numPoints)
+        return NULL;
+    
+    char *rec = data + sizeof(SpillFileHeader) + which * header->recordSize;
+    if (header->numExtraBytes == 0)
+        return (laszip_point_struct *)rec;
+    
+    // Extra bytes need their pointer hooked up, so copy the point
+    memcpy(&scratchPoint,rec,sizeof(laszip_point_struct));
+    scratchPoint.extra_bytes = (laszip_U8 *)(rec + sizeof(laszip_point_struct));
+    return &scratchPoint;
+}
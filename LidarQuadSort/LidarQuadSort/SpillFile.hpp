@@ -0,0 +1,103 @@
+//
+//  SpillFile.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef SpillFile_hpp
+#define SpillFile_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#import "laszip_api.h"
+
+/* Header at the start of a spill file.  The point records follow it.
+  */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    // Size of each record, including extra bytes and padding
+    uint32_t recordSize;
+    uint32_t numExtraBytes;
+    uint32_t pointDataFormat;
+    int64_t numPoints;
+    // Bounds in the quantized (integer) coordinates
+    int32_t minX,minY,minZ;
+    int32_t maxX,maxY,maxZ;
+    char padding[8];
+} SpillFileHeader;
+
+// Size of a point record in a spill file
+uint32_t SpillRecordSize(int numExtraBytes);
+
+/* Spill files hold the intermediate tiles the sorter writes out for the next level.
+    They're written once, read once and deleted, so rather than compress them with
+    LAZ we just dump out fixed size point records.  Each record is a laszip_point_struct
+    followed by its extra bytes, so the reader can hand back pointers straight into the
+    mapped file.
+  */
+class SpillWriter
+{
+public:
+    // Open the file for writing.  Check isValid() afterwards.
+    SpillWriter(const std::string &fileName,int pointDataFormat,int numExtraBytes,size_t bufferSize = 4*1024*1024);
+    ~SpillWriter();
+    
+    bool isValid() { return fp != NULL; }
+    
+    // Append a point to the file
+    bool addPoint(const laszip_point_struct *p);
+    
+    // Flush the buffer and fill in the header
+    bool close();
+    
+    long long getNumPoints() { return header.numPoints; }
+    
+    // Total size of the file once it's closed
+    long long getFileSize();
+    
+protected:
+    bool flushBuffer();
+    
+    std::string fileName;
+    FILE *fp;
+    SpillFileHeader header;
+    std::vector<char> buffer;
+    size_t bufferUsed;
+};
+
+/* Reads a spill file by memory mapping it.  Points come back as pointers
+    into the mapped file, so there's no copying unless the points have extra bytes.
+  */
+class SpillReader
+{
+public:
+    SpillReader(const std::string &fileName);
+    ~SpillReader();
+    
+    // Map the file and check the header
+    bool open();
+    
+    const SpillFileHeader &getHeader() { return *header; }
+    
+    long long getNumPoints() { return header ? header->numPoints : 0; }
+    
+    // Return the given point.  Valid until the next call.
+    laszip_point_struct *getPoint(long long which);
+    
+protected:
+    std::string fileName;
+    int fd;
+    char *data;
+    size_t dataSize;
+    const SpillFileHeader *header;
+    // Used to hook up the extra bytes
+    laszip_point_struct scratchPoint;
+};
+
+#endif /* SpillFile_hpp */
@@ -0,0 +1,112 @@
+//
+//  SpillScheduler.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "SpillScheduler.hpp"
+#include <sys/stat.h>
+#include <algorithm>
+
+static const double MB = 1024.0*1024.0;
+
+long long TempFileSize(const std::string &fileName)
+{
+    struct stat statBuf;
+    if (stat(fileName.c_str(),&statBuf))
+        return 0;
+    return statBuf.st_size;
+}
+
+SpillScheduler::SpillScheduler(long long budget,BuildMetrics *metrics)
+: metrics(metrics), budget(budget), inUse(0), peak(0), numSplits(0)
+{
+}
+
+bool SpillScheduler::startSplit(long long estimate)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Splits in flight give space back when they remove their inputs
+    if (budget > 0)
+        while (inUse + estimate > budget && numSplits > 0)
+            cond.wait(lock);
+
+    if (budget > 0 && inUse + estimate > budget)
+    {
+        fprintf(stderr,"Temp budget of %.1fMB is too small.  Need %.1fMB more with %.1fMB in use.\n",budget/MB,estimate/MB,inUse/MB);
+        return false;
+    }
+
+    numSplits++;
+    inUse += estimate;
+    peak = std::max(peak,inUse);
+    if (metrics)
+        metrics->setMax(BuildMetrics::TempPeak,peak);
+
+    return true;
+}
+
+void SpillScheduler::finishSplit(long long estimate,long long actual)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    numSplits--;
+    inUse += actual - estimate;
+    peak = std::max(peak,inUse);
+    cond.notify_all();
+    if (metrics)
+    {
+        metrics->add(BuildMetrics::TempWritten,actual);
+        metrics->setMax(BuildMetrics::TempPeak,peak);
+    }
+}
+
+void SpillScheduler::addFiles(long long size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    inUse += size;
+    peak = std::max(peak,inUse);
+    if (metrics)
+    {
+        metrics->add(BuildMetrics::TempWritten,size);
+        metrics->setMax(BuildMetrics::TempPeak,peak);
+    }
+}
+
+void SpillScheduler::removeFiles(long long size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    inUse = std::max(inUse - size,0LL);
+    cond.notify_all();
+    if (metrics)
+        metrics->add(BuildMetrics::TempFreed,size);
+}
+
+bool SpillScheduler::preferDepthFirst()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget > 0 && inUse > budget/2;
+}
+
+long long SpillScheduler::getInUse()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return inUse;
+}
+
+long long SpillScheduler::getPeak()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return peak;
+}
+
+void SpillScheduler::report()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (budget > 0)
+        fprintf(stdout,"Peak temp space %.1fMB of %.1fMB budget (%.0f%%)\n",peak/MB,budget/MB,100.0*peak/budget);
+    else
+        fprintf(stdout,"Peak temp space %.1fMB\n",peak/MB);
+}
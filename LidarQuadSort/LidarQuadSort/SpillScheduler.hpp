@@ -0,0 +1,68 @@
+//
+//  SpillScheduler.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef SpillScheduler_hpp
+#define SpillScheduler_hpp
+
+#include <stdio.h>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "BuildMetrics.hpp"
+
+// Size of a file on disk, 0 if it isn't there
+long long TempFileSize(const std::string &fileName);
+
+/* Keeps track of the bytes we've got in temp files and holds the sorter to a budget.
+    Before a node writes out its children it reserves space for them.  If that
+    would go over, it waits for the other splits in flight to finish and give
+    back what they don't need.  If nothing else is in flight the space is never
+    coming back, so the reservation fails and the build stops right there,
+    rather than when the disk fills up.
+    Splitting a node only costs extra space until its input is removed, so
+    expanding the tree depth first keeps the peak close to the size of the input.
+    We tell the sorter to do that once we're halfway to the budget.
+  */
+class SpillScheduler
+{
+public:
+    // A budget of 0 means no limit, but we still keep track.  The temp file counters go in the metrics, if there are any.
+    SpillScheduler(long long budget,BuildMetrics *metrics = NULL);
+
+    // Reserve space for a split before writing it.  Returns false if it will never fit.
+    bool startSplit(long long estimate);
+
+    // The split's files are closed.  Give back whatever the estimate was over.
+    void finishSplit(long long estimate,long long actual);
+
+    // Files we're tracking were written without a reservation
+    void addFiles(long long size);
+
+    // A temp file was removed
+    void removeFiles(long long size);
+
+    // True if subtrees should be expanded right away rather than queued
+    bool preferDepthFirst();
+
+    long long getBudget() { return budget; }
+    long long getInUse();
+    long long getPeak();
+
+    // Print out the peak usage
+    void report();
+
+protected:
+    BuildMetrics *metrics;
+    std::mutex mutex;
+    std::condition_variable cond;
+    long long budget;
+    long long inUse,peak;
+    int numSplits;
+};
+
+#endif /* SpillScheduler_hpp */
@@ -0,0 +1,200 @@
+//
+//  TileBuffer.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "TileBuffer.hpp"
+#include <string.h>
+#include <algorithm>
+
+TileBuffer::TileBuffer()
+: length(0), stream(this)
+{
+}
+
+size_t TileBuffer::getSize()
+{
+    updateLength();
+    return length;
+}
+
+void TileBuffer::clear()
+{
+    length = 0;
+    char *base = &bytes[0];
+    setp(base,base+bytes.size());
+    stream.clear();
+}
+
+void TileBuffer::swap(std::string &str)
+{
+    updateLength();
+    bytes.resize(length);
+    bytes.swap(str);
+    length = bytes.size();
+    bytes.resize(bytes.capacity());
+
+    // Carry on writing from the end of what we got
+    char *base = &bytes[0];
+    setp(base,base+bytes.size());
+    pbump((int)length);
+    stream.clear();
+}
+
+void TileBuffer::updateLength()
+{
+    length = std::max(length,(size_t)(pptr()-pbase()));
+}
+
+void TileBuffer::reserve(size_t size)
+{
+    if (size <= bytes.size())
+        return;
+
+    updateLength();
+    size_t pos = pptr()-pbase();
+    bytes.resize(std::max(size,std::max(bytes.size()*2,(size_t)4096)));
+    bytes.resize(bytes.capacity());
+    char *base = &bytes[0];
+    setp(base,base+bytes.size());
+    pbump((int)pos);
+}
+
+TileBuffer::int_type TileBuffer::overflow(int_type ch)
+{
+    if (traits_type::eq_int_type(ch,traits_type::eof()))
+        return traits_type::not_eof(ch);
+
+    reserve(pptr()-pbase()+1);
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+
+    return ch;
+}
+
+std::streamsize TileBuffer::xsputn(const char *s,std::streamsize n)
+{
+    if (n <= 0)
+        return 0;
+
+    reserve(pptr()-pbase()+n);
+    memcpy(pptr(),s,n);
+    pbump((int)n);
+
+    return n;
+}
+
+TileBuffer::pos_type TileBuffer::seekoff(off_type off,std::ios_base::seekdir dir,std::ios_base::openmode which)
+{
+    if (!(which & std::ios_base::out))
+        return pos_type(off_type(-1));
+
+    // laszip seeks back to fill in the header once it knows the point count
+    updateLength();
+    off_type base = 0;
+    if (dir == std::ios_base::cur)
+        base = pptr()-pbase();
+    else if (dir == std::ios_base::end)
+        base = length;
+    off_type target = base + off;
+    if (target < 0)
+        return pos_type(off_type(-1));
+
+    reserve(target);
+    char *start = &bytes[0];
+    setp(start,start+bytes.size());
+    pbump((int)target);
+
+    return pos_type(target);
+}
+
+TileBuffer::pos_type TileBuffer::seekpos(pos_type pos,std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos),std::ios_base::beg,which);
+}
+
+TileReadBuffer::TileReadBuffer(const char *data,size_t size)
+{
+    char *start = const_cast<char *>(data);
+    setg(start,start,start+size);
+}
+
+TileReadBuffer::pos_type TileReadBuffer::seekoff(off_type off,std::ios_base::seekdir dir,std::ios_base::openmode which)
+{
+    if (!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+
+    char *base = eback();
+    if (dir == std::ios_base::cur)
+        base = gptr();
+    else if (dir == std::ios_base::end)
+        base = egptr();
+    if (off < eback()-base || off > egptr()-base)
+        return pos_type(off_type(-1));
+    setg(eback(),base+off,egptr());
+
+    return pos_type(gptr()-eback());
+}
+
+TileReadBuffer::pos_type TileReadBuffer::seekpos(pos_type pos,std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos),std::ios_base::beg,which);
+}
+
+TileBufferPool::TileBufferPool(size_t maxFree)
+: maxFree(maxFree)
+{
+}
+
+TileBufferPool::~TileBufferPool()
+{
+    for (auto buffer : freeBuffers)
+        delete buffer;
+    freeBuffers.clear();
+}
+
+TileBufferRef TileBufferPool::get()
+{
+    TileBuffer *buffer = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeBuffers.empty())
+        {
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+    }
+    if (buffer)
+        buffer->clear();
+    else
+        buffer = new TileBuffer();
+
+    // The buffer finds its way back here when the last reference goes, if we're still around
+    std::weak_ptr<TileBufferPool> weakPool = shared_from_this();
+    return TileBufferRef(buffer,[weakPool](TileBuffer *buf)
+                         {
+                             TileBufferPoolRef pool = weakPool.lock();
+                             if (pool)
+                                 pool->put(buf);
+                             else
+                                 delete buf;
+                         });
+}
+
+void TileBufferPool::put(TileBuffer *buffer)
+{
+    if (buffer->getCapacity() <= MaxKeepSize)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeBuffers.size() < maxFree)
+        {
+            freeBuffers.push_back(buffer);
+            return;
+        }
+    }
+
+    delete buffer;
+}
@@ -0,0 +1,106 @@
+//
+//  TileBuffer.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TileBuffer_hpp
+#define TileBuffer_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <ostream>
+
+/* Growable byte buffer a tile gets written into.
+    laszip writes to it through getStream(), like it would a stringstream,
+    but the bytes can be handed straight to the database without copying them
+    out.  Buffers come from a TileBufferPool and keep their storage when they
+    go back, so after the first few tiles we're not allocating anything.
+  */
+class TileBuffer : public std::streambuf
+{
+public:
+    TileBuffer();
+
+    // Stream for laszip to write into
+    std::ostream *getStream() { return &stream; }
+
+    // What's been written so far
+    const char *getData() { return bytes.data(); }
+    size_t getSize();
+
+    // Storage we're holding on to
+    size_t getCapacity() { return bytes.capacity(); }
+
+    // Drop the contents, but keep the storage
+    void clear();
+
+    // Trade contents with a string, for encoders that write into one.
+    // Swap an empty string in first and it comes back with our storage.
+    void swap(std::string &str);
+
+protected:
+    // Make room for this many bytes without losing our place
+    void reserve(size_t size);
+
+    // Bytes written can be behind the write position if someone seeked back
+    void updateLength();
+
+    virtual int_type overflow(int_type ch);
+    virtual std::streamsize xsputn(const char *s,std::streamsize n);
+    virtual pos_type seekoff(off_type off,std::ios_base::seekdir dir,std::ios_base::openmode which);
+    virtual pos_type seekpos(pos_type pos,std::ios_base::openmode which);
+
+    // Sized to capacity, so all of it is usable as the put area
+    std::string bytes;
+    size_t length;
+    std::ostream stream;
+};
+
+typedef std::shared_ptr<TileBuffer> TileBufferRef;
+
+/* Reads a tile straight out of memory, instead of copying it into an istringstream.
+  */
+class TileReadBuffer : public std::streambuf
+{
+public:
+    TileReadBuffer(const char *data,size_t size);
+
+protected:
+    virtual pos_type seekoff(off_type off,std::ios_base::seekdir dir,std::ios_base::openmode which);
+    virtual pos_type seekpos(pos_type pos,std::ios_base::openmode which);
+};
+
+/* Hands out TileBuffers and takes them back when the last reference goes away.
+    Safe to use from any thread.  Buffers can outlive the pool, in which case
+    they're just deleted.
+  */
+class TileBufferPool : public std::enable_shared_from_this<TileBufferPool>
+{
+public:
+    // Buffers bigger than this aren't worth holding on to
+    static const size_t MaxKeepSize = 16*1024*1024;
+
+    TileBufferPool(size_t maxFree = 64);
+    ~TileBufferPool();
+
+    // An empty buffer, reused if we've got one
+    TileBufferRef get();
+
+protected:
+    void put(TileBuffer *buffer);
+
+    std::mutex mutex;
+    std::vector<TileBuffer *> freeBuffers;
+    size_t maxFree;
+};
+
+typedef std::shared_ptr<TileBufferPool> TileBufferPoolRef;
+
+#endif /* TileBuffer_hpp */
@@ -0,0 +1,153 @@
+//
+//  WorkStealingPool.cpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "WorkStealingPool.hpp"
+#include <chrono>
+
+// Which pool and worker the current thread belongs to (if any)
+static thread_local WorkStealingPool *currentPool = NULL;
+static thread_local int currentWorker = -1;
+
+WorkStealingPool::WorkStealingPool(int numThreads)
+: queued(0), pending(0), nextWorker(0), shutdown(false)
+{
+    numThreads = std::max(numThreads,1);
+    for (int ii=0;ii<numThreads;ii++)
+        workers.push_back(new Worker());
+    for (int ii=0;ii<numThreads;ii++)
+        threads.push_back(std::thread(&WorkStealingPool::runWorker,this,ii));
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        shutdown = true;
+    }
+    wakeCond.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+    for (auto worker : workers)
+        delete worker;
+}
+
+void WorkStealingPool::submit(const Task &task)
+{
+    // Workers keep their own tasks, everyone else spreads them around
+    int which = currentWorker;
+    if (currentPool != this || which < 0)
+        which = nextWorker++ % workers.size();
+
+    pending++;
+    {
+        Worker *worker = workers[which];
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->tasks.push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+    }
+    wakeCond.notify_one();
+}
+
+void WorkStealingPool::wait()
+{
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    doneCond.wait(lock,[this]{ return pending == 0; });
+}
+
+std::vector<WorkStealingPool::WorkerStats> WorkStealingPool::getStats()
+{
+    std::vector<WorkerStats> stats;
+    for (auto worker : workers)
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        stats.push_back(worker->stats);
+    }
+    return stats;
+}
+
+bool WorkStealingPool::popTask(int which,Task &task)
+{
+    Worker *worker = workers[which];
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (worker->tasks.empty())
+        return false;
+    task = worker->tasks.back();
+    worker->tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::stealTask(int which,Task &task)
+{
+    int numWorkers = (int)workers.size();
+    for (int ii=1;ii<numWorkers;ii++)
+    {
+        Worker *victim = workers[(which+ii) % numWorkers];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->tasks.empty())
+        {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::runWorker(int which)
+{
+    currentPool = this;
+    currentWorker = which;
+    Worker *worker = workers[which];
+
+    while (true)
+    {
+        Task task;
+        bool stolen = false;
+        if (!popTask(which,task))
+            stolen = stealTask(which,task);
+
+        if (!task)
+        {
+            // Nothing to do, so sleep until something shows up
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeCond.wait(lock,[this]{ return shutdown || queued > 0; });
+            if (shutdown && queued == 0)
+                break;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queued--;
+        }
+
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        task();
+        double busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->stats.tasksRun++;
+            if (stolen)
+                worker->stats.tasksStolen++;
+            worker->stats.busyTime += busy;
+        }
+
+        // Let any waiters know when the last bit of work finishes
+        if (--pending == 0)
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            doneCond.notify_all();
+        }
+    }
+
+    currentPool = NULL;
+    currentWorker = -1;
+}
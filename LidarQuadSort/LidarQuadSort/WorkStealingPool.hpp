@@ -0,0 +1,84 @@
+//
+//  WorkStealingPool.hpp
+//  LidarQuadSort
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef WorkStealingPool_hpp
+#define WorkStealingPool_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/* A fixed size thread pool where each worker has its own deque of tasks.
+    Workers push and pop their own tasks from the back (depth first) and
+    steal from the front of someone else's deque (oldest, biggest work) when
+    they run dry.  Tasks may submit more tasks.
+  */
+class WorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // Per worker statistics, used to report how well we scaled
+    class WorkerStats
+    {
+    public:
+        WorkerStats() : tasksRun(0), tasksStolen(0), busyTime(0.0) { }
+        long long tasksRun;
+        long long tasksStolen;
+        // Time spent running tasks (in seconds)
+        double busyTime;
+    };
+
+    // Start up the given number of worker threads
+    WorkStealingPool(int numThreads);
+    ~WorkStealingPool();
+
+    // Add a task.  If called from a worker, it goes on that worker's deque.
+    void submit(const Task &task);
+
+    // Block until every submitted task (and everything they submitted) is done
+    void wait();
+
+    // Number of worker threads
+    int getNumThreads() { return (int)workers.size(); }
+
+    // Snapshot of the per-worker stats
+    std::vector<WorkerStats> getStats();
+
+protected:
+    class Worker
+    {
+    public:
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        WorkerStats stats;
+    };
+
+    void runWorker(int which);
+    bool popTask(int which,Task &task);
+    bool stealTask(int which,Task &task);
+
+    std::vector<Worker *> workers;
+    std::vector<std::thread> threads;
+
+    // Idle workers sleep on this until there's something queued
+    std::mutex sleepMutex;
+    std::condition_variable wakeCond;
+    std::condition_variable doneCond;
+    std::atomic<long long> queued;
+    std::atomic<long long> pending;
+    std::atomic<unsigned int> nextWorker;
+    bool shutdown;
+};
+
+#endif /* WorkStealingPool_hpp */
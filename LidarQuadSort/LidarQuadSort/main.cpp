@@ -7,6 +7,7 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <iostream>
 #include <fstream>
@@ -22,15 +23,17 @@
 #include "KompexSQLiteBlob.h"
 #include "KompexSQLiteException.h"
 #include "LidarSorter.hpp"
+#include "MortonSorter.hpp"
+#include "LidarAppender.hpp"
 #include "LidarDatabase.hpp"
-
-bool FullDataMode = true;
+#include "Benchmarks.hpp"
+#include "ShardBuild.hpp"
 
 int main(int argc, const char * argv[])
 {
     if (argc < 2)
     {
-        fprintf(stderr,"syntax: %s [<in_las> ...] [-tmp <tmp_dir>] [-o <out_sqlite>] [-filelist <fileList.txt>] [-pts <min> <max>]\n",argv[0]);
+        fprintf(stderr,"syntax: %s [<in_las> ...] [-tmp <tmp_dir>] [-o <out_sqlite>] [-filelist <fileList.txt>] [-pts <min> <max>] [-threads <num>] [-mem <megabytes>] [-spill raw|laz] [-spillbench <points>] [-dbbatch <tiles>] [-dbqueue <tiles>] [-dbpagesize <bytes>] [-dbsync] [-ordered] [-grid <cells>] [-sample random|grid] [-decoders <num>] [-unordered] [-manifest <file>] [-engine recursive|morton] [-tmp-budget <megabytes>] [-append] [-indexonly <out_laz>] [-chunk <points>] [-codec laz|compact|columnar] [-codecbench <points>] [-progress <seconds>] [-metrics <out_json>] [-verbose] [-shards <num>] [-shardlevel <level>] [-shardlaunch local|none] [-shardtimeout <seconds>] [-octree] [-octreeratio <ratio>]\n",argv[0]);
         return -1;
     }
 
@@ -40,6 +43,36 @@ int main(int argc, const char * argv[])
     const char *outSqlite = NULL;
     int inc = 0;
     int minPts=20000,maxPts=25000;
+    int numThreads = 1;
+    long long memBudget = 0;
+    LidarSorter::SpillFormat spillFormat = LidarSorter::SpillRaw;
+    long long spillBenchPoints = 0;
+    long long codecBenchPoints = 0;
+    TileCodec tileCodec = TileCodecLAZ;
+    LidarDatabase::WriteOptions dbOptions;
+    bool orderTiles = false;
+    int gridSize = 10;
+    PointSampler::Mode sampleMode = PointSampler::Grid;
+    bool sampleModeSet = false;
+    int numDecoders = 0;
+    bool decodeOrdered = true;
+    std::string manifestFile;
+    bool mortonEngine = false;
+    long long tmpBudget = 0;
+    bool appendMode = false;
+    const char *indexLAZ = NULL;
+    int chunkSize = MasterLAZFile::DefaultChunkSize;
+    double progressInterval = 5.0;
+    const char *metricsJSON = NULL;
+    bool verbose = false;
+    int numShards = 0;
+    int shardLevel = 0;
+    bool shardLaunch = true;
+    double shardTimeout = 0.0;
+    const char *shardPlanFile = NULL;
+    int shardWorkerIndex = -1;
+    bool octree = false;
+    double octreeRatio = 1.0;
     for (unsigned int arg=1;arg<argc;arg+=inc)
     {
         if (!strcmp(argv[arg],"-tmp"))
@@ -79,6 +112,297 @@ int main(int argc, const char * argv[])
             }
             minPts = atoi(argv[arg+1]);
             maxPts = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-threads"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -threads\n");
+                return -1;
+            }
+            numThreads = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-mem"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -mem\n");
+                return -1;
+            }
+            memBudget = atoll(argv[arg+1]) * 1024 * 1024;
+        } else if (!strcmp(argv[arg],"-spill"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -spill\n");
+                return -1;
+            }
+            if (!strcmp(argv[arg+1],"raw"))
+                spillFormat = LidarSorter::SpillRaw;
+            else if (!strcmp(argv[arg+1],"laz"))
+                spillFormat = LidarSorter::SpillLAZ;
+            else {
+                fprintf(stderr,"-spill should be raw or laz\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-spillbench"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -spillbench\n");
+                return -1;
+            }
+            spillBenchPoints = atoll(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-codecbench"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -codecbench\n");
+                return -1;
+            }
+            codecBenchPoints = atoll(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-codec"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -codec\n");
+                return -1;
+            }
+            if (!strcmp(argv[arg+1],"laz"))
+                tileCodec = TileCodecLAZ;
+            else if (!strcmp(argv[arg+1],"compact"))
+                tileCodec = TileCodecCompact;
+            else if (!strcmp(argv[arg+1],"columnar"))
+                tileCodec = TileCodecColumnar;
+            else {
+                fprintf(stderr,"-codec should be laz, compact or columnar\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-dbbatch"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -dbbatch\n");
+                return -1;
+            }
+            dbOptions.batchSize = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-dbqueue"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -dbqueue\n");
+                return -1;
+            }
+            dbOptions.queueSize = atoi(argv[arg+1]);
+            dbOptions.asyncWrites = dbOptions.queueSize > 0;
+        } else if (!strcmp(argv[arg],"-dbpagesize"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -dbpagesize\n");
+                return -1;
+            }
+            dbOptions.pageSize = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-dbsync"))
+        {
+            inc = 1;
+            dbOptions.synchronous = true;
+            dbOptions.journalMode = "DELETE";
+        } else if (!strcmp(argv[arg],"-ordered"))
+        {
+            inc = 1;
+            orderTiles = true;
+        } else if (!strcmp(argv[arg],"-grid"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -grid\n");
+                return -1;
+            }
+            gridSize = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-sample"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -sample\n");
+                return -1;
+            }
+            if (!strcmp(argv[arg+1],"random"))
+                sampleMode = PointSampler::Random;
+            else if (!strcmp(argv[arg+1],"grid"))
+                sampleMode = PointSampler::Grid;
+            else {
+                fprintf(stderr,"-sample should be random or grid\n");
+                return -1;
+            }
+            sampleModeSet = true;
+        } else if (!strcmp(argv[arg],"-decoders"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -decoders\n");
+                return -1;
+            }
+            numDecoders = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-unordered"))
+        {
+            inc = 1;
+            decodeOrdered = false;
+        } else if (!strcmp(argv[arg],"-manifest"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -manifest\n");
+                return -1;
+            }
+            manifestFile = argv[arg+1];
+        } else if (!strcmp(argv[arg],"-engine"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -engine\n");
+                return -1;
+            }
+            if (!strcmp(argv[arg+1],"recursive"))
+                mortonEngine = false;
+            else if (!strcmp(argv[arg+1],"morton"))
+                mortonEngine = true;
+            else {
+                fprintf(stderr,"-engine should be recursive or morton\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-tmp-budget"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -tmp-budget\n");
+                return -1;
+            }
+            tmpBudget = atoll(argv[arg+1]) * 1024 * 1024;
+        } else if (!strcmp(argv[arg],"-append"))
+        {
+            inc = 1;
+            appendMode = true;
+        } else if (!strcmp(argv[arg],"-indexonly"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -indexonly\n");
+                return -1;
+            }
+            indexLAZ = argv[arg+1];
+        } else if (!strcmp(argv[arg],"-chunk"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -chunk\n");
+                return -1;
+            }
+            chunkSize = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-progress"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -progress\n");
+                return -1;
+            }
+            progressInterval = atof(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-metrics"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -metrics\n");
+                return -1;
+            }
+            metricsJSON = argv[arg+1];
+        } else if (!strcmp(argv[arg],"-verbose"))
+        {
+            inc = 1;
+            verbose = true;
+        } else if (!strcmp(argv[arg],"-shards"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -shards\n");
+                return -1;
+            }
+            numShards = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-shardlevel"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -shardlevel\n");
+                return -1;
+            }
+            shardLevel = atoi(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-shardlaunch"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -shardlaunch\n");
+                return -1;
+            }
+            if (!strcmp(argv[arg+1],"local"))
+                shardLaunch = true;
+            else if (!strcmp(argv[arg+1],"none"))
+                shardLaunch = false;
+            else {
+                fprintf(stderr,"-shardlaunch should be local or none\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[arg],"-shardtimeout"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -shardtimeout\n");
+                return -1;
+            }
+            shardTimeout = atof(argv[arg+1]);
+        } else if (!strcmp(argv[arg],"-shardworker"))
+        {
+            // Added by the coordinator when it starts a worker
+            inc = 3;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting two arguments for -shardworker\n");
+                return -1;
+            }
+            shardPlanFile = argv[arg+1];
+            shardWorkerIndex = atoi(argv[arg+2]);
+        } else if (!strcmp(argv[arg],"-octree"))
+        {
+            inc = 1;
+            octree = true;
+        } else if (!strcmp(argv[arg],"-octreeratio"))
+        {
+            inc = 2;
+            if (arg+inc > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -octreeratio\n");
+                return -1;
+            }
+            octreeRatio = atof(argv[arg+1]);
         } else {
             inc = 1;
             inFiles.push_back(argv[arg]);
@@ -100,6 +424,92 @@ int main(int argc, const char * argv[])
         fprintf(stderr,"-pts arguments don't make sense.\n");
         return -1;
     }
+    if (gridSize < 0)
+    {
+        fprintf(stderr,"-grid can't be negative.\n");
+        return -1;
+    }
+    if (numDecoders < 0)
+    {
+        fprintf(stderr,"-decoders can't be negative.\n");
+        return -1;
+    }
+    if (tmpBudget < 0)
+    {
+        fprintf(stderr,"-tmp-budget can't be negative.\n");
+        return -1;
+    }
+    if (chunkSize < 1)
+    {
+        fprintf(stderr,"-chunk needs at least one point.\n");
+        return -1;
+    }
+    if (indexLAZ && tileCodec != TileCodecLAZ)
+    {
+        fprintf(stderr,"Index only databases keep their points in LAZ.  Leave out -codec.\n");
+        return -1;
+    }
+    if (indexLAZ && appendMode)
+    {
+        fprintf(stderr,"Can't append to an index only database.\n");
+        return -1;
+    }
+    if (numThreads < 1)
+    {
+        fprintf(stderr,"-threads needs at least one thread.\n");
+        return -1;
+    }
+    if (numShards < 0 || shardLevel < 0 || shardTimeout < 0.0)
+    {
+        fprintf(stderr,"-shards, -shardlevel and -shardtimeout can't be negative.\n");
+        return -1;
+    }
+    if ((numShards > 0 || shardPlanFile) && (appendMode || mortonEngine || indexLAZ))
+    {
+        fprintf(stderr,"Sharded builds only work with the recursive engine, and not with -append or -indexonly.\n");
+        return -1;
+    }
+    // The Morton engine picks its own sample points from the sorted stream
+    if (mortonEngine && sampleModeSet && sampleMode == PointSampler::Grid)
+    {
+        fprintf(stderr,"-sample grid only works with the recursive engine.\n");
+        return -1;
+    }
+    if (octree && (appendMode || mortonEngine))
+    {
+        fprintf(stderr,"Octree builds only work with the recursive engine, and not with -append.\n");
+        return -1;
+    }
+    if (octree && octreeRatio <= 0.0)
+    {
+        fprintf(stderr,"-octreeratio needs to be positive.\n");
+        return -1;
+    }
+
+    // A shard worker builds its part of the tree into its own database, which the coordinator merges
+    std::unique_ptr<ShardWorker> shardWorker;
+    if (shardPlanFile)
+    {
+        shardWorker.reset(new ShardWorker(shardPlanFile,shardWorkerIndex));
+        if (!shardWorker->init())
+            return -1;
+        numShards = 0;
+        orderTiles = false;
+        metricsJSON = NULL;
+    }
+    std::string shardDB;
+    if (shardWorker)
+    {
+        shardDB = shardWorker->getShardDB();
+        outSqlite = shardDB.c_str();
+    }
+    // Enough tiles at the shard level that the big ones can be evened out
+    if (numShards > 0 && shardLevel == 0)
+    {
+        shardLevel = 1;
+        while ((1LL << (2*shardLevel)) < 4*numShards)
+            shardLevel++;
+    }
     
     // Load the list of files from a text file
     if (fileList)
@@ -122,6 +532,10 @@ int main(int argc, const char * argv[])
             }
         }
         fclose(fp);
+        
+        // Headers for a big file list get cached next to it
+        if (manifestFile.empty())
+            manifestFile = (std::string)fileList + ".manifest";
     }
     
     if (inFiles.empty())
@@ -130,9 +544,15 @@ int main(int argc, const char * argv[])
         return -1;
     }
     
-    std::remove(outSqlite);
-    boost::filesystem::remove_all(boost::filesystem::path(tmpDir));
-    mkdir(tmpDir.c_str(),0775);
+    // Appending adds to what's there, otherwise we start over
+    struct stat outStat;
+    if (appendMode && stat(outSqlite,&outStat))
+    {
+        fprintf(stderr,"Can't append to %s, it doesn't exist.\n",outSqlite);
+        return -1;
+    }
+    if (!appendMode)
+        std::remove(outSqlite);
 
     // Set up a SQLITE output db
     Kompex::SQLiteDatabase *sqliteDb = NULL;
@@ -142,50 +562,173 @@ int main(int argc, const char * argv[])
         fprintf(stderr, "Invalid sqlite database: %s\n",outSqlite);
         return -1;
     }
-    LidarDatabase *lidarDb = new LidarDatabase(sqliteDb,(FullDataMode ? LidarDatabase::FullData : LidarDatabase::IndexOnly));
+    LidarDatabase *lidarDb = NULL;
+    if (appendMode)
+        lidarDb = new LidarDatabase(sqliteDb,dbOptions);
+    else
+    {
+        LidarDatabase::Type dbType = LidarDatabase::FullData;
+        if (indexLAZ)
+            dbType = LidarDatabase::IndexOnly;
+        else if (tileCodec == TileCodecColumnar)
+            dbType = LidarDatabase::Columnar;
+        lidarDb = new LidarDatabase(sqliteDb,dbType,dbOptions,octree ? TileKeyOctree : TileKeyMorton);
+    }
     if (!lidarDb->isValid())
     {
         fprintf(stderr,"Failed to set up sqlite output.\n");
         return -1;
     }
     
-    // This speeds up writing
-    {
-//        Kompex::SQLiteStatement transactStmt(sqliteDb);
-//        transactStmt.SqlStatement((std::string)"BEGIN TRANSACTION");
-    }
-    
     // Set up the input data
     LidarMultiWrapper lidarWrap(inFiles);
+    // Header reads are mostly waiting on the disk, so use a few threads even for a serial build
+    lidarWrap.setScanOptions(std::max(4,std::max(numThreads,numDecoders)),manifestFile);
     if (!lidarWrap.init())
     {
         fprintf(stderr,"Failed to read input files.  Giving up.\n");
         return -1;
     }
+    lidarWrap.setDecodeThreads(numDecoders,decodeOrdered);
 
-    // Set up the recursive sorter and let it run
-    LidarSorter sorter(tmpDir.c_str());
-    sorter.setPointLimit(minPts,maxPts);
-    if (sorter.process(&lidarWrap,lidarDb))
+    // Each build gets its own directory under the temp dir, so several can share a scratch volume
+    mkdir(tmpDir.c_str(),0775);
+    std::string runTmpTemplate = tmpDir + "/build_XXXXXX";
+    std::vector<char> runTmpName(runTmpTemplate.begin(),runTmpTemplate.end());
+    runTmpName.push_back(0);
+    if (!mkdtemp(&runTmpName[0]))
     {
-        fprintf(stdout,"Wrote a total of %lld points",sorter.getNumPointsWritten());
-        return 0;
+        fprintf(stderr,"Failed to make temp directory in %s\n",tmpDir.c_str());
+        return -1;
+    }
+    std::string runTmpDir = &runTmpName[0];
+    // Workers find the subtrees by these paths, so they can't be relative to where we are
+    if (numShards > 0)
+        runTmpDir = boost::filesystem::absolute(boost::filesystem::path(runTmpDir)).string();
+
+    // Just compare the temp file formats and stop
+    if (spillBenchPoints > 0)
+    {
+        bool ok = RunSpillBenchmark(&lidarWrap,spillBenchPoints,runTmpDir);
+        boost::filesystem::remove_all(boost::filesystem::path(runTmpDir));
+        return ok ? 0 : -1;
+    }
+    // Or compare the tile codecs
+    if (codecBenchPoints > 0)
+    {
+        bool ok = RunCodecBenchmark(&lidarWrap,codecBenchPoints,maxPts);
+        boost::filesystem::remove_all(boost::filesystem::path(runTmpDir));
+        return ok ? 0 : -1;
     }
 
-    // Speeds up writing
+    // Set up the sorter and let it run.  The Morton engine uses the memory budget for its sort runs.
+    // Appending takes the point limits from the database and always runs on one thread.
+    std::unique_ptr<LidarSorter> sorter;
+    if (appendMode)
+        sorter.reset(new LidarAppender(runTmpDir.c_str()));
+    else if (mortonEngine)
+        sorter.reset(new MortonSorter(runTmpDir.c_str()));
+    else
+        sorter.reset(new LidarSorter(runTmpDir.c_str()));
+    sorter->setPointLimit(minPts,maxPts);
+    sorter->setNumThreads(numThreads);
+    sorter->setMemoryBudget(memBudget);
+    sorter->setSpillFormat(spillFormat);
+    sorter->setGridSize(gridSize);
+    sorter->setSampleMode(sampleMode);
+    sorter->setTempBudget(tmpBudget);
+    sorter->setTileCodec(tileCodec);
+    if (indexLAZ)
+        sorter->setMasterFile(indexLAZ,chunkSize);
+    sorter->setVerbose(verbose);
+    if (numShards > 0)
+        sorter->setShardLevel(shardLevel);
+    if (octree)
+        sorter->setOctree(octreeRatio);
+    BuildMetrics &metrics = sorter->getMetrics();
+    metrics.setProgressInterval(progressInterval);
+    for (const auto &inFile : inFiles)
     {
-//        Kompex::SQLiteStatement transactStmt(sqliteDb);
-//        transactStmt.SqlStatement((std::string)"END TRANSACTION");
+        struct stat fileStat;
+        if (!stat(inFile.c_str(),&fileStat))
+            metrics.add(BuildMetrics::InputBytes,fileStat.st_size);
     }
+    bool success = false;
+    if (shardWorker)
+        success = sorter->processShard(&lidarWrap,shardWorker->getTiles(),lidarDb);
+    else
+        success = sorter->process(&lidarWrap,lidarDb);
 
-    lidarDb->flush();
+    // Hand the subtrees we left to the workers and pull in what they build
+    if (success && numShards > 0 && !sorter->getShardTiles().empty())
+    {
+        ShardPlan plan;
+        plan.assign(sorter->getShardTiles(),numShards);
+        std::vector<std::string> args(argv,argv+argc);
+        ShardCoordinator coordinator(plan);
+        if (!lidarDb->flush() || !plan.write(runTmpDir + "/shards.plan"))
+            success = false;
+        else
+        {
+            if (shardLaunch)
+                success = coordinator.launch(args);
+            else
+                coordinator.printCommands(args);
+            // Even if a launch failed, wait for the ones that started
+            if (!coordinator.wait(shardTimeout))
+                success = false;
+            if (success)
+                success = coordinator.merge(lidarDb);
+        }
+        if (!success)
+            fprintf(stderr,"Sharded build failed.\n");
+    }
+    
+    // Anything left over from a failed build goes too
+    boost::filesystem::remove_all(boost::filesystem::path(runTmpDir));
+
+    // Write out anything still queued up and commit it
+    if (!lidarDb->flush())
+    {
+        fprintf(stderr,"Failed to write tiles to database.\n");
+        success = false;
+    }
+    // Rewrite the database with the tiles in key order
+    if (success && orderTiles)
+    {
+        fprintf(stdout,"Reordering tiles in database.\n");
+        if (!lidarDb->orderTiles())
+        {
+            fprintf(stderr,"Failed to reorder tiles in database.\n");
+            success = false;
+        }
+    }
+    delete lidarDb;
     try {
         sqliteDb->Close();
     }
     catch (Kompex::SQLiteException &except)
     {
-        fprintf(stderr,"Failed to write blob to database:\n%s\n",except.GetString().c_str());
-        return false;
+        fprintf(stderr,"Failed to close database:\n%s\n",except.GetString().c_str());
+        success = false;
+    }
+    delete sqliteDb;
+
+    // The database is done too, so the numbers are complete
+    metrics.printSummary();
+    if (metricsJSON && !metrics.writeJSON(metricsJSON))
+    {
+        fprintf(stderr,"Failed to write metrics to %s\n",metricsJSON);
+        success = false;
+    }
+    
+    if (shardWorker)
+        shardWorker->finish(success);
+    
+    if (success)
+    {
+        fprintf(stdout,"Wrote a total of %lld points\n",sorter->getNumPointsWritten());
+        return 0;
     }
     
     fprintf(stderr,"Failed to sort LIDAR file.");
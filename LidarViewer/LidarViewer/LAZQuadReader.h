@@ -15,6 +15,8 @@ extern NSString * const kLAZReaderCoordSys;
 extern NSString * const kLAZReaderZOffset;
 /// Scale the color values.  By default this is (1<<16)-1
 extern NSString * const kLAZReaderColorScale;
+/// Memory (in MB) for keeping loaded tiles around after they're unloaded.  Defaults to 128.
+extern NSString * const kLAZReaderCacheSize;
 
 /** @brief The LAZ Quad Reader will page a Lidar (LAZ or LAS) database organized
     into tiles in a sqlite database.
@@ -69,4 +71,7 @@ extern NSString * const kLAZReaderColorScale;
 // Set if the points have their own color
 - (bool)hasColor;
 
+// How well the loaded tile cache is working
+- (void)getCacheStatsHits:(long long *)hits misses:(long long *)misses evictions:(long long *)evictions;
+
 @end
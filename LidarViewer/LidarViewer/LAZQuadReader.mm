@@ -9,18 +9,28 @@
 #include <fstream>
 #include <iostream>
 #import <set>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <mutex>
 
 #import "LAZQuadReader.h"
 #import "LAZShader.h"
 #import "sqlite3.h"
 #import "FMDatabase.h"
-#import "FMDatabaseQueue.h"
+#import "FMDatabasePool.h"
 #import "laszip_api.h"
 #import "WhirlyGlobe.h"
 #import "MeshBuilder.h"
+#import "TileRayIndex.h"
+#import "TileKey.h"
+#import "TileDecoder.h"
+#import "BatchTransform.h"
+#import "TileCache.h"
+#import "TileGrid.h"
 #import "private/WhirlyGlobeViewController_private.h"
 #import "private/MaplyCoordinateSystem_private.h"
 
@@ -31,34 +41,34 @@ using namespace WhirlyKit;
 
 - (bool) intersectWithRenderer:(WhirlyKitSceneRendererES *)renderer view:(WhirlyKitView *)theView touchPt:(const Point2f &)touchPt org:(const Point3d &)org dir:(const Point3d &)dir interPt:(Point3d &)iPt dist:(double &)dist;
 
+- (void)viewUpdated:(WhirlyKitView *)view;
+
+@end
+
+/// Passes view changes along to the reader without the view holding on to it
+@interface LAZViewWatcher : NSObject<WhirlyKitViewWatcherDelegate>
+
+@property (nonatomic,weak) LAZQuadReader *quadReader;
+
+@end
+
+@implementation LAZViewWatcher
+
+- (void)viewUpdated:(WhirlyKitView *)view
+{
+    [_quadReader viewUpdated:view];
+}
+
 @end
 
 NSString * const kLAZReaderCoordSys = @"coordsys";
 NSString * const kLAZReaderZOffset = @"zoffset";
 NSString * const kLAZReaderColorScale = @"colorscale";
+NSString * const kLAZReaderCacheSize = @"cachesize";
 
-// Keep track of tile size (height in particular)
-class TileBoundsInfo
-{
-public:
-    TileBoundsInfo(MaplyTileID tileID) : tileID(tileID), minZ(0.0), maxZ(0.0) { }
-    TileBoundsInfo() { }
-    
-    bool operator < (const TileBoundsInfo &that) const
-    {
-        if (tileID.level == that.tileID.level)
-        {
-            if (tileID.y == that.tileID.y)
-                return tileID.x < that.tileID.x;
-            return tileID.y < that.tileID.y;
-        }
-        return tileID.level < that.tileID.level;
-    }
-    
-    MaplyTileID tileID;
-    double minZ,maxZ;
-    WhirlyKit::VectorTrianglesRef mesh;
-};
+// Largest error we'll accept from the approximate coordinate transform, in display units.
+// That's about 6mm on the globe.
+static const double kLAZMaxTransformError = 1e-9;
 
 /// Intersection handler for grabbing objects
 class IntersectionHandler : public IntersectionManager::Intersectable
@@ -72,18 +82,101 @@ public:
     LAZQuadReader *quadReader;
 };
 
-typedef std::set<TileBoundsInfo> TileBoundsSet;
+// A tile we've already loaded and converted, so we can add it again quickly
+class CachedTile
+{
+public:
+    CachedTile() : minZ(0.0), maxZ(0.0) { }
+    
+    MaplyPoints *points;
+    WhirlyKit::VectorTrianglesRef mesh;
+    double minZ,maxZ;
+};
+typedef std::shared_ptr<CachedTile> CachedTileRef;
+typedef TileCache<long long,CachedTile> LAZTileCache;
+
+// An octree node we haven't loaded because it was out of view
+class PendingNode
+{
+public:
+    long long quadIdx;
+    // Corners of the node's box in display coordinates
+    Point3d corners[8];
+};
+
+// A quadtree tile of an octree database that the pager has loaded.
+// We only load the nodes that are in view and pick up the others as they come into view.
+class LoadedColumn
+{
+public:
+    LoadedColumn() : minZ(MAXFLOAT), maxZ(-MAXFLOAT), fetching(false) { }
+
+    MaplyTileID tileID;
+    // Lowest first
+    std::vector<PendingNode> pending;
+    // Grab meshes for the nodes we have loaded
+    std::vector<WhirlyKit::VectorTrianglesRef> meshes;
+    double minZ,maxZ;
+    // Nodes for this tile are being loaded
+    bool fetching;
+};
+
+// Could any of the box be in view?  It's out if all its corners are outside the same clip plane.
+static bool BoxInView(const Matrix4d &viewMat,const Point3d corners[8])
+{
+    int numOutside[6] = {0,0,0,0,0,0};
+    for (int ii=0;ii<8;ii++)
+    {
+        Vector4d pt = viewMat * Vector4d(corners[ii].x(),corners[ii].y(),corners[ii].z(),1.0);
+        for (int axis=0;axis<3;axis++)
+        {
+            if (pt[axis] < -pt.w())
+                numOutside[2*axis]++;
+            if (pt[axis] > pt.w())
+                numOutside[2*axis+1]++;
+        }
+    }
+    for (int ii=0;ii<6;ii++)
+        if (numOutside[ii] == 8)
+            return false;
+
+    return true;
+}
+
+// Default memory for loaded tiles we're not displaying
+static const int kLAZDefaultCacheSize = 128;
 
 @implementation LAZQuadReader
 {
     FMDatabase *db;
-    FMDatabaseQueue *queue;
+    FMDatabasePool *pool;
     std::ifstream *ifs;
     laszip_POINTER lazReader;
-    TileBoundsSet tileSizes;
+    // Loaded tiles, for picking and heights
+    TileRayIndex tileIndex;
     int pointType;
+    TileKeyScheme tileKeyScheme;
+    // Scale and offset for compact tiles, which don't have their own headers
+    TileQuantization tileQuant;
+    // Columnar tiles live in lidarcolumns and we only read the columns we draw
+    bool columnar;
+    // Height ranges from the tilemeta table, by quad index.  Read only after setup.
+    bool hasTileMeta;
+    std::unordered_map<long long,std::pair<double,double> > tileZRanges;
+    // Octree databases split tiles vertically.  We still page a quadtree, so these are
+    //  the nodes in each quadtree tile (by Morton key), lowest first.
+    bool octree;
+    std::unordered_map<long long,std::vector<long long> > columnNodes;
+    // Loaded octree tiles by Morton key, and the view we last checked their nodes against
+    std::mutex columnMutex;
+    std::unordered_map<long long,LoadedColumn> loadedColumns;
+    Matrix4d viewMatrix;
+    bool hasViewMatrix;
+    LAZViewWatcher *viewWatcher;
+    __weak MaplyQuadPagingLayer *pagingLayer;
     double colorScale;
     IntersectionHandler intersectionHandler;
+    LAZTileCache *tileCache;
     MaplyBaseViewController *viewC;
 }
 
@@ -143,6 +236,70 @@ typedef std::set<TileBoundsInfo> TileBoundsSet;
         if (maxColor > 300)
             colorScale = (1<<16)-1;
     }
+    // Older databases don't have this and are in row major order
+    tileKeyScheme = TileKeyRowMajor;
+    res = [db executeQuery:@"SELECT tilekey from manifest"];
+    if ([res next])
+        tileKeyScheme = (TileKeyScheme)[res intForColumn:@"tilekey"];
+    // Compact tiles need the quantization from the manifest.  LAZ tiles ignore it.
+    columnar = false;
+    res = [db executeQuery:@"SELECT xscale,yscale,zscale,xoffset,yoffset,zoffset,tilecodec from manifest"];
+    if ([res next])
+    {
+        tileQuant = TileQuantization([res doubleForColumnIndex:0],[res doubleForColumnIndex:1],[res doubleForColumnIndex:2],
+                                     [res doubleForColumnIndex:3],[res doubleForColumnIndex:4],[res doubleForColumnIndex:5]);
+        columnar = [res intForColumnIndex:6] == TileCodecColumnar;
+    }
+    // Index only databases keep the points in a big LAZ file next to the database
+    res = [db executeQuery:@"SELECT lazfile from manifest"];
+    if ([res next])
+    {
+        NSString *lazFile = [res stringForColumn:@"lazfile"];
+        if ([lazFile length] > 0)
+        {
+            NSString *lazPath = [[sqlitePath stringByDeletingLastPathComponent] stringByAppendingPathComponent:lazFile];
+            laszip_BOOL isCompressed;
+            laszip_create(&lazReader);
+            if (laszip_open_reader(lazReader,[lazPath UTF8String],&isCompressed))
+            {
+                NSLog(@"Failed to open LAZ file for index only database: %@",lazPath);
+                laszip_destroy(lazReader);
+                lazReader = NULL;
+                return nil;
+            }
+        }
+    }
+    // Newer databases have heights for every tile up front
+    hasTileMeta = false;
+    res = [db executeQuery:@"SELECT name FROM sqlite_master WHERE type='table' AND name='tilemeta'"];
+    if ([res next])
+        hasTileMeta = true;
+    [res close];
+    if (hasTileMeta)
+    {
+        res = [db executeQuery:@"SELECT quadindex,minz,maxz FROM tilemeta"];
+        while ([res next])
+            tileZRanges[[res longLongIntForColumnIndex:0]] = std::make_pair([res doubleForColumnIndex:1],[res doubleForColumnIndex:2]);
+    }
+    // Group the octree nodes by the quadtree tile they sit in
+    octree = tileKeyScheme == TileKeyOctree;
+    if (octree)
+    {
+        std::unordered_map<long long,std::vector<std::pair<int,long long> > > nodes;
+        for (const auto &it : tileZRanges)
+        {
+            int x,y,zCell,level;
+            TileKeyDecodeOctree(it.first,x,y,zCell,level);
+            nodes[TileKeyMake(x,y,level,TileKeyMorton)].push_back(std::make_pair(zCell,it.first));
+        }
+        for (auto &it : nodes)
+        {
+            std::sort(it.second.begin(),it.second.end());
+            std::vector<long long> &keys = columnNodes[it.first];
+            for (const auto &node : it.second)
+                keys.push_back(node.second);
+        }
+    }
 
     // Override the coordinate system
     if (desc[kLAZReaderCoordSys])
@@ -156,6 +313,11 @@ typedef std::set<TileBoundsInfo> TileBoundsSet;
     // Color scale
     if (desc[kLAZReaderColorScale])
         colorScale = [desc[kLAZReaderColorScale] doubleValue];
+    // Memory to keep loaded tiles around in (in MB)
+    int cacheSize = kLAZDefaultCacheSize;
+    if (desc[kLAZReaderCacheSize])
+        cacheSize = [desc[kLAZReaderCacheSize] intValue];
+    tileCache = new LAZTileCache((size_t)cacheSize * 1024 * 1024);
 
     // Note: If this isn't set up right, we need to fake it
     if (srs && [srs length])
@@ -172,19 +334,32 @@ typedef std::set<TileBoundsInfo> TileBoundsSet;
         [_coordSys setBoundsLL:&ll ur:&ur];
     }
     
-    queue = [FMDatabaseQueue databaseQueueWithPath:sqlitePath];
+    // Tiles are read from several threads at once, so give them each a connection
+    pool = [FMDatabasePool databasePoolWithPath:sqlitePath flags:SQLITE_OPEN_READONLY];
     
     // Hook up an intersection handler
     intersectionHandler.quadReader = self;
     IntersectionManager *intersectMan = (IntersectionManager *)viewC->scene->getManager(kWKIntersectionManager);
     intersectMan->addIntersectable(&intersectionHandler);
 
+    // Octree nodes load as they come into view, so we need to know when it moves
+    hasViewMatrix = false;
+    if (octree)
+    {
+        viewWatcher = [[LAZViewWatcher alloc] init];
+        viewWatcher.quadReader = self;
+        [viewC->visualView addWatcherDelegate:viewWatcher];
+    }
+
     return self;
 }
 
 - (void)setZOffset:(double)zOffset
 {
     _zOffset = zOffset;
+    // The cached tiles have the old offset baked in
+    if (tileCache)
+        tileCache->clear();
 }
 
 - (void)setShader:(MaplyShader *)shader
@@ -198,6 +373,15 @@ typedef std::set<TileBoundsInfo> TileBoundsSet;
     {
         delete ifs;
     }
+    if (lazReader)
+    {
+        laszip_close_reader(lazReader);
+        laszip_destroy(lazReader);
+    }
+    if (tileCache)
+        delete tileCache;
+    if (viewWatcher)
+        [viewC->visualView removeWatcherDelegate:viewWatcher];
 }
 
 - (bool)hasColor
@@ -282,24 +466,49 @@ typedef std::set<TileBoundsInfo> TileBoundsSet;
 
 - (void)getBoundingBox:(MaplyTileID)tileID ll:(MaplyCoordinate3dD *)ll ur:(MaplyCoordinate3dD *)ur
 {
-    @synchronized (self) {
-        TileBoundsInfo dummy(tileID);
-        TileBoundsSet::iterator it = tileSizes.find(dummy);
-        if (it != tileSizes.end())
+    // An octree tile covers all its nodes, even the ones we haven't loaded
+    if (octree)
+    {
+        auto it = columnNodes.find(TileKeyMake(tileID.x,tileID.y,tileID.level,TileKeyMorton));
+        if (it != columnNodes.end())
         {
-            ll->z = it->minZ;
-            ur->z = it->maxZ;
-        } else {
-            // Didn't find it, so look for the parent
-            MaplyTileID parentTileID;
-            parentTileID.x = tileID.x/2;  parentTileID.y = tileID.y/2;  parentTileID.level = tileID.level-1;
-            TileBoundsInfo dummy(parentTileID);
-            TileBoundsSet::iterator it = tileSizes.find(dummy);
-            if (it != tileSizes.end())
+            double minZ = MAXFLOAT, maxZ = -MAXFLOAT;
+            for (long long key : it->second)
             {
-                ll->z = it->minZ;
-                ur->z = it->maxZ;
+                auto zIt = tileZRanges.find(key);
+                if (zIt == tileZRanges.end())
+                    continue;
+                minZ = std::min(minZ,zIt->second.first);  maxZ = std::max(maxZ,zIt->second.second);
             }
+            ll->z = minZ + _zOffset;
+            ur->z = maxZ + _zOffset;
+        }
+        return;
+    }
+
+    TileRayIndex::TileRef tile = tileIndex.findTile(tileID);
+    if (!tile && !hasTileMeta && tileID.level > 0)
+    {
+        // Didn't find it, so look for the parent
+        MaplyTileID parentTileID;
+        parentTileID.x = tileID.x/2;  parentTileID.y = tileID.y/2;  parentTileID.level = tileID.level-1;
+        tile = tileIndex.findTile(parentTileID);
+    }
+    if (tile)
+    {
+        ll->z = tile->minZ;
+        ur->z = tile->maxZ;
+        return;
+    }
+    
+    // The sorter may have told us already
+    if (hasTileMeta)
+    {
+        auto it = tileZRanges.find(TileKeyMake(tileID.x,tileID.y,tileID.level,tileKeyScheme));
+        if (it != tileZRanges.end())
+        {
+            ll->z = it->second.first + _zOffset;
+            ur->z = it->second.second + _zOffset;
         }
     }
 }
@@ -307,64 +516,396 @@ typedef std::set<TileBoundsInfo> TileBoundsSet;
 // Look for a valid intersection with any of our meshes
 - (bool) intersectWithRenderer:(WhirlyKitSceneRendererES *)renderer view:(WhirlyKitView *)theView touchPt:(const Point2f &)touchPt org:(const Point3d &)org dir:(const Point3d &)dir interPt:(Point3d &)iPt dist:(double &)dist
 {
-    double minDist = std::numeric_limits<double>::max();
-    Point3d minPt;
     CoordSystemDisplayAdapter *coordAdapter = viewC->visualView.coordAdapter;
+    CoordSystem *srcCoordSys = _coordSys->coordSystem;
+    double minX = self.minX, minY = self.minY, maxX = self.maxX, maxY = self.maxY;
+    TileRayIndex *theIndex = &tileIndex;
+
+    // The index hands us hits nearest first
+    return tileIndex.intersect(org,dir,
+                               [&](const TileRayIndex::Tile &tile,const Point3d &hitPt) -> bool
+                               {
+                                   // Project point back to source system
+                                   Point3d localPt = coordAdapter->displayToLocal(hitPt);
+                                   Point3d srcPt = CoordSystemConvert3d(coordAdapter->getCoordSystem(), srcCoordSys, localPt);
+                                   
+                                   // We found an intersection, but let's check if a higher res tile is loaded
+                                   int numTiles = 1<<(tile.tileID.level+1);
+                                   Point2d tileSize((maxX-minX)/numTiles,(maxY-minY)/numTiles);
+                                   MaplyTileID subTile;
+                                   subTile.x = (srcPt.x() - minX)/tileSize.x();
+                                   subTile.y = (srcPt.y() - minY)/tileSize.y();
+                                   subTile.level = tile.tileID.level+1;
+                                   
+                                   // If the higher res tile is loaded, then we have to trust its surface
+                                   // Odds are that our lower res surface missed some dips.
+                                   return !theIndex->findTile(subTile);
+                               },
+                               iPt,dist);
+}
 
-    // Note: Naive implementation
-    @synchronized (self) {
-        for (auto tileBounds : tileSizes)
+- (void)getCacheStatsHits:(long long *)hits misses:(long long *)misses evictions:(long long *)evictions
+{
+    LAZTileCache::Stats stats = tileCache->getStats();
+    *hits = stats.hits;
+    *misses = stats.misses;
+    *evictions = stats.evictions;
+}
+
+- (void)tileDidUnload:(MaplyTileID)tileID
+{
+    if (octree)
+        [self dropColumn:tileID];
+    else
+        tileIndex.removeTile(tileID);
+}
+
+// Load a tile from the database, or the cache if we've seen it lately.  Octree nodes come through here one at a time.
+- (CachedTileRef)loadTile:(long long)quadIdx tileID:(MaplyTileID)tileID layer:(MaplyQuadPagingLayer *)layer
+{
+    // We may have done all the work for this tile already
+    CachedTileRef cachedTile = tileCache->find(quadIdx);
+    if (cachedTile)
+        return cachedTile;
+
+    // Decoded points for the tile
+    TilePoints __block tilePoints;
+    bool __block loaded = false;
+    // Ground grid from the sorter, if it's there
+    std::vector<float> __block groundGrid;
+    int __block gridX = 0, gridY = 0;
+
+    // We're either using the index with an external LAZ files or we're grabbing the raw data itself
+    [pool inDatabase:^(FMDatabase *theDb) {
+        FMResultSet *res = nil;
+        if (lazReader)
+            res = [theDb executeQuery:[NSString stringWithFormat:@"SELECT start,count FROM tileaddress WHERE quadindex=%lld;",quadIdx]];
+        else if (columnar)
+            // Positions come first, then color.  The rest of the attributes never leave the disk.
+            res = [theDb executeQuery:[NSString stringWithFormat:@"SELECT attr,data FROM lidarcolumns WHERE columnkey IN (%lld,%lld) ORDER BY columnkey;",
+                                       (long long)TileColumnKey(quadIdx,TileColumnPosition),(long long)TileColumnKey(quadIdx,TileColumnColor)]];
+        else
+            res = [theDb executeQuery:[NSString stringWithFormat:@"SELECT data FROM lidartiles WHERE quadindex=%lld;",quadIdx]];
+        if ([res next])
         {
-            double thisT;
-            Point3d thisPt;
-            if (VectorTrianglesRayIntersect(org,dir,*(tileBounds.mesh),&thisT,&thisPt))
+            TileDecoder decoder;
+            decoder.setQuantization(tileQuant);
+            if (lazReader)
             {
-                double thisDist = (thisPt-org).norm();
-                if (thisDist < minDist)
-                {
-                    // Project point back to source system
-                    Point3d localPt = coordAdapter->displayToLocal(thisPt);
-                    Point3d srcPt = CoordSystemConvert3d(coordAdapter->getCoordSystem(), _coordSys->coordSystem, localPt);
-                    
-                    // We found an intersection, but let's check if a higher res tile is loaded
-                    int numTiles = 1<<(tileBounds.tileID.level+1);
-                    Point2d tileSize((self.maxX-self.minX)/numTiles,(self.maxY-self.minY)/numTiles);
-                    MaplyTileID subTile;
-                    subTile.x = (srcPt.x() - self.minX)/tileSize.x();
-                    subTile.y = (srcPt.y() - self.minY)/tileSize.y();
-                    subTile.level = tileBounds.tileID.level+1;
-                    
-                    // If the higher res tile is loaded, then we have to trust its surface
-                    // Odds are that our lower res surface missed some dips.
-                    TileBoundsInfo dummyTile(subTile);
-                    auto it = tileSizes.find(dummyTile);
-                    if (it == tileSizes.end())
-                    {
-                        minDist = thisDist;
-                        minPt = thisPt;
-                    }
+                long long pointStart = [res longLongIntForColumn:@"start"];
+                int count = [res intForColumn:@"count"];
+                // The big LAZ file has the one reader
+                @synchronized (self) {
+                    loaded = decoder.decode(lazReader,pointStart,count,tilePoints);
                 }
+            } else if (columnar) {
+                do {
+                    NSData *data = [res dataNoCopyForColumn:@"data"];
+                    loaded = decoder.decodeColumn([data bytes],[data length],tilePoints);
+                } while (loaded && [res next]);
+            } else {
+                // Decode straight out of the blob.  It's only valid until we move the result set.
+                NSData *data = [res dataNoCopyForColumn:@"data"];
+                loaded = decoder.decode([data bytes],[data length],tilePoints);
+            }
+            if (!loaded)
+                NSLog(@"Failed to decode tile %d: (%d,%d): %s",tileID.level,tileID.x,tileID.y,decoder.getError().c_str());
+        }
+        [res close];
+
+        if (loaded && hasTileMeta)
+        {
+            res = [theDb executeQuery:[NSString stringWithFormat:@"SELECT gridx,gridy,grid FROM tilemeta WHERE quadindex=%lld;",quadIdx]];
+            if ([res next])
+            {
+                gridX = [res intForColumn:@"gridx"];
+                gridY = [res intForColumn:@"gridy"];
+                NSData *gridData = [res dataNoCopyForColumn:@"grid"];
+                if (!TileGroundGrid::decode([gridData bytes],[gridData length],gridX,gridY,groundGrid))
+                    groundGrid.clear();
             }
+            [res close];
         }
+    }];
+
+    if (!loaded)
+        return CachedTileRef();
+
+    size_t count = tilePoints.numPoints;
+    bool hasColors = !tilePoints.red.empty();
+    MaplyPoints *points = [[MaplyPoints alloc] initWithNumPoints:(int)count];
+    int elevID = [points addAttributeType:@"a_elev" type:MaplyShaderAttrTypeFloat];
+
+    // We generate a triangle mesh underneath a given tile to provide something to grab
+    // The sorter may have done the ground grid for us over the whole tile
+    bool useGrid = !groundGrid.empty();
+    Point2d meshLL(tilePoints.minX,tilePoints.minY),meshUR(tilePoints.maxX,tilePoints.maxY);
+    if (useGrid)
+    {
+        Point2d tileSpan((_maxX-_minX)/(1<<tileID.level),(_maxY-_minY)/(1<<tileID.level));
+        meshLL = Point2d(_minX + tileID.x*tileSpan.x(),_minY + tileID.y*tileSpan.y());
+        meshUR = meshLL + tileSpan;
     }
-    
-    if (minDist != std::numeric_limits<double>::max())
+    MeshBuilder meshBuilder(useGrid ? gridX : 10,useGrid ? gridY : 10,meshLL,meshUR,self.coordSys);
+    if (useGrid)
+        meshBuilder.setMinZs(groundGrid,_zOffset);
+
+    // Convert the whole tile to display coordinates in one go
+    std::vector<double> zs(count),dispX(count),dispY(count),dispZ(count);
+    double minZ=MAXFLOAT,maxZ=-MAXFLOAT;
+    for (size_t which=0;which<count;which++)
     {
-        iPt = minPt;
-        dist = minDist;
-        return true;
+        zs[which] = tilePoints.z[which] + _zOffset;
+        minZ = std::min(zs[which],minZ);
+        maxZ = std::max(zs[which],maxZ);
     }
-    
-    return false;
+
+    // Center the coordinates around the tile center.  Octree nodes are centered in height too,
+    //  since they can be stacked well above the ground.
+    MaplyCoordinate3dD tileCenter;
+    tileCenter.x = (tilePoints.minX+tilePoints.maxX)/2.0;
+    tileCenter.y = (tilePoints.minY+tilePoints.maxY)/2.0;
+    tileCenter.z = octree && count > 0 ? (minZ+maxZ)/2.0 : 0.0;
+    MaplyCoordinate3dD tileCenterDisp = [layer.viewC displayCoordD:tileCenter fromSystem:_coordSys];
+    points.transform = [[MaplyMatrix alloc] initWithTranslateX:tileCenterDisp.x y:tileCenterDisp.y z:tileCenterDisp.z];
+
+    MaplyBaseViewController *theViewC = layer.viewC;
+    MaplyCoordinateSystem *coordSys = _coordSys;
+    BatchTransform transform([theViewC,coordSys](size_t num,const double *x,const double *y,const double *z,double *outX,double *outY,double *outZ)
+                             {
+                                 for (size_t which=0;which<num;which++)
+                                 {
+                                     MaplyCoordinate3dD dispCoord = [theViewC displayCoordD:MaplyCoordinate3dDMake(x[which],y[which],z[which]) fromSystem:coordSys];
+                                     outX[which] = dispCoord.x;  outY[which] = dispCoord.y;  outZ[which] = dispCoord.z;
+                                 }
+                             },
+                             kLAZMaxTransformError);
+    transform.transform(count,&tilePoints.x[0],&tilePoints.y[0],&zs[0],&dispX[0],&dispY[0],&dispZ[0]);
+
+    for (size_t which=0;which<count;which++)
+    {
+        float red = 1.0,green = 1.0, blue = 1.0;
+        if (hasColors)
+        {
+            red = tilePoints.red[which] / colorScale;
+            green = tilePoints.green[which] / colorScale;
+            blue = tilePoints.blue[which] / colorScale;
+        }
+        [points addDispCoordDoubleX:dispX[which]-tileCenterDisp.x y:dispY[which]-tileCenterDisp.y z:dispZ[which]-tileCenterDisp.z];
+        [points addColorR:red g:green b:blue a:1.0];
+        [points addAttribute:elevID fVal:zs[which]];
+
+        if (!useGrid)
+            meshBuilder.addPoint(Point3d(tilePoints.x[which],tilePoints.y[which],zs[which]));
+    }
+
+    // Keep track of tile size
+    if (minZ == maxZ)
+        maxZ += 1.0;
+
+//    NSLog(@"Loaded tile %d: (%d,%d) with %d points",tileID.level,tileID.x,tileID.y,count);
+
+    cachedTile = std::make_shared<CachedTile>();
+    cachedTile->points = points;
+    cachedTile->mesh = meshBuilder.makeMesh(layer.viewC);
+    cachedTile->minZ = minZ;  cachedTile->maxZ = maxZ;
+    // Coordinates, color and elevation for each point, plus the mesh
+    size_t tileBytes = count * (3*sizeof(double) + 4*sizeof(float) + sizeof(float));
+    if (cachedTile->mesh)
+        tileBytes += cachedTile->mesh->pts.size() * sizeof(Point3f) + cachedTile->mesh->tris.size() * sizeof(VectorTriangles::Triangle);
+    tileCache->insert(quadIdx,cachedTile,tileBytes);
+
+    return cachedTile;
 }
 
-- (void)tileDidUnload:(MaplyTileID)tileID
+// Load the given nodes and add their points all at once.  Returns nil if none of them loaded.
+- (MaplyComponentObject *)addNodes:(const std::vector<long long> &)quadIdxs tileID:(MaplyTileID)tileID layer:(MaplyQuadPagingLayer *)layer
+                            meshes:(std::vector<WhirlyKit::VectorTrianglesRef> &)meshes minZ:(double &)minZ maxZ:(double &)maxZ
+{
+    // Each node keeps its own points and bounds, so the nodes load and cache separately
+    NSMutableArray *allPoints = [NSMutableArray array];
+    for (long long quadIdx : quadIdxs)
+    {
+        CachedTileRef cachedTile = [self loadTile:quadIdx tileID:tileID layer:layer];
+        if (!cachedTile)
+            continue;
+        [allPoints addObject:cachedTile->points];
+        minZ = std::min(minZ,cachedTile->minZ);  maxZ = std::max(maxZ,cachedTile->maxZ);
+        // Every node has something to grab, not just the one on the ground
+        if (cachedTile->mesh)
+            meshes.push_back(cachedTile->mesh);
+    }
+    if ([allPoints count] == 0)
+        return nil;
+
+    return [layer.viewC addPoints:allPoints desc:
+                                    @{kMaplyColor: [UIColor redColor],
+                                      kMaplyDrawPriority: @(10000000),
+                                      kMaplyShader: _shader.name,
+                                      kMaplyShaderUniforms:
+                                          @{kLAZShaderZMin: @(_minZ+_zOffset),
+                                            kLAZShaderZMax: @(_maxZ+_zOffset),
+                                            kLAZShaderPointSize: @(_pointSize)
+                                            },
+                                      kMaplyZBufferRead: @(YES),
+                                      kMaplyZBufferWrite: @(YES)
+                                      }
+                                        mode:MaplyThreadCurrent];
+}
+
+// Corners of an octree node's box in display coordinates.  The footprint comes from the key and the heights from tilemeta.
+- (void)getNodeCorners:(long long)quadIdx corners:(Point3d *)corners
 {
-    @synchronized (self) {
-        TileBoundsInfo dummy(tileID);
-        TileBoundsSet::iterator it = tileSizes.find(dummy);
-        if (it != tileSizes.end())
-            tileSizes.erase(it);
+    int x,y,zCell,level;
+    TileKeyDecodeOctree(quadIdx,x,y,zCell,level);
+    Point2d tileSpan((_maxX-_minX)/(1<<level),(_maxY-_minY)/(1<<level));
+    double minZ = _minZ, maxZ = _maxZ;
+    auto it = tileZRanges.find(quadIdx);
+    if (it != tileZRanges.end())
+    {
+        minZ = it->second.first;
+        maxZ = it->second.second;
+    }
+
+    for (int ii=0;ii<8;ii++)
+    {
+        MaplyCoordinate3dD coord = MaplyCoordinate3dDMake(_minX + (x + (ii & 0x1))*tileSpan.x(),
+                                                          _minY + (y + ((ii >> 1) & 0x1))*tileSpan.y(),
+                                                          ((ii & 0x4) ? maxZ : minZ) + _zOffset);
+        MaplyCoordinate3dD dispCoord = [viewC displayCoordD:coord fromSystem:_coordSys];
+        corners[ii] = Point3d(dispCoord.x,dispCoord.y,dispCoord.z);
+    }
+}
+
+// Start keeping track of a loaded octree tile.  Returns the nodes that are in view now and holds on to the rest.
+- (std::vector<long long>)startColumn:(MaplyTileID)tileID
+{
+    std::vector<long long> visible;
+    auto it = columnNodes.find(TileKeyMake(tileID.x,tileID.y,tileID.level,TileKeyMorton));
+    if (it == columnNodes.end())
+        return visible;
+
+    LoadedColumn column;
+    column.tileID = tileID;
+    column.fetching = true;
+    for (long long quadIdx : it->second)
+    {
+        PendingNode node;
+        node.quadIdx = quadIdx;
+        [self getNodeCorners:quadIdx corners:node.corners];
+        column.pending.push_back(node);
+    }
+
+    std::lock_guard<std::mutex> lock(columnMutex);
+    std::vector<PendingNode> outOfView;
+    for (const PendingNode &node : column.pending)
+    {
+        if (!hasViewMatrix || BoxInView(viewMatrix,node.corners))
+            visible.push_back(node.quadIdx);
+        else
+            outOfView.push_back(node);
+    }
+    // The pager thinks some of it is visible, so load the lowest node at least
+    if (visible.empty() && !outOfView.empty())
+    {
+        visible.push_back(outOfView.front().quadIdx);
+        outOfView.erase(outOfView.begin());
+    }
+    column.pending = outOfView;
+    loadedColumns[it->first] = column;
+
+    return visible;
+}
+
+// Add the nodes we just loaded to an octree tile and the pick index.  Returns false if the tile went away in the meantime.
+- (bool)finishColumn:(MaplyTileID)tileID meshes:(const std::vector<WhirlyKit::VectorTrianglesRef> &)meshes minZ:(double)minZ maxZ:(double)maxZ
+{
+    std::lock_guard<std::mutex> lock(columnMutex);
+    auto it = loadedColumns.find(TileKeyMake(tileID.x,tileID.y,tileID.level,TileKeyMorton));
+    if (it == loadedColumns.end())
+        return false;
+
+    LoadedColumn &column = it->second;
+    column.fetching = false;
+    column.meshes.insert(column.meshes.end(),meshes.begin(),meshes.end());
+    column.minZ = std::min(column.minZ,minZ);  column.maxZ = std::max(column.maxZ,maxZ);
+    if (!column.meshes.empty())
+        tileIndex.addTile(tileID,column.minZ,column.maxZ,column.meshes);
+
+    return true;
+}
+
+// Stop keeping track of an octree tile
+- (void)dropColumn:(MaplyTileID)tileID
+{
+    // Under the lock so a node that's still loading doesn't put the tile back in the index
+    std::lock_guard<std::mutex> lock(columnMutex);
+    loadedColumns.erase(TileKeyMake(tileID.x,tileID.y,tileID.level,TileKeyMorton));
+    tileIndex.removeTile(tileID);
+}
+
+// Load octree nodes that have come into view since their tile was loaded
+- (void)fetchNodes:(const std::vector<long long> &)quadIdxs tileID:(MaplyTileID)tileID layer:(MaplyQuadPagingLayer *)layer
+{
+    std::vector<WhirlyKit::VectorTrianglesRef> meshes;
+    double minZ = MAXFLOAT, maxZ = -MAXFLOAT;
+    MaplyComponentObject *compObj = [self addNodes:quadIdxs tileID:tileID layer:layer meshes:meshes minZ:minZ maxZ:maxZ];
+    bool stillLoaded = [self finishColumn:tileID meshes:meshes minZ:minZ maxZ:maxZ];
+    if (!compObj)
+        return;
+
+    if (stillLoaded)
+        [layer addData:@[compObj] forTile:tileID style:MaplyDataStyleAdd];
+    else
+        [layer.viewC removeObjects:@[compObj] mode:MaplyThreadCurrent];
+}
+
+// The view moved, so see if any of the octree nodes we skipped are in view now
+- (void)viewUpdated:(WhirlyKitView *)view
+{
+    MaplyQuadPagingLayer *layer = pagingLayer;
+    WhirlyKitSceneRendererES *sceneRenderer = viewC->sceneRenderer;
+    Point2f frameSize(sceneRenderer.framebufferWidth,sceneRenderer.framebufferHeight);
+    if (!layer || frameSize.x() <= 0.0 || frameSize.y() <= 0.0)
+        return;
+    Matrix4d newViewMatrix = [view calcProjectionMatrix:frameSize margin:0.0] * [view calcFullMatrix];
+
+    std::vector<std::pair<MaplyTileID,std::vector<long long> > > toFetch;
+    {
+        std::lock_guard<std::mutex> lock(columnMutex);
+        viewMatrix = newViewMatrix;
+        hasViewMatrix = true;
+
+        for (auto &it : loadedColumns)
+        {
+            LoadedColumn &column = it.second;
+            if (column.fetching || column.pending.empty())
+                continue;
+            std::vector<long long> visible;
+            std::vector<PendingNode> outOfView;
+            for (const PendingNode &node : column.pending)
+            {
+                if (BoxInView(viewMatrix,node.corners))
+                    visible.push_back(node.quadIdx);
+                else
+                    outOfView.push_back(node);
+            }
+            if (visible.empty())
+                continue;
+            column.pending = outOfView;
+            column.fetching = true;
+            toFetch.push_back(std::make_pair(column.tileID,visible));
+        }
+    }
+
+    for (const auto &fetch : toFetch)
+    {
+        MaplyTileID tileID = fetch.first;
+        std::vector<long long> quadIdxs = fetch.second;
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+       ^{
+           [self fetchNodes:quadIdxs tileID:tileID layer:layer];
+       });
     }
 }
 
@@ -372,167 +913,37 @@ typedef std::set<TileBoundsInfo> TileBoundsSet;
 {
     MaplyCoordinate ll,ur;
     [layer boundsforTile:tileID ll:&ll ur:&ur];
-    
+    pagingLayer = layer;
+
 //    NSLog(@"Tile %d: (%d,%d)  ll = (%f,%f),  ur (%f,%f)",tileID.level,tileID.x,tileID.y,ll.x,ll.y,ur.x,ur.y);
-    
+
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
    ^{
        // Put together the precalculated quad index.  This is faster
-       //  than x,y,level
-       int quadIdx = 0;
-       for (int iq=0;iq<tileID.level;iq++)
-           quadIdx += (1<<iq)*(1<<iq);
-       quadIdx += tileID.y*(1<<tileID.level)+tileID.x;
-
-       // Information set up from the database or from the global file
-       laszip_POINTER __block thisReader = NULL;
-       std::stringstream * __block tileStream = NULL;
-       MaplyComponentObject * __block compObj = nil;
-       NSData * __block data = nil;
-       long long __block pointStart = 0;
-       int __block count = 0;
-       bool __block hasColors = false;
-       
-       // We're either using the index with an external LAZ files or we're grabbing the raw data itself
-       [queue inDatabase:^(FMDatabase *theDb) {
-           FMResultSet *res = nil;
-           if (lazReader)
-               res = [db executeQuery:[NSString stringWithFormat:@"SELECT start,count FROM tileaddress WHERE quadindex=%d;",quadIdx]];
-           else
-               res = [db executeQuery:[NSString stringWithFormat:@"SELECT data FROM lidartiles WHERE quadindex=%d;",quadIdx]];
-           if ([res next])
-           {
-               if (lazReader)
-               {
-                   pointStart = [res longLongIntForColumn:@"start"];
-                   count = [res intForColumn:@"count"];
-                   thisReader = lazReader;
-                   laszip_header_struct *header;
-                   laszip_get_header_pointer(thisReader,&header);
-                   hasColors = header->point_data_format > 1;
-               } else {
-                   data = [res dataForColumn:@"data"];
-                   tileStream = new std::stringstream();
-                   tileStream->write(reinterpret_cast<const char *>([data bytes]),[data length]);
-
-                   laszip_BOOL is_compressed;
-                   laszip_create(&thisReader);
-                   laszip_open_stream_reader(thisReader,tileStream,&is_compressed);
-                   laszip_header_struct *header;
-                   laszip_get_header_pointer(thisReader,&header);
-                   hasColors = header->point_data_format > 1;
-                   count = header->number_of_point_records;
-               }
-
-               [res close];
-           }
-       }];
-       
-       if (thisReader)
-       {
-           MaplyPoints *points = [[MaplyPoints alloc] initWithNumPoints:count];
-           int elevID = [points addAttributeType:@"a_elev" type:MaplyShaderAttrTypeFloat];
-           
-           // Center the coordinates around the tile center
-           MaplyCoordinate3dD tileCenter;
-           laszip_header_struct *header;
-           laszip_get_header_pointer(thisReader,&header);
-           tileCenter.x = (header->min_x+header->max_x)/2.0;
-           tileCenter.y = (header->min_y+header->max_y)/2.0;
-           tileCenter.z = 0.0;
-           MaplyCoordinate3dD tileCenterDisp = [layer.viewC displayCoordD:tileCenter fromSystem:_coordSys];
-           points.transform = [[MaplyMatrix alloc] initWithTranslateX:tileCenterDisp.x y:tileCenterDisp.y z:tileCenterDisp.z];
-           
-           // We generate a triangle mesh underneath a given tile to provide something to grab
-           MeshBuilder meshBuilder(10,10,Point2d(header->min_x,header->min_y),Point2d(header->max_x,header->max_y),self.coordSys);
-           
-           long long which = 0;
-           double minZ=MAXFLOAT,maxZ=-MAXFLOAT;
-           while (which < count)
-           {
-               // Get the point and convert to geocentric
-               if (lazReader)
-               {
-                   laszip_seek_point(thisReader,(which+pointStart));
-                   laszip_read_point(thisReader);
-               } else {
-                   laszip_seek_point(thisReader,(which+pointStart));
-                   laszip_read_point(thisReader);
-               }
-               laszip_point_struct *p;
-               laszip_get_point_pointer(thisReader, &p);
-               //                double x,y,z;
-               //                x = p.GetX(), y = p.GetY(); z = p.GetZ();
-               //                trans->TransformEx(1, &x, &y, &z);
-               MaplyCoordinate3dD coord;
-               coord.x = p->X * header->x_scale_factor + header->x_offset;
-               coord.y = p->Y * header->y_scale_factor + header->y_offset;
-               coord.z = p->Z * header->z_scale_factor + header->z_offset;
-               coord.z += _zOffset;
-               
-               minZ = std::min(coord.z,minZ);
-               maxZ = std::max(coord.z,maxZ);
-
-               MaplyCoordinate3dD dispCoord = [layer.viewC displayCoordD:coord fromSystem:_coordSys];
-               MaplyCoordinate3dD dispCoordCenter = MaplyCoordinate3dDMake(dispCoord.x-tileCenterDisp.x, dispCoord.y-tileCenterDisp.y, dispCoord.z-tileCenterDisp.z);
-               
-               float red = 1.0,green = 1.0, blue = 1.0;
-               if (hasColors)
-               {
-                   red = p->rgb[0] / colorScale;
-                   green = p->rgb[1] / colorScale;
-                   blue = p->rgb[2] / colorScale;
-               }
-               [points addDispCoordDoubleX:dispCoordCenter.x y:dispCoordCenter.y z:dispCoordCenter.z];
-               [points addColorR:red g:green b:blue a:1.0];
-               [points addAttribute:elevID fVal:coord.z];
-               
-               meshBuilder.addPoint(Point3d(coord.x,coord.y,coord.z));
-               
-               which++;
-           }
-           
-           // Keep track of tile size
-           if (minZ == maxZ)
-               maxZ += 1.0;
-           @synchronized (self) {
-               TileBoundsInfo tileInfo(tileID);
-               tileInfo.mesh = meshBuilder.makeMesh(layer.viewC);
-               tileInfo.minZ = minZ;  tileInfo.maxZ = maxZ;
-               tileSizes.insert(tileInfo);
-           }
-           
-//           NSLog(@"Loaded tile %d: (%d,%d) with %d points",tileID.level,tileID.x,tileID.y,count);
-
-           compObj = [layer.viewC addPoints:@[points] desc:
-                                            @{kMaplyColor: [UIColor redColor],
-                                              kMaplyDrawPriority: @(10000000),
-                                              kMaplyShader: _shader.name,
-                                              kMaplyShaderUniforms:
-                                                  @{kLAZShaderZMin: @(_minZ+_zOffset),
-                                                    kLAZShaderZMax: @(_maxZ+_zOffset),
-                                                    kLAZShaderPointSize: @(_pointSize)
-                                                    },
-                                              kMaplyZBufferRead: @(YES),
-                                              kMaplyZBufferWrite: @(YES)
-                                              }
-                                                mode:MaplyThreadCurrent];
-           [layer addData:@[compObj] forTile:tileID style:MaplyDataStyleAdd];
-       }
+       //  than x,y,level.  An octree tile is the nodes stacked up in it that we can see.
+       std::vector<long long> quadIdxs;
+       if (octree)
+           quadIdxs = [self startColumn:tileID];
+       else
+           quadIdxs.push_back(TileKeyMake(tileID.x,tileID.y,tileID.level,tileKeyScheme));
 
-       if (!lazReader)
+       std::vector<WhirlyKit::VectorTrianglesRef> meshes;
+       double minZ = MAXFLOAT, maxZ = -MAXFLOAT;
+       MaplyComponentObject *compObj = [self addNodes:quadIdxs tileID:tileID layer:layer meshes:meshes minZ:minZ maxZ:maxZ];
+       if (octree)
        {
-           if (thisReader)
-           {
-               laszip_close_reader(thisReader);
-               laszip_destroy(thisReader);
-               delete tileStream;
-           }
-       }
-       
+           if (compObj)
+               [self finishColumn:tileID meshes:meshes minZ:minZ maxZ:maxZ];
+           else
+               [self dropColumn:tileID];
+       } else if (compObj)
+           tileIndex.addTile(tileID,minZ,maxZ,meshes);
+
        if (compObj)
+       {
+           [layer addData:@[compObj] forTile:tileID style:MaplyDataStyleAdd];
            [layer tileDidLoad:tileID];
-       else
+       } else
            [layer tileFailedToLoad:tileID];
    });
 }
@@ -25,6 +25,10 @@ public:
     // Add a point for evaluation.  We'll snap to the edges
     void addPoint(const WhirlyKit::Point3d &pt);
     
+    // Use a precomputed grid of minimum heights instead of adding points.
+    // NaN cells are empty.  Needs to be the same size as our grid.
+    bool setMinZs(const std::vector<float> &cells,double zOffset);
+    
     // Generate a mesh from the points underneath
     WhirlyKit::VectorTrianglesRef makeMesh(MaplyBaseViewController *viewC);
     
@@ -30,6 +30,17 @@ void MeshBuilder::addPoint(const Point3d &pt)
     z = std::min(z,pt.z());
 }
 
+bool MeshBuilder::setMinZs(const std::vector<float> &cells,double zOffset)
+{
+    if (cells.size() != minZs.size())
+        return false;
+    
+    for (unsigned int ii=0;ii<cells.size();ii++)
+        minZs[ii] = std::isnan(cells[ii]) ? std::numeric_limits<double>::max() : cells[ii] + zOffset;
+    
+    return true;
+}
+
 VectorTrianglesRef MeshBuilder::makeSimpleMesh(MaplyBaseViewController *viewC)
 {
     CoordSystemDisplayAdapter *coordAdapter = viewC->visualView.coordAdapter;
@@ -102,8 +113,8 @@ VectorTrianglesRef MeshBuilder::makeMesh(MaplyBaseViewController *viewC)
         for (int ix=0;ix<=sizeX;ix++)
         {
             Point2d pt = ll + Point2d(ix*span2.x(),iy*span2.y());
-            int whichX = std::max(ix,sizeX-1);
-            int whichY = std::max(iy,sizeY-1);
+            int whichX = std::min(ix,sizeX-1);
+            int whichY = std::min(iy,sizeY-1);
             double z = minZs[whichY*sizeX+whichX];
             Point3d localPt = CoordSystemConvert3d(srcCoordSys->coordSystem, coordAdapter->getCoordSystem(), Point3d(pt.x(),pt.y(),z));
             Point3d dispPt = coordAdapter->localToDisplay(localPt);
@@ -0,0 +1,92 @@
+//
+//  TileRayIndex.h
+//  LidarViewer
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#ifndef TileRayIndex_h
+#define TileRayIndex_h
+
+#import <Foundation/Foundation.h>
+#import <WhirlyGlobeComponent.h>
+#import <WhirlyGlobe.h>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <vector>
+
+/** Quadtree over the loaded tiles, used for ray picking and height lookups.
+    Each node carries the display space bounding box of everything under it,
+    so a ray only looks at the tiles it might actually hit, nearest first.
+
+    The tree is never modified in place.  Adding or removing a tile copies the
+    path down to it and swaps in a new root, so readers just grab the current
+    root and never wait on tile loads.
+  */
+class TileRayIndex
+{
+public:
+    // A loaded tile
+    class Tile
+    {
+    public:
+        Tile() : minZ(0.0), maxZ(0.0), hasBounds(false) { }
+
+        MaplyTileID tileID;
+        // Height range in the source coordinate system
+        double minZ,maxZ;
+        // Grab meshes in display coordinates.  Octree tiles have one for each node we've loaded.
+        std::vector<WhirlyKit::VectorTrianglesRef> meshes;
+        // Display space bounds of the meshes
+        WhirlyKit::Point3d ll,ur;
+        bool hasBounds;
+    };
+    typedef std::shared_ptr<const Tile> TileRef;
+
+    // Called for each hit.  Return false to ignore it and keep looking.
+    typedef std::function<bool(const Tile &tile,const WhirlyKit::Point3d &hitPt)> AcceptFunc;
+
+    TileRayIndex();
+
+    // Add a tile, replacing what was there
+    void addTile(MaplyTileID tileID,double minZ,double maxZ,const std::vector<WhirlyKit::VectorTrianglesRef> &meshes);
+
+    // Remove a tile if it's there
+    void removeTile(MaplyTileID tileID);
+
+    // Look for a loaded tile
+    TileRef findTile(MaplyTileID tileID) const;
+
+    // Find the closest accepted intersection along the ray
+    bool intersect(const WhirlyKit::Point3d &org,const WhirlyKit::Point3d &dir,const AcceptFunc &accept,WhirlyKit::Point3d &hitPt,double &hitDist) const;
+
+protected:
+    class Node;
+    typedef std::shared_ptr<const Node> NodeRef;
+
+    class Node
+    {
+    public:
+        Node() : hasBounds(false) { }
+
+        // Tile at this node, if it's loaded
+        TileRef tile;
+        NodeRef children[4];
+        // Bounds of this tile and everything under it
+        WhirlyKit::Point3d ll,ur;
+        bool hasBounds;
+    };
+
+    NodeRef getRoot() const;
+    NodeRef replacePath(const NodeRef &node,int depth,const MaplyTileID &tileID,const TileRef &tile) const;
+    void intersectNode(const NodeRef &node,const WhirlyKit::Point3d &org,const WhirlyKit::Point3d &dir,double dirLen,const AcceptFunc &accept,WhirlyKit::Point3d &hitPt,double &hitDist) const;
+
+    // Swapped atomically
+    NodeRef root;
+    // Only one writer at a time
+    std::mutex writeMutex;
+};
+
+#endif /* TileRayIndex_h */
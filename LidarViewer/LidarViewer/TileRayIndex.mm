@@ -0,0 +1,199 @@
+//
+//  TileRayIndex.mm
+//  LidarViewer
+//
+//  Created by Steve Gifford on 10/17/26.
+//  Copyright © 2026 mousebird consulting. All rights reserved.
+//
+
+#include "TileRayIndex.h"
+#include <algorithm>
+#include <limits>
+
+using namespace WhirlyKit;
+
+// Distance along the ray to where it enters the box.  Returns false if it misses.
+static bool RayBoxEntry(const Point3d &org,const Point3d &dir,double dirLen,const Point3d &ll,const Point3d &ur,double &entryDist)
+{
+    double tMin = 0.0, tMax = std::numeric_limits<double>::max();
+    for (int ii=0;ii<3;ii++)
+    {
+        if (dir[ii] == 0.0)
+        {
+            if (org[ii] < ll[ii] || org[ii] > ur[ii])
+                return false;
+            continue;
+        }
+        double t0 = (ll[ii] - org[ii]) / dir[ii];
+        double t1 = (ur[ii] - org[ii]) / dir[ii];
+        if (t0 > t1)
+            std::swap(t0,t1);
+        tMin = std::max(tMin,t0);
+        tMax = std::min(tMax,t1);
+        if (tMin > tMax)
+            return false;
+    }
+
+    entryDist = tMin * dirLen;
+    return true;
+}
+
+TileRayIndex::TileRayIndex()
+{
+}
+
+TileRayIndex::NodeRef TileRayIndex::getRoot() const
+{
+    return std::atomic_load(&root);
+}
+
+void TileRayIndex::addTile(MaplyTileID tileID,double minZ,double maxZ,const std::vector<VectorTrianglesRef> &meshes)
+{
+    std::shared_ptr<Tile> tile(new Tile());
+    tile->tileID = tileID;
+    tile->minZ = minZ;  tile->maxZ = maxZ;
+    for (const VectorTrianglesRef &mesh : meshes)
+    {
+        if (!mesh || mesh->pts.empty())
+            continue;
+        tile->meshes.push_back(mesh);
+        if (!tile->hasBounds)
+        {
+            tile->ll = tile->ur = mesh->pts[0].cast<double>();
+            tile->hasBounds = true;
+        }
+        for (const Point3f &pt : mesh->pts)
+        {
+            tile->ll = tile->ll.cwiseMin(pt.cast<double>());
+            tile->ur = tile->ur.cwiseMax(pt.cast<double>());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+    NodeRef newRoot = replacePath(getRoot(),0,tileID,tile);
+    std::atomic_store(&root,newRoot);
+}
+
+void TileRayIndex::removeTile(MaplyTileID tileID)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    NodeRef newRoot = replacePath(getRoot(),0,tileID,TileRef());
+    std::atomic_store(&root,newRoot);
+}
+
+// Copy the nodes from here down to the tile, with the tile swapped in (or out)
+TileRayIndex::NodeRef TileRayIndex::replacePath(const NodeRef &node,int depth,const MaplyTileID &tileID,const TileRef &tile) const
+{
+    std::shared_ptr<Node> newNode(node ? new Node(*node) : new Node());
+    if (depth == tileID.level)
+        newNode->tile = tile;
+    else {
+        // Which child is on the way to the tile
+        int shift = tileID.level - depth - 1;
+        int which = (((tileID.y >> shift) & 0x1) << 1) | ((tileID.x >> shift) & 0x1);
+        newNode->children[which] = replacePath(newNode->children[which],depth+1,tileID,tile);
+    }
+
+    // Nothing left under here
+    bool empty = !newNode->tile;
+    for (int ii=0;ii<4;ii++)
+        if (newNode->children[ii])
+            empty = false;
+    if (empty)
+        return NodeRef();
+
+    // Bounds are everything we can hit under this node
+    newNode->hasBounds = false;
+    if (newNode->tile && newNode->tile->hasBounds)
+    {
+        newNode->ll = newNode->tile->ll;
+        newNode->ur = newNode->tile->ur;
+        newNode->hasBounds = true;
+    }
+    for (int ii=0;ii<4;ii++)
+    {
+        const NodeRef &child = newNode->children[ii];
+        if (!child || !child->hasBounds)
+            continue;
+        if (newNode->hasBounds)
+        {
+            newNode->ll = newNode->ll.cwiseMin(child->ll);
+            newNode->ur = newNode->ur.cwiseMax(child->ur);
+        } else {
+            newNode->ll = child->ll;
+            newNode->ur = child->ur;
+            newNode->hasBounds = true;
+        }
+    }
+
+    return newNode;
+}
+
+TileRayIndex::TileRef TileRayIndex::findTile(MaplyTileID tileID) const
+{
+    NodeRef node = getRoot();
+    for (int depth=0;node && depth<tileID.level;depth++)
+    {
+        int shift = tileID.level - depth - 1;
+        int which = (((tileID.y >> shift) & 0x1) << 1) | ((tileID.x >> shift) & 0x1);
+        node = node->children[which];
+    }
+
+    return node ? node->tile : TileRef();
+}
+
+bool TileRayIndex::intersect(const Point3d &org,const Point3d &dir,const AcceptFunc &accept,Point3d &hitPt,double &hitDist) const
+{
+    double dirLen = dir.norm();
+    if (dirLen == 0.0)
+        return false;
+
+    hitDist = std::numeric_limits<double>::max();
+    intersectNode(getRoot(),org,dir,dirLen,accept,hitPt,hitDist);
+
+    return hitDist != std::numeric_limits<double>::max();
+}
+
+void TileRayIndex::intersectNode(const NodeRef &node,const Point3d &org,const Point3d &dir,double dirLen,const AcceptFunc &accept,Point3d &hitPt,double &hitDist) const
+{
+    if (!node || !node->hasBounds)
+        return;
+
+    // This tile.  Any of its meshes might be the nearest.
+    const TileRef &tile = node->tile;
+    double entryDist;
+    if (tile && tile->hasBounds && RayBoxEntry(org,dir,dirLen,tile->ll,tile->ur,entryDist) && entryDist < hitDist)
+    {
+        for (const VectorTrianglesRef &mesh : tile->meshes)
+        {
+            double thisT;
+            Point3d thisPt;
+            if (VectorTrianglesRayIntersect(org,dir,*mesh,&thisT,&thisPt))
+            {
+                double thisDist = (thisPt-org).norm();
+                if (thisDist < hitDist && accept(*tile,thisPt))
+                {
+                    hitDist = thisDist;
+                    hitPt = thisPt;
+                }
+            }
+        }
+    }
+
+    // Children, nearest first, and stop once they're behind what we've already hit
+    std::pair<double,int> order[4];
+    int numChildren = 0;
+    for (int ii=0;ii<4;ii++)
+    {
+        const NodeRef &child = node->children[ii];
+        if (child && child->hasBounds && RayBoxEntry(org,dir,dirLen,child->ll,child->ur,entryDist))
+            order[numChildren++] = std::make_pair(entryDist,ii);
+    }
+    std::sort(order,order+numChildren);
+    for (int ii=0;ii<numChildren;ii++)
+    {
+        if (order[ii].first >= hitDist)
+            break;
+        intersectNode(node->children[order[ii].second],org,dir,dirLen,accept,hitPt,hitDist);
+    }
+}